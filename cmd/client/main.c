@@ -7,27 +7,53 @@ static int connection_socket;
 void interrupt_handler(int signal);
 
 int main(int argc, char *argv[]) {
-  struct sockaddr_in serverAddr;
-  struct hostent *host;
-  long port;
   //   if (argc < 4) {
   // fprintf(stderr, "./client [host] [port] [protocol]\n");
   // exit(1);
   //   }
-  if ((host = gethostbyname(argv[1])) == NULL) {
-    fprintf(stderr, "Couldn't get host name\n");
+  if (argc < 2) {
+    fprintf(stderr, "%s [host] [port] | %s unix:[path] [--shm]\n", argv[0],
+            argv[0]);
     exit(1);
   }
-  port = strtol(argv[2], NULL, 0);
-  if ((connection_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-    fprintf(stderr, "Couldn't create socket\n");
-    exit(1);
+  if (strncmp(argv[1], "unix:", 5) == 0) {
+    // same host - talk to the server over a unix domain socket
+    struct sockaddr_un serverAddr;
+    if ((connection_socket = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+      fprintf(stderr, "Couldn't create socket\n");
+      exit(1);
+    }
+    establish_unix_connection_with_server(&serverAddr, argv[1] + 5,
+                                          connection_socket);
+    // --shm moves all further traffic to a shared memory channel
+    if (argc > 2 && strcmp(argv[2], "--shm") == 0 &&
+        ShmClientAttach(connection_socket) == -1)
+      fprintf(stderr, "falling back to the unix socket\n");
+  } else {
+    struct sockaddr_in serverAddr;
+    struct hostent *host;
+    long port;
+    if (argc < 3) {
+      fprintf(stderr, "%s [host] [port]\n", argv[0]);
+      exit(1);
+    }
+    if ((host = gethostbyname(argv[1])) == NULL) {
+      fprintf(stderr, "Couldn't get host name\n");
+      exit(1);
+    }
+    port = strtol(argv[2], NULL, 0);
+    if ((connection_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+      fprintf(stderr, "Couldn't create socket\n");
+      exit(1);
+    }
+    establish_connection_with_server(&serverAddr, host, connection_socket,
+                                     port);
   }
-  establish_connection_with_server(&serverAddr, host, connection_socket, port);
   set_non_blocking(connection_socket);
   set_non_blocking(0);
   // Set a handler for the interrupt signal
   signal(SIGINT, interrupt_handler);
+  hello_request(connection_socket);
   Loop(connection_socket);
 }
 void interrupt_handler(int signal) { leave_request(connection_socket); }
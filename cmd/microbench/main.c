@@ -0,0 +1,408 @@
+// clock_gettime , syscall
+#define _GNU_SOURCE
+#include "../../pkg/handlers/handlers.h"
+#include "../../pkg/uuid/uuid.h"
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+// microbench - measures the primitives every request goes through : message
+// encoding and decoding , the queue under concurrent producers and
+// consumers , UUIDs , Trim and directory listings. every benchmark reports
+// ns/op , ops/s and , when the kernel lets us read them , hardware counters
+// per op. --csv prints one line per benchmark to diff between builds.
+
+// default time every benchmark is measured for
+#define BENCH_TIME_MS 200
+// default largest number of producers and consumers of the queue benchmark
+#define BENCH_MAX_THREADS 4
+// queue benchmarks at most , threads doubling from 1
+#define BENCH_QUEUE_RUNS 16
+// fewest iterations calibration trusts , below it starting threads dominates
+#define BENCH_MIN_ITERATIONS 1024
+// body of the encoding benchmarks
+#define BENCH_BODY_LEN 64
+#define BENCH_BINARY_LEN 4096
+
+// Benchmark - an operation run iterations times by run , threads being the
+// producers and consumers of the queue benchmarks
+typedef struct {
+  char name[32];
+  void (*run)(uint64_t iterations, int threads);
+  int threads;
+} Benchmark;
+
+// hardware counters read around every measured run
+static const struct {
+  uint64_t config;
+  const char *name;
+} counterKinds[] = {{PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+                    {PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+                    {PERF_COUNT_HW_CACHE_MISSES, "cache_misses"},
+                    {PERF_COUNT_HW_BRANCH_MISSES, "branch_misses"}};
+#define NUM_COUNTERS (int)(sizeof(counterKinds) / sizeof(counterKinds[0]))
+
+// Result - one measured benchmark , a counter is -1 when not available
+typedef struct {
+  uint64_t iterations;
+  uint64_t elapsedNs;
+  double counters[NUM_COUNTERS];
+} Result;
+
+static int counterFds[NUM_COUNTERS];
+// results of the operations land here so they aren't optimized away
+static volatile uint64_t sink;
+static char listingDir[MAX_BUFFER] = ".";
+
+static uint64_t NowNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// OpenCounters - opens the counters of this process and the threads it
+// starts. counters the kernel refuses stay at -1
+static void OpenCounters(void) {
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = counterKinds[i].config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    counterFds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+}
+
+static void StartCounters(void) {
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    if (counterFds[i] == -1)
+      continue;
+    ioctl(counterFds[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(counterFds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+// StopCounters - reads the counters , scaled up when the kernel had to
+// multiplex them
+static void StopCounters(double *values) {
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    uint64_t read_values[3];
+    values[i] = -1;
+    if (counterFds[i] == -1)
+      continue;
+    ioctl(counterFds[i], PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counterFds[i], read_values, sizeof(read_values)) !=
+            sizeof(read_values) ||
+        read_values[2] == 0)
+      continue;
+    values[i] = (double)read_values[0] * read_values[1] / read_values[2];
+  }
+}
+
+static void BenchMarshall(uint64_t iterations, int threads) {
+  unsigned char frame[PROTOCOL_HEADER_LEN + BENCH_BODY_LEN + 1];
+  char body[BENCH_BODY_LEN + 1];
+  memset(body, 'x', BENCH_BODY_LEN);
+  body[BENCH_BODY_LEN] = '\0';
+  for (uint64_t i = 0; i < iterations; i++)
+    sink += MarshallMessage(frame, 0xC0DE, ECHO_REQUEST, body);
+}
+
+static void BenchMarshallBinary(uint64_t iterations, int threads) {
+  static unsigned char frame[PROTOCOL_HEADER_LEN + BENCH_BINARY_LEN];
+  static unsigned char body[BENCH_BINARY_LEN];
+  for (uint64_t i = 0; i < iterations; i++)
+    sink += MarshallBinaryMessage(frame, 0xC0DE, FILE_REPLY, body,
+                                  BENCH_BINARY_LEN, 0);
+}
+
+static void BenchUnmarshall(uint64_t iterations, int threads) {
+  unsigned char frame[PROTOCOL_HEADER_LEN + BENCH_BODY_LEN + 1];
+  char body[BENCH_BODY_LEN + 1];
+  memset(body, 'x', BENCH_BODY_LEN);
+  body[BENCH_BODY_LEN] = '\0';
+  MarshallMessage(frame, 0xC0DE, ECHO_REQUEST, body);
+  for (uint64_t i = 0; i < iterations; i++) {
+    Message message = UnmarshallMessage(0, (const char *)frame);
+    sink += message.size;
+    free(message.body);
+  }
+}
+
+static void BenchHeader(uint64_t iterations, int threads) {
+  unsigned char frame[PROTOCOL_HEADER_LEN + 1];
+  MarshallMessage(frame, 0xC0DE, ECHO_REQUEST, "");
+  for (uint64_t i = 0; i < iterations; i++) {
+    sink += ExtractMessageMagic(frame) + ExtractMessageProtocol(frame) +
+            ExtractMessageBodySize(frame);
+  }
+}
+
+// BenchDecode - one op is one frame decoded from a buffer of FRAME_BATCH
+static void BenchDecode(uint64_t iterations, int threads) {
+  static unsigned char data[FRAME_BATCH *
+                            (PROTOCOL_HEADER_LEN + BENCH_BODY_LEN + 1)];
+  DecodedFrame frames[FRAME_BATCH];
+  FrameBatch batch;
+  char body[BENCH_BODY_LEN + 1];
+  size_t len = 0;
+  memset(body, 'x', BENCH_BODY_LEN);
+  body[BENCH_BODY_LEN] = '\0';
+  for (int i = 0; i < FRAME_BATCH; i++)
+    len += MarshallMessage(data + len, 0xC0DE, ECHO_REQUEST, body);
+  for (uint64_t i = 0; i < iterations; i += FRAME_BATCH) {
+    DecodeFrames(data, len, frames, FRAME_BATCH, &batch);
+    sink += batch.numFrames;
+  }
+}
+
+static void BenchUUIDString(uint64_t iterations, int threads) {
+  char id[UUID_STRING_LEN + 1];
+  for (uint64_t i = 0; i < iterations; i++) {
+    GenerateUUID(id);
+    sink += id[0];
+  }
+}
+
+static void BenchUUIDBytes(uint64_t iterations, int threads) {
+  Uuid id;
+  for (uint64_t i = 0; i < iterations; i++) {
+    GenerateUUIDBytes(&id);
+    sink += id.bytes[0];
+  }
+}
+
+// BenchTrim - the copy Trim works on is counted too
+static void BenchTrim(uint64_t iterations, int threads) {
+  static const char text[] = "   /some/directory/name   \n";
+  char copy[sizeof(text)];
+  for (uint64_t i = 0; i < iterations; i++) {
+    memcpy(copy, text, sizeof(text));
+    sink += Trim(copy)[0];
+  }
+}
+
+static void BenchListing(uint64_t iterations, int threads) {
+  for (uint64_t i = 0; i < iterations; i++) {
+    char *listing = BuildDirectoryListing(listingDir);
+    if (listing == NULL) {
+      fprintf(stderr, "Couldn't list %s\n", listingDir);
+      exit(1);
+    }
+    sink += listing[0];
+    free(listing);
+  }
+}
+
+// QueueWork - the messages one producer pushes or one consumer pops
+typedef struct {
+  Queue *q;
+  uint64_t count;
+} QueueWork;
+
+// Producer - pushes like the reader of a connection does
+static void *Producer(void *arg) {
+  QueueWork *work = arg;
+  Queue *q = work->q;
+  Message message;
+  memset(&message, 0, sizeof(message));
+  message.magic = 0xC0DE;
+  message.protocol = ECHO_REQUEST;
+  for (uint64_t i = 0; i < work->count; i++) {
+    pthread_mutex_lock(q->mutex);
+    while (q->full)
+      pthread_cond_wait(q->notFull, q->mutex);
+    Push(q, 0, message);
+    pthread_mutex_unlock(q->mutex);
+    pthread_cond_signal(q->notEmpty);
+  }
+  return NULL;
+}
+
+// Consumer - pops like a worker does
+static void *Consumer(void *arg) {
+  QueueWork *work = arg;
+  Queue *q = work->q;
+  for (uint64_t i = 0; i < work->count; i++) {
+    pthread_mutex_lock(q->mutex);
+    while (q->empty)
+      pthread_cond_wait(q->notEmpty, q->mutex);
+    Message message = Pop(q);
+    pthread_mutex_unlock(q->mutex);
+    pthread_cond_signal(q->notFull);
+    sink += message.protocol;
+  }
+  return NULL;
+}
+
+// BenchQueue - one op is one message pushed by one of threads producers and
+// popped by one of threads consumers
+static void BenchQueue(uint64_t iterations, int threads) {
+  Queue *q = NewQueue();
+  pthread_t *ids = malloc(2 * threads * sizeof(pthread_t));
+  QueueWork *work = malloc(2 * threads * sizeof(QueueWork));
+  if (ids == NULL || work == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < 2 * threads; i++) {
+    work[i].q = q;
+    work[i].count = iterations / threads +
+                    ((uint64_t)(i % threads) < iterations % threads);
+    pthread_create(&ids[i], NULL, i < threads ? Producer : Consumer,
+                   &work[i]);
+  }
+  for (int i = 0; i < 2 * threads; i++)
+    pthread_join(ids[i], NULL);
+  DestroyQueue(q);
+  free(work);
+  free(ids);
+}
+
+// Measure - finds how many iterations take about timeMs , then runs them
+// again with the counters on
+static Result Measure(const Benchmark *bench, uint64_t timeMs) {
+  Result result;
+  uint64_t target = timeMs * 1000000ULL, iterations = 1, elapsed = 0;
+  while (1) {
+    uint64_t start = NowNs();
+    bench->run(iterations, bench->threads);
+    elapsed = NowNs() - start;
+    if (elapsed >= target / 10 && iterations >= BENCH_MIN_ITERATIONS)
+      break;
+    iterations *= 4;
+  }
+  if (elapsed == 0)
+    elapsed = 1;
+  iterations = (uint64_t)((double)iterations * target / elapsed);
+  if (iterations == 0)
+    iterations = 1;
+  StartCounters();
+  uint64_t start = NowNs();
+  bench->run(iterations, bench->threads);
+  result.elapsedNs = NowNs() - start;
+  StopCounters(result.counters);
+  result.iterations = iterations;
+  return result;
+}
+
+static void PrintResult(const Benchmark *bench, const Result *result,
+                        int csv) {
+  double nsPerOp = (double)result->elapsedNs / result->iterations;
+  double opsPerSec = nsPerOp > 0 ? 1e9 / nsPerOp : 0;
+  if (csv)
+    printf("%s,%d,%llu,%.2f,%.0f", bench->name, bench->threads,
+           (unsigned long long)result->iterations, nsPerOp, opsPerSec);
+  else
+    printf("%-16s %7d %12llu %10.2f %14.0f", bench->name, bench->threads,
+           (unsigned long long)result->iterations, nsPerOp, opsPerSec);
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    double perOp = result->counters[i] / result->iterations;
+    if (csv && result->counters[i] < 0)
+      printf(",");
+    else if (csv)
+      printf(",%.3f", perOp);
+    else if (result->counters[i] < 0)
+      printf(" %13s", "-");
+    else
+      printf(" %13.2f", perOp);
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "%s [options]\n"
+          "  -t, --time MS      measure every benchmark for about MS "
+          "milliseconds (default %d)\n"
+          "  -n, --threads N    run the queue with 1 , 2 , 4 .. N producers "
+          "and as many consumers (default %d)\n"
+          "  -b, --bench NAME   only the benchmarks whose name starts with "
+          "NAME\n"
+          "  -d, --dir DIR      directory the listing benchmark lists "
+          "(default .)\n"
+          "      --csv          one comma separated line per benchmark , "
+          "counters per op , empty when not available\n",
+          name, BENCH_TIME_MS, BENCH_MAX_THREADS);
+}
+
+int main(int argc, char *argv[]) {
+  static const struct option options[] = {
+      {"time", required_argument, 0, 't'},
+      {"threads", required_argument, 0, 'n'},
+      {"bench", required_argument, 0, 'b'},
+      {"dir", required_argument, 0, 'd'},
+      {"csv", no_argument, 0, 'c'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0}};
+  static const Benchmark single[] = {
+      {"marshall", BenchMarshall, 1},
+      {"marshall-binary", BenchMarshallBinary, 1},
+      {"unmarshall", BenchUnmarshall, 1},
+      {"header", BenchHeader, 1},
+      {"decode", BenchDecode, 1},
+      {"uuid-string", BenchUUIDString, 1},
+      {"uuid-bytes", BenchUUIDBytes, 1},
+      {"trim", BenchTrim, 1},
+      {"listing", BenchListing, 1}};
+  long timeMs = BENCH_TIME_MS, maxThreads = BENCH_MAX_THREADS;
+  const char *only = "";
+  int csv = 0, opt;
+  while ((opt = getopt_long(argc, argv, "t:n:b:d:h", options, NULL)) != -1) {
+    if (opt == 't' && (timeMs = strtol(optarg, NULL, 10)) > 0)
+      continue;
+    if (opt == 'n' && (maxThreads = strtol(optarg, NULL, 10)) > 0)
+      continue;
+    if (opt == 'b') {
+      only = optarg;
+    } else if (opt == 'd') {
+      strncpy(listingDir, optarg, MAX_BUFFER - 1);
+    } else if (opt == 'c') {
+      csv = 1;
+    } else {
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  Benchmark benchmarks[sizeof(single) / sizeof(single[0]) + BENCH_QUEUE_RUNS];
+  int numBenchmarks = sizeof(single) / sizeof(single[0]);
+  memcpy(benchmarks, single, sizeof(single));
+  for (long threads = 1; threads <= maxThreads; threads *= 2) {
+    if (numBenchmarks == (int)(sizeof(benchmarks) / sizeof(benchmarks[0])))
+      break;
+    Benchmark *bench = &benchmarks[numBenchmarks++];
+    strcpy(bench->name, "queue");
+    bench->run = BenchQueue;
+    bench->threads = threads;
+  }
+
+  OpenCounters();
+  if (csv) {
+    printf("name,threads,iterations,ns_per_op,ops_per_sec");
+    for (int i = 0; i < NUM_COUNTERS; i++)
+      printf(",%s_per_op", counterKinds[i].name);
+  } else {
+    printf("%-16s %7s %12s %10s %14s", "benchmark", "threads", "iterations",
+           "ns/op", "ops/s");
+    for (int i = 0; i < NUM_COUNTERS; i++)
+      printf(" %13s", counterKinds[i].name);
+  }
+  printf("\n");
+  for (int i = 0; i < numBenchmarks; i++) {
+    if (strncmp(benchmarks[i].name, only, strlen(only)) != 0)
+      continue;
+    Result result = Measure(&benchmarks[i], timeMs);
+    PrintResult(&benchmarks[i], &result, csv);
+  }
+  return sink == 0xFFFFFFFFFFFFFFFFULL;
+}
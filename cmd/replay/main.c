@@ -0,0 +1,265 @@
+// clock_gettime
+#define _GNU_SOURCE
+#include "../../pkg/capture/capture.h"
+#include "../../pkg/client/async.h"
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+
+// replay - sends the frames of a capture recorded by the server's --capture
+// option to a server , every captured connection on a connection of its
+// own , at the pace they were recorded at (or faster) , then reports the
+// latency of the requests
+
+// buckets of the table of captured connections
+#define REPLAY_BUCKETS 1024
+// how long to wait for the last replies once the capture is sent
+#define REPLAY_DRAIN_MS 30000
+
+// Connection - the connection replaying one captured connection
+typedef struct Connection {
+  uint32_t id;
+  AsyncClient *client;
+  int outstanding;
+  // the captured client left , closed once its replies are in
+  int leaving;
+  struct Connection *next;
+} Connection;
+
+// Sample - a request in flight
+typedef struct {
+  Connection *conn;
+  uint64_t sentAt;
+} Sample;
+
+static Connection *connections[REPLAY_BUCKETS];
+static int numConnections;
+// failed counts requests sent whose connection was lost , unsent the frames
+// that couldn't be sent at all
+static unsigned long sent, failed, unsent, skipped;
+// latencies in microseconds
+static uint64_t *latencies;
+static size_t numLatencies, latencyCap;
+
+static uint64_t NowUsec(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void OnReply(AsyncClient *client, AsyncReply *reply, void *arg) {
+  Sample *sample = arg;
+  sample->conn->outstanding--;
+  if (reply->status != 0) {
+    failed++;
+  } else {
+    if (numLatencies == latencyCap) {
+      latencyCap = latencyCap ? latencyCap * 2 : 4096;
+      latencies = realloc(latencies, latencyCap * sizeof(uint64_t));
+      if (latencies == NULL) {
+        perror("Couldn't allocate anymore memory!");
+        exit(EXIT_FAILURE);
+      }
+    }
+    latencies[numLatencies++] = NowUsec() - sample->sentAt;
+  }
+  free(sample);
+}
+
+// FindConnection - connection replaying the captured connection id , opened
+// on first use
+static Connection *FindConnection(uint32_t id, const char *host, long port) {
+  Connection **link = &connections[id % REPLAY_BUCKETS];
+  while (*link != NULL && (*link)->id != id)
+    link = &(*link)->next;
+  if (*link != NULL)
+    return *link;
+  AsyncClient *client = AsyncConnect(host, port);
+  if (client == NULL)
+    return NULL;
+  Connection *conn = calloc(1, sizeof(Connection));
+  if (conn == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  conn->id = id;
+  conn->client = client;
+  *link = conn;
+  numConnections++;
+  return conn;
+}
+
+// PollConnections - waits up to timeoutMs for the connections , completes
+// replies and closes the connections that are done
+static void PollConnections(int timeoutMs) {
+  struct pollfd pfds[numConnections + 1];
+  Connection *conns[numConnections + 1];
+  int n = 0;
+  for (int i = 0; i < REPLAY_BUCKETS; i++) {
+    for (Connection *conn = connections[i]; conn != NULL; conn = conn->next) {
+      pfds[n].fd = AsyncFd(conn->client);
+      pfds[n].events = POLLIN | (AsyncPending(conn->client) ? POLLOUT : 0);
+      conns[n++] = conn;
+    }
+  }
+  if (poll(pfds, n, timeoutMs) <= 0)
+    return;
+  for (int i = 0; i < n; i++) {
+    if (pfds[i].revents && AsyncPoll(conns[i]->client, 0) == -1)
+      conns[i]->leaving = 1;
+  }
+  for (int i = 0; i < REPLAY_BUCKETS; i++) {
+    Connection **link = &connections[i];
+    while (*link != NULL) {
+      Connection *conn = *link;
+      if (!conn->leaving || conn->outstanding > 0) {
+        link = &conn->next;
+        continue;
+      }
+      *link = conn->next;
+      AsyncClose(conn->client);
+      free(conn);
+      numConnections--;
+    }
+  }
+}
+
+// Replay - sends one captured frame
+static void Replay(CaptureRecord *record, const char *host, long port) {
+  uint16_t protocol = record->protocol;
+  // the replaying connections do their own handshake and tagging
+  if (protocol == REQUEST_TAG || protocol == HELLO_REQUEST ||
+      protocol == SHM_ATTACH_REQUEST) {
+    skipped++;
+    return;
+  }
+  if (InflateMessageBody(&protocol, &record->body, &record->size) == -1) {
+    skipped++;
+    return;
+  }
+  Connection *conn = FindConnection(record->connection, host, port);
+  if (conn == NULL) {
+    unsent++;
+    return;
+  }
+  if (strcmp(record->body, "/exit\n") == 0) {
+    conn->leaving = 1;
+    return;
+  }
+  Sample *sample = malloc(sizeof(Sample));
+  if (sample == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  sample->conn = conn;
+  sample->sentAt = NowUsec();
+  if (AsyncSend(conn->client, protocol, record->body, record->size, OnReply,
+                sample) == 0) {
+    free(sample);
+    unsent++;
+    return;
+  }
+  conn->outstanding++;
+  sent++;
+}
+
+static int CompareLatency(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static double Percentile(double p) {
+  if (numLatencies == 0)
+    return 0;
+  size_t i = (size_t)(p * (numLatencies - 1) + 0.5);
+  return latencies[i] / 1000.0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "%s [options] host port capture | %s [options] unix:path capture\n"
+          "  -s, --speed FACTOR replay FACTOR times faster than recorded , 0 "
+          "sends everything at once (default 1)\n",
+          name, name);
+}
+
+int main(int argc, char *argv[]) {
+  static const struct option options[] = {
+      {"speed", required_argument, 0, 's'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0}};
+  double speed = 1;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "s:h", options, NULL)) != -1) {
+    if (opt == 's' && (speed = strtod(optarg, NULL)) >= 0)
+      continue;
+    usage(argv[0]);
+    exit(1);
+  }
+  const char *host, *path;
+  long port = 0;
+  if (optind + 2 == argc && strncmp(argv[optind], "unix:", 5) == 0) {
+    host = argv[optind];
+    path = argv[optind + 1];
+  } else if (optind + 3 == argc) {
+    host = argv[optind];
+    port = strtol(argv[optind + 1], NULL, 10);
+    path = argv[optind + 2];
+  } else {
+    usage(argv[0]);
+    exit(1);
+  }
+  FILE *fp = CaptureOpen(path);
+  if (fp == NULL) {
+    fprintf(stderr, "%s is not a capture\n", path);
+    exit(1);
+  }
+
+  CaptureRecord record;
+  int status;
+  uint64_t first = 0, start = NowUsec();
+  while ((status = CaptureRead(fp, &record)) == 1) {
+    if (first == 0)
+      first = record.timestamp / 1000 + 1;
+    if (speed > 0) {
+      // wait for the time the frame was recorded at , scaled by speed
+      uint64_t due = start + (record.timestamp / 1000 + 1 - first) / speed;
+      uint64_t now;
+      while ((now = NowUsec()) < due)
+        PollConnections((due - now + 999) / 1000);
+    } else {
+      PollConnections(0);
+    }
+    Replay(&record, host, port);
+    free(record.body);
+  }
+  if (status == -1)
+    fprintf(stderr, "%s is truncated , replaying what was read\n", path);
+  fclose(fp);
+  uint64_t sendTime = NowUsec() - start;
+  uint64_t deadline = NowUsec() + REPLAY_DRAIN_MS * 1000;
+  while (numLatencies + failed < sent && NowUsec() < deadline)
+    PollConnections(100);
+  uint64_t elapsed = NowUsec() - start;
+  unsigned long missing = sent - numLatencies - failed;
+
+  qsort(latencies, numLatencies, sizeof(uint64_t), CompareLatency);
+  printf("requests %lu , completed %zu , failed %lu , missing %lu , unsent "
+         "%lu , skipped %lu frames\n",
+         sent, numLatencies, failed, missing, unsent, skipped);
+  printf("sent in %.3f s , done in %.3f s , %.1f requests/s\n",
+         sendTime / 1e6, elapsed / 1e6,
+         elapsed ? numLatencies / (elapsed / 1e6) : 0);
+  printf("latency ms p50 %.3f p90 %.3f p99 %.3f max %.3f\n", Percentile(0.5),
+         Percentile(0.9), Percentile(0.99), Percentile(1));
+  for (int i = 0; i < REPLAY_BUCKETS; i++) {
+    while (connections[i] != NULL) {
+      Connection *conn = connections[i];
+      connections[i] = conn->next;
+      AsyncClose(conn->client);
+      free(conn);
+    }
+  }
+  free(latencies);
+  return failed || missing || unsent ? 1 : 0;
+}
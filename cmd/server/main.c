@@ -4,23 +4,100 @@
 #include "../../pkg/server/server.h"
 #include "../../pkg/shared/consts.h"
 
+// Listeners - what every worker process of --processes serves
+typedef struct {
+  const ServerConfig *config;
+  const int *socketFds;
+  int numSockets;
+} Listeners;
+
+// ServeProcess - runs the server in worker process index , recording its
+// capture and trace to files of its own. a restarted worker gets new ones
+// too , so the records of the process it replaces are kept
+static void ServeProcess(int index, uint32_t restarts, void *arg) {
+  Listeners *listeners = arg;
+  ServerConfig config = *listeners->config;
+  char suffix[PREFORK_SUFFIX_LEN];
+  if (restarts == 0)
+    snprintf(suffix, sizeof(suffix), ".%d", index);
+  else
+    snprintf(suffix, sizeof(suffix), ".%d.%u", index, restarts);
+  if (config.capturePath[0] != '\0')
+    strncat(config.capturePath, suffix,
+            CAPTURE_PATH_LEN - strlen(config.capturePath) - 1);
+  if (config.tracePath[0] != '\0')
+    strncat(config.tracePath, suffix,
+            TRACE_PATH_LEN - strlen(config.tracePath) - 1);
+  InitializeRPCHandlers(&config, listeners->socketFds,
+                        listeners->numSockets);
+}
+
 int main(int argc, char *argv[]) {
-  struct sockaddr_in serverAddr;
-  long port = 8080;
-  int socketFd;
-  if (argc == 2)
-    port = strtol(argv[1], NULL, 0);
-  if ((socketFd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-    perror("Socket creation failed");
-    exit(1);
-  }
+  ServerConfig config;
+  int socketFds[MAX_LISTENERS];
+  int numSockets = 0;
+  ParseServerConfig(&config, argc, argv);
 
-  Bind(&serverAddr, socketFd, port);
-  if (listen(socketFd, 1) == -1) {
-    perror("listen failed: ");
-    exit(1);
+  if (config.takeoverPath[0] != '\0') {
+    // hot restart , the server being replaced hands its listeners over
+    numSockets = TakeoverListeners(config.takeoverPath,
+                                   config.takeoverConnections, socketFds,
+                                   MAX_LISTENERS);
+    if (numSockets == -1)
+      exit(1);
+  } else {
+    if (config.tcpEnabled) {
+      // listeners are non blocking so an accept thread can drain its whole
+      // backlog after every wakeup
+      for (int i = 0; i < config.listeners; i++) {
+        struct sockaddr_in serverAddr;
+        int socketFd;
+        if ((socketFd = socket(AF_INET,
+                               SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               0)) == -1) {
+          perror("Socket creation failed");
+          exit(1);
+        }
+        if (config.listeners > 1)
+          EnableReusePort(socketFd);
+        Bind(&serverAddr, socketFd, config.port);
+        if (listen(socketFd, config.backlog) == -1) {
+          perror("listen failed: ");
+          exit(1);
+        }
+        socketFds[numSockets++] = socketFd;
+      }
+      if (config.listeners > 1 && config.reusePortCpuFilter)
+        AttachReusePortCpuFilter(socketFds[0], config.listeners);
+    }
+    if (config.unixPath[0] != '\0') {
+      struct sockaddr_un unixAddr;
+      int socketFd;
+      if ((socketFd = socket(AF_UNIX,
+                             SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                             0)) == -1) {
+        perror("Unix socket creation failed");
+        exit(1);
+      }
+      BindUnix(&unixAddr, socketFd, config.unixPath);
+      if (listen(socketFd, config.backlog) == -1) {
+        perror("listen failed: ");
+        exit(1);
+      }
+      fprintf(stderr, "[DEBUG] listening on unix socket %s\n",
+              config.unixPath);
+      socketFds[numSockets++] = socketFd;
+    }
+  }
+  if (config.processes > 0) {
+    Listeners listeners = {&config, socketFds, numSockets};
+    PreforkRun(config.processes, ServeProcess, &listeners);
+  } else {
+    InitializeRPCHandlers(&config, socketFds, numSockets);
   }
-  InitializeRPCHandlers(socketFd);
 
-  close(socketFd);
+  for (int i = 0; i < numSockets; i++)
+    close(socketFds[i]);
+  if (config.unixPath[0] != '\0' && config.unixPath[0] != '@')
+    unlink(config.unixPath);
 }
@@ -0,0 +1,117 @@
+#include "../../pkg/trace/trace.h"
+#include <getopt.h>
+
+// trace - reports where the requests of a trace written by the server's
+// --trace option spent their time : the percentiles of the time every
+// stage took , and the stages of the slowest requests
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "%s [options] trace\n"
+          "  -b, --buckets      print the histogram of every stage\n"
+          "  -p, --protocol C   only requests of protocol C , like D for "
+          "downloads\n"
+          "  -s, --slowest N    print the stages of the N slowest requests\n",
+          name);
+}
+
+static uint64_t Total(const TraceRecord *record) {
+  const uint64_t *at = record->stamps.at;
+  if (at[TRACE_HEADER] == 0 || at[TRACE_SENT] < at[TRACE_HEADER])
+    return 0;
+  return at[TRACE_SENT] - at[TRACE_HEADER];
+}
+
+// CompareTotal - slowest first
+static int CompareTotal(const void *a, const void *b) {
+  uint64_t ta = Total(a), tb = Total(b);
+  return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+// PrintRequest - the time a request took to reach every stage from the
+// previous one , in microseconds
+static void PrintRequest(const TraceRecord *record) {
+  char id[UUID_STRING_LEN + 1];
+  FormatUUID(&record->id, id);
+  printf("%s %c tag %u total %.1f :", id, (char)record->protocol,
+         record->tag, Total(record) / 1000.0);
+  for (int stage = TRACE_BODY; stage < TRACE_STAGES; stage++) {
+    uint64_t from = record->stamps.at[stage - 1], to = record->stamps.at[stage];
+    if (from != 0 && to >= from)
+      printf(" %s %.1f", TraceStageName(stage), (to - from) / 1000.0);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  static const struct option options[] = {
+      {"buckets", no_argument, 0, 'b'},
+      {"protocol", required_argument, 0, 'p'},
+      {"slowest", required_argument, 0, 's'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0}};
+  int buckets = 0, protocol = 0;
+  long slowest = 0;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "bp:s:h", options, NULL)) != -1) {
+    if (opt == 'b') {
+      buckets = 1;
+    } else if (opt == 'p' && optarg[0] != '\0') {
+      protocol = (unsigned char)optarg[0];
+    } else if (opt == 's' && (slowest = strtol(optarg, NULL, 10)) >= 0) {
+      continue;
+    } else {
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    exit(1);
+  }
+  FILE *fp = TraceOpen(argv[optind]);
+  if (fp == NULL) {
+    fprintf(stderr, "%s is not a trace\n", argv[optind]);
+    exit(1);
+  }
+
+  TraceHistogram *histograms = calloc(TRACE_STAGES, sizeof(TraceHistogram));
+  TraceRecord *records = NULL;
+  size_t numRecords = 0, cap = 0;
+  TraceRecord record;
+  int status;
+  if (histograms == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  while ((status = TraceRead(fp, &record)) == 1) {
+    if (protocol != 0 && record.protocol != (uint32_t)protocol)
+      continue;
+    TraceAddRecord(histograms, &record);
+    if (slowest == 0)
+      continue;
+    if (numRecords == cap) {
+      cap = cap ? cap * 2 : 4096;
+      records = realloc(records, cap * sizeof(TraceRecord));
+      if (records == NULL) {
+        perror("Couldn't allocate anymore memory!");
+        exit(EXIT_FAILURE);
+      }
+    }
+    records[numRecords++] = record;
+  }
+  fclose(fp);
+  if (status == -1)
+    fprintf(stderr, "the trace is truncated\n");
+
+  TraceReport(stdout, histograms, buckets);
+  if (numRecords > 0) {
+    qsort(records, numRecords, sizeof(TraceRecord), CompareTotal);
+    printf("\nslowest requests (us) :\n");
+    for (size_t i = 0; i < numRecords && i < (size_t)slowest; i++)
+      PrintRequest(&records[i]);
+  }
+  free(records);
+  free(histograms);
+  return 0;
+}
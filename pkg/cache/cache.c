@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include "cache.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// FileCacheShard - one hash table + lru list , most recently used first
+typedef struct {
+  pthread_mutex_t mutex;
+  FileCacheEntry *buckets[FILE_CACHE_BUCKETS];
+  FileCacheEntry *lruHead;
+  FileCacheEntry *lruTail;
+} FileCacheShard;
+
+static FileCacheShard shards[FILE_CACHE_SHARDS];
+// bytes all shards may hold together , 0 while the cache is disabled , and
+// bytes they hold
+static size_t cacheCapacity;
+static size_t cacheBytes;
+
+static size_t HashKey(const struct stat *st) {
+  size_t hash = (size_t)st->st_ino * 0x9E3779B97F4A7C15ULL;
+  hash ^= (size_t)st->st_dev + (hash >> 29);
+  return hash ^ (hash >> 32);
+}
+
+static int SameVersion(const FileCacheEntry *entry, const struct stat *st) {
+  return entry->ino == st->st_ino && entry->dev == st->st_dev &&
+         entry->size == st->st_size &&
+         entry->mtimeSec == st->st_mtim.tv_sec &&
+         entry->mtimeNsec == st->st_mtim.tv_nsec;
+}
+
+static void FreeEntry(FileCacheEntry *entry) {
+  free(entry->data);
+  free(entry->compressed);
+  pthread_mutex_destroy(&entry->compressMutex);
+  free(entry);
+}
+
+static void LruUnlink(FileCacheShard *shard, FileCacheEntry *entry) {
+  if (entry->lruPrev != NULL)
+    entry->lruPrev->lruNext = entry->lruNext;
+  else
+    shard->lruHead = entry->lruNext;
+  if (entry->lruNext != NULL)
+    entry->lruNext->lruPrev = entry->lruPrev;
+  else
+    shard->lruTail = entry->lruPrev;
+  entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void LruPushFront(FileCacheShard *shard, FileCacheEntry *entry) {
+  entry->lruPrev = NULL;
+  entry->lruNext = shard->lruHead;
+  if (shard->lruHead != NULL)
+    shard->lruHead->lruPrev = entry;
+  else
+    shard->lruTail = entry;
+  shard->lruHead = entry;
+}
+
+static int OverCapacity(void) {
+  return __atomic_load_n(&cacheBytes, __ATOMIC_RELAXED) > cacheCapacity;
+}
+
+// Evict - removes the least recently used entries of the shard , but keep ,
+// while the cache holds more than its capacity. entries still being sent
+// are freed by their last release. called with the shard locked
+static void Evict(FileCacheShard *shard, const FileCacheEntry *keep) {
+  while (OverCapacity() && shard->lruTail != NULL && shard->lruTail != keep) {
+    FileCacheEntry *victim = shard->lruTail;
+    FileCacheEntry **link =
+        &shard->buckets[victim->hash / FILE_CACHE_SHARDS % FILE_CACHE_BUCKETS];
+    while (*link != victim)
+      link = &(*link)->hashNext;
+    *link = victim->hashNext;
+    LruUnlink(shard, victim);
+    victim->inCache = 0;
+    __atomic_sub_fetch(&cacheBytes, victim->size + victim->compressedSize,
+                       __ATOMIC_RELAXED);
+    if (__atomic_sub_fetch(&victim->refs, 1, __ATOMIC_ACQ_REL) == 0)
+      FreeEntry(victim);
+  }
+}
+
+// MakeRoom - brings the cache back under its capacity after shard grew ,
+// from shard first and then from the others , one shard locked at a time.
+// keep is only evicted when nothing else is left. called with shard locked ,
+// returns with it unlocked
+static void MakeRoom(FileCacheShard *shard, const FileCacheEntry *keep) {
+  Evict(shard, keep);
+  pthread_mutex_unlock(&shard->mutex);
+  int first = shard - shards;
+  for (int i = 1; i < FILE_CACHE_SHARDS && OverCapacity(); i++) {
+    FileCacheShard *other = &shards[(first + i) % FILE_CACHE_SHARDS];
+    pthread_mutex_lock(&other->mutex);
+    Evict(other, NULL);
+    pthread_mutex_unlock(&other->mutex);
+  }
+  if (OverCapacity()) {
+    pthread_mutex_lock(&shard->mutex);
+    Evict(shard, NULL);
+    pthread_mutex_unlock(&shard->mutex);
+  }
+}
+
+// ReadVersion - reads the file open at fd into private memory when it still
+// is the version st describes , before and after reading. a mapping would
+// fault once the file is truncated while being sent. returns NULL otherwise
+static void *ReadVersion(int fd, const struct stat *st) {
+  struct stat now;
+  if (fstat(fd, &now) == -1 || !S_ISREG(now.st_mode) ||
+      now.st_ino != st->st_ino || now.st_dev != st->st_dev ||
+      now.st_size != st->st_size ||
+      now.st_mtim.tv_sec != st->st_mtim.tv_sec ||
+      now.st_mtim.tv_nsec != st->st_mtim.tv_nsec)
+    return NULL;
+  void *data = malloc(st->st_size);
+  if (data == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  off_t done = 0;
+  while (done < st->st_size) {
+    ssize_t n = pread(fd, (char *)data + done, st->st_size - done, done);
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  // a write while reading leaves a mix of both versions
+  if (done != st->st_size || fstat(fd, &now) == -1 ||
+      now.st_size != st->st_size ||
+      now.st_mtim.tv_sec != st->st_mtim.tv_sec ||
+      now.st_mtim.tv_nsec != st->st_mtim.tv_nsec) {
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+// LoadEntry - reads the file into a new entry with a single reference ,
+// done without holding any shard lock. the path may name another file by
+// now , the one opened must be the version st was taken from
+static FileCacheEntry *LoadEntry(const char *path, const struct stat *st) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+  void *data = ReadVersion(fd, st);
+  close(fd);
+  if (data == NULL)
+    return NULL;
+  FileCacheEntry *entry = (FileCacheEntry *)calloc(1, sizeof(FileCacheEntry));
+  if (entry == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  entry->dev = st->st_dev;
+  entry->ino = st->st_ino;
+  entry->mtimeSec = st->st_mtim.tv_sec;
+  entry->mtimeNsec = st->st_mtim.tv_nsec;
+  entry->size = st->st_size;
+  entry->hash = HashKey(st);
+  entry->refs = 1;
+  pthread_mutex_init(&entry->compressMutex, NULL);
+  entry->data = data;
+  return entry;
+}
+
+void FileCacheInit(size_t capacity) {
+  for (int i = 0; i < FILE_CACHE_SHARDS; i++)
+    pthread_mutex_init(&shards[i].mutex, NULL);
+  cacheCapacity = capacity;
+}
+
+FileCacheEntry *FileCacheAcquire(const char *path, const struct stat *st) {
+  if (st->st_size == 0 || (size_t)st->st_size > cacheCapacity)
+    return NULL;
+  size_t hash = HashKey(st);
+  FileCacheShard *shard = &shards[hash % FILE_CACHE_SHARDS];
+  FileCacheEntry **bucket =
+      &shard->buckets[hash / FILE_CACHE_SHARDS % FILE_CACHE_BUCKETS];
+  FileCacheEntry *entry;
+
+  pthread_mutex_lock(&shard->mutex);
+  for (entry = *bucket; entry != NULL; entry = entry->hashNext) {
+    if (SameVersion(entry, st)) {
+      __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+      LruUnlink(shard, entry);
+      LruPushFront(shard, entry);
+      pthread_mutex_unlock(&shard->mutex);
+      return entry;
+    }
+  }
+  pthread_mutex_unlock(&shard->mutex);
+
+  FileCacheEntry *loaded = LoadEntry(path, st);
+  if (loaded == NULL)
+    return NULL;
+
+  // another download may have loaded the same version meanwhile
+  pthread_mutex_lock(&shard->mutex);
+  for (entry = *bucket; entry != NULL; entry = entry->hashNext) {
+    if (SameVersion(entry, st)) {
+      __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&shard->mutex);
+      FreeEntry(loaded);
+      return entry;
+    }
+  }
+  // one reference for the cache , one for the caller
+  loaded->refs = 2;
+  loaded->inCache = 1;
+  loaded->hashNext = *bucket;
+  *bucket = loaded;
+  LruPushFront(shard, loaded);
+  __atomic_add_fetch(&cacheBytes, loaded->size, __ATOMIC_RELAXED);
+  MakeRoom(shard, loaded);
+  return loaded;
+}
+
+const unsigned char *FileCacheCompressed(FileCacheEntry *entry,
+                                         size_t *size) {
+  pthread_mutex_lock(&entry->compressMutex);
+  if (entry->compressState == 0) {
+    unsigned char *compressed = malloc(MarshalledSizeBound(entry->size));
+    if (compressed == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    size_t compressedSize =
+        CompressMessageBody(compressed, entry->data, entry->size);
+    if (compressedSize == 0) {
+      free(compressed);
+      entry->compressState = -1;
+    } else {
+      compressed = realloc(compressed, compressedSize);
+      // the compressed copy counts towards the capacity
+      FileCacheShard *shard = &shards[entry->hash % FILE_CACHE_SHARDS];
+      pthread_mutex_lock(&shard->mutex);
+      entry->compressed = compressed;
+      entry->compressedSize = compressedSize;
+      entry->compressState = 1;
+      if (entry->inCache) {
+        __atomic_add_fetch(&cacheBytes, compressedSize, __ATOMIC_RELAXED);
+        MakeRoom(shard, entry);
+      } else {
+        pthread_mutex_unlock(&shard->mutex);
+      }
+    }
+  }
+  pthread_mutex_unlock(&entry->compressMutex);
+  *size = entry->compressedSize;
+  return entry->compressState == 1 ? entry->compressed : NULL;
+}
+
+void FileCacheRelease(FileCacheEntry *entry) {
+  if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    FreeEntry(entry);
+}
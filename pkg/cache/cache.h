@@ -0,0 +1,61 @@
+#ifndef CACHE
+#define CACHE
+#include "../message/message.h"
+#include "../shared/consts.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+// number of independently locked shards of the file cache
+#define FILE_CACHE_SHARDS 16
+// hash buckets per shard
+#define FILE_CACHE_BUCKETS 256
+
+// FileCacheEntry - contents of one version of a file. an entry is shared by
+// every download of that version and freed once it has been evicted and its
+// last reference released
+typedef struct FileCacheEntry {
+  dev_t dev;
+  ino_t ino;
+  time_t mtimeSec;
+  long mtimeNsec;
+  off_t size;
+  // hash of (dev , ino) , picks the shard and bucket
+  size_t hash;
+  // private copy of the file contents , size bytes long
+  void *data;
+  // compressed FILE_REPLY body , built by the first download to a peer
+  // that accepts compression
+  unsigned char *compressed;
+  size_t compressedSize;
+  // 0 until compression was tried , 1 when compressed is set and -1 when
+  // the file does not compress
+  int compressState;
+  pthread_mutex_t compressMutex;
+  // the entry is still indexed by its shard
+  int inCache;
+  // one reference is held by the cache while the entry is in it
+  int refs;
+  struct FileCacheEntry *hashNext;
+  struct FileCacheEntry *lruPrev;
+  struct FileCacheEntry *lruNext;
+} FileCacheEntry;
+
+// FileCacheInit - enables the cache with the given capacity in bytes , a
+// budget all shards share so a single file may take all of it. 0 leaves the
+// cache disabled
+void FileCacheInit(size_t capacity);
+// FileCacheAcquire - returns the cached contents of the file at path , st
+// being its current stat. the file is loaded on a miss. returns NULL when
+// the cache is disabled , the file is larger than its capacity or can't be
+// read
+FileCacheEntry *FileCacheAcquire(const char *path, const struct stat *st);
+// FileCacheCompressed - returns the compressed body of an entry (see
+// CompressMessageBody) and its size , or NULL if the file does not compress
+const unsigned char *FileCacheCompressed(FileCacheEntry *entry,
+                                         size_t *size);
+// FileCacheRelease - drops a reference returned by FileCacheAcquire
+void FileCacheRelease(FileCacheEntry *entry);
+#endif
@@ -0,0 +1,199 @@
+// clock_gettime
+#define _GNU_SOURCE
+#include "capture.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <time.h>
+
+// the buffer frames are copied to and the one being written swap places.
+// fileMutex is held while writing to fp , taken with mutex held so records
+// reach the file in the order they were buffered
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;
+  pthread_mutex_t fileMutex;
+  pthread_t writer;
+  unsigned char *buffers[2];
+  int active;
+  size_t used;
+  FILE *fp;
+  int stopping;
+  struct timespec start;
+  unsigned long dropped;
+} capture = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+               PTHREAD_MUTEX_INITIALIZER};
+static int running;
+
+static void PutU64(unsigned char *dest, uint64_t value) {
+  *(uint32_t *)dest = htonl(value >> 32);
+  *(uint32_t *)(dest + 4) = htonl(value & 0xFFFFFFFF);
+}
+
+static void *CaptureWriter(void *arg) {
+  pthread_mutex_lock(&capture.mutex);
+  while (1) {
+    while (capture.used == 0 && !capture.stopping) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += CAPTURE_FLUSH_MS * 1000000L;
+      deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+      deadline.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait(&capture.wake, &capture.mutex, &deadline);
+    }
+    if (capture.used == 0)
+      break;
+    unsigned char *buffer = capture.buffers[capture.active];
+    size_t used = capture.used;
+    capture.active ^= 1;
+    capture.used = 0;
+    pthread_mutex_lock(&capture.fileMutex);
+    pthread_mutex_unlock(&capture.mutex);
+    if (fwrite(buffer, 1, used, capture.fp) != used || fflush(capture.fp))
+      perror("capture write failed: ");
+    pthread_mutex_unlock(&capture.fileMutex);
+    pthread_mutex_lock(&capture.mutex);
+  }
+  pthread_mutex_unlock(&capture.mutex);
+  return NULL;
+}
+
+int CaptureStart(const char *path) {
+  capture.fp = fopen(path, "wb");
+  if (capture.fp == NULL) {
+    perror("Couldn't create capture file");
+    return -1;
+  }
+  capture.buffers[0] = malloc(CAPTURE_BUFFER_SIZE);
+  capture.buffers[1] = malloc(CAPTURE_BUFFER_SIZE);
+  if (capture.buffers[0] == NULL || capture.buffers[1] == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, capture.fp);
+  clock_gettime(CLOCK_MONOTONIC, &capture.start);
+  if (pthread_create(&capture.writer, NULL, CaptureWriter, NULL) != 0) {
+    perror("Couldn't start the capture writer");
+    fclose(capture.fp);
+    return -1;
+  }
+  __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static void PutRecordHeader(unsigned char *record, uint64_t timestamp,
+                            int fd, uint16_t magic, uint16_t protocol,
+                            uint32_t size) {
+  PutU64(record, timestamp);
+  *(uint32_t *)(record + 8) =
+      htonl((SessionGeneration(fd) << 16) | (fd & 0xFFFF));
+  *(uint16_t *)(record + CAPTURE_RECORD_LEN) = htons(magic);
+  *(uint16_t *)(record + CAPTURE_RECORD_LEN + 2) = htons(protocol);
+  *(uint32_t *)(record + CAPTURE_RECORD_LEN + 4) = htonl(size);
+}
+
+// WriteDirectly - writes a frame larger than a buffer straight to the file ,
+// after the frames buffered before it. called with capture.mutex held
+static void WriteDirectly(const unsigned char *header, const void *body,
+                          uint32_t size) {
+  unsigned char *buffer = capture.buffers[capture.active];
+  size_t used = capture.used;
+  capture.used = 0;
+  // waits for the writer to be done with the older buffer
+  pthread_mutex_lock(&capture.fileMutex);
+  if (fwrite(buffer, 1, used, capture.fp) != used ||
+      fwrite(header, 1, CAPTURE_RECORD_LEN + PROTOCOL_HEADER_LEN,
+             capture.fp) != CAPTURE_RECORD_LEN + PROTOCOL_HEADER_LEN ||
+      fwrite(body, 1, size, capture.fp) != size || fflush(capture.fp))
+    perror("capture write failed: ");
+  pthread_mutex_unlock(&capture.fileMutex);
+}
+
+void CaptureFrame(int fd, uint16_t magic, uint16_t protocol, const void *body,
+                  uint32_t size) {
+  if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    return;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t timestamp =
+      (uint64_t)(now.tv_sec - capture.start.tv_sec) * 1000000000ULL +
+      now.tv_nsec - capture.start.tv_nsec;
+  size_t length = CAPTURE_RECORD_LEN + PROTOCOL_HEADER_LEN + size;
+  pthread_mutex_lock(&capture.mutex);
+  if (length > CAPTURE_BUFFER_SIZE) {
+    unsigned char header[CAPTURE_RECORD_LEN + PROTOCOL_HEADER_LEN];
+    PutRecordHeader(header, timestamp, fd, magic, protocol, size);
+    WriteDirectly(header, body, size);
+    pthread_mutex_unlock(&capture.mutex);
+    return;
+  }
+  if (capture.used + length > CAPTURE_BUFFER_SIZE) {
+    if (capture.dropped++ == 0)
+      fprintf(stderr, "[DEBUG] capture can't keep up , dropping frames\n");
+    pthread_mutex_unlock(&capture.mutex);
+    return;
+  }
+  unsigned char *record = capture.buffers[capture.active] + capture.used;
+  PutRecordHeader(record, timestamp, fd, magic, protocol, size);
+  memcpy(record + CAPTURE_RECORD_LEN + PROTOCOL_HEADER_LEN, body, size);
+  capture.used += length;
+  // wake the writer early when half the buffer is taken
+  if (capture.used > CAPTURE_BUFFER_SIZE / 2)
+    pthread_cond_signal(&capture.wake);
+  pthread_mutex_unlock(&capture.mutex);
+}
+
+void CaptureStop(void) {
+  if (!__atomic_exchange_n(&running, 0, __ATOMIC_ACQ_REL))
+    return;
+  pthread_mutex_lock(&capture.mutex);
+  capture.stopping = 1;
+  pthread_cond_signal(&capture.wake);
+  pthread_mutex_unlock(&capture.mutex);
+  pthread_join(capture.writer, NULL);
+  fclose(capture.fp);
+  free(capture.buffers[0]);
+  free(capture.buffers[1]);
+  if (capture.dropped > 0)
+    fprintf(stderr, "[DEBUG] capture dropped %lu frames\n", capture.dropped);
+}
+
+FILE *CaptureOpen(const char *path) {
+  char magic[CAPTURE_MAGIC_LEN];
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return NULL;
+  if (fread(magic, 1, CAPTURE_MAGIC_LEN, fp) != CAPTURE_MAGIC_LEN ||
+      memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0) {
+    fclose(fp);
+    return NULL;
+  }
+  return fp;
+}
+
+int CaptureRead(FILE *fp, CaptureRecord *record) {
+  unsigned char header[CAPTURE_RECORD_LEN + PROTOCOL_HEADER_LEN];
+  size_t n = fread(header, 1, sizeof(header), fp);
+  if (n == 0)
+    return 0;
+  if (n != sizeof(header))
+    return -1;
+  record->timestamp = (uint64_t)ntohl(*(uint32_t *)header) << 32 |
+                      ntohl(*(uint32_t *)(header + 4));
+  record->connection = ntohl(*(uint32_t *)(header + 8));
+  record->magic = ntohs(*(uint16_t *)(header + CAPTURE_RECORD_LEN));
+  record->protocol = ntohs(*(uint16_t *)(header + CAPTURE_RECORD_LEN + 2));
+  record->size = ntohl(*(uint32_t *)(header + CAPTURE_RECORD_LEN + 4));
+  if (record->size > MAX_INFLATED_BODY)
+    return -1;
+  record->body = malloc(record->size + 1);
+  if (record->body == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  if (fread(record->body, 1, record->size, fp) != record->size) {
+    free(record->body);
+    return -1;
+  }
+  record->body[record->size] = '\0';
+  return 1;
+}
@@ -0,0 +1,58 @@
+#ifndef CAPTURE
+#define CAPTURE
+#include "../session/session.h"
+#include "../shared/consts.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Capture - records the frames clients send to the server , to replay them
+// later (see cmd/replay). frames are copied to a memory buffer by the
+// threads reading them and written to the file by a background thread.
+//
+// a capture file starts with CAPTURE_MAGIC , followed by one record per
+// frame : the nanoseconds since the capture started (8 bytes) , the id of
+// the connection (4 bytes) and the frame exactly as it was read , header
+// and body. integers are in network order like on the wire.
+
+#define CAPTURE_MAGIC "TCPCAP01"
+#define CAPTURE_MAGIC_LEN 8
+// longest capture file path
+#define CAPTURE_PATH_LEN 256
+// bytes in front of the frame of every record
+#define CAPTURE_RECORD_LEN 12
+// frames buffered while the writer catches up , frames that don't fit are
+// dropped. a frame larger than the whole buffer is written directly
+#define CAPTURE_BUFFER_SIZE (8 << 20)
+// the writer flushes at least this often
+#define CAPTURE_FLUSH_MS 100
+
+// CaptureRecord - one frame read back from a capture
+typedef struct {
+  uint64_t timestamp;
+  // descriptor of the connection in the low 16 bits , its generation in
+  // the high ones
+  uint32_t connection;
+  uint16_t magic;
+  uint16_t protocol;
+  uint32_t size;
+  // size bytes , NUL terminated , to free
+  char *body;
+} CaptureRecord;
+
+// CaptureStart - starts recording every frame to path. returns -1 if it
+// can't be created
+int CaptureStart(const char *path);
+// CaptureFrame - records a frame read from fd , when a capture is running
+void CaptureFrame(int fd, uint16_t magic, uint16_t protocol, const void *body,
+                  uint32_t size);
+// CaptureStop - writes what is buffered and closes the capture
+void CaptureStop(void);
+
+// CaptureOpen - opens a capture for reading , NULL if it isn't one
+FILE *CaptureOpen(const char *path);
+// CaptureRead - reads the next record. returns 1 , 0 at the end of the
+// capture or -1 if it is truncated
+int CaptureRead(FILE *fp, CaptureRecord *record);
+#endif
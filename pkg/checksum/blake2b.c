@@ -0,0 +1,128 @@
+#include "blake2b.h"
+#include <string.h>
+
+static const uint64_t IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+    0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+
+static const unsigned char SIGMA[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}};
+
+static uint64_t Rotr64(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+static uint64_t Load64(const unsigned char *p) {
+  uint64_t x = 0;
+  for (int i = 7; i >= 0; i--)
+    x = (x << 8) | p[i];
+  return x;
+}
+
+#define G(a, b, c, d, x, y)                                                    \
+  do {                                                                         \
+    v[a] = v[a] + v[b] + (x);                                                  \
+    v[d] = Rotr64(v[d] ^ v[a], 32);                                            \
+    v[c] = v[c] + v[d];                                                        \
+    v[b] = Rotr64(v[b] ^ v[c], 24);                                            \
+    v[a] = v[a] + v[b] + (y);                                                  \
+    v[d] = Rotr64(v[d] ^ v[a], 16);                                            \
+    v[c] = v[c] + v[d];                                                        \
+    v[b] = Rotr64(v[b] ^ v[c], 63);                                            \
+  } while (0)
+
+// Blake2bCompress - mixes one block into the state. the four column and
+// four diagonal G steps of a round are independent of each other , which
+// lets the compiler vectorize them
+static void Blake2bCompress(Blake2bState *state, const unsigned char *block,
+                            int last) {
+  uint64_t m[16];
+  uint64_t v[16];
+  for (int i = 0; i < 16; i++)
+    m[i] = Load64(block + 8 * i);
+  for (int i = 0; i < 8; i++) {
+    v[i] = state->h[i];
+    v[i + 8] = IV[i];
+  }
+  v[12] ^= state->t[0];
+  v[13] ^= state->t[1];
+  if (last)
+    v[14] = ~v[14];
+  for (int r = 0; r < 12; r++) {
+    const unsigned char *s = SIGMA[r];
+    G(0, 4, 8, 12, m[s[0]], m[s[1]]);
+    G(1, 5, 9, 13, m[s[2]], m[s[3]]);
+    G(2, 6, 10, 14, m[s[4]], m[s[5]]);
+    G(3, 7, 11, 15, m[s[6]], m[s[7]]);
+    G(0, 5, 10, 15, m[s[8]], m[s[9]]);
+    G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+    G(2, 7, 8, 13, m[s[12]], m[s[13]]);
+    G(3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+  for (int i = 0; i < 8; i++)
+    state->h[i] ^= v[i] ^ v[i + 8];
+}
+
+static void AddCounter(Blake2bState *state, uint64_t n) {
+  state->t[0] += n;
+  if (state->t[0] < n)
+    state->t[1]++;
+}
+
+void Blake2bInit(Blake2bState *state, size_t digestLen) {
+  memset(state, 0, sizeof(*state));
+  for (int i = 0; i < 8; i++)
+    state->h[i] = IV[i];
+  // parameter block: digest length , no key , fanout 1 , depth 1
+  state->h[0] ^= 0x01010000ULL ^ digestLen;
+  state->digestLen = digestLen;
+}
+
+void Blake2bUpdate(Blake2bState *state, const void *data, size_t length) {
+  const unsigned char *in = data;
+  while (length > 0) {
+    // the last block has to be kept back for Blake2bFinal
+    if (state->bufLen == BLAKE2B_BLOCK_LEN) {
+      AddCounter(state, BLAKE2B_BLOCK_LEN);
+      Blake2bCompress(state, state->buf, 0);
+      state->bufLen = 0;
+    }
+    // whole blocks straight from the input
+    if (state->bufLen == 0) {
+      while (length > BLAKE2B_BLOCK_LEN) {
+        AddCounter(state, BLAKE2B_BLOCK_LEN);
+        Blake2bCompress(state, in, 0);
+        in += BLAKE2B_BLOCK_LEN;
+        length -= BLAKE2B_BLOCK_LEN;
+      }
+    }
+    size_t n = BLAKE2B_BLOCK_LEN - state->bufLen;
+    if (n > length)
+      n = length;
+    memcpy(state->buf + state->bufLen, in, n);
+    state->bufLen += n;
+    in += n;
+    length -= n;
+  }
+}
+
+void Blake2bFinal(Blake2bState *state, unsigned char *out) {
+  unsigned char digest[BLAKE2B_MAX_DIGEST_LEN];
+  AddCounter(state, state->bufLen);
+  memset(state->buf + state->bufLen, 0, BLAKE2B_BLOCK_LEN - state->bufLen);
+  Blake2bCompress(state, state->buf, 1);
+  for (int i = 0; i < 8; i++)
+    for (int j = 0; j < 8; j++)
+      digest[8 * i + j] = (unsigned char)(state->h[i] >> (8 * j));
+  memcpy(out, digest, state->digestLen);
+}
@@ -0,0 +1,25 @@
+#ifndef BLAKE2B
+#define BLAKE2B
+#include <stddef.h>
+#include <stdint.h>
+// bytes of a BLAKE2b block
+#define BLAKE2B_BLOCK_LEN 128
+// largest BLAKE2b digest
+#define BLAKE2B_MAX_DIGEST_LEN 64
+
+// Blake2bState - incremental BLAKE2b (RFC 7693) state
+typedef struct {
+  uint64_t h[8];
+  uint64_t t[2];
+  unsigned char buf[BLAKE2B_BLOCK_LEN];
+  size_t bufLen;
+  size_t digestLen;
+} Blake2bState;
+
+// Blake2bInit - starts an unkeyed hash producing digestLen (1 to 64) bytes
+void Blake2bInit(Blake2bState *state, size_t digestLen);
+// Blake2bUpdate - hashes length more bytes of data
+void Blake2bUpdate(Blake2bState *state, const void *data, size_t length);
+// Blake2bFinal - writes the digest to out
+void Blake2bFinal(Blake2bState *state, unsigned char *out);
+#endif
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include "checksum.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// ChecksumSlot - one remembered digest
+typedef struct {
+  dev_t dev;
+  ino_t ino;
+  time_t mtimeSec;
+  long mtimeNsec;
+  int used;
+  FileDigest digest;
+} ChecksumSlot;
+
+// HashJob - a file being hashed , from data when it is cached and else
+// read from fd. threads take the next chunk until none is left
+typedef struct {
+  const unsigned char *data;
+  int fd;
+  off_t size;
+  uint32_t numChunks;
+  uint32_t nextChunk;
+  // set by the first thread that couldn't read its chunk
+  int failed;
+  unsigned char (*chunks)[CHECKSUM_DIGEST_LEN];
+} HashJob;
+
+static ChecksumSlot slots[CHECKSUM_CACHE_SLOTS];
+static pthread_mutex_t slotsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ChecksumSlot *SlotOf(const struct stat *st) {
+  size_t hash = (size_t)st->st_ino * 0x9E3779B97F4A7C15ULL ^ st->st_dev;
+  return &slots[(hash >> 16) % CHECKSUM_CACHE_SLOTS];
+}
+
+static int SameVersion(const struct stat *a, const struct stat *b) {
+  return a->st_ino == b->st_ino && a->st_dev == b->st_dev &&
+         a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+         a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static int SlotMatches(const ChecksumSlot *slot, const struct stat *st) {
+  return slot->used && slot->ino == st->st_ino && slot->dev == st->st_dev &&
+         slot->digest.size == st->st_size &&
+         slot->mtimeSec == st->st_mtim.tv_sec &&
+         slot->mtimeNsec == st->st_mtim.tv_nsec;
+}
+
+// CopyDigest - deep copy , the leaf digests of dest are newly allocated
+static void CopyDigest(FileDigest *dest, const FileDigest *src) {
+  *dest = *src;
+  dest->chunks = malloc((src->numChunks + 1) * CHECKSUM_DIGEST_LEN);
+  if (dest->chunks == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(dest->chunks, src->chunks, src->numChunks * CHECKSUM_DIGEST_LEN);
+}
+
+// ReadChunk - reads length bytes at offset into buffer , failing on a file
+// that got shorter
+static int ReadChunk(int fd, unsigned char *buffer, size_t length,
+                     off_t offset) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = pread(fd, buffer + done, length - done, offset + done);
+    if (n <= 0)
+      return -1;
+    done += n;
+  }
+  return 0;
+}
+
+// HashChunks - hashes chunks of the job until none is left. chunks of a file
+// that isn't cached are read into a private buffer , a mapping would fault
+// once the file is truncated while being hashed
+static void *HashChunks(void *arg) {
+  HashJob *job = (HashJob *)arg;
+  const unsigned char leafPrefix = 0x00;
+  unsigned char *buffer = NULL;
+  if (job->data == NULL && job->numChunks > 0) {
+    buffer = malloc(CHECKSUM_CHUNK_SIZE);
+    if (buffer == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+  }
+  uint32_t chunk;
+  while ((chunk = __atomic_fetch_add(&job->nextChunk, 1, __ATOMIC_RELAXED)) <
+         job->numChunks) {
+    off_t offset = (off_t)chunk * CHECKSUM_CHUNK_SIZE;
+    size_t length = job->size - offset < CHECKSUM_CHUNK_SIZE
+                        ? (size_t)(job->size - offset)
+                        : CHECKSUM_CHUNK_SIZE;
+    const unsigned char *data = job->data + offset;
+    if (buffer != NULL) {
+      if (ReadChunk(job->fd, buffer, length, offset) == -1) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        break;
+      }
+      data = buffer;
+    }
+    Blake2bState state;
+    Blake2bInit(&state, CHECKSUM_DIGEST_LEN);
+    Blake2bUpdate(&state, &leafPrefix, 1);
+    Blake2bUpdate(&state, data, length);
+    Blake2bFinal(&state, job->chunks[chunk]);
+  }
+  free(buffer);
+  return NULL;
+}
+
+// HashData - computes the tree hash of size bytes at data , or read from fd
+// when data is NULL. returns -1 when the file couldn't be read
+static int HashData(FileDigest *digest, const unsigned char *data, int fd,
+                    off_t size) {
+  HashJob job;
+  job.data = data;
+  job.fd = fd;
+  job.size = size;
+  job.failed = 0;
+  job.numChunks = (size + CHECKSUM_CHUNK_SIZE - 1) / CHECKSUM_CHUNK_SIZE;
+  job.nextChunk = 0;
+  job.chunks = malloc((job.numChunks + 1) * CHECKSUM_DIGEST_LEN);
+  if (job.chunks == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  // the calling thread hashes chunks too
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int numThreads = cpus < CHECKSUM_MAX_THREADS ? (int)cpus : CHECKSUM_MAX_THREADS;
+  if ((uint32_t)numThreads > job.numChunks)
+    numThreads = job.numChunks;
+  pthread_t threads[CHECKSUM_MAX_THREADS];
+  int started = 0;
+  for (int i = 1; i < numThreads; i++) {
+    if (pthread_create(&threads[started], NULL, HashChunks, &job) == 0)
+      started++;
+  }
+  HashChunks(&job);
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  if (job.failed) {
+    free(job.chunks);
+    return -1;
+  }
+
+  const unsigned char rootPrefix = 0x01;
+  unsigned char sizeBytes[8];
+  for (int i = 0; i < 8; i++)
+    sizeBytes[i] = (unsigned char)((uint64_t)size >> (8 * i));
+  Blake2bState state;
+  Blake2bInit(&state, CHECKSUM_DIGEST_LEN);
+  Blake2bUpdate(&state, &rootPrefix, 1);
+  Blake2bUpdate(&state, sizeBytes, sizeof(sizeBytes));
+  Blake2bUpdate(&state, job.chunks, job.numChunks * CHECKSUM_DIGEST_LEN);
+  Blake2bFinal(&state, digest->root);
+  digest->size = size;
+  digest->numChunks = job.numChunks;
+  digest->chunks = job.chunks;
+  return 0;
+}
+
+int FileChecksum(const char *path, const struct stat *st, FileDigest *digest) {
+  ChecksumSlot *slot = SlotOf(st);
+  pthread_mutex_lock(&slotsMutex);
+  if (SlotMatches(slot, st)) {
+    CopyDigest(digest, &slot->digest);
+    pthread_mutex_unlock(&slotsMutex);
+    return 0;
+  }
+  pthread_mutex_unlock(&slotsMutex);
+
+  // the file opened must be the version st describes , else its digest
+  // would be remembered under the key of another
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  struct stat now;
+  if (fstat(fd, &now) == -1 || !SameVersion(&now, st)) {
+    close(fd);
+    return -1;
+  }
+  // hot files are hashed straight from the download cache
+  FileCacheEntry *cached = FileCacheAcquire(path, st);
+  int hashed;
+  if (cached != NULL) {
+    hashed = HashData(digest, cached->data, -1, cached->size);
+    FileCacheRelease(cached);
+  } else {
+    hashed = HashData(digest, NULL, fd, st->st_size);
+    // a write while hashing leaves a digest of neither version
+    if (hashed == 0 && (fstat(fd, &now) == -1 || !SameVersion(&now, st))) {
+      FreeFileDigest(digest);
+      hashed = -1;
+    }
+  }
+  close(fd);
+  if (hashed == -1)
+    return -1;
+
+  pthread_mutex_lock(&slotsMutex);
+  if (slot->used)
+    FreeFileDigest(&slot->digest);
+  slot->dev = st->st_dev;
+  slot->ino = st->st_ino;
+  slot->mtimeSec = st->st_mtim.tv_sec;
+  slot->mtimeNsec = st->st_mtim.tv_nsec;
+  slot->used = 1;
+  CopyDigest(&slot->digest, digest);
+  pthread_mutex_unlock(&slotsMutex);
+  return 0;
+}
+
+void FreeFileDigest(FileDigest *digest) {
+  free(digest->chunks);
+  digest->chunks = NULL;
+}
+
+void DigestToHex(char *dest, const unsigned char *digest) {
+  static const char digits[] = "0123456789abcdef";
+  for (int i = 0; i < CHECKSUM_DIGEST_LEN; i++) {
+    dest[2 * i] = digits[digest[i] >> 4];
+    dest[2 * i + 1] = digits[digest[i] & 0xF];
+  }
+  dest[2 * CHECKSUM_DIGEST_LEN] = '\0';
+}
@@ -0,0 +1,39 @@
+#ifndef CHECKSUM
+#define CHECKSUM
+#include "../cache/cache.h"
+#include "../shared/consts.h"
+#include "blake2b.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+// bytes of file hashed by each leaf of the tree
+#define CHECKSUM_CHUNK_SIZE (1 << 20)
+// bytes of every digest of the tree (BLAKE2b-256)
+#define CHECKSUM_DIGEST_LEN 32
+// files whose digest is remembered
+#define CHECKSUM_CACHE_SLOTS 256
+// most threads hashing one file
+#define CHECKSUM_MAX_THREADS 16
+
+// FileDigest - tree hash of a file. leaf i is BLAKE2b-256 of 0x00 followed
+// by chunk i , the root is BLAKE2b-256 of 0x01 , the file size (8 bytes ,
+// little endian) and every leaf in order. chunks are hashed in parallel
+typedef struct {
+  off_t size;
+  uint32_t numChunks;
+  unsigned char root[CHECKSUM_DIGEST_LEN];
+  // numChunks leaf digests
+  unsigned char (*chunks)[CHECKSUM_DIGEST_LEN];
+} FileDigest;
+
+// FileChecksum - fills digest with the tree hash of the file at path , st
+// being its current stat. results are cached by (dev , inode , mtime , size)
+// so only the first request for a version of a file reads it.
+// returns -1 if the file can't be read or is no longer , or not throughout ,
+// the version st describes
+int FileChecksum(const char *path, const struct stat *st, FileDigest *digest);
+// FreeFileDigest - releases the leaf digests of a FileDigest
+void FreeFileDigest(FileDigest *digest);
+// DigestToHex - writes the 2 * CHECKSUM_DIGEST_LEN hex characters of a
+// digest and a terminating NUL to dest
+void DigestToHex(char *dest, const unsigned char *digest);
+#endif
@@ -0,0 +1,367 @@
+// getaddrinfo
+#define _GNU_SOURCE
+#include "async.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// AsyncRequest - a request in flight
+typedef struct AsyncRequest {
+  AsyncCallback cb;
+  void *arg;
+  AsyncReply reply;
+  // set once REQUEST_DONE arrived , for requests waited on with AsyncWait
+  int done;
+  struct AsyncRequest *next;
+} AsyncRequest;
+
+struct AsyncClient {
+  int fd;
+  int closed;
+  uint32_t nextTag;
+  // bytes queued for the socket
+  unsigned char *out;
+  size_t outLen, outCap;
+  // bytes read but not yet parsed into frames
+  unsigned char *in;
+  size_t inLen, inCap;
+  // request the frames being read answer , set by REQUEST_TAG
+  AsyncRequest *current;
+  AsyncRequest *requests[ASYNC_BUCKETS];
+};
+
+static void *Allocate(void *ptr, size_t size) {
+  ptr = realloc(ptr, size);
+  if (ptr == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+// Reserve - makes room for len more bytes after *used in *buf
+static void Reserve(unsigned char **buf, size_t *cap, size_t used,
+                    size_t len) {
+  if (used + len <= *cap)
+    return;
+  size_t grown = *cap ? *cap * 2 : ASYNC_READ_SIZE;
+  while (grown < used + len)
+    grown *= 2;
+  *buf = Allocate(*buf, grown);
+  *cap = grown;
+}
+
+static AsyncRequest **FindRequest(AsyncClient *client, uint32_t tag) {
+  AsyncRequest **link = &client->requests[tag % ASYNC_BUCKETS];
+  while (*link != NULL && (*link)->reply.tag != tag)
+    link = &(*link)->next;
+  return link;
+}
+
+// Complete - hands a finished reply to its callback , or keeps it for
+// AsyncWait
+static void Complete(AsyncClient *client, AsyncRequest **link, int status) {
+  AsyncRequest *request = *link;
+  request->reply.status = status;
+  if (client->current == request)
+    client->current = NULL;
+  if (request->cb == NULL) {
+    request->done = 1;
+    return;
+  }
+  *link = request->next;
+  request->cb(client, &request->reply, request->arg);
+  AsyncFreeReply(&request->reply);
+  free(request);
+}
+
+// Shutdown - closes the connection and fails every reply still missing
+static void Shutdown(AsyncClient *client) {
+  if (client->closed)
+    return;
+  client->closed = 1;
+  SessionReset(client->fd);
+  close(client->fd);
+  for (int i = 0; i < ASYNC_BUCKETS; i++) {
+    AsyncRequest **link = &client->requests[i];
+    while (*link != NULL) {
+      if ((*link)->done) {
+        link = &(*link)->next;
+        continue;
+      }
+      AsyncRequest *request = *link;
+      Complete(client, link, -1);
+      // a request kept for AsyncWait stays linked
+      if (*link == request)
+        link = &request->next;
+    }
+  }
+}
+
+static void Enqueue(AsyncClient *client, const unsigned char *data,
+                    size_t len) {
+  Reserve(&client->out, &client->outCap, client->outLen, len);
+  memcpy(client->out + client->outLen, data, len);
+  client->outLen += len;
+}
+
+// Flush - writes queued bytes until the socket would block
+static int Flush(AsyncClient *client) {
+  size_t written = 0;
+  while (written < client->outLen) {
+    ssize_t n = send(client->fd, client->out + written,
+                     client->outLen - written, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (n <= 0)
+      return -1;
+    written += n;
+  }
+  memmove(client->out, client->out + written, client->outLen - written);
+  client->outLen -= written;
+  return 0;
+}
+
+// HandleFrame - acts on one frame read from the server. returns the number
+// of replies it completed
+static int HandleFrame(AsyncClient *client, uint16_t protocol, char *body,
+                       uint32_t size) {
+  if (protocol == REQUEST_TAG || protocol == REQUEST_DONE) {
+    uint32_t tag = size == 4 ? ntohl(*(uint32_t *)body) : 0;
+    AsyncRequest **link = FindRequest(client, tag);
+    free(body);
+    if (protocol == REQUEST_TAG) {
+      client->current = *link;
+      return 0;
+    }
+    if (*link == NULL || (*link)->done)
+      return 0;
+    Complete(client, link, 0);
+    return 1;
+  }
+  if (client->current == NULL) {
+    // untagged , only the capability handshake is expected
+    if (protocol == HELLO_REPLY)
+      SessionSetCapabilities(client->fd, strtoul(body, NULL, 0));
+    free(body);
+    return 0;
+  }
+  AsyncReply *reply = &client->current->reply;
+  reply->frames =
+      Allocate(reply->frames, (reply->numFrames + 1) * sizeof(Message));
+  Message *frame = &reply->frames[reply->numFrames++];
+  frame->message_sender = client->fd;
+  frame->magic = 0xC0DE;
+  frame->protocol = protocol;
+  frame->size = size;
+  frame->tag = reply->tag;
+  frame->body = body;
+  return 0;
+}
+
+// ParseFrames - handles every complete frame read so far
+static int ParseFrames(AsyncClient *client) {
+  size_t offset = 0;
+  int completed = 0;
+  while (client->inLen - offset >= PROTOCOL_HEADER_LEN) {
+    unsigned char *header = client->in + offset;
+    uint16_t protocol = ExtractMessageProtocol(header);
+    uint32_t size = ExtractMessageBodySize(header);
+    // only a compressed body is bounded , it expands to MAX_INFLATED_BODY
+    // at most
+    if (ExtractMessageMagic(header) != 0xC0DE ||
+        ((protocol & PROTOCOL_FLAG_COMPRESSED) && size > MAX_INFLATED_BODY))
+      return -1;
+    if (client->inLen - offset - PROTOCOL_HEADER_LEN < size)
+      break;
+    char *body = Allocate(NULL, size + 1);
+    memcpy(body, header + PROTOCOL_HEADER_LEN, size);
+    body[size] = '\0';
+    offset += PROTOCOL_HEADER_LEN + size;
+    if (InflateMessageBody(&protocol, &body, &size) == -1) {
+      free(body);
+      return -1;
+    }
+    completed += HandleFrame(client, protocol, body, size);
+    if (client->closed)
+      break;
+  }
+  memmove(client->in, client->in + offset, client->inLen - offset);
+  client->inLen -= offset;
+  return completed;
+}
+
+AsyncClient *AsyncAttach(int fd) {
+  AsyncClient *client = calloc(1, sizeof(AsyncClient));
+  if (client == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, (flags < 0 ? 0 : flags) | O_NONBLOCK);
+  client->fd = fd;
+  client->nextTag = 1;
+  // offer compression , replies come back compressed once it was agreed on
+  char body[16];
+  unsigned char hello[PROTOCOL_HEADER_LEN + sizeof(body)];
+  snprintf(body, sizeof(body), "%u", SUPPORTED_CAPABILITIES);
+  Enqueue(client, hello, MarshallMessage(hello, 0xC0DE, HELLO_REQUEST, body));
+  if (Flush(client) == -1)
+    Shutdown(client);
+  return client;
+}
+
+AsyncClient *AsyncConnect(const char *host, long port) {
+  int fd = -1;
+  if (strncmp(host, "unix:", 5) == 0) {
+    struct sockaddr_un addr;
+    socklen_t len = FillUnixAddress(&addr, host + 5);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+      return NULL;
+    if (connect(fd, (struct sockaddr *)&addr, len) == -1) {
+      close(fd);
+      return NULL;
+    }
+    return AsyncAttach(fd);
+  }
+  struct addrinfo hints, *addrs, *addr;
+  char service[16];
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%ld", port);
+  if (getaddrinfo(host, service, &hints, &addrs) != 0)
+    return NULL;
+  for (addr = addrs; addr != NULL; addr = addr->ai_next) {
+    fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd == -1)
+      continue;
+    if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addrs);
+  return fd == -1 ? NULL : AsyncAttach(fd);
+}
+
+uint32_t AsyncSend(AsyncClient *client, uint16_t protocol, const void *body,
+                   size_t length, AsyncCallback cb, void *arg) {
+  if (client->closed)
+    return 0;
+  uint32_t tag = client->nextTag++;
+  // 0 marks untagged requests
+  if (client->nextTag == 0)
+    client->nextTag = 1;
+  AsyncRequest *request = calloc(1, sizeof(AsyncRequest));
+  if (request == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  request->cb = cb;
+  request->arg = arg;
+  request->reply.tag = tag;
+  AsyncRequest **bucket = &client->requests[tag % ASYNC_BUCKETS];
+  request->next = *bucket;
+  *bucket = request;
+
+  Reserve(&client->out, &client->outCap, client->outLen,
+          REQUEST_TAG_FRAME_LEN + MarshalledSizeBound(length));
+  client->outLen +=
+      MarshallRequestTag(client->out + client->outLen, REQUEST_TAG, tag);
+  client->outLen += MarshallBinaryMessage(
+      client->out + client->outLen, 0xC0DE, protocol, body, length,
+      SessionCapabilities(client->fd) & CAP_COMPRESSION);
+  if (Flush(client) == -1)
+    Shutdown(client);
+  return tag;
+}
+
+int AsyncPoll(AsyncClient *client, int timeoutMs) {
+  if (client->closed)
+    return -1;
+  struct pollfd pfd = {client->fd, POLLIN, 0};
+  if (client->outLen > 0)
+    pfd.events |= POLLOUT;
+  int ready = poll(&pfd, 1, timeoutMs);
+  if (ready == -1 && errno != EINTR) {
+    Shutdown(client);
+    return -1;
+  }
+  if (ready <= 0)
+    return 0;
+  if ((pfd.revents & POLLOUT) && Flush(client) == -1) {
+    Shutdown(client);
+    return -1;
+  }
+  if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+    return 0;
+  int eof = 0;
+  while (1) {
+    Reserve(&client->in, &client->inCap, client->inLen, ASYNC_READ_SIZE);
+    ssize_t n = read(client->fd, client->in + client->inLen, ASYNC_READ_SIZE);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (n <= 0) {
+      eof = 1;
+      break;
+    }
+    client->inLen += n;
+  }
+  int completed = ParseFrames(client);
+  if (completed == -1 || eof) {
+    Shutdown(client);
+    return completed == -1 ? -1 : completed;
+  }
+  return completed;
+}
+
+int AsyncWait(AsyncClient *client, uint32_t tag, AsyncReply *reply) {
+  AsyncRequest *request = *FindRequest(client, tag);
+  if (request == NULL || request->cb != NULL)
+    return -1;
+  // polling may free requests ahead of it in the bucket , only the request
+  // itself stays until it is unlinked below
+  while (!request->done && AsyncPoll(client, -1) != -1)
+    ;
+  AsyncRequest **link = FindRequest(client, tag);
+  *link = request->next;
+  *reply = request->reply;
+  free(request);
+  return reply->status;
+}
+
+void AsyncFreeReply(AsyncReply *reply) {
+  for (int i = 0; i < reply->numFrames; i++)
+    free(reply->frames[i].body);
+  free(reply->frames);
+  reply->frames = NULL;
+  reply->numFrames = 0;
+}
+
+int AsyncFd(const AsyncClient *client) { return client->fd; }
+
+size_t AsyncPending(const AsyncClient *client) { return client->outLen; }
+
+void AsyncClose(AsyncClient *client) {
+  Shutdown(client);
+  for (int i = 0; i < ASYNC_BUCKETS; i++) {
+    while (client->requests[i] != NULL) {
+      AsyncRequest *request = client->requests[i];
+      client->requests[i] = request->next;
+      AsyncFreeReply(&request->reply);
+      free(request);
+    }
+  }
+  free(client->out);
+  free(client->in);
+  free(client);
+}
@@ -0,0 +1,67 @@
+#ifndef ASYNC
+#define ASYNC
+#include "../message/message.h"
+#include "../session/session.h"
+#include "../shared/consts.h"
+#include "../shared/utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+// Async - a non interactive client for programs embedding the framework.
+// every request is sent tagged with an id , so any number of them can be
+// in flight on one connection and their replies are matched by id whatever
+// order the server answers them in. the connection is non blocking and
+// driven by AsyncPoll , either from AsyncWait or from the caller's own
+// event loop watching AsyncFd.
+
+typedef struct AsyncClient AsyncClient;
+
+// AsyncReply - every frame the server sent back for one request
+typedef struct {
+  uint32_t tag;
+  // 0 when the reply is complete , -1 when the connection was lost first
+  int status;
+  int numFrames;
+  // bodies are NUL terminated and already decompressed
+  Message *frames;
+} AsyncReply;
+
+// AsyncCallback - runs from AsyncPoll once a reply is complete. the reply
+// is freed when it returns. it may send new requests but must not close
+// the client
+typedef void (*AsyncCallback)(AsyncClient *client, AsyncReply *reply,
+                              void *arg);
+
+// AsyncConnect - connects to host:port , or to the unix socket path when
+// host starts with "unix:". returns NULL on failure
+AsyncClient *AsyncConnect(const char *host, long port);
+// AsyncAttach - takes over an already connected socket
+AsyncClient *AsyncAttach(int fd);
+// AsyncSend - queues a request with a body of length bytes and returns its
+// id , or 0 when the connection is closed. cb runs once the reply is
+// complete , without a callback the reply is kept for AsyncWait
+uint32_t AsyncSend(AsyncClient *client, uint16_t protocol, const void *body,
+                   size_t length, AsyncCallback cb, void *arg);
+// AsyncPoll - waits up to timeoutMs (-1 forever) for the connection , then
+// writes what is queued , reads what arrived and completes replies. returns
+// the number of replies completed , or -1 once the connection is closed
+int AsyncPoll(AsyncClient *client, int timeoutMs);
+// AsyncWait - polls until the reply of a request sent without callback is
+// complete and moves it to reply. returns reply->status , or -1 for an
+// unknown id
+int AsyncWait(AsyncClient *client, uint32_t tag, AsyncReply *reply);
+// AsyncFreeReply - frees the frames of a reply returned by AsyncWait
+void AsyncFreeReply(AsyncReply *reply);
+// AsyncFd - descriptor to watch for readability , and for writability while
+// AsyncPending reports queued bytes
+int AsyncFd(const AsyncClient *client);
+// AsyncPending - bytes queued but not yet written
+size_t AsyncPending(const AsyncClient *client);
+// AsyncClose - closes the connection , replies still missing complete with
+// status -1 , and frees the client
+void AsyncClose(AsyncClient *client);
+
+// buckets of the table of requests in flight
+#define ASYNC_BUCKETS 256
+// bytes read from the socket at a time
+#define ASYNC_READ_SIZE 65536
+#endif
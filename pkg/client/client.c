@@ -4,6 +4,8 @@ void Loop(int socket)
 {
   int file_count = 1;
   char *upload_name = malloc(MAX_BUFFER);
+  // local file of the sync download or upload in progress
+  char *sync_path = malloc(MAX_BUFFER);
 
   fd_set clientFds;
   //   char choice[MAX_BUFFER];
@@ -11,6 +13,7 @@ void Loop(int socket)
   int waiting_for_choice = 1;
   int waiting_for_reply = 0;
   int upload_initiated = 0;
+  int sync_upload_initiated = 0;
   while (1)
   {
     if (show_menu)
@@ -19,18 +22,30 @@ void Loop(int socket)
       puts("Please select your prefer service:\n  1. Echo\n  2. "
            "Download\n  3. Upload\n  4. Change Directory\n  5. List "
            "Directory\n  "
-           "6. Quit\nEnter your choice: ");
+           "6. Checksum\n  7. Sync Download\n  8. Sync Upload\n  9. Batch Download\n  0. Quit\nEnter your choice: ");
       show_menu = 0;
     }
 
     // Reset the socket set each time since select()
-    // modifies it
+    // modifies it. on a shared memory connection we wait on its eventfd
+    // instead of the socket (-1 means a reply is already buffered)
+    int wait_fd = TransportWaitFd(socket);
+    struct timeval no_wait = {0, 0};
     FD_ZERO(&clientFds);
-    FD_SET(socket, &clientFds);
+    if (wait_fd != -1)
+      FD_SET(wait_fd, &clientFds);
     FD_SET(0, &clientFds);
     // wait for an available socket
-    if (select(FD_SETSIZE, &clientFds, NULL, NULL, NULL) != -1)
+    if (select(FD_SETSIZE, &clientFds, NULL, NULL,
+               wait_fd == -1 ? &no_wait : NULL) != -1)
     {
+      if (wait_fd != socket)
+      {
+        if (wait_fd == -1 || FD_ISSET(wait_fd, &clientFds))
+          FD_SET(socket, &clientFds);
+        if (wait_fd != -1 && wait_fd != 0)
+          FD_CLR(wait_fd, &clientFds);
+      }
       for (int connection_file_descriptor_socket = 0;
            connection_file_descriptor_socket < FD_SETSIZE;
            connection_file_descriptor_socket++)
@@ -41,7 +56,7 @@ void Loop(int socket)
           {
             printf("SERVER SOCKET CONNECTED\n");
             char *header = malloc(PROTOCOL_HEADER_LEN);
-            int n = read(socket, header, PROTOCOL_HEADER_LEN);
+            int n = TransportRecv(socket, header, PROTOCOL_HEADER_LEN);
             printf("size read  [%d] \n", n);
             if (n > 1)
             {
@@ -50,8 +65,14 @@ void Loop(int socket)
               {
                 uint16_t protocol = ExtractMessageProtocol(header);
                 uint32_t payload_size = ExtractMessageBodySize(header);
-                char *recv_buffer = malloc(payload_size);
-                read(socket, recv_buffer, payload_size);
+                char *recv_buffer = malloc(payload_size + 1);
+                TransportRecv(socket, recv_buffer, payload_size);
+                recv_buffer[payload_size] = '\0';
+                if (InflateMessageBody(&protocol, &recv_buffer, &payload_size) == -1)
+                {
+                  fprintf(stderr, "[ ERROR MESSAGE ] : [ corrupt compressed body ]");
+                  protocol = UNKNOWN_TYPE;
+                }
                 Message reply;
                 reply.message_sender = socket;
                 reply.magic = magic;
@@ -77,6 +98,27 @@ void Loop(int socket)
                   fprintf(stderr, "[ ECHO FROM SERVER ] ");
                   break;
                 }
+                case HELLO_REPLY:
+                {
+                  // the server answers with the capabilities both sides support
+                  SessionSetCapabilities(socket, strtoul(reply.body, NULL, 0));
+                  break;
+                }
+                case DELTA_REPLY:
+                {
+                  SyncDownloadProtocolHandleServerReply(sync_path, reply);
+                  break;
+                }
+                case UPLOAD_REPLY:
+                {
+                  fprintf(stderr, "[ File Upload ] : [ stored %s ]", reply.body);
+                  break;
+                }
+                case CHECKSUM_REPLY:
+                {
+                  fprintf(stderr, "[ Checksum Result ] : [ %s ]", reply.body);
+                  break;
+                }
                 case LIST_DIR_REPLY:
                 {
                   fprintf(stderr, "[ List Dir Result ] : [ %s ]", reply.body);
@@ -162,27 +204,21 @@ void Loop(int socket)
                     char *arr_ptr = &payload[0];
                     int payload_length = strlen(arr_ptr);
                     // fprintf(stderr, "file Content  %s\n", arr_ptr);
-                    if (payload_length <= MAX_BUFFER)
-                    {
-                      char *reply = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
-                      int mesg_length = MarshallMessage(reply, 0xC0DE, FILE_REPLY, arr_ptr);
-                      if (send(socket, reply, payload_length + PROTOCOL_HEADER_LEN, 0) == -1)
-                        perror("write failed: ");
-                      fprintf(stderr, "[DEBUG] Download Handler Server : Replying back .... \n");
-                    }
-                    else
-                    {
-                      while (payload_length > 0)
-                      {
-                        char *reply = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
-                        int mesg_length = MarshallMessage(reply, 0xC0DE, FILE_REPLY, arr_ptr);
-                        int sent = send(socket, reply, payload_length + PROTOCOL_HEADER_LEN, 0);
-                        if (sent == -1)
-                          perror("write failed: ");
-                        fprintf(stderr, "[DEBUG] Download Handler Server : Replying back .... \n");
-                        payload_length = payload_length - sent;
-                      }
-                    }
+                    // the file is compressed when the server accepts it
+                    char *reply = malloc(MarshalledSizeBound(payload_length));
+                    size_t mesg_length = MarshallBinaryMessage(
+                        (unsigned char *)reply, 0xC0DE, FILE_REPLY, arr_ptr,
+                        payload_length, SessionCapabilities(socket) & CAP_COMPRESSION);
+                    if (TransportSend(socket, reply, mesg_length) == -1)
+                      perror("write failed: ");
+                    free(reply);
+                    fprintf(stderr, "[DEBUG] Download Handler Server : Replying back .... \n");
+                  }
+                  else if (sync_upload_initiated)
+                  {
+                    // the reply carries the signature of the server's copy
+                    SyncUploadProtocolHandleServerReply(socket, sync_path, reply);
+                    sync_upload_initiated = 0;
                   }
                   upload_initiated = 0;
                   break;
@@ -227,18 +263,16 @@ void Loop(int socket)
                 break;
               }
             }
-            if (bcmp(choice, "1", 1) && bcmp(choice, "2", 1) &&
-                bcmp(choice, "3", 1) && bcmp(choice, "4", 1) &&
-                bcmp(choice, "5", 1) && bcmp(choice, "6", 1))
+            if (choice[0] < '0' || choice[0] > '9')
             {
-              printf("Please enter a valid number from 1 to 6\n");
+              printf("Please enter a valid number from 0 to 9\n");
               continue;
             }
             system("clear");
 
             waiting_for_choice = 0;
             // Quit-----------------------------------------------------------------------------------------
-            if (!bcmp(choice, "6", 1))
+            if (!bcmp(choice, "0", 1))
             {
               printf("Your choice is to Quit the program\n");
               leave_request(socket);
@@ -270,7 +304,7 @@ void Loop(int socket)
               Message message;
               message.body = (char *)(request + PROTOCOL_HEADER_LEN);
               printf("value cli [%s]\n", arr_ptr);
-              if (send(socket, request, strlen(arr_ptr) + PROTOCOL_HEADER_LEN, 0) == -1)
+              if (TransportSend(socket, request, strlen(arr_ptr) + PROTOCOL_HEADER_LEN) == -1)
                 perror("write failed: ");
               fprintf(
                   stderr,
@@ -296,6 +330,35 @@ void Loop(int socket)
               printf("Your choice is List Directory Protocol\n");
               ListDirectoryProtocolSendRequestToServer(socket);
             }
+            // Checksum-----------------------------------------------------------------------------------------
+            if (!bcmp(choice, "6", 1))
+            {
+              printf("Your choice is Checksum Protocol\n");
+              ChecksumProtocolSendRequestToServer(socket);
+            }
+            // Sync
+            // Download-----------------------------------------------------------------------------------------
+            if (!bcmp(choice, "7", 1))
+            {
+              printf("Your choice is Sync Download Protocol\n");
+              SyncDownloadProtocolSendRequestToServer(socket, sync_path);
+            }
+            // Sync
+            // Upload-----------------------------------------------------------------------------------------
+            if (!bcmp(choice, "8", 1))
+            {
+              printf("Your choice is Sync Upload Protocol\n");
+              SyncUploadProtocolSendRequestToServer(socket, sync_path);
+              sync_upload_initiated = 1;
+            }
+            // Batch
+            // Download-----------------------------------------------------------------------------------------
+            if (!bcmp(choice, "9", 1))
+            {
+              printf("Your choice is Batch Download Protocol\n");
+              BatchDownloadProtocolSendRequestToServer(socket);
+              show_menu = 1;
+            }
           }
         }
         continue;
@@ -319,6 +382,18 @@ void establish_connection_with_server(struct sockaddr_in *serverAddr,
   }
 }
 
+void establish_unix_connection_with_server(struct sockaddr_un *serverAddr,
+                                           const char *path,
+                                           int connection_socket)
+{
+  socklen_t len = FillUnixAddress(serverAddr, path);
+  if (connect(connection_socket, (struct sockaddr *)serverAddr, len) < 0)
+  {
+    perror("Couldn't connect to server");
+    exit(1);
+  }
+}
+
 void set_non_blocking(int file_descriptor)
 {
   int flags = fcntl(file_descriptor, F_GETFL);
@@ -328,6 +403,45 @@ void set_non_blocking(int file_descriptor)
   fcntl(file_descriptor, F_SETFL, flags);
 }
 
+// Offers the server every capability of this build and waits a moment for
+// its answer , so the main loop starts with the capabilities in place. a
+// late reply is still picked up by the main loop
+void hello_request(int socket)
+{
+  char body[16];
+  unsigned char request[PROTOCOL_HEADER_LEN + sizeof(body)];
+  snprintf(body, sizeof(body), "%u", SUPPORTED_CAPABILITIES);
+  int mesg_length = MarshallMessage(request, 0xC0DE, HELLO_REQUEST, body);
+  if (TransportSend(socket, request, mesg_length) == -1)
+  {
+    perror("write failed: ");
+    return;
+  }
+  int wait_fd = TransportWaitFd(socket);
+  if (wait_fd != -1)
+  {
+    fd_set fds;
+    struct timeval timeout = {HELLO_TIMEOUT_SEC, 0};
+    FD_ZERO(&fds);
+    FD_SET(wait_fd, &fds);
+    if (select(wait_fd + 1, &fds, NULL, NULL, &timeout) <= 0)
+      return;
+  }
+  unsigned char header[PROTOCOL_HEADER_LEN];
+  if (TransportRecv(socket, header, PROTOCOL_HEADER_LEN) != PROTOCOL_HEADER_LEN ||
+      ExtractMessageMagic(header) != 0xC0DE ||
+      ExtractMessageProtocol(header) != HELLO_REPLY ||
+      ExtractMessageBodySize(header) >= (int)sizeof(body))
+  {
+    fprintf(stderr, "unexpected reply to the capability handshake\n");
+    return;
+  }
+  uint32_t size = ExtractMessageBodySize(header);
+  memset(body, 0, sizeof(body));
+  if (TransportRecv(socket, body, size) == (int)size)
+    SessionSetCapabilities(socket, strtoul(body, NULL, 0));
+}
+
 void leave_request(int socket)
 {
   if (write(socket, "/exit\n", MAX_BUFFER - 1) == -1)
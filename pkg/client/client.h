@@ -15,6 +15,7 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 // main connection loop for client
 void Loop(int connection_socket);
@@ -22,9 +23,20 @@ void Loop(int connection_socket);
 void establish_connection_with_server(struct sockaddr_in *serverAddr,
                                       struct hostent *host,
                                       int connection_socket, long port);
+// Connects to a server listening on a unix domain socket. a leading '@'
+// in path selects the abstract namespace
+void establish_unix_connection_with_server(struct sockaddr_un *serverAddr,
+                                           const char *path,
+                                           int connection_socket);
 // Sets the file descriptor to nonblocking mode
 void set_non_blocking(int file_descriptor);
 
+// seconds to wait for the server to answer the capability handshake
+#define HELLO_TIMEOUT_SEC 1
+
+// Negotiates the capabilities of the connection with the server
+void hello_request(int socket);
+
 // Notify the server when the client exits by sending "/exit"
 void leave_request(int socket);
 
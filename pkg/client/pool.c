@@ -0,0 +1,347 @@
+// clock_gettime , getaddrinfo
+#define _GNU_SOURCE
+#include "pool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum { POOL_DOWN, POOL_CONNECTING, POOL_UP } PoolState;
+
+typedef struct PoolEndpoint PoolEndpoint;
+
+// PoolConnection - one connection of an endpoint
+typedef struct {
+  PoolEndpoint *endpoint;
+  PoolState state;
+  // socket of a connect in progress
+  int fd;
+  AsyncClient *client;
+  // replies sent for but not complete yet
+  int outstanding;
+  // when the connect started , or the last reply completed
+  long long since;
+  int healthPending;
+  long long healthSentAt;
+  // a send found the connection closed , PoolPoll ejects the endpoint
+  int broken;
+} PoolConnection;
+
+struct PoolEndpoint {
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+  int backoffMs;
+  // when the ejected endpoint is reconnected
+  long long retryAt;
+  PoolConnection *connections;
+};
+
+struct ConnectionPool {
+  PoolEndpoint *endpoints;
+  int numEndpoints;
+  int connectionsPerEndpoint;
+  // where the search for the least loaded connection starts , so ties are
+  // spread round robin
+  int next;
+  // set while the pool ejects an endpoint , callbacks can't pick it
+  int ejecting;
+};
+
+// PoolCall - wraps the callback of a request to keep count of the replies
+// outstanding on its connection
+typedef struct {
+  PoolConnection *connection;
+  AsyncCallback cb;
+  void *arg;
+} PoolCall;
+
+static long long Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// ResolveEndpoint - fills the address of "host:port" or "unix:path"
+static int ResolveEndpoint(PoolEndpoint *endpoint, const char *name) {
+  if (strncmp(name, "unix:", 5) == 0) {
+    endpoint->addrLen = FillUnixAddress(
+        (struct sockaddr_un *)&endpoint->addr, name + 5);
+    return 0;
+  }
+  char host[MAX_BUFFER];
+  const char *colon = strrchr(name, ':');
+  if (colon == NULL || (size_t)(colon - name) >= sizeof(host))
+    return -1;
+  // [::1]:8080
+  const char *start = name[0] == '[' ? name + 1 : name;
+  size_t length = colon - start - (colon[-1] == ']' ? 1 : 0);
+  memcpy(host, start, length);
+  host[length] = '\0';
+  struct addrinfo hints, *addrs;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, colon + 1, &hints, &addrs) != 0)
+    return -1;
+  memcpy(&endpoint->addr, addrs->ai_addr, addrs->ai_addrlen);
+  endpoint->addrLen = addrs->ai_addrlen;
+  freeaddrinfo(addrs);
+  return 0;
+}
+
+// StartConnect - starts a non blocking connect , PoolPoll finishes it
+static void StartConnect(PoolConnection *connection) {
+  PoolEndpoint *endpoint = connection->endpoint;
+  int fd = socket(endpoint->addr.ss_family, SOCK_STREAM, 0);
+  connection->since = Now();
+  connection->state = POOL_DOWN;
+  if (fd == -1)
+    return;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  if (connect(fd, (struct sockaddr *)&endpoint->addr, endpoint->addrLen) ==
+          -1 &&
+      errno != EINPROGRESS) {
+    close(fd);
+    return;
+  }
+  connection->fd = fd;
+  connection->state = POOL_CONNECTING;
+}
+
+// Eject - closes every connection of an endpoint and schedules their
+// reconnect
+static void Eject(ConnectionPool *pool, PoolEndpoint *endpoint) {
+  long long now = Now();
+  pool->ejecting = 1;
+  for (int i = 0; i < pool->connectionsPerEndpoint; i++) {
+    PoolConnection *connection = &endpoint->connections[i];
+    PoolState state = connection->state;
+    connection->state = POOL_DOWN;
+    connection->healthPending = 0;
+    connection->broken = 0;
+    if (state == POOL_CONNECTING)
+      close(connection->fd);
+    if (state == POOL_UP) {
+      // fails the replies still missing , their callbacks run now
+      AsyncClose(connection->client);
+      connection->client = NULL;
+    }
+  }
+  pool->ejecting = 0;
+  endpoint->retryAt = now + endpoint->backoffMs;
+  endpoint->backoffMs *= 2;
+  if (endpoint->backoffMs > POOL_MAX_BACKOFF_MS)
+    endpoint->backoffMs = POOL_MAX_BACKOFF_MS;
+}
+
+// FinishConnect - hands a connected socket to the Async library
+static int FinishConnect(PoolConnection *connection) {
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length) ==
+          -1 ||
+      error != 0) {
+    return -1;
+  }
+  connection->client = AsyncAttach(connection->fd);
+  connection->state = POOL_UP;
+  connection->since = Now();
+  connection->endpoint->backoffMs = POOL_MIN_BACKOFF_MS;
+  return 0;
+}
+
+static void CompleteCall(AsyncClient *client, AsyncReply *reply, void *arg) {
+  PoolCall *call = arg;
+  call->connection->outstanding--;
+  call->connection->since = Now();
+  if (call->cb != NULL)
+    call->cb(client, reply, call->arg);
+  free(call);
+}
+
+static void CompleteHealthCheck(AsyncClient *client, AsyncReply *reply,
+                                void *arg) {
+  PoolConnection *connection = arg;
+  if (reply->status == 0 && connection->client == client)
+    connection->healthPending = 0;
+}
+
+ConnectionPool *PoolCreate(const char *const *endpoints, int numEndpoints,
+                           int connectionsPerEndpoint) {
+  ConnectionPool *pool = calloc(1, sizeof(ConnectionPool));
+  if (pool == NULL || (pool->endpoints = calloc(
+                           numEndpoints, sizeof(PoolEndpoint))) == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  pool->numEndpoints = numEndpoints;
+  pool->connectionsPerEndpoint = connectionsPerEndpoint;
+  for (int i = 0; i < numEndpoints; i++) {
+    PoolEndpoint *endpoint = &pool->endpoints[i];
+    endpoint->backoffMs = POOL_MIN_BACKOFF_MS;
+    endpoint->connections =
+        calloc(connectionsPerEndpoint, sizeof(PoolConnection));
+    if (endpoint->connections == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    for (int j = 0; j < connectionsPerEndpoint; j++)
+      endpoint->connections[j].endpoint = endpoint;
+    if (ResolveEndpoint(endpoint, endpoints[i]) == -1) {
+      fprintf(stderr, "Couldn't resolve %s\n", endpoints[i]);
+      pool->numEndpoints = i + 1;
+      PoolDestroy(pool);
+      return NULL;
+    }
+    for (int j = 0; j < connectionsPerEndpoint; j++)
+      StartConnect(&endpoint->connections[j]);
+  }
+  // the pool is handed out warm
+  long long deadline = Now() + POOL_CONNECT_TIMEOUT_MS;
+  int total = numEndpoints * connectionsPerEndpoint;
+  while (PoolAvailable(pool) < total && Now() < deadline)
+    PoolPoll(pool, deadline - Now());
+  return pool;
+}
+
+int PoolSend(ConnectionPool *pool, uint16_t protocol, const void *body,
+             size_t length, AsyncCallback cb, void *arg) {
+  int total = pool->numEndpoints * pool->connectionsPerEndpoint;
+  if (pool->ejecting || total == 0)
+    return -1;
+  pool->next = (pool->next + 1) % total;
+  while (1) {
+    PoolConnection *best = NULL;
+    for (int i = 0; i < total; i++) {
+      int index = (pool->next + i) % total;
+      PoolConnection *connection =
+          &pool->endpoints[index / pool->connectionsPerEndpoint]
+               .connections[index % pool->connectionsPerEndpoint];
+      if (connection->state != POOL_UP || connection->broken)
+        continue;
+      if (best == NULL || connection->outstanding < best->outstanding)
+        best = connection;
+    }
+    if (best == NULL)
+      return -1;
+    PoolCall *call = malloc(sizeof(PoolCall));
+    if (call == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    call->connection = best;
+    call->cb = cb;
+    call->arg = arg;
+    if (AsyncSend(best->client, protocol, body, length, CompleteCall, call) !=
+        0) {
+      best->outstanding++;
+      return 0;
+    }
+    // closed under us , try the next best one
+    free(call);
+    best->broken = 1;
+  }
+}
+
+int PoolPoll(ConnectionPool *pool, int timeoutMs) {
+  int total = pool->numEndpoints * pool->connectionsPerEndpoint;
+  struct pollfd *fds = calloc(total > 0 ? total : 1, sizeof(struct pollfd));
+  long long now = Now();
+  int completed = 0;
+  if (fds == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  // wake up for the next reconnect or health check
+  long long wake = now + POOL_HEALTH_INTERVAL_MS;
+  for (int i = 0; i < total; i++) {
+    PoolEndpoint *endpoint = &pool->endpoints[i / pool->connectionsPerEndpoint];
+    PoolConnection *connection =
+        &endpoint->connections[i % pool->connectionsPerEndpoint];
+    fds[i].fd = -1;
+    if (connection->state == POOL_DOWN && endpoint->retryAt < wake)
+      wake = endpoint->retryAt;
+    if (connection->state == POOL_CONNECTING) {
+      fds[i].fd = connection->fd;
+      fds[i].events = POLLOUT;
+    }
+    if (connection->state == POOL_UP) {
+      fds[i].fd = AsyncFd(connection->client);
+      fds[i].events = POLLIN | (AsyncPending(connection->client) ? POLLOUT : 0);
+    }
+  }
+  int wait = wake > now ? (int)(wake - now) : 0;
+  if (timeoutMs >= 0 && timeoutMs < wait)
+    wait = timeoutMs;
+  poll(fds, total, wait);
+
+  now = Now();
+  for (int i = 0; i < total; i++) {
+    PoolEndpoint *endpoint = &pool->endpoints[i / pool->connectionsPerEndpoint];
+    PoolConnection *connection =
+        &endpoint->connections[i % pool->connectionsPerEndpoint];
+    switch (connection->state) {
+    case POOL_DOWN:
+      if (now < endpoint->retryAt)
+        break;
+      StartConnect(connection);
+      if (connection->state == POOL_DOWN)
+        Eject(pool, endpoint);
+      break;
+    case POOL_CONNECTING:
+      if (fds[i].revents != 0 && FinishConnect(connection) == 0)
+        break;
+      if (fds[i].revents != 0 ||
+          now - connection->since > POOL_CONNECT_TIMEOUT_MS) {
+        fprintf(stderr, "[DEBUG] pool : connect failed , ejecting endpoint\n");
+        Eject(pool, endpoint);
+      }
+      break;
+    case POOL_UP: {
+      int result = fds[i].revents != 0 ? AsyncPoll(connection->client, 0) : 0;
+      if (result == -1 || connection->broken ||
+          (connection->healthPending &&
+           now - connection->healthSentAt > POOL_HEALTH_TIMEOUT_MS)) {
+        fprintf(stderr, "[DEBUG] pool : connection failed , ejecting "
+                        "endpoint\n");
+        Eject(pool, endpoint);
+        break;
+      }
+      completed += result;
+      // only connections without replies lately are asked how they do
+      if (!connection->healthPending &&
+          now - connection->since >= POOL_HEALTH_INTERVAL_MS) {
+        connection->healthPending = 1;
+        connection->healthSentAt = now;
+        connection->since = now;
+        AsyncSend(connection->client, ECHO_REQUEST, "ping", 4,
+                  CompleteHealthCheck, connection);
+      }
+      break;
+    }
+    }
+  }
+  free(fds);
+  return completed;
+}
+
+int PoolAvailable(const ConnectionPool *pool) {
+  int available = 0;
+  for (int i = 0; i < pool->numEndpoints; i++)
+    for (int j = 0; j < pool->connectionsPerEndpoint; j++)
+      available += pool->endpoints[i].connections[j].state == POOL_UP;
+  return available;
+}
+
+void PoolDestroy(ConnectionPool *pool) {
+  for (int i = 0; i < pool->numEndpoints; i++) {
+    Eject(pool, &pool->endpoints[i]);
+    free(pool->endpoints[i].connections);
+  }
+  free(pool->endpoints);
+  free(pool);
+}
@@ -0,0 +1,43 @@
+#ifndef POOL
+#define POOL
+#include "async.h"
+// Pool - keeps warm Async connections to several servers and spreads
+// requests over them. every request goes to the healthy connection with the
+// fewest replies outstanding. connections are health checked with an echo ,
+// an endpoint whose connection fails or stops answering is ejected : its
+// connections are closed and reconnected in the background , without
+// blocking requests to the other endpoints , with a growing backoff.
+// everything happens from PoolPoll , a pool is not thread safe.
+
+typedef struct ConnectionPool ConnectionPool;
+
+// PoolCreate - connects connectionsPerEndpoint times to every endpoint ,
+// written "host:port" or "unix:path" , and waits up to
+// POOL_CONNECT_TIMEOUT_MS for them. returns NULL when an endpoint can't be
+// resolved
+ConnectionPool *PoolCreate(const char *const *endpoints, int numEndpoints,
+                           int connectionsPerEndpoint);
+// PoolSend - sends a request on the least loaded healthy connection , cb runs
+// from PoolPoll with its reply. returns -1 when no connection is healthy
+int PoolSend(ConnectionPool *pool, uint16_t protocol, const void *body,
+             size_t length, AsyncCallback cb, void *arg);
+// PoolPoll - waits up to timeoutMs (-1 until something happens) for the
+// connections , completes replies , runs health checks and reconnects.
+// returns the number of replies completed
+int PoolPoll(ConnectionPool *pool, int timeoutMs);
+// PoolAvailable - number of healthy connections
+int PoolAvailable(const ConnectionPool *pool);
+// PoolDestroy - closes every connection , missing replies complete with
+// status -1
+void PoolDestroy(ConnectionPool *pool);
+
+// a health check is sent on every idle connection this often
+#define POOL_HEALTH_INTERVAL_MS 1000
+// a connection that doesn't answer its health check in time is failed
+#define POOL_HEALTH_TIMEOUT_MS 2000
+// a connect that takes longer is failed
+#define POOL_CONNECT_TIMEOUT_MS 1000
+// delay before reconnecting an ejected endpoint , doubled on every failure
+#define POOL_MIN_BACKOFF_MS 100
+#define POOL_MAX_BACKOFF_MS 5000
+#endif
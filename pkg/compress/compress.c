@@ -0,0 +1,167 @@
+#include "compress.h"
+#include <string.h>
+
+// matches are at least this long
+#define MIN_MATCH 4
+// the block always ends with this many literals
+#define LAST_LITERALS 5
+// no match may start within this many bytes of the end
+#define MATCH_FIND_LIMIT 12
+// log2 of the number of hash table slots
+#define HASH_LOG 12
+#define MAX_OFFSET 65535
+
+static uint32_t Read32(const unsigned char *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static uint32_t HashSequence(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// WriteLength - writes the part of a length that did not fit in its token
+// nibble as a run of 255s and a final byte
+static unsigned char *WriteLength(unsigned char *op, size_t length) {
+  while (length >= 255) {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = (unsigned char)length;
+  return op;
+}
+
+// WriteSequence - emits literals followed by a match of matchLength bytes
+// at offset , or just the literals when offset is 0. returns NULL when dest
+// has no room left
+static unsigned char *WriteSequence(unsigned char *op, unsigned char *opEnd,
+                                    const unsigned char *literals,
+                                    size_t literalLength, size_t offset,
+                                    size_t matchLength) {
+  if ((size_t)(opEnd - op) <
+      1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1)
+    return NULL;
+  unsigned char *token = op++;
+  *token = (unsigned char)((literalLength < 15 ? literalLength : 15) << 4);
+  if (literalLength >= 15)
+    op = WriteLength(op, literalLength - 15);
+  memcpy(op, literals, literalLength);
+  op += literalLength;
+  if (offset == 0)
+    return op;
+  *op++ = (unsigned char)(offset & 0xFF);
+  *op++ = (unsigned char)(offset >> 8);
+  matchLength -= MIN_MATCH;
+  *token |= (unsigned char)(matchLength < 15 ? matchLength : 15);
+  if (matchLength >= 15)
+    op = WriteLength(op, matchLength - 15);
+  return op;
+}
+
+size_t CompressBound(size_t length) { return length + length / 255 + 16; }
+
+size_t Compress(unsigned char *dest, size_t capacity, const void *src,
+                size_t length) {
+  uint32_t table[1 << HASH_LOG];
+  const unsigned char *base = (const unsigned char *)src;
+  const unsigned char *ip = base;
+  const unsigned char *anchor = base;
+  const unsigned char *end = base + length;
+  unsigned char *op = dest;
+  unsigned char *opEnd = dest + capacity;
+
+  memset(table, 0, sizeof(table));
+  if (length > MATCH_FIND_LIMIT) {
+    const unsigned char *matchLimit = end - LAST_LITERALS;
+    const unsigned char *findLimit = end - MATCH_FIND_LIMIT;
+    while (ip < findLimit) {
+      uint32_t sequence = Read32(ip);
+      uint32_t hash = HashSequence(sequence);
+      const unsigned char *ref = base + table[hash];
+      table[hash] = (uint32_t)(ip - base);
+      if (ref >= ip || ip - ref > MAX_OFFSET || Read32(ref) != sequence) {
+        // skip faster through data that does not compress
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+      while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      const unsigned char *matchEnd = ip + MIN_MATCH;
+      const unsigned char *refEnd = ref + MIN_MATCH;
+      while (matchEnd < matchLimit && *matchEnd == *refEnd) {
+        matchEnd++;
+        refEnd++;
+      }
+      op = WriteSequence(op, opEnd, anchor, ip - anchor, ip - ref,
+                         matchEnd - ip);
+      if (op == NULL)
+        return 0;
+      ip = anchor = matchEnd;
+    }
+  }
+  op = WriteSequence(op, opEnd, anchor, end - anchor, 0, 0);
+  return op == NULL ? 0 : (size_t)(op - dest);
+}
+
+long Decompress(unsigned char *dest, size_t capacity, const void *src,
+                size_t length) {
+  const unsigned char *ip = (const unsigned char *)src;
+  const unsigned char *ipEnd = ip + length;
+  unsigned char *op = dest;
+  unsigned char *opEnd = dest + capacity;
+
+  while (ip < ipEnd) {
+    unsigned char token = *ip++;
+    size_t literalLength = token >> 4;
+    if (literalLength == 15) {
+      unsigned char byte;
+      do {
+        if (ip >= ipEnd)
+          return -1;
+        byte = *ip++;
+        literalLength += byte;
+      } while (byte == 255);
+    }
+    if (literalLength > (size_t)(ipEnd - ip) ||
+        literalLength > (size_t)(opEnd - op))
+      return -1;
+    memcpy(op, ip, literalLength);
+    op += literalLength;
+    ip += literalLength;
+    // the last sequence has no match
+    if (ip == ipEnd)
+      break;
+    if (ipEnd - ip < 2)
+      return -1;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dest))
+      return -1;
+    size_t matchLength = token & 15;
+    if (matchLength == 15) {
+      unsigned char byte;
+      do {
+        if (ip >= ipEnd)
+          return -1;
+        byte = *ip++;
+        matchLength += byte;
+      } while (byte == 255);
+    }
+    matchLength += MIN_MATCH;
+    if (matchLength > (size_t)(opEnd - op))
+      return -1;
+    const unsigned char *match = op - offset;
+    if (offset >= matchLength) {
+      memcpy(op, match, matchLength);
+      op += matchLength;
+    } else {
+      // overlapping match repeats the last offset bytes
+      while (matchLength-- > 0)
+        *op++ = *match++;
+    }
+  }
+  return (long)(op - dest);
+}
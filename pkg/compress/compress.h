@@ -0,0 +1,20 @@
+#ifndef COMPRESS
+#define COMPRESS
+#include <stddef.h>
+#include <stdint.h>
+// Compress - built in LZ77 codec producing the LZ4 block format , so any
+// LZ4 implementation can decode what it produces. it favours speed over
+// ratio: one hash probe per position and no entropy coding.
+
+// CompressBound - largest output Compress can produce for length bytes
+size_t CompressBound(size_t length);
+// Compress - compresses length bytes of src into dest , which holds
+// capacity bytes. returns the compressed size or 0 if it did not fit
+size_t Compress(unsigned char *dest, size_t capacity, const void *src,
+                size_t length);
+// Decompress - decodes the block of length bytes in src into dest , which
+// must hold exactly the original size. returns the decoded size or -1 when
+// the block is malformed
+long Decompress(unsigned char *dest, size_t capacity, const void *src,
+                size_t length);
+#endif
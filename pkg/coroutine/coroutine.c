@@ -0,0 +1,293 @@
+// MAP_ANONYMOUS , MAP_STACK , clock_gettime
+#define _GNU_SOURCE
+#include "coroutine.h"
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+typedef struct Coroutine {
+#if defined(__x86_64__)
+  // stack pointer saved while it is switched out
+  void *sp;
+#else
+  ucontext_t context;
+#endif
+  // mapping of its stack , the guard page first
+  unsigned char *stack;
+  CoroutineFunc fn;
+  void *arg;
+  int done;
+  // descriptor it waits on and when it is resumed anyway
+  int fd;
+  uint64_t deadline;
+  // waiting list of the thread , or its pool through next
+  struct Coroutine *prev, *next;
+} Coroutine;
+
+// Scheduler - the coroutines of one thread , and the context of the thread
+// itself while one of them runs
+typedef struct {
+#if defined(__x86_64__)
+  void *sp;
+#else
+  ucontext_t context;
+#endif
+  Coroutine *current;
+  Coroutine *pool;
+  // waiting coroutines oldest first , which is also their deadline order
+  Coroutine *head, *tail;
+  int running, waiting;
+  int epollFd, wakeFd;
+} Scheduler;
+
+static size_t stackSize = DEFAULT_COROUTINE_STACK_SIZE;
+static int maxCoroutines = DEFAULT_COROUTINES;
+static __thread Scheduler scheduler = {.epollFd = -1, .wakeFd = -1};
+
+#if defined(__x86_64__)
+// CoroutineSwitch - pushes the callee saved registers , stores the stack
+// pointer in *from and pops the registers saved on the stack at to ,
+// returning where that context was switched out
+void CoroutineSwitch(void **from, void *to);
+__asm__(".text\n"
+        ".globl CoroutineSwitch\n"
+        ".hidden CoroutineSwitch\n"
+        ".type CoroutineSwitch, @function\n"
+        "CoroutineSwitch:\n"
+        "  pushq %rbp\n"
+        "  pushq %rbx\n"
+        "  pushq %r12\n"
+        "  pushq %r13\n"
+        "  pushq %r14\n"
+        "  pushq %r15\n"
+        "  movq %rsp, (%rdi)\n"
+        "  movq %rsi, %rsp\n"
+        "  popq %r15\n"
+        "  popq %r14\n"
+        "  popq %r13\n"
+        "  popq %r12\n"
+        "  popq %rbx\n"
+        "  popq %rbp\n"
+        "  ret\n"
+        ".size CoroutineSwitch, .-CoroutineSwitch\n");
+#endif
+
+static void SwitchIn(Coroutine *co) {
+#if defined(__x86_64__)
+  CoroutineSwitch(&scheduler.sp, co->sp);
+#else
+  swapcontext(&scheduler.context, &co->context);
+#endif
+}
+
+static void SwitchOut(Coroutine *co) {
+#if defined(__x86_64__)
+  CoroutineSwitch(&co->sp, scheduler.sp);
+#else
+  swapcontext(&co->context, &scheduler.context);
+#endif
+}
+
+// CoroutineEntry - first function of every coroutine , it switches out
+// for good once its body returned
+static void CoroutineEntry(void) {
+  Coroutine *co = scheduler.current;
+  co->fn(co->arg);
+  co->done = 1;
+  SwitchOut(co);
+}
+
+static size_t PageSize(void) { return sysconf(_SC_PAGESIZE); }
+
+// PrepareStack - makes the first switch to co enter CoroutineEntry
+static void PrepareStack(Coroutine *co) {
+#if defined(__x86_64__)
+  // registers popped by CoroutineSwitch , then its return address , then
+  // the one CoroutineEntry would return to , 16 byte aligned like a call
+  void **sp = (void **)(((uintptr_t)co->stack + PageSize() + stackSize) &
+                        ~(uintptr_t)15);
+  *--sp = NULL;
+  *--sp = (void *)CoroutineEntry;
+  for (int i = 0; i < 6; i++)
+    *--sp = NULL;
+  co->sp = sp;
+#else
+  getcontext(&co->context);
+  co->context.uc_stack.ss_sp = co->stack + PageSize();
+  co->context.uc_stack.ss_size = stackSize;
+  co->context.uc_link = NULL;
+  makecontext(&co->context, CoroutineEntry, 0);
+#endif
+}
+
+// TakeCoroutine - a coroutine from the pool of the thread , or a new one.
+// returns NULL when its stack can't be mapped
+static Coroutine *TakeCoroutine(void) {
+  Coroutine *co = scheduler.pool;
+  if (co != NULL) {
+    scheduler.pool = co->next;
+    return co;
+  }
+  co = calloc(1, sizeof(Coroutine));
+  if (co == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  co->stack = mmap(NULL, PageSize() + stackSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (co->stack == MAP_FAILED) {
+    perror("coroutine stack failed: ");
+    free(co);
+    return NULL;
+  }
+  // an overflow faults on the guard page instead of corrupting memory
+  mprotect(co->stack, PageSize(), PROT_NONE);
+  return co;
+}
+
+// Resume - runs co until it ends or waits , an ended one goes back to the
+// pool with its stack
+static void Resume(Coroutine *co) {
+  scheduler.current = co;
+  SwitchIn(co);
+  scheduler.current = NULL;
+  if (co->done) {
+    co->next = scheduler.pool;
+    scheduler.pool = co;
+    scheduler.running--;
+  }
+}
+
+static uint64_t NowMs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int Epoll(void) {
+  if (scheduler.epollFd == -1)
+    scheduler.epollFd = epoll_create1(EPOLL_CLOEXEC);
+  return scheduler.epollFd;
+}
+
+// Wake - takes a waiting coroutine off the list and resumes it
+static void Wake(Coroutine *co) {
+  if (co->prev != NULL)
+    co->prev->next = co->next;
+  else
+    scheduler.head = co->next;
+  if (co->next != NULL)
+    co->next->prev = co->prev;
+  else
+    scheduler.tail = co->prev;
+  scheduler.waiting--;
+  // fails once the descriptor was closed , epoll forgot it already
+  epoll_ctl(scheduler.epollFd, EPOLL_CTL_DEL, co->fd, NULL);
+  Resume(co);
+}
+
+void CoroutineInit(size_t size, int coroutines) {
+  size_t page = PageSize();
+  stackSize = (size + page - 1) / page * page;
+  maxCoroutines = coroutines;
+}
+
+int CoroutineStart(CoroutineFunc fn, void *arg) {
+  if (scheduler.current != NULL || maxCoroutines <= 0 || CoroutineFull())
+    return -1;
+  Coroutine *co = TakeCoroutine();
+  if (co == NULL)
+    return -1;
+  co->fn = fn;
+  co->arg = arg;
+  co->done = 0;
+  PrepareStack(co);
+  scheduler.running++;
+  Resume(co);
+  return 0;
+}
+
+int CoroutineWaitFd(int fd, short events) {
+  Coroutine *co = scheduler.current;
+  if (co == NULL || Epoll() == -1)
+    return -1;
+  struct epoll_event event;
+  event.events = EPOLLONESHOT | (events & POLLIN ? EPOLLIN : 0) |
+                 (events & POLLOUT ? EPOLLOUT : 0);
+  event.data.ptr = co;
+  if (epoll_ctl(scheduler.epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+    return -1;
+  co->fd = fd;
+  co->deadline = NowMs() + COROUTINE_RECHECK_MS;
+  co->next = NULL;
+  co->prev = scheduler.tail;
+  if (scheduler.tail != NULL)
+    scheduler.tail->next = co;
+  else
+    scheduler.head = co;
+  scheduler.tail = co;
+  scheduler.waiting++;
+  SwitchOut(co);
+  return 0;
+}
+
+int CoroutineActive(void) { return scheduler.current != NULL; }
+
+int CoroutineWaiting(void) { return scheduler.waiting; }
+
+int CoroutineFull(void) {
+  return maxCoroutines > 0 && scheduler.running >= maxCoroutines;
+}
+
+// Dispatch - resumes the coroutines whose descriptors epoll reports ready
+// within timeout milliseconds (-1 forever) , then the ones past their
+// deadline
+static void Dispatch(int timeout) {
+  struct epoll_event events[COROUTINE_EVENTS];
+  int n = epoll_wait(scheduler.epollFd, events, COROUTINE_EVENTS, timeout);
+  for (int i = 0; i < n; i++)
+    if (events[i].data.ptr != NULL)
+      Wake(events[i].data.ptr);
+  // coroutines that waited too long try again , their descriptor may be
+  // closed
+  uint64_t now = NowMs();
+  while (scheduler.head != NULL && scheduler.head->deadline <= now)
+    Wake(scheduler.head);
+}
+
+void CoroutineRun(int wakeFd) {
+  if (Epoll() == -1)
+    return;
+  if (wakeFd != scheduler.wakeFd) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (scheduler.wakeFd != -1)
+      epoll_ctl(scheduler.epollFd, EPOLL_CTL_DEL, scheduler.wakeFd, NULL);
+    if (wakeFd != -1 &&
+        epoll_ctl(scheduler.epollFd, EPOLL_CTL_ADD, wakeFd, &event) == -1)
+      wakeFd = -1;
+    scheduler.wakeFd = wakeFd;
+  }
+  int timeout = -1;
+  if (scheduler.head != NULL) {
+    uint64_t now = NowMs();
+    timeout = scheduler.head->deadline > now
+                  ? (int)(scheduler.head->deadline - now)
+                  : 0;
+  }
+  Dispatch(timeout);
+}
+
+void CoroutinePoll(void) {
+  if (scheduler.waiting > 0 && Epoll() != -1)
+    Dispatch(0);
+}
@@ -0,0 +1,57 @@
+#ifndef COROUTINE
+#define COROUTINE
+#include <stddef.h>
+// Coroutine - functions written in blocking style that run on their own
+// small stack and suspend where they would block , so one thread keeps
+// many of them in progress. a thread starts coroutines with
+// CoroutineStart , they run until they end or wait for a descriptor in
+// CoroutineWaitFd , and the thread resumes the waiting ones from
+// CoroutineRun once epoll reports their descriptors ready. stacks are
+// mapped with a guard page below them and kept in a pool of the thread
+// for the next coroutines. the switch only saves the callee saved
+// registers (hand written for x86-64 , ucontext elsewhere).
+
+// stack of every coroutine unless configured otherwise
+#define DEFAULT_COROUTINE_STACK_SIZE (64 * 1024)
+// smallest stack a coroutine may get , handlers keep buffers like the 16 KB
+// table of Compress on it
+#define MIN_COROUTINE_STACK_SIZE (32 * 1024)
+// coroutines a thread runs at once unless configured otherwise
+#define DEFAULT_COROUTINES 1024
+// a waiting coroutine is resumed after this long even when its descriptor
+// isn't ready , epoll silently forgets descriptors that get closed
+#define COROUTINE_RECHECK_MS 1000
+// epoll events handled per wait
+#define COROUTINE_EVENTS 64
+
+// CoroutineFunc - body of a coroutine
+typedef void (*CoroutineFunc)(void *arg);
+
+// CoroutineInit - sets the stack size of coroutines and how many a thread
+// runs at once , 0 coroutines disables them
+void CoroutineInit(size_t stackSize, int maxCoroutines);
+// CoroutineStart - runs fn(arg) on a new coroutine of the calling thread
+// until it ends or waits , arg only has to live until then. returns -1
+// without calling fn when the thread can't start one more , or already
+// runs on one
+int CoroutineStart(CoroutineFunc fn, void *arg);
+// CoroutineWaitFd - suspends the calling coroutine until fd is ready for
+// events (POLLIN , POLLOUT) or COROUTINE_RECHECK_MS passed , callers try
+// again either way. returns -1 right away when not called on a coroutine
+int CoroutineWaitFd(int fd, short events);
+// CoroutineActive - returns 1 when called on a coroutine
+int CoroutineActive(void);
+// CoroutineWaiting - coroutines of the calling thread waiting on their
+// descriptors
+int CoroutineWaiting(void);
+// CoroutineFull - returns 1 when the calling thread runs as many
+// coroutines as it may , never when they are disabled
+int CoroutineFull(void);
+// CoroutineRun - waits until descriptors of waiting coroutines are ready ,
+// or wakeFd is readable when it isn't -1 , and resumes those coroutines
+void CoroutineRun(int wakeFd);
+// CoroutinePoll - resumes the waiting coroutines whose descriptors are
+// ready or whose recheck is due without blocking , so a thread that always
+// has other work still gets back to them
+void CoroutinePoll(void);
+#endif
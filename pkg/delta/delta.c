@@ -0,0 +1,501 @@
+// pread , pwrite , O_CLOEXEC
+#define _GNU_SOURCE
+#include "delta.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// DeltaBuffer - growing output buffer. once it can't grow , or would grow
+// past limit , it is failed and ignores what is appended
+typedef struct {
+  unsigned char *data;
+  size_t length;
+  size_t capacity;
+  size_t limit;
+  int failed;
+} DeltaBuffer;
+
+static void Reserve(DeltaBuffer *buffer, size_t more) {
+  if (buffer->failed || buffer->length + more <= buffer->capacity)
+    return;
+  if (more > buffer->limit - buffer->length) {
+    buffer->failed = 1;
+    return;
+  }
+  size_t capacity = 2 * (buffer->length + more);
+  unsigned char *data = realloc(buffer->data, capacity);
+  if (data == NULL) {
+    buffer->failed = 1;
+    return;
+  }
+  buffer->data = data;
+  buffer->capacity = capacity;
+}
+
+static void Append(DeltaBuffer *buffer, const void *data, size_t length) {
+  Reserve(buffer, length);
+  if (buffer->failed)
+    return;
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
+
+static void AppendU32(DeltaBuffer *buffer, uint32_t value) {
+  value = htonl(value);
+  Append(buffer, &value, 4);
+}
+
+static void AppendU64(DeltaBuffer *buffer, uint64_t value) {
+  AppendU32(buffer, (uint32_t)(value >> 32));
+  AppendU32(buffer, (uint32_t)value);
+}
+
+// Finish - returns the data of buffer and stores its length , or frees it
+// and returns NULL when it failed
+static unsigned char *Finish(DeltaBuffer *buffer, size_t *length) {
+  if (buffer->failed) {
+    free(buffer->data);
+    return NULL;
+  }
+  *length = buffer->length;
+  return buffer->data;
+}
+
+static uint32_t ReadU32(const unsigned char *p) {
+  uint32_t value;
+  memcpy(&value, p, 4);
+  return ntohl(value);
+}
+
+static uint64_t ReadU64(const unsigned char *p) {
+  return ((uint64_t)ReadU32(p) << 32) | ReadU32(p + 4);
+}
+
+// ReadAt - returns length bytes at offset of file , pointing into it when
+// it is in memory or read to buffer otherwise. NULL on a short read , the
+// file changed under us
+static const unsigned char *ReadAt(const DeltaFile *file,
+                                   unsigned char *buffer, uint64_t offset,
+                                   size_t length) {
+  if (file->data != NULL)
+    return file->data + offset;
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = pread(file->fd, buffer + done, length - done, offset + done);
+    if (n <= 0)
+      return NULL;
+    done += n;
+  }
+  return buffer;
+}
+
+int DeltaOpenFile(DeltaFile *file, const char *path) {
+  struct stat st;
+  file->data = (const unsigned char *)"";
+  file->fd = -1;
+  file->size = 0;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return -1;
+  }
+  file->data = NULL;
+  file->fd = fd;
+  file->size = st.st_size;
+  return 0;
+}
+
+void DeltaCloseFile(DeltaFile *file) {
+  if (file->fd != -1)
+    close(file->fd);
+  file->fd = -1;
+}
+
+// WeakSum - rsync's rolling checksum of a block : the low half sums the
+// bytes and the high half weighs each byte by its distance to the end
+static uint32_t WeakSum(const unsigned char *data, size_t length,
+                        uint32_t *a, uint32_t *b) {
+  uint32_t s1 = 0;
+  uint32_t s2 = 0;
+  for (size_t i = 0; i < length; i++) {
+    s1 += data[i];
+    s2 += s1;
+  }
+  *a = s1 & 0xFFFF;
+  *b = s2 & 0xFFFF;
+  return *a | (*b << 16);
+}
+
+static void StrongSum(unsigned char *out, const unsigned char *data,
+                      size_t length) {
+  Blake2bState state;
+  Blake2bInit(&state, DELTA_STRONG_LEN);
+  Blake2bUpdate(&state, data, length);
+  Blake2bFinal(&state, out);
+}
+
+static size_t BlockSize(uint64_t size) {
+  size_t blockSize = DELTA_MIN_BLOCK;
+  while (blockSize < DELTA_MAX_BLOCK && (uint64_t)blockSize * blockSize < size)
+    blockSize *= 2;
+  while (blockSize < DELTA_BLOCK_LIMIT &&
+         (size + blockSize - 1) / blockSize > DELTA_MAX_BLOCKS)
+    blockSize *= 2;
+  return blockSize;
+}
+
+unsigned char *DeltaSignature(const DeltaFile *basis, size_t *signatureLen) {
+  DeltaBuffer out = {NULL, 0, 0, SIZE_MAX, 0};
+  uint64_t size = basis->size;
+  size_t blockSize = BlockSize(size);
+  uint64_t numBlocks = (size + blockSize - 1) / blockSize;
+  if (numBlocks > UINT32_MAX)
+    return NULL;
+  unsigned char *block = NULL;
+  if (basis->data == NULL && (block = malloc(blockSize)) == NULL)
+    return NULL;
+  Reserve(&out, DELTA_SIGNATURE_HEADER_LEN + numBlocks * DELTA_ENTRY_LEN);
+  AppendU32(&out, blockSize);
+  AppendU32(&out, numBlocks);
+  AppendU64(&out, size);
+  for (uint64_t i = 0; i < numBlocks && !out.failed; i++) {
+    uint64_t offset = i * blockSize;
+    size_t length = size - offset < blockSize ? size - offset : blockSize;
+    const unsigned char *data = ReadAt(basis, block, offset, length);
+    if (data == NULL) {
+      out.failed = 1;
+      break;
+    }
+    uint32_t a, b;
+    unsigned char strong[DELTA_STRONG_LEN];
+    AppendU32(&out, WeakSum(data, length, &a, &b));
+    StrongSum(strong, data, length);
+    Append(&out, strong, DELTA_STRONG_LEN);
+  }
+  free(block);
+  return Finish(&out, signatureLen);
+}
+
+// Window - the bytes of the file DeltaEncode still needs , from the start
+// of the pending literal to past the block being matched. a file in memory
+// is used in place
+typedef struct {
+  const DeltaFile *file;
+  unsigned char *buffer;
+  size_t capacity;
+  // file offset of the first byte held , and how many are
+  uint64_t start;
+  size_t length;
+  // digest of every byte read so far , in order
+  Blake2bState digest;
+} Window;
+
+// Slide - makes the window hold [from , to) , dropping what comes before
+// from and reading ahead as much as fits. returns -1 when the file can't
+// be read
+static int Slide(Window *window, uint64_t from, uint64_t to) {
+  const DeltaFile *file = window->file;
+  uint64_t end = window->start + window->length;
+  if (to <= end)
+    return 0;
+  if (file->data != NULL) {
+    Blake2bUpdate(&window->digest, file->data + end, to - end);
+    window->length = to;
+    return 0;
+  }
+  memmove(window->buffer, window->buffer + (from - window->start), end - from);
+  window->start = from;
+  window->length = end - from;
+  size_t more = window->capacity - window->length;
+  if (more > file->size - end)
+    more = file->size - end;
+  if (ReadAt(file, window->buffer + window->length, end, more) == NULL)
+    return -1;
+  Blake2bUpdate(&window->digest, window->buffer + window->length, more);
+  window->length += more;
+  return 0;
+}
+
+// At - the byte at offset of the file , which the window holds
+static const unsigned char *At(const Window *window, uint64_t offset) {
+  if (window->file->data != NULL)
+    return window->file->data + offset;
+  return window->buffer + (offset - window->start);
+}
+
+// Encoder - state of DeltaEncode
+typedef struct {
+  DeltaBuffer out;
+  // pending copy of blocks [copyStart , copyStart + copyCount)
+  uint32_t copyStart;
+  uint32_t copyCount;
+} Encoder;
+
+static void FlushCopy(Encoder *encoder) {
+  if (encoder->copyCount == 0)
+    return;
+  unsigned char op = DELTA_COPY;
+  Append(&encoder->out, &op, 1);
+  AppendU32(&encoder->out, encoder->copyStart);
+  AppendU32(&encoder->out, encoder->copyCount);
+  encoder->copyCount = 0;
+}
+
+static void EmitLiteral(Encoder *encoder, const unsigned char *data,
+                        size_t length) {
+  if (length == 0)
+    return;
+  FlushCopy(encoder);
+  unsigned char op = DELTA_LITERAL;
+  Append(&encoder->out, &op, 1);
+  AppendU32(&encoder->out, length);
+  Append(&encoder->out, data, length);
+}
+
+// EmitCopy - consecutive blocks are merged into a single copy
+static void EmitCopy(Encoder *encoder, uint32_t block) {
+  if (encoder->copyCount > 0 &&
+      encoder->copyStart + encoder->copyCount == block) {
+    encoder->copyCount++;
+    return;
+  }
+  FlushCopy(encoder);
+  encoder->copyStart = block;
+  encoder->copyCount = 1;
+}
+
+unsigned char *DeltaEncode(const DeltaFile *file,
+                           const unsigned char *signature,
+                           size_t signatureLen, size_t limit,
+                           size_t *deltaLen) {
+  if (signatureLen < DELTA_SIGNATURE_HEADER_LEN)
+    return NULL;
+  size_t blockSize = ReadU32(signature);
+  uint32_t numBlocks = ReadU32(signature + 4);
+  uint64_t basisSize = ReadU64(signature + 8);
+  const unsigned char *entries = signature + DELTA_SIGNATURE_HEADER_LEN;
+  if (blockSize == 0 || blockSize > DELTA_BLOCK_LIMIT ||
+      (signatureLen - DELTA_SIGNATURE_HEADER_LEN) / DELTA_ENTRY_LEN <
+          numBlocks ||
+      basisSize > (uint64_t)numBlocks * blockSize)
+    return NULL;
+  // all blocks are blockSize long except maybe the last one
+  size_t lastLength =
+      numBlocks > 0 ? basisSize - (uint64_t)(numBlocks - 1) * blockSize : 0;
+  uint64_t size = file->size;
+
+  // chained hash table of the weak sums
+  uint32_t numBuckets = 1;
+  while (numBuckets < 2 * numBlocks)
+    numBuckets *= 2;
+  int32_t *heads = malloc(numBuckets * sizeof(int32_t));
+  int32_t *next = malloc((numBlocks + 1) * sizeof(int32_t));
+  // the pending literal is at most DELTA_CHUNK long , followed by the block
+  // being matched and the byte rolled in next
+  Window window = {file, NULL, DELTA_CHUNK + 2 * blockSize, 0, 0};
+  if (file->data == NULL)
+    window.buffer = malloc(window.capacity);
+  if (heads == NULL || next == NULL ||
+      (file->data == NULL && window.buffer == NULL)) {
+    free(heads);
+    free(next);
+    free(window.buffer);
+    return NULL;
+  }
+  memset(heads, 0xFF, numBuckets * sizeof(int32_t));
+  for (uint32_t i = numBlocks; i-- > 0;) {
+    // the short last block is matched separately at the end of the data
+    if (i == numBlocks - 1 && lastLength != blockSize)
+      continue;
+    uint32_t bucket = ReadU32(entries + i * DELTA_ENTRY_LEN) & (numBuckets - 1);
+    next[i] = heads[bucket];
+    heads[bucket] = i;
+  }
+  Blake2bInit(&window.digest, DELTA_DIGEST_LEN);
+
+  Encoder encoder = {{NULL, 0, 0, limit, 0}, 0, 0};
+  AppendU32(&encoder.out, blockSize);
+  uint64_t literalStart = 0;
+  uint64_t i = 0;
+  uint32_t a = 0, b = 0;
+  int haveSum = 0;
+  while (numBlocks > 0 && i + blockSize <= size && !encoder.out.failed) {
+    if (Slide(&window, literalStart,
+              i + blockSize < size ? i + blockSize + 1 : size) == -1) {
+      encoder.out.failed = 1;
+      break;
+    }
+    const unsigned char *data = At(&window, i);
+    if (!haveSum) {
+      WeakSum(data, blockSize, &a, &b);
+      haveSum = 1;
+    }
+    uint32_t weak = a | (b << 16);
+    int32_t match = -1;
+    int strongDone = 0;
+    unsigned char strong[DELTA_STRONG_LEN];
+    for (int32_t candidate = heads[weak & (numBuckets - 1)]; candidate != -1;
+         candidate = next[candidate]) {
+      const unsigned char *entry = entries + candidate * DELTA_ENTRY_LEN;
+      if (ReadU32(entry) != weak)
+        continue;
+      // the strong sum is only computed once the weak one matched
+      if (!strongDone) {
+        StrongSum(strong, data, blockSize);
+        strongDone = 1;
+      }
+      if (memcmp(entry + 4, strong, DELTA_STRONG_LEN) == 0) {
+        match = candidate;
+        break;
+      }
+    }
+    if (match != -1) {
+      EmitLiteral(&encoder, At(&window, literalStart), i - literalStart);
+      EmitCopy(&encoder, match);
+      i += blockSize;
+      literalStart = i;
+      haveSum = 0;
+      continue;
+    }
+    // roll the window one byte forward
+    if (i + blockSize < size) {
+      a = (a - data[0] + data[blockSize]) & 0xFFFF;
+      b = (b - blockSize * data[0] + a) & 0xFFFF;
+    }
+    i++;
+    // a long run of unmatched bytes goes out in pieces , so only that much
+    // of the file is held
+    if (i - literalStart >= DELTA_CHUNK) {
+      EmitLiteral(&encoder, At(&window, literalStart), i - literalStart);
+      literalStart = i;
+    }
+  }
+  // the data may end with the short last block of the basis , the window
+  // holds everything from literalStart then
+  if (numBlocks > 0 && lastLength != blockSize &&
+      size - literalStart >= lastLength && !encoder.out.failed &&
+      Slide(&window, literalStart, size) == 0) {
+    const unsigned char *tail = At(&window, size - lastLength);
+    const unsigned char *entry = entries + (numBlocks - 1) * DELTA_ENTRY_LEN;
+    uint32_t ta, tb;
+    unsigned char strong[DELTA_STRONG_LEN];
+    if (WeakSum(tail, lastLength, &ta, &tb) == ReadU32(entry)) {
+      StrongSum(strong, tail, lastLength);
+      if (memcmp(entry + 4, strong, DELTA_STRONG_LEN) == 0) {
+        EmitLiteral(&encoder, At(&window, literalStart),
+                    size - lastLength - literalStart);
+        EmitCopy(&encoder, numBlocks - 1);
+        literalStart = size;
+      }
+    }
+  }
+  while (literalStart < size && !encoder.out.failed) {
+    size_t length =
+        size - literalStart < DELTA_CHUNK ? size - literalStart : DELTA_CHUNK;
+    if (Slide(&window, literalStart, literalStart + length) == -1) {
+      encoder.out.failed = 1;
+      break;
+    }
+    EmitLiteral(&encoder, At(&window, literalStart), length);
+    literalStart += length;
+  }
+  FlushCopy(&encoder);
+
+  unsigned char op = DELTA_END;
+  unsigned char digest[DELTA_DIGEST_LEN];
+  Blake2bFinal(&window.digest, digest);
+  Append(&encoder.out, &op, 1);
+  AppendU64(&encoder.out, size);
+  Append(&encoder.out, digest, DELTA_DIGEST_LEN);
+  free(heads);
+  free(next);
+  free(window.buffer);
+  return Finish(&encoder.out, deltaLen);
+}
+
+// Emit - writes length bytes of the result at *written and adds them to its
+// digest. returns -1 when out can't be written
+static int Emit(int out, Blake2bState *state, const unsigned char *data,
+                size_t length, uint64_t *written) {
+  Blake2bUpdate(state, data, length);
+  for (size_t done = 0; done < length;) {
+    ssize_t n = pwrite(out, data + done, length - done, *written + done);
+    if (n <= 0)
+      return -1;
+    done += n;
+  }
+  *written += length;
+  return 0;
+}
+
+int64_t DeltaApply(const DeltaFile *basis, const unsigned char *delta,
+                   size_t deltaLen, int out) {
+  const unsigned char *p = delta + 4;
+  const unsigned char *end = delta + deltaLen;
+  size_t trailer = 1 + 8 + DELTA_DIGEST_LEN;
+  if (deltaLen < 4 + trailer || delta[deltaLen - trailer] != DELTA_END)
+    return -1;
+  // the size END declares bounds the result , a delta repeating copies of
+  // the basis can't grow it past that
+  uint64_t declared = ReadU64(end - trailer + 1);
+  if (declared > INT64_MAX)
+    return -1;
+  unsigned char *buffer = NULL;
+  if (basis->data == NULL && (buffer = malloc(DELTA_CHUNK)) == NULL)
+    return -1;
+  uint64_t basisSize = basis->size;
+  uint64_t written = 0;
+  int64_t result = -1;
+  Blake2bState state;
+  Blake2bInit(&state, DELTA_DIGEST_LEN);
+  size_t blockSize = ReadU32(delta);
+  while (p < end) {
+    unsigned char op = *p++;
+    if (op == DELTA_COPY && end - p >= 8) {
+      uint64_t offset = (uint64_t)ReadU32(p) * blockSize;
+      uint64_t length = (uint64_t)ReadU32(p + 4) * blockSize;
+      p += 8;
+      if (offset >= basisSize)
+        break;
+      if (length > basisSize - offset)
+        length = basisSize - offset;
+      if (length > declared - written)
+        break;
+      // the basis is copied a chunk at a time
+      while (length > 0) {
+        size_t chunk = length < DELTA_CHUNK ? length : DELTA_CHUNK;
+        const unsigned char *data = ReadAt(basis, buffer, offset, chunk);
+        if (data == NULL || Emit(out, &state, data, chunk, &written) == -1)
+          break;
+        offset += chunk;
+        length -= chunk;
+      }
+      if (length > 0)
+        break;
+    } else if (op == DELTA_LITERAL && end - p >= 4 &&
+               ReadU32(p) <= (size_t)(end - p - 4)) {
+      size_t length = ReadU32(p);
+      if (length > declared - written ||
+          Emit(out, &state, p + 4, length, &written) == -1)
+        break;
+      p += 4 + length;
+    } else if (op == DELTA_END && end - p == 8 + DELTA_DIGEST_LEN) {
+      unsigned char digest[DELTA_DIGEST_LEN];
+      Blake2bFinal(&state, digest);
+      if (ReadU64(p) == written &&
+          memcmp(digest, p + 8, DELTA_DIGEST_LEN) == 0)
+        result = written;
+      break;
+    } else {
+      break;
+    }
+  }
+  free(buffer);
+  return result;
+}
@@ -0,0 +1,76 @@
+#ifndef DELTA
+#define DELTA
+#include "../checksum/blake2b.h"
+#include "../shared/consts.h"
+#include <stddef.h>
+#include <stdint.h>
+// smallest and largest block of a signature , the size in between grows
+// with the square root of the file like rsync does. past DELTA_MAX_BLOCKS
+// blocks they grow further , so the signature of a huge file still fits in
+// a READY_REPLY
+#define DELTA_MIN_BLOCK 2048
+#define DELTA_MAX_BLOCK (128 * 1024)
+#define DELTA_MAX_BLOCKS                                                       \
+  ((MAX_CONTROL_BODY - DELTA_SIGNATURE_HEADER_LEN) / DELTA_ENTRY_LEN)
+// largest block size a signature may ask for , it sizes DeltaEncode's window
+#define DELTA_BLOCK_LIMIT (64u << 20)
+// unmatched bytes are sent in literals of this size at most , and files are
+// read and written this many bytes at a time
+#define DELTA_CHUNK (1024 * 1024)
+// bytes of the strong checksum of each block
+#define DELTA_STRONG_LEN 16
+// bytes of the digest of the whole result carried by a delta
+#define DELTA_DIGEST_LEN 32
+// bytes of one block of a signature : weak sum + strong checksum
+#define DELTA_ENTRY_LEN (4 + DELTA_STRONG_LEN)
+// bytes of a signature header : block size , block count , basis size
+#define DELTA_SIGNATURE_HEADER_LEN 16
+
+// a delta starts with the block size of the signature it was made from
+// (u32) , followed by operations , each one a type byte followed by its fields in
+// network order
+enum {
+  // u32 first block , u32 block count : copy blocks of the basis
+  DELTA_COPY = 'C',
+  // u32 length , data : bytes that are not in the basis
+  DELTA_LITERAL = 'L',
+  // u64 size , digest : end of the delta , size and BLAKE2b-256 of the
+  // result
+  DELTA_END = 'E'
+};
+
+// DeltaFile - a file the delta functions read , size bytes held in memory
+// at data , or read from fd with pread DELTA_CHUNK at a time when data is
+// NULL , so files of any size are never loaded whole
+typedef struct {
+  const unsigned char *data;
+  int fd;
+  uint64_t size;
+} DeltaFile;
+
+// DeltaOpenFile - describes the regular file at path. returns -1 , and
+// describes an empty file , when it can't be opened
+int DeltaOpenFile(DeltaFile *file, const char *path);
+// DeltaCloseFile - closes the file DeltaOpenFile opened , if any
+void DeltaCloseFile(DeltaFile *file);
+// DeltaSignature - describes the blocks of the receiver's copy (basis) of
+// a file so the sender can refer to them. returns a malloc'ed signature and
+// stores its length in signatureLen , or NULL when the basis can't be read
+// in full or memory runs out
+unsigned char *DeltaSignature(const DeltaFile *basis, size_t *signatureLen);
+// DeltaEncode - describes file as blocks of the basis the signature was
+// made from and literal bytes. returns a malloc'ed delta and stores its
+// length in deltaLen , or NULL when the signature is malformed , the file
+// can't be read in full , memory runs out or the delta would be longer
+// than limit
+unsigned char *DeltaEncode(const DeltaFile *file,
+                           const unsigned char *signature,
+                           size_t signatureLen, size_t limit,
+                           size_t *deltaLen);
+// DeltaApply - rebuilds the sender's file from the basis and a delta ,
+// writing it to out as it goes. returns its size , or -1 when the delta is
+// malformed , the result does not match its digest or a file can't be read
+// or written (out then holds garbage)
+int64_t DeltaApply(const DeltaFile *basis, const unsigned char *delta,
+                   size_t deltaLen, int out);
+#endif
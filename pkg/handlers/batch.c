@@ -0,0 +1,271 @@
+// posix_fadvise
+#define _GNU_SOURCE
+#include "handlers.h"
+
+// a batch download streams every requested file back as consecutive frames
+// on the connection , like a tar stream :
+// - one BATCH_FILE_REPLY per file , whose body is the file name , a NUL
+//   byte and the file contents
+// - a BATCH_END_REPLY closing the stream , whose body reads
+//   "files <sent> errors <failed>"
+// the request body is a newline separated list of paths , or a single
+// directory whose files are all sent with names relative to it
+
+// SafeBatchName - a name sent by the server , without leading slashes , or
+// NULL when it would leave BATCH_DIR
+static const char *SafeBatchName(const char *name) {
+  while (*name == '/')
+    name++;
+  if (*name == '\0' || strcmp(name, "..") == 0 || strncmp(name, "../", 3) == 0 ||
+      strstr(name, "/../") != NULL ||
+      (strlen(name) >= 3 && strcmp(name + strlen(name) - 3, "/..") == 0))
+    return NULL;
+  return name;
+}
+
+// MakeParentDirectories - creates the missing directories leading to path
+static void MakeParentDirectories(char *path) {
+  for (char *slash = strchr(path + 1, '/'); slash != NULL;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(path, 0755);
+    *slash = '/';
+  }
+}
+
+// the client reads the whole stream before going back to the menu , every
+// file is written below BATCH_DIR
+void BatchDownloadProtocolSendRequestToServer(int socket) {
+  printf("Enter a directory , or file names separated by spaces , to "
+         "download\n");
+  char input[MAX_BUFFER];
+  if (fgets(input, MAX_BUFFER - 1, stdin) == NULL)
+    return;
+  char *arr_ptr = Trim(&input[0]);
+  for (char *c = arr_ptr; *c != '\0'; c++)
+    if (*c == ' ')
+      *c = '\n';
+  unsigned char *request = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
+  int mesg_length =
+      MarshallMessage(request, 0xC0DE, BATCH_DOWNLOAD_REQUEST, arr_ptr);
+  int sent = TransportSend(socket, request, mesg_length);
+  free(request);
+  if (sent == -1) {
+    perror("write failed: ");
+    return;
+  }
+  fprintf(stderr, "[DEBUG] client : sending batch download request to "
+                  "server\n");
+
+  unsigned char header[PROTOCOL_HEADER_LEN];
+  int files = 0;
+  while (TransportRecv(socket, header, PROTOCOL_HEADER_LEN) ==
+         PROTOCOL_HEADER_LEN) {
+    uint16_t protocol = ExtractMessageProtocol(header);
+    uint32_t size = ExtractMessageBodySize(header);
+    char *body = malloc(size + 1);
+    if (body == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    if (ExtractMessageMagic(header) != 0xC0DE ||
+        TransportRecv(socket, body, size) != (int)size ||
+        InflateMessageBody(&protocol, &body, &size) == -1) {
+      fprintf(stderr, "batch download stream is corrupt\n");
+      free(body);
+      return;
+    }
+    body[size] = '\0';
+    if (protocol != BATCH_FILE_REPLY) {
+      fprintf(stderr, "[ Batch Download Result ] : [ %d files written , %s ]",
+              files, body);
+      free(body);
+      return;
+    }
+    char *name_end = memchr(body, '\0', size);
+    const char *name = name_end != NULL ? SafeBatchName(body) : NULL;
+    if (name == NULL) {
+      fprintf(stderr, "skipping a file with an unsafe name\n");
+      free(body);
+      continue;
+    }
+    char path[MAX_BUFFER];
+    snprintf(path, sizeof(path), "%s%s", BATCH_DIR, name);
+    MakeParentDirectories(path);
+    size_t name_length = name_end - body + 1;
+    if (ReplaceFileContents(path, body + name_length, size - name_length) == -1)
+      perror("batch download failed to write file");
+    else
+      files++;
+    free(body);
+  }
+  fprintf(stderr, "connection closed during the batch download\n");
+}
+
+// BatchList - names of the files of a batch
+typedef struct {
+  char **paths;
+  // name sent for each path
+  const char **names;
+  int count;
+  int capacity;
+  int errors;
+  // progress of the stream
+  int index;
+  int sent;
+  // descriptor of the file read ahead , -1 if none
+  int ahead;
+} BatchList;
+
+static void AddPath(BatchList *list, const char *path, size_t nameOffset) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity == 0 ? 64 : 2 * list->capacity;
+    list->paths = realloc(list->paths, list->capacity * sizeof(char *));
+    list->names = realloc(list->names, list->capacity * sizeof(char *));
+    if (list->paths == NULL || list->names == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+  }
+  list->paths[list->count] = strdup(path);
+  list->names[list->count] = list->paths[list->count] + nameOffset;
+  list->count++;
+}
+
+// AddDirectory - adds every regular file below dir , names start after
+// nameOffset characters of their path
+static void AddDirectory(BatchList *list, const char *dir, size_t nameOffset,
+                         int depth) {
+  DIR *handle = opendir(dir);
+  struct dirent *ent;
+  if (handle == NULL || depth > BATCH_MAX_DEPTH) {
+    list->errors++;
+    if (handle != NULL)
+      closedir(handle);
+    return;
+  }
+  while ((ent = readdir(handle)) != NULL) {
+    char path[MAX_BUFFER];
+    struct stat st;
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    if (lstat(path, &st) == -1)
+      continue;
+    if (S_ISDIR(st.st_mode))
+      AddDirectory(list, path, nameOffset, depth + 1);
+    else if (S_ISREG(st.st_mode))
+      AddPath(list, path, nameOffset);
+  }
+  closedir(handle);
+}
+
+// OpenAhead - opens a file of the batch and asks the kernel to start
+// reading it in , so it is in the page cache once its turn comes
+static int OpenAhead(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd != -1)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  return fd;
+}
+
+// StartBatchFile - sends the header and name of the BATCH_FILE_REPLY of an
+// open file , the transfer sends its contents. returns -1 if it can't be
+// sent
+static int StartBatchFile(int socket, Transfer *transfer, const char *name,
+                          int fd) {
+  struct stat st;
+  unsigned char header[PROTOCOL_HEADER_LEN];
+  size_t nameLength = strlen(name) + 1;
+  // a file too large for one frame is counted with the errors
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+      (uint64_t)st.st_size > UINT32_MAX - nameLength)
+    return -1;
+  MarshallMessageHeader(header, 0xC0DE, BATCH_FILE_REPLY,
+                        nameLength + st.st_size);
+  if (TransportSend(socket, header, PROTOCOL_HEADER_LEN) == -1 ||
+      TransportSend(socket, name, nameLength) == -1) {
+    perror("write failed: ");
+    return -1;
+  }
+  transfer->fileFd = fd;
+  transfer->offset = 0;
+  transfer->remaining = st.st_size;
+  return 0;
+}
+
+// NextBatchFile - moves the transfer to the next file that can be sent , or
+// ends the stream with its summary
+static int NextBatchFile(int socket, Transfer *transfer) {
+  BatchList *list = transfer->state;
+  if (transfer->fileFd != -1) {
+    close(transfer->fileFd);
+    transfer->fileFd = -1;
+    list->sent++;
+  }
+  while (list->index < list->count) {
+    int i = list->index++;
+    int fd = list->ahead;
+    // the next file is opened and read ahead while this one is sent
+    list->ahead =
+        list->index < list->count ? OpenAhead(list->paths[list->index]) : -1;
+    if (fd != -1 && StartBatchFile(socket, transfer, list->names[i], fd) == 0)
+      return 0;
+    list->errors++;
+    if (fd != -1)
+      close(fd);
+  }
+  char summary[64];
+  unsigned char reply[PROTOCOL_HEADER_LEN + sizeof(summary)];
+  snprintf(summary, sizeof(summary), "files %d errors %d", list->sent,
+           list->errors);
+  int mesg_length = MarshallMessage(reply, 0xC0DE, BATCH_END_REPLY, summary);
+  if (TransportSend(socket, reply, mesg_length) == -1)
+    perror("write failed: ");
+  fprintf(stderr, "[DEBUG] Batch Download Handler Server : sent %d files\n",
+          list->sent);
+  return -1;
+}
+
+static void ReleaseBatch(Transfer *transfer) {
+  BatchList *list = transfer->state;
+  if (transfer->fileFd != -1)
+    close(transfer->fileFd);
+  if (list->ahead != -1)
+    close(list->ahead);
+  for (int i = 0; i < list->count; i++)
+    free(list->paths[i]);
+  free(list->paths);
+  free(list->names);
+  free(list);
+}
+
+Transfer *BatchDownloadProtocolServerHandler(int socket, Message message) {
+  BatchList *list = calloc(1, sizeof(BatchList));
+  struct stat st;
+  char *body = Trim(message.body);
+  if (list == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  if (strchr(body, '\n') == NULL && stat(body, &st) == 0 &&
+      S_ISDIR(st.st_mode)) {
+    size_t length = strlen(body);
+    while (length > 1 && body[length - 1] == '/')
+      body[--length] = '\0';
+    AddDirectory(list, body, length + 1, 0);
+  } else {
+    char *saveptr;
+    for (char *path = strtok_r(body, "\n", &saveptr); path != NULL;
+         path = strtok_r(NULL, "\n", &saveptr))
+      if (*Trim(path) != '\0')
+        AddPath(list, path, 0);
+  }
+  list->ahead = list->count > 0 ? OpenAhead(list->paths[0]) : -1;
+  // files are sent one after the other by a single transfer
+  Transfer *transfer = NewTransfer(socket);
+  transfer->next = NextBatchFile;
+  transfer->release = ReleaseBatch;
+  transfer->state = list;
+  return TransferRun(socket, transfer) ? NULL : transfer;
+}
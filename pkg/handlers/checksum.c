@@ -0,0 +1,67 @@
+#include "handlers.h"
+
+// the request body is the file name , optionally followed by a line
+// reading "chunks" to also get the digest of every chunk
+void ChecksumProtocolSendRequestToServer(int socket) {
+  printf("Enter File Name for checksum\n");
+  char input[MAX_BUFFER];
+  fgets(input, MAX_BUFFER - 1, stdin);
+  char *arr_ptr = Trim(&input[0]);
+  printf("Include the checksum of every chunk ? (y/n)\n");
+  char answer[MAX_BUFFER];
+  if (fgets(answer, MAX_BUFFER - 1, stdin) != NULL && answer[0] == 'y')
+    strncat(arr_ptr, "\nchunks", MAX_BUFFER - strlen(arr_ptr) - 1);
+  unsigned char *request = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
+  int mesg_length = MarshallMessage(request, 0xC0DE, CHECKSUM_REQUEST, arr_ptr);
+  if (TransportSend(socket, request, mesg_length) == -1)
+    perror("write failed: ");
+  free(request);
+  fprintf(stderr, "[DEBUG] client : sending checksum request to server\n");
+}
+// the reply starts with "blake2b-256-tree <chunk size> <file size> <root>"
+// followed by one "<chunk> <digest>" line per chunk when they were asked for
+void ChecksumProtocolServerHandler(int socket, Message message) {
+  struct stat st;
+  FileDigest digest;
+  char *options = strchr(message.body, '\n');
+  int withChunks = 0;
+  if (options != NULL) {
+    *options++ = '\0';
+    withChunks = strncmp(options, "chunks", 6) == 0;
+  }
+  if (stat(message.body, &st) == -1 || !S_ISREG(st.st_mode) ||
+      FileChecksum(message.body, &st, &digest) == -1) {
+    char reply[PROTOCOL_HEADER_LEN + 32];
+    int mesg_length = MarshallMessage((unsigned char *)reply, 0xC0DE,
+                                      ERROR_MESSAGE, "file not found");
+    if (TransportSend(socket, reply, mesg_length) == -1)
+      perror("write failed: ");
+    return;
+  }
+  // 2 hex characters per byte plus the chunk number and separators
+  size_t lineLength = 2 * CHECKSUM_DIGEST_LEN + 16;
+  size_t capacity = 64 + lineLength * (withChunks ? digest.numChunks + 1 : 1);
+  char *payload = malloc(capacity);
+  if (payload == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  char hex[2 * CHECKSUM_DIGEST_LEN + 1];
+  DigestToHex(hex, digest.root);
+  size_t length = snprintf(payload, capacity, "blake2b-256-tree %d %lld %s\n",
+                           CHECKSUM_CHUNK_SIZE, (long long)digest.size, hex);
+  for (uint32_t i = 0; withChunks && i < digest.numChunks; i++) {
+    DigestToHex(hex, digest.chunks[i]);
+    length += snprintf(payload + length, capacity - length, "%u %s\n", i, hex);
+  }
+  char *reply = malloc(MarshalledSizeBound(length));
+  size_t mesg_length = MarshallBinaryMessage(
+      (unsigned char *)reply, 0xC0DE, CHECKSUM_REPLY, payload, length,
+      SessionCapabilities(socket) & CAP_COMPRESSION);
+  if (TransportSend(socket, reply, mesg_length) == -1)
+    perror("write failed: ");
+  free(reply);
+  free(payload);
+  FreeFileDigest(&digest);
+  fprintf(stderr, "[DEBUG] Checksum Handler Server : Replying back .... \n");
+}
@@ -0,0 +1,180 @@
+// fdatasync , O_DIRECTORY
+#define _GNU_SOURCE
+#include "handlers.h"
+#include <sys/eventfd.h>
+
+// PendingCommit - an upload waiting for the committer , it lives on the
+// stack of the handler waiting for it
+typedef struct PendingCommit {
+  int fd;
+  const char *tmpPath;
+  const char *path;
+  int result;
+  int done;
+  // eventfd written once it is done when the handler runs on a coroutine ,
+  // -1 when it waits on committed instead
+  int wakeFd;
+  struct PendingCommit *next;
+} PendingCommit;
+
+static struct {
+  pthread_mutex_t mutex;
+  // wakes the committer , and the handlers once their batch is committed
+  pthread_cond_t wake;
+  pthread_cond_t committed;
+  pthread_t committer;
+  PendingCommit *head;
+  PendingCommit **tail;
+  int stopping;
+} commit = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+            PTHREAD_COND_INITIALIZER};
+static int running;
+
+// SyncDirectories - fsyncs once every directory the renamed files of batch
+// are in
+static int SyncDirectories(PendingCommit **batch, int size) {
+  size_t lengths[COMMIT_BATCH];
+  int result = 0;
+  for (int i = 0; i < size; i++) {
+    const char *path = batch[i]->path, *slash = strrchr(path, '/');
+    lengths[i] = slash != NULL ? slash - path + 1 : 0;
+    int seen = 0;
+    for (int j = 0; j < i && !seen; j++)
+      seen = lengths[j] == lengths[i] &&
+             memcmp(batch[j]->path, path, lengths[i]) == 0;
+    if (seen)
+      continue;
+    char dir[MAX_BUFFER];
+    snprintf(dir, sizeof(dir), "%.*s", (int)lengths[i], path);
+    int fd = open(lengths[i] > 0 ? dir : ".", O_RDONLY | O_DIRECTORY);
+    if (fd == -1 || fsync(fd) == -1) {
+      perror("upload directory sync failed: ");
+      result = -1;
+    }
+    if (fd != -1)
+      close(fd);
+  }
+  return result;
+}
+
+// Replace - renames the written file over path , after syncing it when
+// sync is set
+static int Replace(int fd, const char *tmpPath, const char *path, int sync) {
+  int result = sync ? fdatasync(fd) : 0;
+  if (close(fd) == -1)
+    result = -1;
+  if (result == 0 && rename(tmpPath, path) == -1)
+    result = -1;
+  if (result == -1)
+    unlink(tmpPath);
+  return result;
+}
+
+static void *Committer(void *arg) {
+  PendingCommit *batch[COMMIT_BATCH];
+  pthread_mutex_lock(&commit.mutex);
+  while (1) {
+    while (commit.head == NULL && !commit.stopping)
+      pthread_cond_wait(&commit.wake, &commit.mutex);
+    if (commit.head == NULL)
+      break;
+    int size = 0;
+    while (commit.head != NULL && size < COMMIT_BATCH) {
+      batch[size++] = commit.head;
+      commit.head = commit.head->next;
+    }
+    if (commit.head == NULL)
+      commit.tail = &commit.head;
+    pthread_mutex_unlock(&commit.mutex);
+
+    // every file is synced before it replaces the one it is named after ,
+    // then their directories are synced once for the whole batch
+    for (int i = 0; i < size; i++) {
+      batch[i]->result =
+          Replace(batch[i]->fd, batch[i]->tmpPath, batch[i]->path, 1);
+      if (batch[i]->result == -1)
+        perror("upload commit failed: ");
+    }
+    int synced = SyncDirectories(batch, size);
+
+    pthread_mutex_lock(&commit.mutex);
+    for (int i = 0; i < size; i++) {
+      if (synced == -1)
+        batch[i]->result = -1;
+      batch[i]->done = 1;
+      if (batch[i]->wakeFd != -1 &&
+          eventfd_write(batch[i]->wakeFd, 1) == -1)
+        perror("commit wakeup failed: ");
+    }
+    pthread_cond_broadcast(&commit.committed);
+  }
+  pthread_mutex_unlock(&commit.mutex);
+  return NULL;
+}
+
+void CommitStart(int durable) {
+  if (!durable)
+    return;
+  commit.head = NULL;
+  commit.tail = &commit.head;
+  commit.stopping = 0;
+  if (pthread_create(&commit.committer, NULL, Committer, NULL) != 0) {
+    perror("committer thread failed , uploads are not synced: ");
+    return;
+  }
+  __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+}
+
+void CommitStop(void) {
+  if (!__atomic_exchange_n(&running, 0, __ATOMIC_ACQ_REL))
+    return;
+  pthread_mutex_lock(&commit.mutex);
+  commit.stopping = 1;
+  pthread_cond_signal(&commit.wake);
+  pthread_mutex_unlock(&commit.mutex);
+  pthread_join(commit.committer, NULL);
+}
+
+int CommitFile(const char *path, const void *data, size_t size) {
+  char tmpPath[MAX_BUFFER];
+  int fd = OpenReplacement(path, tmpPath);
+  if (fd == -1)
+    return -1;
+  if (size > 0 && UringPwrite(fd, data, size, 0) == -1)
+    return FinishReplacement(fd, tmpPath, path, 1);
+  return CommitReplacement(fd, tmpPath, path);
+}
+
+int CommitReplacement(int fd, const char *tmpPath, const char *path) {
+  if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    return Replace(fd, tmpPath, path, 0);
+  // a coroutine is suspended until its batch is committed , so the other
+  // uploads its worker answers meanwhile join the same batch
+  PendingCommit pending = {fd, tmpPath, path, 0, 0, -1, NULL};
+  if (CoroutineActive())
+    pending.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pthread_mutex_lock(&commit.mutex);
+  if (commit.stopping) {
+    // the committer is gone or about to be , the upload syncs alone
+    pthread_mutex_unlock(&commit.mutex);
+    if (pending.wakeFd != -1)
+      close(pending.wakeFd);
+    return Replace(fd, tmpPath, path, 1);
+  }
+  *commit.tail = &pending;
+  commit.tail = &pending.next;
+  pthread_cond_signal(&commit.wake);
+  while (!pending.done) {
+    if (pending.wakeFd == -1) {
+      pthread_cond_wait(&commit.committed, &commit.mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&commit.mutex);
+    CoroutineWaitFd(pending.wakeFd, POLLIN);
+    pthread_mutex_lock(&commit.mutex);
+  }
+  pthread_mutex_unlock(&commit.mutex);
+  if (pending.wakeFd != -1)
+    close(pending.wakeFd);
+  return pending.result;
+}
@@ -0,0 +1,29 @@
+#ifndef COMMIT
+#define COMMIT
+#include <stddef.h>
+
+// Commit - stores uploaded files. a file is written to a temporary name
+// next to its path and renamed over it once complete , so nobody ever sees
+// half of it. when durable , a committer thread takes every upload waiting
+// at once , fdatasyncs their files , renames them and fsyncs each of their
+// directories a single time for the whole batch (group commit). the
+// handler waits until then , so an upload is acknowledged only once it
+// survives a crash , and concurrent uploads share the directory syncs
+// instead of waiting for each other's. a handler on a coroutine is
+// suspended meanwhile rather than its worker.
+
+// uploads committed by one round of the committer at most
+#define COMMIT_BATCH 64
+
+// CommitStart - starts the committer thread when durable is set
+void CommitStart(int durable);
+// CommitStop - stops it once the uploads waiting are committed
+void CommitStop(void);
+// CommitFile - replaces the file at path by size bytes of data. returns 0
+// once it is stored , durably when the committer runs , -1 on error
+int CommitFile(const char *path, const void *data, size_t size);
+// CommitReplacement - like CommitFile , for a new version of path already
+// written to the temporary file fd (tmpPath) of OpenReplacement. fd is
+// closed
+int CommitReplacement(int fd, const char *tmpPath, const char *path);
+#endif
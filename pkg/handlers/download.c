@@ -1,89 +1,250 @@
+// pread , st_mtim
+#define _GNU_SOURCE
 
 #include "handlers.h"
 
-void DownloadProtocolSendRequestToServer(int socket) {
-  printf("Enter File Name for download\n");
-  char input[MAX_BUFFER];
-  fgets(input, MAX_BUFFER - 1, stdin);
-  char *arr_ptr = &input[0];
-  arr_ptr[strlen(arr_ptr) - 1] = '\0';
-  char *request = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
-  int mesg_length = MarshallMessage(request, 0xC0DE, DOWNLOAD_REQUEST, arr_ptr);
-  Message message;
-  message.body = (char *)(request + PROTOCOL_HEADER_LEN);
-
-  if (send(socket, request, strlen(arr_ptr) + PROTOCOL_HEADER_LEN, 0) == -1)
-    perror("write failed: ");
-  fprintf(stderr,
-          "[DEBUG] client : sending download request for file %s to server\n",
-          message.body);
+// ReleaseDownload - drops the cached copy or closes the file of a download
+static void ReleaseDownload(Transfer *transfer) {
+  if (transfer->state != NULL)
+    FileCacheRelease(transfer->state);
+  else
+    close(transfer->fileFd);
 }
-void DownloadProtocolServerHandler(int socket, Message message) {
-  char *payload = malloc(MAX_BUFFER);
-  uint16_t protocol;
-
-  FILE *fp = fopen(message.body, "r");
-  if (fp == NULL) {
-    memset(payload, 0, sizeof(payload));
-
-    strcpy(payload, "file not found");
-    protocol = ERROR_MESSAGE;
-  } else {
-    /* Go to the end of the file. */
-    if (fseek(fp, 0L, SEEK_END) == 0) {
-      /* Get the size of the file. */
-      long bufsize = ftell(fp);
-      if (bufsize == -1) {
-        memset(payload, 0, sizeof(payload));
-
-        strcpy(payload, "could not get file size");
-        protocol = ERROR_MESSAGE;
-      } else {
-
-        /* Allocate our buffer to that size. */
-        payload = malloc(sizeof(char) * (bufsize + 1));
 
-        /* Go back to the start of the file. */
-        if (fseek(fp, 0L, SEEK_SET) != 0) {
-          memset(payload, 0, sizeof(payload));
+// ReleaseCompressedDownload - frees the body compressed for a download
+static void ReleaseCompressedDownload(Transfer *transfer) {
+  free((void *)transfer->data);
+}
 
-          strcpy(payload, "could not go to file start");
-          protocol = ERROR_MESSAGE;
-        } else {
-          /* Read the entire file into memory. */
-          size_t newLen = fread(payload, sizeof(char), bufsize, fp);
-          if (ferror(fp) != 0) {
-            memset(payload, 0, sizeof(payload));
+// CompressFile - compresses the file open at fd , st being its stat , for
+// a peer that accepts compression when the cache can't hold it. returns the
+// malloc'ed body (see CompressMessageBody) and stores its size , or NULL
+// when it doesn't compress , changed while it was read or doesn't fit under
+// the memory cap
+static unsigned char *CompressFile(int socket, int fd, const struct stat *st,
+                                   size_t *compressedSize) {
+  size_t size = st->st_size;
+  size_t bound = MarshalledSizeBound(size);
+  if (size < COMPRESSION_THRESHOLD || size > MAX_INFLATED_BODY ||
+      !MemoryAdmit(size + bound))
+    return NULL;
+  unsigned char *data = malloc(size);
+  unsigned char *compressed = malloc(bound);
+  struct stat now;
+  size_t done = 0;
+  *compressedSize = 0;
+  MemoryCharge(socket, size + bound);
+  while (data != NULL && compressed != NULL && done < size) {
+    ssize_t n = pread(fd, data + done, size - done, done);
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  // a write while reading leaves a mix of both versions
+  if (done == size && fstat(fd, &now) == 0 && now.st_size == st->st_size &&
+      now.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+      now.st_mtim.tv_nsec == st->st_mtim.tv_nsec)
+    *compressedSize = CompressMessageBody(compressed, data, size);
+  MemoryRelease(socket, size + bound);
+  free(data);
+  if (*compressedSize == 0) {
+    free(compressed);
+    return NULL;
+  }
+  return compressed;
+}
 
-            strcpy(payload, "Error reading file");
-            protocol = ERROR_MESSAGE;
-          } else {
-            payload[newLen++] = '\0'; /* Just to be safe. */
-          }
-        }
+Transfer *DownloadProtocolServerHandler(int socket, Message message) {
+  unsigned char header[PROTOCOL_HEADER_LEN];
+  struct stat st;
+  int fd = -1;
+  FileCacheEntry *cached = NULL;
+  if (stat(message.body, &st) == 0 && S_ISREG(st.st_mode)) {
+    // hot files are served from the shared cache without touching the disk
+    cached = FileCacheAcquire(message.body, &st);
+    if (cached == NULL) {
+      fd = open(message.body, O_RDONLY);
+      if (fd != -1 && fstat(fd, &st) == -1) {
+        close(fd);
+        fd = -1;
       }
     }
-    fclose(fp);
   }
-  char *arr_ptr = &payload[0];
-  int payload_length = strlen(arr_ptr);
-  // fprintf(stderr, "file Content  %s\n", arr_ptr);
-  if (payload_length <= MAX_BUFFER) {
-    char *reply = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
-    int mesg_length = MarshallMessage(reply, 0xC0DE, FILE_REPLY, arr_ptr);
-    if (send(socket, reply, payload_length + PROTOCOL_HEADER_LEN, 0) == -1)
+  if (cached == NULL && fd == -1) {
+    char reply[PROTOCOL_HEADER_LEN + 32];
+    int mesg_length = MarshallMessage((unsigned char *)reply, 0xC0DE,
+                                      ERROR_MESSAGE, "file not found");
+    if (TransportSend(socket, reply, mesg_length) == -1)
       perror("write failed: ");
-    fprintf(stderr, "[DEBUG] Download Handler Server : Replying back .... \n");
+    return NULL;
+  }
+  // the size field of the header can't announce more. MAX_INFLATED_BODY
+  // only bounds compressed bodies , bigger files are sent as they are
+  if ((uint64_t)st.st_size > UINT32_MAX) {
+    if (cached != NULL)
+      FileCacheRelease(cached);
+    else
+      close(fd);
+    SendErrorMessage(socket, "file too large");
+    return NULL;
+  }
+  // the body is either sent from the cached copy or streamed straight from
+  // the file by the transport , a time slice at a time
+  Transfer *transfer = NewTransfer(socket);
+  transfer->release = ReleaseDownload;
+  transfer->state = cached;
+  transfer->fileFd = fd;
+  transfer->remaining = st.st_size;
+  // peers that accept compression get the cached compressed copy , made
+  // once per version of the file. files the cache can't hold are
+  // compressed for every download instead
+  const unsigned char *compressed = NULL;
+  size_t compressedSize = 0;
+  if (SessionCapabilities(socket) & CAP_COMPRESSION) {
+    if (cached != NULL) {
+      compressed = FileCacheCompressed(cached, &compressedSize);
+    } else if ((compressed = CompressFile(socket, fd, &st,
+                                          &compressedSize)) != NULL) {
+      close(fd);
+      transfer->fileFd = -1;
+      transfer->release = ReleaseCompressedDownload;
+    }
+  }
+  // the header announces the whole file
+  if (compressed != NULL) {
+    MarshallMessageHeader(header, 0xC0DE,
+                          FILE_REPLY | PROTOCOL_FLAG_COMPRESSED,
+                          compressedSize);
+    transfer->data = compressed;
+    transfer->remaining = compressedSize;
   } else {
-    while (payload_length > 0) {
-      char *reply = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
-      int mesg_length = MarshallMessage(reply, 0xC0DE, FILE_REPLY, arr_ptr);
-      int sent = send(socket, reply, payload_length + PROTOCOL_HEADER_LEN, 0);
-      if (sent == -1)
-        perror("write failed: ");
-      fprintf(stderr,
-              "[DEBUG] Download Handler Server : Replying back .... \n");
-      payload_length = payload_length - sent;
+    MarshallMessageHeader(header, 0xC0DE, FILE_REPLY, st.st_size);
+    if (cached != NULL)
+      transfer->data = cached->data;
+  }
+  if (TransportSend(socket, header, PROTOCOL_HEADER_LEN) == -1) {
+    perror("write failed: ");
+    transfer->remaining = 0;
+  }
+  fprintf(stderr, "[DEBUG] Download Handler Server : Replying back .... \n");
+  return TransferRun(socket, transfer) ? NULL : transfer;
+}
+
+// the request body is the remote file name , a NUL byte and the signature
+// of the client's copy (DeltaSignature)
+void SyncDownloadProtocolSendRequestToServer(int socket, char *local_path) {
+  printf("Enter File Name for sync download\n");
+  char input[MAX_BUFFER];
+  fgets(input, MAX_BUFFER - 1, stdin);
+  char *remote = Trim(&input[0]);
+  printf("Enter the local copy to update\n");
+  fgets(local_path, MAX_BUFFER - 1, stdin);
+  Trim(local_path);
+  // a missing local copy is synced from an empty basis
+  DeltaFile basis;
+  DeltaOpenFile(&basis, local_path);
+  size_t signatureLen;
+  unsigned char *signature = DeltaSignature(&basis, &signatureLen);
+  DeltaCloseFile(&basis);
+  if (signature == NULL) {
+    fprintf(stderr, "[ ERROR MESSAGE ] : [ can't read %s ]", local_path);
+    return;
+  }
+  size_t nameLength = strlen(remote) + 1;
+  unsigned char *body = malloc(nameLength + signatureLen);
+  if (body == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(body, remote, nameLength);
+  memcpy(body + nameLength, signature, signatureLen);
+  unsigned char *request = malloc(MarshalledSizeBound(nameLength + signatureLen));
+  size_t mesg_length =
+      MarshallBinaryMessage(request, 0xC0DE, SYNC_DOWNLOAD_REQUEST, body,
+                            nameLength + signatureLen,
+                            SessionCapabilities(socket) & CAP_COMPRESSION);
+  if (TransportSend(socket, request, mesg_length) == -1)
+    perror("write failed: ");
+  fprintf(stderr,
+          "[DEBUG] client : sending sync download request for file %s with a "
+          "%zu byte signature\n",
+          remote, signatureLen);
+  free(request);
+  free(body);
+  free(signature);
+}
+// the local copy is rebuilt in a temporary file next to it , which replaces
+// it once the delta checked out
+void SyncDownloadProtocolHandleServerReply(const char *local_path,
+                                           Message reply) {
+  char tmpPath[MAX_BUFFER];
+  int out = OpenReplacement(local_path, tmpPath);
+  if (out == -1) {
+    perror("sync download write failed: ");
+    return;
+  }
+  DeltaFile basis;
+  DeltaOpenFile(&basis, local_path);
+  int64_t resultSize =
+      DeltaApply(&basis, (unsigned char *)reply.body, reply.size, out);
+  DeltaCloseFile(&basis);
+  if (resultSize == -1) {
+    FinishReplacement(out, tmpPath, local_path, 1);
+    fprintf(stderr, "[ ERROR MESSAGE ] : [ corrupt delta for %s ]", local_path);
+  } else if (FinishReplacement(out, tmpPath, local_path, 0) == -1)
+    perror("sync download write failed: ");
+  else
+    fprintf(stderr,
+            "[ Sync Download Reply ] : [ %s updated , %lld bytes from a %d "
+            "byte delta ]",
+            local_path, (long long)resultSize, reply.size);
+}
+void SyncDownloadProtocolServerHandler(int socket, Message message) {
+  const char *nameEnd = memchr(message.body, '\0', message.size);
+  struct stat st;
+  if (nameEnd == NULL) {
+    SendErrorMessage(socket, "malformed sync request");
+    return;
+  }
+  size_t nameLength = nameEnd - message.body;
+  const unsigned char *signature =
+      (unsigned char *)message.body + nameLength + 1;
+  size_t signatureLen = message.size - nameLength - 1;
+  // hot files are encoded straight from the download cache , the others
+  // are read a block at a time
+  FileCacheEntry *cached = NULL;
+  DeltaFile file = {NULL, -1, 0};
+  if (stat(message.body, &st) == 0 && S_ISREG(st.st_mode)) {
+    cached = FileCacheAcquire(message.body, &st);
+    if (cached != NULL) {
+      file.data = cached->data;
+      file.size = cached->size;
     }
   }
+  if (cached == NULL && DeltaOpenFile(&file, message.body) == -1) {
+    SendErrorMessage(socket, "file not found");
+    return;
+  }
+  size_t deltaLen;
+  unsigned char *delta = DeltaEncode(&file, signature, signatureLen,
+                                     FrameBodyLimit(DELTA_REPLY), &deltaLen);
+  DeltaCloseFile(&file);
+  if (delta == NULL) {
+    SendErrorMessage(socket, "could not make a delta");
+  } else {
+    unsigned char *reply = malloc(MarshalledSizeBound(deltaLen));
+    size_t mesg_length = MarshallBinaryMessage(
+        reply, 0xC0DE, DELTA_REPLY, delta, deltaLen,
+        SessionCapabilities(socket) & CAP_COMPRESSION);
+    if (TransportSend(socket, reply, mesg_length) == -1)
+      perror("write failed: ");
+    free(reply);
+    fprintf(stderr,
+            "[DEBUG] Sync Download Handler Server : Replying back with a %zu "
+            "byte delta .... \n",
+            deltaLen);
+  }
+  free(delta);
+  if (cached != NULL)
+    FileCacheRelease(cached);
 }
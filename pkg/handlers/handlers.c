@@ -1,57 +1,198 @@
 #include "handlers.h"
 #include <string.h>
 
+// SendRequestTag - frames the replies of a tagged request
+static void SendRequestTag(int socket, uint16_t protocol, uint32_t tag) {
+  unsigned char frame[REQUEST_TAG_FRAME_LEN];
+  MarshallRequestTag(frame, protocol, tag);
+  if (TransportSend(socket, frame, REQUEST_TAG_FRAME_LEN) == -1)
+    perror("write failed: ");
+}
+
+// ProtocolHandler - runs the handler of a request. returns the rest of its
+// reply when it is too long to send in one go
+typedef Transfer *(*ProtocolHandler)(Multiplexer *mux, int socket,
+                                     Message message);
+
+// one ProtocolHandler per handler of the registry (see PROTOCOLS) , calling
+// it the way its serve column says
+#define SERVE_NONE(handler)
+#define SERVE_PLAIN(handler)                                                   \
+  static Transfer *Serve##handler(Multiplexer *mux, int socket,              \
+                                  Message message) {                         \
+    handler(socket, message);                                                \
+    return NULL;                                                             \
+  }
+#define SERVE_DIR(handler)                                                     \
+  static Transfer *Serve##handler(Multiplexer *mux, int socket,              \
+                                  Message message) {                         \
+    handler(socket, mux->dir, message);                                      \
+    return NULL;                                                             \
+  }
+#define SERVE_TRANSFER(handler)                                                \
+  static Transfer *Serve##handler(Multiplexer *mux, int socket,              \
+                                  Message message) {                         \
+    return handler(socket, message);                                         \
+  }
+#define PROTOCOL_ADAPTER(name, value, body, priority, serve, handler, ...)    \
+  SERVE_##serve(handler)
+PROTOCOLS(PROTOCOL_ADAPTER)
+
+// the table workers dispatch on , NULL for what they don't answer
+#define HANDLER_NONE(value, handler)
+#define HANDLER_PLAIN(value, handler) [value] = Serve##handler,
+#define HANDLER_DIR HANDLER_PLAIN
+#define HANDLER_TRANSFER HANDLER_PLAIN
+#define PROTOCOL_HANDLER(name, value, body, priority, serve, handler, ...)    \
+  HANDLER_##serve(value, handler)
+static const ProtocolHandler handlers[PROTOCOL_TABLE_SIZE] = {
+    PROTOCOLS(PROTOCOL_HANDLER)};
+
+// Dispatch - runs the handler of a request , a single indirect call
+static Transfer *Dispatch(Multiplexer *mux, int socket, Message message) {
+  if (message.protocol >= PROTOCOL_TABLE_SIZE ||
+      handlers[message.protocol] == NULL)
+    return NULL;
+  return handlers[message.protocol](mux, socket, message);
+}
+
+// QueuedBytes - memory a transfer holds while it waits in the queue , the
+// bytes of an in memory reply not sent yet
+static size_t QueuedBytes(const Transfer *transfer) {
+  return transfer->data != NULL ? transfer->remaining : 0;
+}
+
+// Request - what a worker hands to the coroutine answering a message
+typedef struct {
+  Multiplexer *mux;
+  Message message;
+} Request;
+
+// ServeRequest - answers a popped message , on a coroutine of the worker
+// when it can start one. its replies then wait for socket buffer space in
+// CoroutineWaitFd (see WaitReady) while the worker goes on with others
+static void ServeRequest(void *arg) {
+  // copied before the coroutine first waits , arg is gone by then
+  Multiplexer *mux = ((Request *)arg)->mux;
+  Message message = ((Request *)arg)->message;
+  Queue *q = mux->Queue;
+
+  // replies go back to the connection the request arrived on , those of
+  // a tagged request are framed by REQUEST_TAG and REQUEST_DONE
+  int socket = message.message_sender;
+  Transfer *transfer = message.resume;
+  if (transfer == NULL) {
+    message.trace.at[TRACE_DEQUEUE] = TraceNow();
+    if (message.tag != 0)
+      SendRequestTag(socket, REQUEST_TAG, message.tag);
+    message.trace.at[TRACE_HANDLER_START] = TraceNow();
+    transfer = Dispatch(mux, socket, message);
+    message.trace.at[TRACE_HANDLER_END] = TraceNow();
+    // handlers copy what they keep of the body
+    MemoryRelease(socket, message.size);
+    free(message.body);
+    free(message.name);
+    message.body = NULL;
+    message.name = NULL;
+  } else {
+    MemoryRelease(socket, QueuedBytes(transfer));
+    if (TransferRun(socket, transfer))
+      transfer = NULL;
+  }
+  // a long reply goes on while nothing else waits , and is queued again
+  // behind the waiting requests otherwise. when the queue is full it
+  // keeps its worker , so workers never wait on each other
+  int yielded = 0;
+  while (transfer != NULL && !yielded) {
+    if (!__atomic_load_n(&q->empty, __ATOMIC_RELAXED)) {
+      pthread_mutex_lock(q->mutex);
+      if (!q->full) {
+        MemoryCharge(socket, QueuedBytes(transfer));
+        message.resume = transfer;
+        QUEUE Push(q, socket, message);
+        yielded = 1;
+      }
+      pthread_mutex_unlock(q->mutex);
+    }
+    if (!yielded && TransferRun(socket, transfer))
+      transfer = NULL;
+  }
+  if (yielded) {
+    pthread_cond_signal(q->notEmpty);
+    return;
+  }
+  if (message.tag != 0)
+    SendRequestTag(socket, REQUEST_DONE, message.tag);
+  TraceRequest(socket, &message.id, message.tag, message.protocol,
+               &message.trace);
+  PreforkCount(PREFORK_REQUESTS);
+  SessionEndRequest(socket);
+  pthread_mutex_lock(q->mutex);
+  int unparked = ReleaseConnection(q, socket);
+  pthread_mutex_unlock(q->mutex);
+  if (unparked > 0)
+    pthread_cond_broadcast(q->notEmpty);
+}
+
 void *ServerRequestHandler(void *arg) {
   Multiplexer *mux = (Multiplexer *)arg;
+  Queue *q = mux->Queue;
   memset(mux->dir, 0, 256);
   strcpy(mux->dir, "./");
   while (1) {
-    // Obtain lock and pop message from Queue when not empty
-    pthread_mutex_lock((mux->Queue)->mutex);
-    while ((mux->Queue)->empty) {
-      pthread_cond_wait((mux->Queue)->notEmpty, (mux->Queue)->mutex);
-    }
-    const Message message = QUEUE Pop(mux->Queue);
-    pthread_mutex_unlock((mux->Queue)->mutex);
-    pthread_cond_signal((mux->Queue)->notFull);
-
-    for (int i = 0; i < mux->conn->numClients; i++) {
-      int socket = mux->conn->clientSockets[i];
-
-      switch (message.protocol) {
-        if (socket != 0) {
-
-        case ECHO_REQUEST: {
-          if (message.message_sender == socket) {
-            EchoProtocolServerHandler(socket, message);
-          }
-          break;
-        }
-        case DOWNLOAD_REQUEST: {
-          printf("[DEBUG] Server Recieved Download Request\n");
-          DownloadProtocolServerHandler(socket, message);
-          break;
-        }
-        case FILE_REPLY: {
-          printf("[DEBUG] Server Recieved Upload Request\n");
-          UploadProtocolServerHandler(socket, message);
-          break;
-        }
-        case CHANGE_DIR_REQUEST: {
-          printf("[DEBUG] Server Recieved Change Directory Request\n");
-          ChangeDirectoryProtocolServerHandler(socket, mux->dir, message);
-          break;
-        }
-        case LIST_DIR_REQUEST: {
-          printf("[DEBUG] Server Recieved List Directory Request\n");
-          ListDirectoryProtocolServerHandler(socket, mux->dir, message);
-          break;
-        }
-        default: {
-          break;
-        }
+    // Obtain lock and pop message from Queue when not empty , messages of a
+    // connection another worker is answering are parked until it is done
+    Request request = {mux};
+    pthread_mutex_lock(q->mutex);
+    do {
+      // a busy queue never lets the loop below wait , the waiting
+      // coroutines are resumed before every message instead
+      if (CoroutineWaiting() > 0) {
+        pthread_mutex_unlock(q->mutex);
+        CoroutinePoll();
+        pthread_mutex_lock(q->mutex);
+      }
+      while (q->empty || CoroutineFull()) {
+        if (CoroutineWaiting() == 0) {
+          pthread_cond_wait(q->notEmpty, q->mutex);
+          continue;
         }
+        // the sockets of waiting coroutines are watched , and the queue
+        // through its wakeFd while there is room for one more
+        int watch = !CoroutineFull();
+        if (watch)
+          QueueWatch(q);
+        pthread_mutex_unlock(q->mutex);
+        CoroutineRun(watch ? q->wakeFd : -1);
+        pthread_mutex_lock(q->mutex);
+        if (watch)
+          QueueUnwatch(q);
       }
-    }
+      request.message = QUEUE Pop(q);
+    } while (!ClaimConnection(q, &request.message));
+    pthread_mutex_unlock(q->mutex);
+    pthread_cond_signal(q->notFull);
+    if (CoroutineStart(ServeRequest, &request) == -1)
+      ServeRequest(&request);
   }
 }
+void SendErrorMessage(int socket, const char *text) {
+  char reply[PROTOCOL_HEADER_LEN + MAX_BUFFER];
+  int mesg_length =
+      MarshallMessage((unsigned char *)reply, 0xC0DE, ERROR_MESSAGE, text);
+  if (TransportSend(socket, reply, mesg_length) == -1)
+    perror("write failed: ");
+}
+// tagged handshakes are answered by a worker , untagged ones right where
+// they are read (see HandleClientFrame)
+void HelloProtocolServerHandler(int socket, Message message) {
+  uint32_t capabilities =
+      strtoul(message.body, NULL, 0) & SUPPORTED_CAPABILITIES;
+  char body[16];
+  unsigned char reply[PROTOCOL_HEADER_LEN + sizeof(body)];
+  snprintf(body, sizeof(body), "%u", capabilities);
+  SessionSetCapabilities(socket, capabilities);
+  int mesg_length = MarshallMessage(reply, 0xC0DE, HELLO_REPLY, body);
+  if (TransportSend(socket, reply, mesg_length) == -1)
+    perror("write failed: ");
+}
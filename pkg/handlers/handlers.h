@@ -1,6 +1,9 @@
 #ifndef HANDLERS
 #define HANDLERS
 // #include "../message/message.h"
+#include "../cache/cache.h"
+#include "../checksum/checksum.h"
+#include "../delta/delta.h"
 #include "../multiplexer/multiplexer.h"
 // #include "../queue/queue.h"
 #include "../shared/consts.h"
@@ -16,12 +19,16 @@
 #include <string.h>
 
 #include "../message/message.h"
+#include "commit.h"
+#include "transfer.h"
 #include "wire.h"
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 // https://www.ibm.com/support/knowledgecenter/en/SSVSD8_8.4.1/com.ibm.websphere.dtx.dsgnstud.doc/references/r_design_studio_intro_Hex_Decimal_and_Symbol_Values.htm
 
@@ -30,17 +37,38 @@
 // their protocol, it would redirect them to the approporiate
 // handler
 void *ServerRequestHandler(void *arg);
+// SendErrorMessage - replies with an ERROR_MESSAGE carrying text
+void SendErrorMessage(int socket, const char *text);
 
-void EchoProtocolSendRequestToServer(int socket);
-void EchoProtocolServerHandler(int socket, Message message);
-void DownloadProtocolSendRequestToServer(int socket);
-void DownloadProtocolServerHandler(int socket, Message message);
+// the server handlers and client stubs named in the registry (see
+// PROTOCOLS) , handlers that return a Transfer return the rest of their
+// reply when it was too long to send at once
+#define SERVE_PROTOTYPE_NONE(handler)
+#define SERVE_PROTOTYPE_PLAIN(handler)                                        \
+  void handler(int socket, Message message);
+#define SERVE_PROTOTYPE_DIR(handler)                                           \
+  void handler(int socket, char *dir_path, Message message);
+#define SERVE_PROTOTYPE_TRANSFER(handler)                                      \
+  Transfer *handler(int socket, Message message);
+#define SEND_PROTOTYPE_NONE(stub)
+#define SEND_PROTOTYPE_LINE(stub) void stub(int socket);
+#define PROTOCOL_PROTOTYPES(name, value, body, priority, serve, handler, send, \
+                            stub, prompt)                                      \
+  SERVE_PROTOTYPE_##serve(handler) SEND_PROTOTYPE_##send(stub)
+PROTOCOLS(PROTOCOL_PROTOTYPES)
+
+// BuildDirectoryListing - names in the directory at path separated by " | " ,
+// to free , or NULL when it can't be opened
+char *BuildDirectoryListing(const char *path);
+
+// client stubs written by hand
 void UploadProtocolSendRequestToServer(int socket);
-void UploadProtocolServerHandler(int socket, Message message);
-void ChangeDirectoryProtocolSendRequestToServer(int socket);
-void ChangeDirectoryProtocolServerHandler(int socket, char *dir_path,
-                                          Message message);
-void ListDirectoryProtocolSendRequestToServer(int socket);
-void ListDirectoryProtocolServerHandler(int socket, char *dir_path,
-                                        Message message);
+void SyncDownloadProtocolSendRequestToServer(int socket, char *local_path);
+void SyncDownloadProtocolHandleServerReply(const char *local_path,
+                                           Message reply);
+void SyncUploadProtocolSendRequestToServer(int socket, char *local_path);
+void SyncUploadProtocolHandleServerReply(int socket, const char *local_path,
+                                         Message reply);
+void BatchDownloadProtocolSendRequestToServer(int socket);
+void ChecksumProtocolSendRequestToServer(int socket);
 #endif
\ No newline at end of file
@@ -4,78 +4,84 @@
 #include <stdint.h>
 #include <string.h>
 
-void ListDirectoryProtocolSendRequestToServer(int socket) {
-  printf("Enter Directory name For server list\n");
-  char input[MAX_BUFFER];
-  fgets(input, MAX_BUFFER - 1, stdin);
-  char *arr_ptr = Trim(&input[0]);
-  char *request = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
-  int mesg_length = MarshallMessage(request, 0xC0DE, LIST_DIR_REQUEST, arr_ptr);
-  Message message;
-  message.body = (char *)(request + PROTOCOL_HEADER_LEN);
+char *BuildDirectoryListing(const char *path) {
+  //  dir (pointer) -  used for keeping track of the current directory name.
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    return NULL;
+  // the listing grows with the directory , large ones are what
+  // compression pays off for
+  size_t capacity = MAX_BUFFER;
+  size_t used = 0;
+  char *payload = malloc(capacity);
+  if (payload == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  payload[0] = '\0';
+  struct dirent *ent;
+  // While we are in a directory and there are other directories
+  // present.
+  while ((ent = readdir(dir)) != NULL) {
+    char temp[256];
+    memset(temp, 0, 256);
 
-  if (send(socket, request, strlen(arr_ptr) + PROTOCOL_HEADER_LEN, 0) == -1)
-    perror("write failed: ");
-  fprintf(
-      stderr,
-      "[DEBUG] client : sending list directory request for file %s to server\n",
-      Trim(arr_ptr));
+    // Prints all of the data to the console.
+    sscanf(ent->d_name, "%s\n",
+           temp); // Trimming on both sides occurs here
+    size_t length = strlen(temp);
+    if (used + length + 4 > capacity) {
+      capacity = 2 * (used + length + 4);
+      payload = realloc(payload, capacity);
+      if (payload == NULL) {
+        perror("Couldn't allocate anymore memory!");
+        exit(EXIT_FAILURE);
+      }
+    }
+    memcpy(payload + used, temp, length);
+    memcpy(payload + used + length, " | ", 4);
+    used += length + 3;
+  }
+  closedir(dir);
+  return payload;
 }
+
 void ListDirectoryProtocolServerHandler(int socket, char *dir_path,
                                         Message message) {
   char buf[256];
   sscanf(dir_path, "%s", buf);
-  //  dir (pointer) -  used for keeping track of the current directory name.
-  DIR *dir;
-  char payload[MAX_BUFFER];
-  uint16_t protocol;
+  uint16_t protocol = LIST_DIR_REPLY;
   if (Trim(message.body) != NULL) {
 
     sscanf(Trim(message.body), "%s",
            buf); // Trimming on both sides occurs here
   }
-  dir = opendir(buf);
-
-  // If the directory exists.
-  if (dir != NULL) {
-    struct dirent *ent;
-    protocol = LIST_DIR_REPLY;
-    // While we are in a directory and there are other directories
-    // present.
-    while ((ent = readdir(dir)) != NULL) {
-      char temp[256];
-      memset(temp, 0, 256);
-
-      // Prints all of the data to the console.
-      sscanf(ent->d_name, "%s\n",
-             temp); // Trimming on both sides occurs here
-      strcat(payload, temp);
-      strcat(payload, " | ");
-    }
-    closedir(dir);
-  }
+  char *payload = BuildDirectoryListing(buf);
   // If the directory does not exist.
-  else if (dir == NULL) {
-    memset(payload, 0, sizeof(payload));
-
-    strcpy(payload, "You either typed the path incorrectly or the directory "
-                    "does not existn");
+  if (payload == NULL) {
+    static const char *notFound = "You either typed the path incorrectly or "
+                                  "the directory does not existn";
+    payload = malloc(strlen(notFound) + 1);
+    if (payload == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    strcpy(payload, notFound);
     protocol = ERROR_MESSAGE;
-    closedir(dir);
   }
 
   char *arr_ptr = Trim(&payload[0]);
 
   int payload_length = strlen(arr_ptr);
 
-  char *reply = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
-  int mesg_length = MarshallMessage(reply, 0xC0DE, protocol, arr_ptr);
-  if (send(socket, reply, strlen(arr_ptr) + PROTOCOL_HEADER_LEN, 0) == -1)
+  char *reply = malloc(MarshalledSizeBound(payload_length));
+  size_t mesg_length = MarshallBinaryMessage(
+      (unsigned char *)reply, 0xC0DE, protocol, arr_ptr, payload_length,
+      SessionCapabilities(socket) & CAP_COMPRESSION);
+  if (TransportSend(socket, reply, mesg_length) == -1)
     perror("write failed: ");
-  memset(reply, 0, sizeof(reply));
-  memset(arr_ptr, 0, sizeof(arr_ptr));
-  //   memset(payload, 0, sizeof(payload));
-  dir = NULL;
+  free(reply);
+  free(payload);
   fprintf(stderr,
           "[DEBUG] List Directory Handler Server : Replying back .... \n");
 }
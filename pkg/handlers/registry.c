@@ -0,0 +1,28 @@
+#include "handlers.h"
+
+// SendLine - prints prompt , reads a line from stdin and sends it as the body
+// of a request of protocol
+static void SendLine(int socket, uint16_t protocol, const char *name,
+                     const char *prompt) {
+  if (prompt[0] != '\0')
+    printf("%s\n", prompt);
+  char input[MAX_BUFFER];
+  if (fgets(input, MAX_BUFFER - 1, stdin) == NULL)
+    return;
+  input[strcspn(input, "\n")] = '\0';
+  unsigned char request[PROTOCOL_HEADER_LEN + MAX_BUFFER];
+  int mesg_length = MarshallMessage(request, 0xC0DE, protocol, input);
+  if (TransportSend(socket, request, mesg_length) == -1)
+    perror("write failed: ");
+  fprintf(stderr, "[DEBUG] client : sending %s [%s] to server\n", name,
+          input);
+}
+
+// the client stubs of the registry (see PROTOCOLS)
+#define SEND_STUB_NONE(name, value, stub, prompt)
+#define SEND_STUB_LINE(name, value, stub, prompt)                              \
+  void stub(int socket) { SendLine(socket, value, #name, prompt); }
+#define PROTOCOL_STUB(name, value, body, priority, serve, handler, send, stub, \
+                      prompt)                                                  \
+  SEND_STUB_##send(name, value, stub, prompt)
+PROTOCOLS(PROTOCOL_STUB)
@@ -0,0 +1,64 @@
+// clock_gettime
+#define _GNU_SOURCE
+#include "handlers.h"
+#include <time.h>
+
+static long long Microseconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+Transfer *NewTransfer(int socket) {
+  Transfer *transfer = calloc(1, sizeof(Transfer));
+  if (transfer == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  transfer->fileFd = -1;
+  transfer->generation = SessionGeneration(socket);
+  return transfer;
+}
+
+// Replaced - returns 1 once the connection of the transfer was closed , and
+// maybe reused , while it waited in the queue or in a send that blocked
+static int Replaced(int socket, const Transfer *transfer) {
+  return SessionGeneration(socket) != transfer->generation;
+}
+
+int TransferRun(int socket, Transfer *transfer) {
+  long long deadline = Microseconds() + TRANSFER_SLICE_USEC;
+  int failed = Replaced(socket, transfer);
+  while (!failed) {
+    while (transfer->remaining > 0) {
+      if (Replaced(socket, transfer)) {
+        failed = 1;
+        break;
+      }
+      size_t n = transfer->remaining < TRANSFER_CHUNK_SIZE
+                     ? transfer->remaining
+                     : TRANSFER_CHUNK_SIZE;
+      ssize_t sent =
+          transfer->data != NULL
+              ? TransportSend(socket, transfer->data + transfer->offset, n)
+              : TransportSendFile(socket, transfer->fileFd, transfer->offset,
+                                  n);
+      if (sent == -1) {
+        perror("write failed: ");
+        failed = 1;
+        break;
+      }
+      transfer->offset += n;
+      transfer->remaining -= n;
+      if (transfer->remaining > 0 && Microseconds() >= deadline)
+        return 0;
+    }
+    if (failed || transfer->next == NULL || Replaced(socket, transfer) ||
+        transfer->next(socket, transfer) == -1)
+      break;
+  }
+  if (transfer->release != NULL)
+    transfer->release(transfer);
+  free(transfer);
+  return 1;
+}
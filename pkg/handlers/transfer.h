@@ -0,0 +1,36 @@
+#ifndef TRANSFER
+#define TRANSFER
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// bytes sent at a time by a transfer
+#define TRANSFER_CHUNK_SIZE (256 << 10)
+// a transfer yields its worker once it sent for this long
+#define TRANSFER_SLICE_USEC 2000
+
+// Transfer - a reply too long to send in one go. a worker sends it for a
+// time slice and queues it again , so requests of other connections get
+// their turn between slices. the bytes still to send come from data when
+// it is set , or else from fileFd.
+typedef struct Transfer {
+  const unsigned char *data;
+  int fileFd;
+  off_t offset;
+  size_t remaining;
+  // starts the next part of the reply once the bytes are sent , returns -1
+  // when there is none
+  int (*next)(int socket, struct Transfer *transfer);
+  // frees what the transfer holds , called once it ends
+  void (*release)(struct Transfer *transfer);
+  void *state;
+  // SessionGeneration of the connection when the transfer started
+  uint32_t generation;
+} Transfer;
+
+// NewTransfer - returns a transfer for socket , with nothing to send yet
+Transfer *NewTransfer(int socket);
+// TransferRun - sends a time slice of the transfer. returns 0 when it has
+// more to send , or 1 once it ended and was freed
+int TransferRun(int socket, Transfer *transfer);
+#endif
@@ -11,12 +11,157 @@ void UploadProtocolSendRequestToServer(int socket) {
   message.body = (char *)(request + PROTOCOL_HEADER_LEN);
 }
 
+// UploadPath - uploads are stored in UPLOAD_DIR under the base name the
+// client gave them
+static void UploadPath(char *dest, size_t size, const char *name) {
+  const char *base = strrchr(name, '/');
+  snprintf(dest, size, "%s%s", UPLOAD_DIR, base != NULL ? base + 1 : name);
+}
+
+// AcknowledgeUpload - answers an upload with an UPLOAD_REPLY once it is
+// committed , result being what committing it returned
+static void AcknowledgeUpload(int socket, const char *path, int result) {
+  if (result == -1) {
+    perror("upload store failed: ");
+    SendErrorMessage(socket, "could not store the file");
+    return;
+  }
+  unsigned char reply[PROTOCOL_HEADER_LEN + MAX_BUFFER];
+  int mesg_length = MarshallMessage(reply, 0xC0DE, UPLOAD_REPLY, path);
+  if (TransportSend(socket, reply, mesg_length) == -1)
+    perror("write failed: ");
+}
+
+// the server is ready as soon as it hears of an upload , the client then
+// sends the file as a FILE_REPLY. the reader remembered its name already
+void UploadRequestServerHandler(int socket, Message message) {
+  unsigned char reply[PROTOCOL_HEADER_LEN];
+  int mesg_length = MarshallMessage(reply, 0xC0DE, READY_REPLY, "");
+  if (TransportSend(socket, reply, mesg_length) == -1)
+    perror("write failed: ");
+}
+
+// the file is stored under the name its UPLOAD_REQUEST gave it , uploads
+// that weren't announced go to UPLOAD_DEFAULT_NAME
 void UploadProtocolServerHandler(int socket, Message message) {
-  fprintf(stderr, "[ File Upload ] : [ %s ]", message.body);
-  // the following would store the file ...
-  FILE *fp;
-  // sscanf(file_count, "./fixture/client/recieved", buf);
-  fp = fopen("./fixture/server/recieved", "w+");
-  fprintf(fp, "%s\n", message.body);
-  fclose(fp);
+  char path[MAX_BUFFER];
+  UploadPath(path, sizeof(path),
+             message.name != NULL ? message.name : UPLOAD_DEFAULT_NAME);
+  fprintf(stderr, "[ File Upload ] : [ %s , %u bytes ]\n", path,
+          message.size);
+  AcknowledgeUpload(socket, path,
+                    CommitFile(path, message.body, message.size));
+}
+
+// a sync upload starts like an upload : the client names the file and the
+// server answers with a READY_REPLY , whose body is the signature of its
+// copy. the client then sends a DELTA_REPLY of the file name , a NUL byte
+// and the delta against that signature
+void SyncUploadProtocolSendRequestToServer(int socket, char *local_path) {
+  printf("Enter File Name for sync upload\n");
+  fgets(local_path, MAX_BUFFER - 1, stdin);
+  Trim(local_path);
+  const char *base = strrchr(local_path, '/');
+  const char *name = base != NULL ? base + 1 : local_path;
+  unsigned char request[PROTOCOL_HEADER_LEN + MAX_BUFFER];
+  int mesg_length = MarshallMessage(request, 0xC0DE, SYNC_UPLOAD_REQUEST, name);
+  if (TransportSend(socket, request, mesg_length) == -1)
+    perror("write failed: ");
+  fprintf(stderr, "[DEBUG] client : sending sync upload request for file %s\n",
+          name);
+}
+void SyncUploadProtocolHandleServerReply(int socket, const char *local_path,
+                                         Message reply) {
+  DeltaFile file;
+  if (DeltaOpenFile(&file, local_path) == -1) {
+    fprintf(stderr, "[ ERROR MESSAGE ] : [ can't read %s ]", local_path);
+    return;
+  }
+  const char *base = strrchr(local_path, '/');
+  const char *name = base != NULL ? base + 1 : local_path;
+  size_t nameLength = strlen(name) + 1;
+  // the delta goes out in a single DELTA_REPLY after the name
+  size_t deltaLen;
+  unsigned char *delta =
+      DeltaEncode(&file, (unsigned char *)reply.body, reply.size,
+                  FrameBodyLimit(DELTA_REPLY) - nameLength, &deltaLen);
+  DeltaCloseFile(&file);
+  if (delta == NULL) {
+    fprintf(stderr, "[ ERROR MESSAGE ] : [ can't make a delta of %s ]",
+            local_path);
+    return;
+  }
+  unsigned char *body = malloc(nameLength + deltaLen);
+  unsigned char *request = malloc(MarshalledSizeBound(nameLength + deltaLen));
+  if (body == NULL || request == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(body, name, nameLength);
+  memcpy(body + nameLength, delta, deltaLen);
+  size_t mesg_length = MarshallBinaryMessage(
+      request, 0xC0DE, DELTA_REPLY, body, nameLength + deltaLen,
+      SessionCapabilities(socket) & CAP_COMPRESSION);
+  if (TransportSend(socket, request, mesg_length) == -1)
+    perror("write failed: ");
+  fprintf(stderr,
+          "[ Sync Upload ] : [ %s , %llu bytes sent as a %zu byte delta ]",
+          local_path, (unsigned long long)file.size, deltaLen);
+  free(request);
+  free(body);
+  free(delta);
+}
+void SyncUploadSignatureServerHandler(int socket, Message message) {
+  char path[MAX_BUFFER];
+  size_t signatureLen;
+  DeltaFile basis;
+  UploadPath(path, sizeof(path), message.body);
+  // a file uploaded for the first time is synced from an empty basis
+  DeltaOpenFile(&basis, path);
+  unsigned char *signature = DeltaSignature(&basis, &signatureLen);
+  DeltaCloseFile(&basis);
+  if (signature == NULL) {
+    SendErrorMessage(socket, "could not read the file");
+    return;
+  }
+  unsigned char *reply = malloc(MarshalledSizeBound(signatureLen));
+  size_t mesg_length = MarshallBinaryMessage(
+      reply, 0xC0DE, READY_REPLY, signature, signatureLen,
+      SessionCapabilities(socket) & CAP_COMPRESSION);
+  if (TransportSend(socket, reply, mesg_length) == -1)
+    perror("write failed: ");
+  free(reply);
+  free(signature);
+}
+// the result is written straight to the temporary file the upload is
+// committed from , the basis is read a block at a time
+void SyncUploadProtocolServerHandler(int socket, Message message) {
+  char path[MAX_BUFFER];
+  char tmpPath[MAX_BUFFER];
+  const char *nameEnd = memchr(message.body, '\0', message.size);
+  if (nameEnd == NULL) {
+    SendErrorMessage(socket, "malformed sync upload");
+    return;
+  }
+  size_t nameLength = nameEnd - message.body;
+  UploadPath(path, sizeof(path), message.body);
+  int out = OpenReplacement(path, tmpPath);
+  if (out == -1) {
+    AcknowledgeUpload(socket, path, -1);
+    return;
+  }
+  DeltaFile basis;
+  DeltaOpenFile(&basis, path);
+  int64_t resultSize =
+      DeltaApply(&basis, (unsigned char *)message.body + nameLength + 1,
+                 message.size - nameLength - 1, out);
+  DeltaCloseFile(&basis);
+  if (resultSize == -1) {
+    FinishReplacement(out, tmpPath, path, 1);
+    SendErrorMessage(socket, "corrupt delta");
+    return;
+  }
+  fprintf(stderr, "[ Sync Upload ] : [ %s , %lld bytes ]\n", path,
+          (long long)resultSize);
+  AcknowledgeUpload(socket, path, CommitReplacement(out, tmpPath, path));
 }
@@ -0,0 +1,263 @@
+// accept4 - pipe2 - MSG_CMSG_CLOEXEC
+#define _GNU_SOURCE
+#include "handoff.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <time.h>
+
+static struct {
+  int listenFd;
+  char path[UNIX_PATH_LEN];
+  // written once , every reader sees them readable from then on
+  int acceptWake[2];
+  int connectionWake[2];
+  // socket connected to the replacement while connections are handed off
+  int peerFd;
+  pthread_mutex_t mutex;
+} handoff = {-1, "", {-1, -1}, {-1, -1}, -1, PTHREAD_MUTEX_INITIALIZER};
+// socket connected to the old server while its connections arrive
+static int takeoverFd = -1;
+
+// SendFds - sends value along with numFds descriptors as one packet
+static int SendFds(int socket, uint32_t value, const int *fds, int numFds) {
+  char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+  uint32_t data = htonl(value);
+  struct iovec iov = {&data, sizeof(data)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (numFds > 0) {
+    memset(control, 0, sizeof(control));
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * numFds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * numFds);
+  }
+  ssize_t n;
+  while ((n = sendmsg(socket, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+    ;
+  return n == sizeof(data) ? 0 : -1;
+}
+
+// RecvFds - receives a packet of SendFds. returns the number of descriptors
+// stored in fds , -1 once the peer is gone
+static int RecvFds(int socket, uint32_t *value, int *fds, int maxFds) {
+  char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+  uint32_t data;
+  struct iovec iov = {&data, sizeof(data)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n;
+  while ((n = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+    ;
+  if (n != sizeof(data))
+    return -1;
+  *value = ntohl(data);
+  int numFds = 0;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    int *received = (int *)CMSG_DATA(cmsg);
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (int i = 0; i < count; i++) {
+      if (numFds < maxFds)
+        fds[numFds++] = received[i];
+      else
+        close(received[i]);
+    }
+  }
+  return numFds;
+}
+
+// HandoffThread - waits for the replacement , hands everything over and
+// exits the process once the requests in flight are answered
+static void *HandoffThread(void *arg) {
+  Multiplexer *mux = (Multiplexer *)arg;
+  char request = 0;
+  int peer;
+  while (1) {
+    peer = accept4(handoff.listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (peer == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      perror("handoff accept failed: ");
+      return NULL;
+    }
+    if (recv(peer, &request, 1, 0) == 1 &&
+        (request == HANDOFF_LISTENERS || request == HANDOFF_CONNECTIONS))
+      break;
+    close(peer);
+  }
+  // the replacement waits on the path from now on
+  close(handoff.listenFd);
+  if (handoff.path[0] != '@')
+    unlink(handoff.path);
+  if (SendFds(peer, mux->conn->numListeners, mux->conn->listenerFds,
+              mux->conn->numListeners) == -1) {
+    perror("handoff failed , serving on: ");
+    close(peer);
+    return NULL;
+  }
+  fprintf(stderr, "[DEBUG] listeners handed to the new server , draining\n");
+  if (write(handoff.acceptWake[1], "x", 1) != 1)
+    perror("handoff wake failed: ");
+  if (request == HANDOFF_CONNECTIONS) {
+    pthread_mutex_lock(&handoff.mutex);
+    handoff.peerFd = peer;
+    pthread_mutex_unlock(&handoff.mutex);
+    if (write(handoff.connectionWake[1], "x", 1) != 1)
+      perror("handoff wake failed: ");
+  }
+
+  // connections left when the drain ends are closed , their clients
+  // reconnect to the new server
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (1) {
+    pthread_mutex_lock(mux->clientListMutex);
+    int clients = mux->conn->numClients;
+    pthread_mutex_unlock(mux->clientListMutex);
+    if (SessionsInFlight() == 0 &&
+        (request == HANDOFF_LISTENERS || clients == 0))
+      break;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - start.tv_sec) * 1000 +
+            (now.tv_nsec - start.tv_nsec) / 1000000 >=
+        HANDOFF_DRAIN_MS) {
+      fprintf(stderr, "[DEBUG] drain timed out with %d clients left\n",
+              clients);
+      break;
+    }
+    usleep(HANDOFF_RETRY_MS * 1000);
+  }
+  pthread_mutex_lock(&handoff.mutex);
+  handoff.peerFd = -1;
+  close(peer);
+  pthread_mutex_unlock(&handoff.mutex);
+  CaptureStop();
+  TraceStop();
+  fprintf(stderr, "[DEBUG] drained , exiting\n");
+  exit(EXIT_SUCCESS);
+}
+
+int HandoffListen(const char *path, Multiplexer *mux) {
+  struct sockaddr_un addr;
+  socklen_t len = FillUnixAddress(&addr, path);
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (path[0] != '@')
+    unlink(path);
+  if (fd == -1 || bind(fd, (struct sockaddr *)&addr, len) == -1 ||
+      listen(fd, 1) == -1) {
+    perror("handoff socket failed: ");
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+  if (pipe2(handoff.acceptWake, O_CLOEXEC) == -1 ||
+      pipe2(handoff.connectionWake, O_CLOEXEC) == -1) {
+    perror("handoff pipe failed: ");
+    close(fd);
+    return -1;
+  }
+  strncpy(handoff.path, path, UNIX_PATH_LEN - 1);
+  handoff.listenFd = fd;
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, HandoffThread, mux) != 0) {
+    perror("Couldn't start the handoff thread");
+    close(fd);
+    return -1;
+  }
+  pthread_detach(thread);
+  return 0;
+}
+
+int HandoffAcceptWakeFd(void) { return handoff.acceptWake[0]; }
+
+int HandoffConnectionWakeFd(void) { return handoff.connectionWake[0]; }
+
+int HandoffConnection(int fd) {
+  int sent = -1;
+  pthread_mutex_lock(&handoff.mutex);
+  if (handoff.peerFd != -1)
+    sent = SendFds(handoff.peerFd, SessionCapabilities(fd), &fd, 1);
+  pthread_mutex_unlock(&handoff.mutex);
+  return sent;
+}
+
+int TakeoverListeners(const char *path, int connections, int *fds,
+                      int maxFds) {
+  struct sockaddr_un addr;
+  socklen_t len = FillUnixAddress(&addr, path);
+  char request = connections ? HANDOFF_CONNECTIONS : HANDOFF_LISTENERS;
+  uint32_t numListeners;
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, len) == -1 ||
+      send(fd, &request, 1, MSG_NOSIGNAL) != 1) {
+    perror("takeover failed: ");
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+  int numFds = RecvFds(fd, &numListeners, fds,
+                       maxFds < MAX_LISTENERS ? maxFds : MAX_LISTENERS);
+  if (numFds <= 0) {
+    fprintf(stderr, "takeover failed , no listeners received from %s\n",
+            path);
+    close(fd);
+    return -1;
+  }
+  fprintf(stderr, "[DEBUG] took over %d listeners\n", numFds);
+  if (connections)
+    takeoverFd = fd;
+  else
+    close(fd);
+  return numFds;
+}
+
+// AdoptConnections - serves every connection the old server sends until it
+// exits
+static void *AdoptConnections(void *arg) {
+  Multiplexer *mux = (Multiplexer *)arg;
+  uint32_t capabilities;
+  int fd, adopted = 0;
+  int received;
+  while ((received = RecvFds(takeoverFd, &capabilities, &fd, 1)) != -1) {
+    if (received == 0)
+      continue;
+    if (fd >= MAX_SESSIONS || AddClient(mux, fd) == -1) {
+      close(fd);
+      continue;
+    }
+    SessionSetCapabilities(fd, capabilities);
+    if (StartClientHandler(mux, fd) == -1)
+      Disconnect(mux, fd);
+    else
+      adopted++;
+  }
+  close(takeoverFd);
+  takeoverFd = -1;
+  fprintf(stderr, "[DEBUG] adopted %d connections from the old server\n",
+          adopted);
+  return NULL;
+}
+
+void TakeoverConnections(Multiplexer *mux) {
+  pthread_t thread;
+  if (takeoverFd == -1)
+    return;
+  if (pthread_create(&thread, NULL, AdoptConnections, mux) != 0) {
+    perror("Couldn't start the takeover thread");
+    return;
+  }
+  pthread_detach(thread);
+}
@@ -0,0 +1,45 @@
+#ifndef HANDOFF
+#define HANDOFF
+#include "../capture/capture.h"
+#include "../trace/trace.h"
+#include "../multiplexer/multiplexer.h"
+#include <sys/un.h>
+// Handoff - hot restart. a server started with --handoff PATH waits on the
+// unix socket PATH for the server replacing it. the replacement , started
+// with --takeover PATH , connects to it and receives the listening sockets
+// with SCM_RIGHTS , so no connection attempt is refused while both run.
+// asked for them , the idle connections follow one by one along with the
+// capabilities negotiated on them. the old server stops accepting ,
+// finishes the requests it has in flight and exits.
+
+// first byte sent by the replacement , it wants the listeners only or the
+// idle connections as well
+#define HANDOFF_LISTENERS 'L'
+#define HANDOFF_CONNECTIONS 'C'
+// the old server exits after this long even if connections are left
+#define HANDOFF_DRAIN_MS 10000
+// busy connections are checked again this often until they are idle
+#define HANDOFF_RETRY_MS 50
+
+// HandoffListen - waits on path for a replacement from a background thread.
+// returns -1 when the socket can't be created
+int HandoffListen(const char *path, Multiplexer *mux);
+// HandoffAcceptWakeFd - becomes readable once the listeners were handed
+// off and accept loops must stop , -1 without --handoff
+int HandoffAcceptWakeFd(void);
+// HandoffConnectionWakeFd - becomes readable once the replacement wants the
+// connections , -1 without --handoff
+int HandoffConnectionWakeFd(void);
+// HandoffConnection - sends the idle connection fd to the replacement , the
+// caller then closes its own descriptor. returns -1 if it can't be sent
+int HandoffConnection(int fd);
+
+// TakeoverListeners - asks the server waiting on path for its listening
+// sockets , and for its idle connections when connections is set. returns
+// the number of listeners stored in fds or -1
+int TakeoverListeners(const char *path, int connections, int *fds,
+                      int maxFds);
+// TakeoverConnections - adopts the connections sent after the listeners
+// from a background thread , each one gets a ClientHandler
+void TakeoverConnections(Multiplexer *mux);
+#endif
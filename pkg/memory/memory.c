@@ -0,0 +1,77 @@
+// clock_gettime
+#define _GNU_SOURCE
+#include "memory.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+static size_t held[MAX_SESSIONS];
+static size_t total;
+static size_t softCap, hardCap;
+// readers paused past the soft cap , woken when the total gets under it
+static pthread_mutex_t pauseMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resumed = PTHREAD_COND_INITIALIZER;
+static int paused;
+
+void MemoryInit(size_t soft, size_t hard) {
+  softCap = soft;
+  hardCap = hard;
+}
+
+void MemoryCharge(int fd, size_t bytes) {
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    __atomic_add_fetch(&held[fd], bytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&total, bytes, __ATOMIC_RELAXED);
+}
+
+void MemoryRelease(int fd, size_t bytes) {
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    __atomic_sub_fetch(&held[fd], bytes, __ATOMIC_RELAXED);
+  size_t now = __atomic_sub_fetch(&total, bytes, __ATOMIC_RELAXED);
+  if (now < softCap && __atomic_load_n(&paused, __ATOMIC_ACQUIRE) > 0) {
+    pthread_mutex_lock(&pauseMutex);
+    pthread_cond_broadcast(&resumed);
+    pthread_mutex_unlock(&pauseMutex);
+  }
+}
+
+size_t MemoryHeld(int fd) {
+  if (fd == -1)
+    return __atomic_load_n(&total, __ATOMIC_RELAXED);
+  if (fd < 0 || fd >= MAX_SESSIONS)
+    return 0;
+  return __atomic_load_n(&held[fd], __ATOMIC_RELAXED);
+}
+
+int MemoryAdmit(size_t bytes) {
+  return hardCap == 0 ||
+         __atomic_load_n(&total, __ATOMIC_RELAXED) + bytes <= hardCap;
+}
+
+// BigConsumer - the total is past the soft cap and fd holds a large share
+// of it , more than its receive buffer that pausing would not give back
+static int BigConsumer(int fd) {
+  size_t held = MemoryHeld(fd);
+  return __atomic_load_n(&total, __ATOMIC_RELAXED) >= softCap &&
+         held > softCap / MEMORY_PAUSE_SHARE && held > FRAME_READ_SIZE;
+}
+
+void MemoryWaitToRead(int fd) {
+  if (softCap == 0 || !BigConsumer(fd))
+    return;
+  fprintf(stderr,
+          "[DEBUG] pausing socket %d , it holds %zu of %zu bytes held\n", fd,
+          MemoryHeld(fd), MemoryHeld(-1));
+  pthread_mutex_lock(&pauseMutex);
+  __atomic_add_fetch(&paused, 1, __ATOMIC_ACQ_REL);
+  while (BigConsumer(fd)) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += MEMORY_PAUSE_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&resumed, &pauseMutex, &deadline);
+  }
+  __atomic_sub_fetch(&paused, 1, __ATOMIC_ACQ_REL);
+  pthread_mutex_unlock(&pauseMutex);
+}
@@ -0,0 +1,36 @@
+#ifndef MEMORY_ACCOUNTING
+#define MEMORY_ACCOUNTING
+#include "../message/message.h"
+#include "../shared/consts.h"
+#include <stddef.h>
+// Memory - bytes the server holds for each connection and in total : its
+// receive buffers , the bodies of its requests until a worker is done with
+// them and the in memory replies waiting in the queue. past the soft cap
+// the connections holding the most stop being read until the total is
+// back under it , past the hard cap new requests are rejected with an
+// ERROR_MESSAGE. readers of many connections (the uring backend) can't
+// wait and only apply the hard cap.
+
+// past the soft cap , connections holding more than 1/MEMORY_PAUSE_SHARE
+// of it stop being read
+#define MEMORY_PAUSE_SHARE 16
+// a paused reader checks again at least this often
+#define MEMORY_PAUSE_MS 100
+// body of the ERROR_MESSAGE a request rejected past the hard cap gets
+#define MEMORY_OVERLOADED_TEXT "server overloaded"
+
+// MemoryInit - sets the caps in bytes , 0 disables one
+void MemoryInit(size_t softCap, size_t hardCap);
+// MemoryCharge - counts bytes held for the connection on fd
+void MemoryCharge(int fd, size_t bytes);
+// MemoryRelease - stops counting bytes charged to fd
+void MemoryRelease(int fd, size_t bytes);
+// MemoryHeld - bytes held for fd , or in total when fd is -1
+size_t MemoryHeld(int fd);
+// MemoryAdmit - returns 1 when bytes more can be held without going past
+// the hard cap
+int MemoryAdmit(size_t bytes);
+// MemoryWaitToRead - returns once fd may be read , waiting while the soft
+// cap is exceeded and fd is one of the big consumers
+void MemoryWaitToRead(int fd);
+#endif
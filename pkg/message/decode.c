@@ -0,0 +1,130 @@
+#include "message.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRAME_SIMD
+#endif
+
+// network order bytes of the magic
+#define MAGIC_HIGH 0xC0
+#define MAGIC_LOW 0xDE
+
+// body limits of the registry , 0 for the values no protocol uses
+#define BODY_LIMIT(name, value, body, ...) [value] = MAX_##body##_BODY,
+static const uint32_t bodyLimits[PROTOCOL_TABLE_SIZE] = {PROTOCOLS(BODY_LIMIT)};
+
+uint32_t FrameBodyLimit(uint16_t protocol) {
+  protocol &= ~PROTOCOL_FLAG_COMPRESSED;
+  if (protocol >= PROTOCOL_TABLE_SIZE || bodyLimits[protocol] == 0)
+    return MAX_CONTROL_BODY;
+  return bodyLimits[protocol];
+}
+
+int ValidFrameHeader(const unsigned char *header) {
+  uint16_t protocol = ExtractMessageProtocol(header);
+  // protocols are ascii characters , optionally flagged compressed
+  return ExtractMessageMagic(header) == 0xC0DE &&
+         (protocol & ~PROTOCOL_FLAG_COMPRESSED) != 0 &&
+         (protocol & ~PROTOCOL_FLAG_COMPRESSED) <= 0x7F &&
+         (uint32_t)ExtractMessageBodySize(header) <= FrameBodyLimit(protocol);
+}
+
+static size_t FindFrameMagicScalar(const unsigned char *data, size_t len,
+                                   size_t from) {
+  for (size_t i = from; i < len; i++) {
+    const unsigned char *p = memchr(data + i, MAGIC_HIGH, len - i);
+    if (p == NULL)
+      return len;
+    i = p - data;
+    if (i + 1 == len || data[i + 1] == MAGIC_LOW)
+      return i;
+  }
+  return len;
+}
+
+static size_t FindFrameMagicPlain(const unsigned char *data, size_t len) {
+  return FindFrameMagicScalar(data, len, 0);
+}
+
+#ifdef FRAME_SIMD
+// compares every byte with the first magic byte and the byte after it with
+// the second one , 16 or 32 positions at a time
+__attribute__((target("sse2"))) static size_t
+FindFrameMagicSse2(const unsigned char *data, size_t len) {
+  const __m128i high = _mm_set1_epi8((char)MAGIC_HIGH);
+  const __m128i low = _mm_set1_epi8((char)MAGIC_LOW);
+  size_t i = 0;
+  for (; i + 17 <= len; i += 16) {
+    __m128i first = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i second = _mm_loadu_si128((const __m128i *)(data + i + 1));
+    int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, high),
+                                               _mm_cmpeq_epi8(second, low)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return FindFrameMagicScalar(data, len, i);
+}
+
+__attribute__((target("avx2"))) static size_t
+FindFrameMagicAvx2(const unsigned char *data, size_t len) {
+  const __m256i high = _mm256_set1_epi8((char)MAGIC_HIGH);
+  const __m256i low = _mm256_set1_epi8((char)MAGIC_LOW);
+  size_t i = 0;
+  for (; i + 33 <= len; i += 32) {
+    __m256i first = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i second = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(first, high), _mm256_cmpeq_epi8(second, low)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return FindFrameMagicScalar(data, len, i);
+}
+#endif
+
+size_t FindFrameMagic(const unsigned char *data, size_t len) {
+#ifdef FRAME_SIMD
+  // picked on first use , every thread picks the same one
+  static size_t (*find)(const unsigned char *, size_t);
+  size_t (*scan)(const unsigned char *, size_t) =
+      __atomic_load_n(&find, __ATOMIC_RELAXED);
+  if (scan == NULL) {
+    __builtin_cpu_init();
+    scan = __builtin_cpu_supports("avx2")   ? FindFrameMagicAvx2
+           : __builtin_cpu_supports("sse2") ? FindFrameMagicSse2
+                                            : FindFrameMagicPlain;
+    __atomic_store_n(&find, scan, __ATOMIC_RELAXED);
+  }
+  return scan(data, len);
+#else
+  return FindFrameMagicPlain(data, len);
+#endif
+}
+
+void DecodeFrames(const unsigned char *data, size_t len, DecodedFrame *frames,
+                  size_t maxFrames, FrameBatch *batch) {
+  size_t offset = 0;
+  memset(batch, 0, sizeof(*batch));
+  while (batch->numFrames < maxFrames && len - offset >= PROTOCOL_HEADER_LEN) {
+    const unsigned char *header = data + offset;
+    if (!ValidFrameHeader(header)) {
+      // resynchronize on the next magic past this position
+      size_t next =
+          offset + 1 + FindFrameMagic(header + 1, len - offset - 1);
+      batch->skipped += next - offset;
+      offset = next;
+      continue;
+    }
+    size_t size = (uint32_t)ExtractMessageBodySize(header);
+    if (len - offset - PROTOCOL_HEADER_LEN < size) {
+      batch->pending = PROTOCOL_HEADER_LEN + size;
+      break;
+    }
+    DecodedFrame *frame = &frames[batch->numFrames++];
+    frame->magic = 0xC0DE;
+    frame->protocol = ExtractMessageProtocol(header);
+    frame->size = size;
+    frame->body = header + PROTOCOL_HEADER_LEN;
+    offset += PROTOCOL_HEADER_LEN + size;
+  }
+  batch->consumed = offset;
+}
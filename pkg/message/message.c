@@ -3,10 +3,10 @@ Message UnmarshallMessage(int message_sender, const char *marshalled_message) {
   const uint32_t message_size = ExtractMessageBodySize(marshalled_message);
   const uint16_t message_magic = ExtractMessageMagic(marshalled_message);
   const uint16_t message_protocol = ExtractMessageProtocol(marshalled_message);
-  const char *message_body = ExtractMessageBody(marshalled_message);
 
   Message p;
-  p.body = malloc(sizeof(message_body));
+  memset(&p, 0, sizeof(p));
+  p.body = malloc(message_size + 1);
   if (p.body == NULL) {
     perror("Couldn't allocate anymore memory!");
     exit(EXIT_FAILURE);
@@ -15,7 +15,8 @@ Message UnmarshallMessage(int message_sender, const char *marshalled_message) {
   p.protocol = message_protocol;
   p.magic = message_magic;
   p.size = message_size;
-  strcpy(p.body, message_body);
+  memcpy(p.body, marshalled_message + PROTOCOL_HEADER_LEN, message_size);
+  p.body[message_size] = '\0';
   return p;
   //   printf("EXECUTING BROADCAST REPLY ...\n");
 }
@@ -36,16 +37,89 @@ int MarshallMessage(unsigned char *dest, const uint16_t magic,
 
   return PROTOCOL_HEADER_LEN + payload_length;
 }
+void MarshallMessageHeader(unsigned char *dest, const uint16_t magic,
+                           const uint16_t protocol, const uint32_t size) {
+  *(uint16_t *)(dest) = htons(magic);
+  *(uint16_t *)(dest + 2) = htons(protocol);
+  *(uint32_t *)(dest + 4) = htonl(size);
+}
+// a compressed body is the original size (4 bytes) followed by the block
+size_t CompressMessageBody(unsigned char *dest, const void *content,
+                           size_t length) {
+  if (length < COMPRESSION_THRESHOLD || length > MAX_INFLATED_BODY)
+    return 0;
+  size_t compressed = Compress(dest + 4, CompressBound(length), content, length);
+  // not worth making the peer decompress
+  if (compressed == 0 || compressed + 4 >= length - length / 8)
+    return 0;
+  *(uint32_t *)dest = htonl(length);
+  return compressed + 4;
+}
+int MarshallRequestTag(unsigned char *dest, const uint16_t protocol,
+                       const uint32_t tag) {
+  MarshallMessageHeader(dest, 0xC0DE, protocol, 4);
+  *(uint32_t *)(dest + PROTOCOL_HEADER_LEN) = htonl(tag);
+  return REQUEST_TAG_FRAME_LEN;
+}
+size_t MarshalledSizeBound(size_t length) {
+  return PROTOCOL_HEADER_LEN + 4 + CompressBound(length);
+}
+size_t MarshallBinaryMessage(unsigned char *dest, const uint16_t magic,
+                             const uint16_t protocol, const void *content,
+                             size_t length, int compress) {
+  size_t size = 0;
+  if (compress)
+    size = CompressMessageBody(dest + PROTOCOL_HEADER_LEN, content, length);
+  if (size > 0) {
+    MarshallMessageHeader(dest, magic, protocol | PROTOCOL_FLAG_COMPRESSED,
+                          size);
+  } else {
+    MarshallMessageHeader(dest, magic, protocol, length);
+    memcpy(dest + PROTOCOL_HEADER_LEN, content, length);
+    size = length;
+  }
+  return PROTOCOL_HEADER_LEN + size;
+}
+int InflateMessageBody(uint16_t *protocol, char **body, uint32_t *size) {
+  if (!(*protocol & PROTOCOL_FLAG_COMPRESSED))
+    return 0;
+  if (*size < 4)
+    return -1;
+  // a compressed frame may not expand past what its protocol allows
+  // uncompressed , checked before anything is allocated
+  uint32_t length = ntohl(*(uint32_t *)*body);
+  if (length > FrameBodyLimit(*protocol))
+    return -1;
+  char *inflated = malloc(length + 1);
+  if (inflated == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  if (Decompress((unsigned char *)inflated, length,
+                 (unsigned char *)*body + 4, *size - 4) != (long)length) {
+    free(inflated);
+    return -1;
+  }
+  inflated[length] = '\0';
+  free(*body);
+  *body = inflated;
+  *size = length;
+  *protocol &= ~PROTOCOL_FLAG_COMPRESSED;
+  return 0;
+}
 // Message to real content
 // The return value is the from/to descriptor
 const char *ExtractMessageBody(const unsigned char *src) {
   // int ExtractMessageData(unsigned char *dest, const unsigned char *src) {
   char *dest;
   uint32_t decoded_body_length = ExtractMessageBodySize(src);
-  printf("Extract msg body -> %lu\n", decoded_body_length);
 
-  dest = malloc(decoded_body_length + PROTOCOL_HEADER_LEN + 20);
-  strncpy((char *)dest, (char *)src + PROTOCOL_HEADER_LEN, 14);
+  dest = malloc(decoded_body_length + 1);
+  if (dest == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(dest, src + PROTOCOL_HEADER_LEN, decoded_body_length);
   dest[decoded_body_length] = 0;
   return dest;
 }
@@ -11,7 +11,10 @@
 #include <unistd.h>
 
 // For string helper methods
+#include "../compress/compress.h"
 #include "../shared/consts.h"
+#include "../trace/trace.h"
+#include "../uuid/uuid.h"
 
 typedef struct {
   // used to keep track of the socket that sent the message
@@ -22,17 +25,58 @@ typedef struct {
   uint16_t protocol;
   //   message body size
   int size;
+  //   id announced by the REQUEST_TAG frame before the message , 0 if none
+  uint32_t tag;
+  //   unique id of a request read from a connection , for tracing
+  Uuid id;
+  //   times the request reached every stage , see Trace
+  TraceStamps trace;
+  //   state of a time sliced reply a worker continues , NULL for messages
+  //   read from a connection
+  void *resume;
+  //   name the UPLOAD_REQUEST before a FILE_REPLY gave it , taken when the
+  //   FILE_REPLY is read , NULL for other messages
+  char *name;
   //   message body
   char *body;
 } Message;
 
 // UnmarshallMessage - returns a message struct based on a given
-// bytestream
+// bytestream , its body is a NUL terminated copy to free
 Message UnmarshallMessage(int message_sender, const char *marshalled_message);
 // MarshallMessage - takes input and returns an encoded sequence
 int MarshallMessage(unsigned char *dest, const uint16_t magic,
                     const uint16_t protocol, const char *content);
 
+// MarshallMessageHeader - writes only the 8 byte header of a message whose
+// body of the given size is sent separately
+void MarshallMessageHeader(unsigned char *dest, const uint16_t magic,
+                           const uint16_t protocol, const uint32_t size);
+
+// MarshallBinaryMessage - writes a message with a body of length bytes.
+// when compress is set and it pays off , the body is compressed and
+// PROTOCOL_FLAG_COMPRESSED is added to the protocol. dest must hold
+// MarshalledSizeBound(length) bytes. returns the number of bytes written
+size_t MarshallBinaryMessage(unsigned char *dest, const uint16_t magic,
+                             const uint16_t protocol, const void *content,
+                             size_t length, int compress);
+// MarshallRequestTag - writes a REQUEST_TAG or REQUEST_DONE frame for the
+// request id tag to dest (REQUEST_TAG_FRAME_LEN bytes) and returns its size
+int MarshallRequestTag(unsigned char *dest, const uint16_t protocol,
+                       const uint32_t tag);
+// MarshalledSizeBound - largest message MarshallBinaryMessage can produce
+size_t MarshalledSizeBound(size_t length);
+// CompressMessageBody - writes the compressed form of a body to dest
+// (MarshalledSizeBound(length) bytes). returns its size , or 0 when the
+// body is too small or does not compress
+size_t CompressMessageBody(unsigned char *dest, const void *content,
+                           size_t length);
+// InflateMessageBody - when *protocol carries PROTOCOL_FLAG_COMPRESSED ,
+// replaces the *size bytes of *body by the NUL terminated decompressed
+// body and clears the flag. returns -1 if the body is malformed or would
+// expand past FrameBodyLimit of its protocol
+int InflateMessageBody(uint16_t *protocol, char **body, uint32_t *size);
+
 // ExtractMessageBodySize - returns size of data that is packed inside
 // messagExtractMessageProtocol
 int ExtractMessageBodySize(const unsigned char *buf);
@@ -44,5 +88,47 @@ uint16_t ExtractMessageMagic(const unsigned char *buf);
 // returns a hex value representing message time
 uint16_t ExtractMessageProtocol(const unsigned char *buf);
 // int ExtractMessageBody(unsigned char *dest, const unsigned char *src);
+// ExtractMessageBody - NUL terminated copy of the body of a message , to free
 const char *ExtractMessageBody(const unsigned char *src);
+
+// DecodedFrame - a frame decoded in place , body points into the buffer it
+// was decoded from
+typedef struct {
+  uint16_t magic;
+  uint16_t protocol;
+  uint32_t size;
+  const unsigned char *body;
+} DecodedFrame;
+
+// FrameBatch - what one DecodeFrames call went through
+typedef struct {
+  size_t numFrames;
+  // bytes taken by the frames decoded and the garbage skipped , the rest
+  // starts with an incomplete frame
+  size_t consumed;
+  // garbage skipped while resynchronizing on the magic
+  size_t skipped;
+  // header and body size of the incomplete frame when its header is
+  // complete and valid , 0 otherwise
+  size_t pending;
+} FrameBatch;
+
+// frames decoded by one DecodeFrames call of the receive paths
+#define FRAME_BATCH 64
+// bytes received at a time
+#define FRAME_READ_SIZE (64 * 1024)
+
+// FrameBodyLimit - largest body a frame of protocol may carry
+uint32_t FrameBodyLimit(uint16_t protocol);
+// ValidFrameHeader - returns 1 when the 8 bytes at header have the magic ,
+// a known protocol range and a body within FrameBodyLimit
+int ValidFrameHeader(const unsigned char *header);
+// FindFrameMagic - offset of the first byte that may start the magic in
+// data (a trailing 0xC0 included) , len when there is none. uses AVX2 or
+// SSE2 when the cpu has them
+size_t FindFrameMagic(const unsigned char *data, size_t len);
+// DecodeFrames - decodes up to maxFrames complete frames from data. bytes
+// that don't start a valid header are skipped up to the next magic
+void DecodeFrames(const unsigned char *data, size_t len, DecodedFrame *frames,
+                  size_t maxFrames, FrameBatch *batch);
 #endif
\ No newline at end of file
@@ -1,114 +1,467 @@
+#define _GNU_SOURCE
 #include "multiplexer.h"
+#include "../handoff/handoff.h"
 
-// Adds client's fd to list of client fds and
-// spawns a new ClientHandler thread for it
+int AddClient(Multiplexer *mux, int clientSocketFd) {
+  int added = -1;
+  // Obtain lock on clients list and add new client in
+  pthread_mutex_lock(mux->clientListMutex);
+  if ((mux->conn)->numClients < MAX_BUFFER) {
+    // Add new client to a free slot of the list
+    int slot = 0;
+    while ((mux->conn)->clientSockets[slot] != 0)
+      slot++;
+    (mux->conn)->clientSockets[slot] = clientSocketFd;
+    (mux->conn)->numClients++;
+    SessionAssignId(clientSocketFd);
+    TraceAccepted(clientSocketFd);
+    PreforkCount(PREFORK_ACCEPTED);
+    RateLimitAccept(clientSocketFd);
+    added = 0;
+  }
+  pthread_mutex_unlock(mux->clientListMutex);
+  return added;
+}
+
+int StartClientHandler(Multiplexer *mux, int clientSocketFd) {
+  ClientContext *client = malloc(sizeof(ClientContext));
+  if (client == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  client->mux = mux;
+  client->clientSocketFd = clientSocketFd;
+  pthread_t clientThread;
+  if (SpawnThread(&clientThread, mux->clientThreads, clientSocketFd, "client",
+                  ClientHandler, (void *)client) != 0) {
+    free(client);
+    return -1;
+  }
+  pthread_detach(clientThread);
+  return 0;
+}
+
+// AcceptClients - accepts every pending connection on the given listener,
+// adds each client's fd to list of client fds and spawns a new
+// ClientHandler thread for it
+static void AcceptClients(Multiplexer *mux, int listenerFd) {
+  while (1) {
+    int clientSocketFd =
+        accept4(listenerFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (clientSocketFd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      // EAGAIN - the backlog of this listener has been drained
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("accept failed: ");
+      return;
+    }
+    fprintf(stderr, " accepted new client. Socket: %d\n", clientSocketFd);
+    if (AddClient(mux, clientSocketFd) == -1) {
+      close(clientSocketFd);
+    } else if (StartClientHandler(mux, clientSocketFd) == -1) {
+      Disconnect(mux, clientSocketFd);
+    } else {
+      Uuid id;
+      char idString[UUID_STRING_LEN + 1];
+      SessionId(clientSocketFd, &id);
+      FormatUUID(&id, idString);
+      fprintf(stderr,
+              "Client connection to server has been successfully "
+              "multiplexed on socket: %d , id %s\n",
+              clientSocketFd, idString);
+    }
+  }
+}
+
+// Waits on the listeners owned by this acceptor and accepts new clients
+// from whichever one of them is ready
 void *Multiplex(void *arg) {
 
-  Multiplexer *mux = (Multiplexer *)arg;
+  Acceptor *acceptor = (Acceptor *)arg;
+  Multiplexer *mux = acceptor->mux;
+  struct pollfd listeners[MAX_LISTENERS + 1];
+  int numListeners = acceptor->numListeners;
+  for (int i = 0; i < numListeners; i++) {
+    listeners[i].fd = acceptor->listenerFds[i];
+    listeners[i].events = POLLIN;
+  }
+  // the accept loop ends once the listeners were handed to a new server
+  int wakeFd = HandoffAcceptWakeFd();
+  listeners[numListeners].fd = wakeFd;
+  listeners[numListeners].events = POLLIN;
   while (1) {
-    int clientSocketFd = accept((mux->conn)->socketFd, NULL, NULL);
-    if (clientSocketFd > 0) {
-      fprintf(stderr, " accepted new client. Socket: %d\n", clientSocketFd);
-      // Obtain lock on clients list and add new client in
-      pthread_mutex_lock(mux->clientListMutex);
-      if ((mux->conn)->numClients < MAX_BUFFER) {
-        // Add new client to list
-        for (int i = 0; i < MAX_BUFFER; i++) {
-          if (!FD_ISSET((mux->conn)->clientSockets[i], &(mux->readFds))) {
-            (mux->conn)->clientSockets[i] = clientSocketFd;
-            i = MAX_BUFFER;
-          }
-        }
-
-        FD_SET(clientSocketFd, &(mux->readFds));
-        mux->clientSocketFd = clientSocketFd;
-
-        pthread_t clientThread;
-        if ((pthread_create(&clientThread, NULL, (void *)&ClientHandler,
-                            (void *)mux)) == 0) {
-          (mux->conn)->numClients++;
-          fprintf(stderr,
-                  "Client connection to server has been successfully "
-                  "multiplexed on socket: %d\n",
-                  clientSocketFd);
-        } else
-          close(clientSocketFd);
-      }
-      pthread_mutex_unlock(mux->clientListMutex);
+    if (poll(listeners, numListeners + (wakeFd != -1), -1) == -1)
+      continue;
+    if (wakeFd != -1 && listeners[numListeners].revents)
+      return NULL;
+    for (int i = 0; i < numListeners; i++) {
+      if (listeners[i].revents & POLLIN)
+        AcceptClients(mux, listeners[i].fd);
     }
   }
 }
 
-// ClientHandler - Listens for payloads from client to add to queue
-void *ClientHandler(void *arg) {
-  Multiplexer *mux = (Multiplexer *)arg;
+// set on threads reading many connections (see MultiplexEventLoop)
+static __thread int eventLoop;
+static __thread MultiplexReplyQueue replyQueue;
+// bytes queued through replyQueue by the HandleClientBytes call running
+static __thread size_t replyBytes;
+
+void MultiplexEventLoop(MultiplexReplyQueue queue) {
+  eventLoop = 1;
+  replyQueue = queue;
+  RateLimitEventLoop();
+}
+
+// SendReply - sends a reply of the thread reading the connection , queued
+// on an event loop that must not wait for the peer to read
+static void SendReply(int clientSocketFd, const void *reply, size_t len) {
+  if (replyQueue != NULL && replyQueue(clientSocketFd, reply, len) == 0) {
+    replyBytes += len;
+    RateLimitCharge(clientSocketFd, len);
+    return;
+  }
+  if (TransportSend(clientSocketFd, reply, len) == -1)
+    perror("write failed: ");
+}
+
+void RejectRequest(int clientSocketFd, uint32_t tag, const char *text) {
+  unsigned char reply[2 * REQUEST_TAG_FRAME_LEN + PROTOCOL_HEADER_LEN +
+                      MAX_BUFFER];
+  int len = 0;
+  if (tag != 0)
+    len += MarshallRequestTag(reply, REQUEST_TAG, tag);
+  len += MarshallMessage(reply + len, 0xC0DE, ERROR_MESSAGE, text);
+  if (tag != 0)
+    len += MarshallRequestTag(reply + len, REQUEST_DONE, tag);
+  SendReply(clientSocketFd, reply, len);
+}
 
+int HandleClientFrame(Multiplexer *mux, int clientSocketFd, uint16_t magic,
+                      uint16_t protocol, uint32_t payload_size,
+                      char *recv_buffer) {
   Queue *q = mux->Queue;
-  int clientSocketFd = mux->clientSocketFd;
-  char *header = malloc(PROTOCOL_HEADER_LEN + 1);
-  int n;
-  while ((n = read(clientSocketFd, header, PROTOCOL_HEADER_LEN)) > 1) {
-    uint16_t magic = ExtractMessageMagic(header);
-    if (magic == 0xC0DE) {
-      uint16_t protocol = ExtractMessageProtocol(header);
-      uint32_t payload_size = ExtractMessageBodySize(header);
-      char *recv_buffer = malloc(payload_size);
-      read(clientSocketFd, recv_buffer, payload_size);
-      if (strcmp(recv_buffer, "/exit\n") == 0) {
-        fprintf(stderr, "Client on socket %d has disconnected.\n",
-                clientSocketFd);
-        Disconnect(mux, clientSocketFd);
-        return NULL;
+  CaptureFrame(clientSocketFd, magic, protocol, recv_buffer, payload_size);
+  if (protocol == SHM_ATTACH_REQUEST) {
+    // same host client moving its traffic to a shared memory channel ,
+    // the following reads of this connection come from the ring
+    ShmServerAttach(clientSocketFd);
+    free(recv_buffer);
+    return 1;
+  }
+  // a compressed body is admitted at the size it declares and counted while
+  // it is inflated , the largest allocation a client can cause
+  uint32_t inflating = 0;
+  if ((protocol & PROTOCOL_FLAG_COMPRESSED) && payload_size >= 4 &&
+      ntohl(*(uint32_t *)recv_buffer) <= FrameBodyLimit(protocol)) {
+    inflating = ntohl(*(uint32_t *)recv_buffer);
+    if (!MemoryAdmit(inflating)) {
+      fprintf(stderr,
+              "[DEBUG] rejecting a compressed request of socket %d , %zu "
+              "bytes are held\n",
+              clientSocketFd, MemoryHeld(-1));
+      RejectRequest(clientSocketFd, SessionTakePendingTag(clientSocketFd),
+                    MEMORY_OVERLOADED_TEXT);
+      free(recv_buffer);
+      return 0;
+    }
+    MemoryCharge(clientSocketFd, inflating);
+  }
+  int inflated = InflateMessageBody(&protocol, &recv_buffer, &payload_size);
+  MemoryRelease(clientSocketFd, inflating);
+  if (inflated == -1) {
+    fprintf(stderr, "[DEBUG] Client on socket %d sent a corrupt body\n",
+            clientSocketFd);
+    free(recv_buffer);
+    return -1;
+  }
+  if (protocol == REQUEST_TAG) {
+    // the next request carries this id , its replies are framed by
+    // REQUEST_TAG and REQUEST_DONE so a client can have many in flight
+    if (payload_size == 4)
+      SessionSetPendingTag(clientSocketFd, ntohl(*(uint32_t *)recv_buffer));
+    free(recv_buffer);
+    return 0;
+  }
+  uint32_t tag = SessionTakePendingTag(clientSocketFd);
+  if (protocol == HELLO_REQUEST && tag == 0) {
+    // capability handshake , both sides use what the other one supports
+    // for the rest of the connection
+    uint32_t capabilities =
+        strtoul(recv_buffer, NULL, 0) & SUPPORTED_CAPABILITIES;
+    char body[16];
+    unsigned char reply[PROTOCOL_HEADER_LEN + sizeof(body)];
+    snprintf(body, sizeof(body), "%u", capabilities);
+    SessionSetCapabilities(clientSocketFd, capabilities);
+    int mesg_length = MarshallMessage(reply, 0xC0DE, HELLO_REPLY, body);
+    SendReply(clientSocketFd, reply, mesg_length);
+    free(recv_buffer);
+    return 0;
+  }
+  if (strcmp(recv_buffer, "/exit\n") == 0) {
+    free(recv_buffer);
+    return -1;
+  }
+  if (RateLimitAdmit(clientSocketFd, protocol,
+                     PROTOCOL_HEADER_LEN + payload_size) == -1) {
+    fprintf(stderr, "[DEBUG] Client on socket %d is over its rate limit\n",
+            clientSocketFd);
+    RejectRequest(clientSocketFd, tag, RATE_LIMITED_TEXT);
+    free(recv_buffer);
+    return 0;
+  }
+  if (!MemoryAdmit(payload_size)) {
+    fprintf(stderr,
+            "[DEBUG] rejecting a request of socket %d , %zu bytes are held\n",
+            clientSocketFd, MemoryHeld(-1));
+    RejectRequest(clientSocketFd, tag, MEMORY_OVERLOADED_TEXT);
+    free(recv_buffer);
+    return 0;
+  }
+  // Wait for Queue to not be full before pushing message , an event loop
+  // would stop reading every other connection meanwhile
+  pthread_mutex_lock(q->mutex);
+  if (q->full && eventLoop) {
+    pthread_mutex_unlock(q->mutex);
+    fprintf(stderr, "[DEBUG] rejecting a request of socket %d , the queue "
+                    "is full\n",
+            clientSocketFd);
+    RejectRequest(clientSocketFd, tag, QUEUE_FULL_TEXT);
+    free(recv_buffer);
+    return 0;
+  }
+  while (q->full) {
+    pthread_cond_wait(q->notFull, q->mutex);
+  }
+
+  Message message;
+  message.message_sender = clientSocketFd;
+  message.magic = magic;
+  message.protocol = protocol;
+  message.size = payload_size;
+  message.body = recv_buffer;
+  message.tag = tag;
+  GenerateUUIDBytes(&message.id);
+  TraceFrame(clientSocketFd, &message.trace);
+  message.resume = NULL;
+  // uploads are named in the order they are read , the worker storing one
+  // may only run once the next one was announced
+  message.name = NULL;
+  if (message.protocol == UPLOAD_REQUEST)
+    SessionSetUploadName(clientSocketFd, message.body);
+  else if (message.protocol == FILE_REPLY)
+    message.name = SessionTakeUploadName(clientSocketFd);
+  if (message.protocol == ERROR_MESSAGE) {
+    fprintf(stderr,
+            "[DEBUG] Client on Socket [%d] send server error message [%s] \n",
+            message.message_sender, message.body);
+    free(message.body);
+  } else {
+    // change dir , tagged requests are all answered by the workers
+    if (message.tag == 0 && (message.protocol == CHANGE_DIR_REQUEST ||
+                             message.protocol == UPLOAD_REQUEST)) {
+      fprintf(stderr, "[DEBUG] srv upload msg protocol[%s] \n", message.body);
+
+      char payload[MAX_BUFFER] = "";
+      char *arr_ptr = &payload[0];
+      char *reply = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
+      MarshallMessage(reply, 0xC0DE, READY_REPLY, arr_ptr);
+      SendReply(message.message_sender, reply,
+                strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
+      free(reply);
+      fprintf(stderr, "[DEBUG] Upload Handler Server : Replying back .... \n");
+      if (message.protocol == CHANGE_DIR_REQUEST) {
+        SessionBeginRequest(clientSocketFd);
+        MemoryCharge(clientSocketFd, payload_size);
+        Push(q, clientSocketFd, message);
       } else {
-        // Wait for Queue to not be full before pushing message
-        while (q->full) {
-          pthread_cond_wait(q->notFull, q->mutex);
-        }
-        pthread_mutex_lock(q->mutex);
-
-        Message message;
-        message.message_sender = clientSocketFd;
-        message.magic = magic;
-        message.protocol = protocol;
-        message.size = payload_size;
-        message.body = recv_buffer;
-        if (message.protocol == ERROR_MESSAGE) {
-          fprintf(
-              stderr,
-              "[DEBUG] Client on Socket [%d] send server error message [%s] \n",
-              message.message_sender, message.body);
-        } else {
-          // change dir
-          if (message.protocol == CHANGE_DIR_REQUEST ||
-              message.protocol == UPLOAD_REQUEST) {
-            fprintf(stderr, "[DEBUG] srv upload msg protocol[%s] \n",
-                    message.body);
-
-            char payload[MAX_BUFFER];
-            char *arr_ptr = &payload[0];
-            int payload_length = strlen(arr_ptr);
-            char *reply = malloc(strlen(arr_ptr) + PROTOCOL_HEADER_LEN);
-            int mesg_length =
-                MarshallMessage(reply, 0xC0DE, READY_REPLY, arr_ptr);
-            if (send(message.message_sender, reply,
-                     strlen(arr_ptr) + PROTOCOL_HEADER_LEN, 0) == -1)
-              perror("write failed: ");
-            fprintf(stderr,
-                    "[DEBUG] Upload Handler Server : Replying back .... \n");
-            if (message.protocol == CHANGE_DIR_REQUEST) {
-              Push(q, clientSocketFd, message);
-            }
-          }
-
-          else {
-            Push(q, clientSocketFd, message);
-          }
-        }
+        free(message.body);
+      }
+    }
+
+    else {
+      SessionBeginRequest(clientSocketFd);
+      MemoryCharge(clientSocketFd, payload_size);
+      Push(q, clientSocketFd, message);
+    }
+  }
+  pthread_mutex_unlock(q->mutex);
+  pthread_cond_signal(q->notEmpty);
+  return 0;
+}
+
+// WaitFrame - waits for the next frame of a connection when the server may
+// be replaced. returns 1 once the connection was handed to the new server
+static int WaitFrame(int clientSocketFd) {
+  int wakeFd = HandoffConnectionWakeFd();
+  if (wakeFd == -1 || TransportIsShm(clientSocketFd))
+    return 0;
+  struct pollfd pfds[2] = {{clientSocketFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+  int handingOff = 0;
+  while (1) {
+    // after the wakeup a busy connection is checked again until it is idle
+    int ready = handingOff ? poll(pfds, 1, HANDOFF_RETRY_MS)
+                           : poll(pfds, 2, -1);
+    if (ready == -1 && errno != EINTR)
+      return 0;
+    if (ready > 0 && pfds[0].revents)
+      return 0;
+    if (ready > 0 && pfds[1].revents)
+      handingOff = 1;
+    if (handingOff && SessionIdle(clientSocketFd))
+      return HandoffConnection(clientSocketFd) == 0;
+  }
+}
+
+int HandleClientBytes(Multiplexer *mux, int clientSocketFd,
+                      const unsigned char *data, size_t len, size_t *garbage,
+                      size_t *consumed, size_t *pending) {
+  DecodedFrame frames[FRAME_BATCH];
+  FrameBatch batch;
+  size_t offset = 0;
+  do {
+    DecodeFrames(data + offset, len - offset, frames, FRAME_BATCH, &batch);
+    // garbage counts from the last valid frame on
+    if (batch.numFrames > 0)
+      *garbage = 0;
+    *garbage += batch.skipped;
+    if (*garbage > MAX_FRAME_GARBAGE) {
+      fprintf(stderr, "[DEBUG] Client on socket %d sent %zu bytes of garbage\n",
+              clientSocketFd, *garbage);
+      return -1;
+    }
+    replyBytes = 0;
+    for (size_t i = 0; i < batch.numFrames; i++) {
+      // the frames behind the replies an event loop queued wait until they
+      // were sent , so do the ones moving the connection to shared memory
+      if (replyBytes >= MULTIPLEX_REPLY_BATCH ||
+          (replyBytes > 0 && frames[i].protocol == SHM_ATTACH_REQUEST)) {
+        *consumed = frames[i].body - PROTOCOL_HEADER_LEN - data;
+        *pending = 0;
+        return 0;
+      }
+      char *recv_buffer = malloc(frames[i].size + 1);
+      if (recv_buffer == NULL) {
+        perror("Couldn't allocate anymore memory!");
+        exit(EXIT_FAILURE);
       }
-      pthread_mutex_unlock(q->mutex);
-      pthread_cond_signal(q->notEmpty);
+      memcpy(recv_buffer, frames[i].body, frames[i].size);
+      recv_buffer[frames[i].size] = '\0';
+      int result = HandleClientFrame(mux, clientSocketFd, frames[i].magic,
+                                     frames[i].protocol, frames[i].size,
+                                     recv_buffer);
+      if (result != 0) {
+        *consumed = frames[i].body + frames[i].size - data;
+        *pending = 0;
+        return result;
+      }
+    }
+    offset += batch.consumed;
+  } while (batch.numFrames == FRAME_BATCH);
+  *consumed = offset;
+  *pending = batch.pending;
+  return 0;
+}
+
+// DiscardBody - reads and drops the left bytes of a frame body through
+// buffer. returns -1 when the connection closed
+static int DiscardBody(int clientSocketFd, unsigned char *buffer,
+                       size_t left) {
+  while (left > 0) {
+    size_t n = left < FRAME_READ_SIZE ? left : FRAME_READ_SIZE;
+    if (TransportRecv(clientSocketFd, buffer, n) <= 0)
+      return -1;
+    left -= n;
+  }
+  return 0;
+}
+
+// ClientHandler - Listens for payloads from client to add to queue. bytes
+// are received in bulk and decoded FRAME_BATCH frames at a time
+void *ClientHandler(void *arg) {
+  ClientContext *client = (ClientContext *)arg;
+  Multiplexer *mux = client->mux;
+
+  int clientSocketFd = client->clientSocketFd;
+  free(client);
+  unsigned char *buffer = malloc(FRAME_READ_SIZE);
+  if (buffer == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  MemoryCharge(clientSocketFd, FRAME_READ_SIZE);
+  size_t len = 0, garbage = 0, consumed, pending;
+  while (1) {
+    if (len == 0 && WaitFrame(clientSocketFd)) {
+      fprintf(stderr, "Client on socket %d was handed to the new server.\n",
+              clientSocketFd);
+      MemoryRelease(clientSocketFd, FRAME_READ_SIZE);
+      Disconnect(mux, clientSocketFd);
+      free(buffer);
+      return NULL;
+    }
+    // past the soft cap the connections holding the most wait
+    MemoryWaitToRead(clientSocketFd);
+    int n = TransportRecvSome(clientSocketFd, buffer + len,
+                              FRAME_READ_SIZE - len);
+    if (n <= 0)
+      break;
+    TraceReceived(clientSocketFd, len);
+    len += n;
+    if (HandleClientBytes(mux, clientSocketFd, buffer, len, &garbage,
+                          &consumed, &pending) == -1)
+      break;
+    memmove(buffer, buffer + consumed, len - consumed);
+    len -= consumed;
+    if (pending <= FRAME_READ_SIZE)
+      continue;
+    // a frame bigger than the buffer is read straight into its body
+    uint32_t payload_size = pending - PROTOCOL_HEADER_LEN;
+    size_t received = len - PROTOCOL_HEADER_LEN;
+    if (!MemoryAdmit(payload_size)) {
+      // the body is read through the buffer and dropped , the connection
+      // stays in step with the frames that follow
+      if (DiscardBody(clientSocketFd, buffer, payload_size - received) == -1)
+        break;
+      fprintf(stderr,
+              "[DEBUG] rejecting a %u byte frame of socket %d , %zu bytes "
+              "are held\n",
+              payload_size, clientSocketFd, MemoryHeld(-1));
+      RejectRequest(clientSocketFd, SessionTakePendingTag(clientSocketFd),
+                    MEMORY_OVERLOADED_TEXT);
+      len = 0;
+      garbage = 0;
+      continue;
+    }
+    char *recv_buffer = malloc(payload_size + 1);
+    if (recv_buffer == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    MemoryCharge(clientSocketFd, payload_size);
+    memcpy(recv_buffer, buffer + PROTOCOL_HEADER_LEN, received);
+    int status = TransportRecv(clientSocketFd, recv_buffer + received,
+                               payload_size - received);
+    MemoryRelease(clientSocketFd, payload_size);
+    if (status <= 0) {
+      free(recv_buffer);
+      break;
     }
+    TraceReceived(clientSocketFd, len);
+    recv_buffer[payload_size] = '\0';
+    len = 0;
+    garbage = 0;
+    if (HandleClientFrame(mux, clientSocketFd, ExtractMessageMagic(buffer),
+                          ExtractMessageProtocol(buffer), payload_size,
+                          recv_buffer) == -1)
+      break;
   }
+  fprintf(stderr, "Client on socket %d has disconnected.\n", clientSocketFd);
+  MemoryRelease(clientSocketFd, FRAME_READ_SIZE);
+  Disconnect(mux, clientSocketFd);
+  free(buffer);
+  return NULL;
 }
 
 // Removes the socket from the list of active client sockets and closes it
@@ -117,7 +470,10 @@ void Disconnect(Multiplexer *data, int clientSocketFd) {
   for (int i = 0; i < MAX_BUFFER; i++) {
     if ((data->conn)->clientSockets[i] == clientSocketFd) {
       (data->conn)->clientSockets[i] = 0;
+      TransportRelease(clientSocketFd);
+      SessionReset(clientSocketFd);
       close(clientSocketFd);
+      PreforkCount(PREFORK_CLOSED);
       (data->conn)->numClients--;
       i = MAX_BUFFER;
     }
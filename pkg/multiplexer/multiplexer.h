@@ -1,10 +1,18 @@
 #ifndef MULTIPLEXER
 #define MULTIPLEXER
+#include "../capture/capture.h"
+#include "../memory/memory.h"
+#include "../prefork/prefork.h"
 #include "../message/message.h"
 #include "../queue/queue.h"
+#include "../ratelimit/ratelimit.h"
+#include "../session/session.h"
 #include "../shared/consts.h"
 #include "../shared/utils.h"
+#include "../threads/threads.h"
+#include "../transport/transport.h"
 #include <ctype.h>
+#include <errno.h>
 #include <dirent.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -17,9 +25,19 @@
 #include <unistd.h>
 // fd_set
 #include <sys/select.h>
+// poll
+#include <poll.h>
+// text of the ERROR_MESSAGE rejecting a request while the queue is full
+#define QUEUE_FULL_TEXT "server busy"
+// bytes of replies an event loop queues for a connection before it stops
+// decoding its frames (see HandleClientBytes)
+#define MULTIPLEX_REPLY_BATCH (64 * 1024)
 // connection  struct
 typedef struct {
   int socketFd;
+  // every listening socket (tcp and unix) new clients are accepted from
+  int listenerFds[MAX_LISTENERS];
+  int numListeners;
   int clientSockets[MAX_BUFFER];
   int numClients;
 } Connection;
@@ -32,14 +50,67 @@ typedef struct {
   pthread_mutex_t *clientListMutex;
   char dir[256];
   QUEUE Queue *Queue;
-  // clientSocketFd is used to have a local copy of
-  // the socket per connection
-  // using the value in conn causes the server to shit the bed
-  // and behave erraticaly
-  int clientSocketFd;
+  // attributes of the per client reader threads
+  const ThreadRole *clientThreads;
 } Multiplexer;
 
+// Acceptor - state of one accept thread. every acceptor owns its own
+// listening sockets so that SO_REUSEPORT listeners are drained in parallel
+typedef struct {
+  Multiplexer *mux;
+  int listenerFds[MAX_LISTENERS];
+  int numListeners;
+} Acceptor;
+
+// ClientContext - argument of a ClientHandler thread. it is heap allocated
+// per connection so concurrent accepts can't overwrite each other's socket
+typedef struct {
+  Multiplexer *mux;
+  int clientSocketFd;
+} ClientContext;
+
 void Disconnect(Multiplexer *data, int clientSocketFd);
 void *Multiplex(void *arg);
 void *ClientHandler(void *arg);
+// UringMultiplex - io_uring backend of Multiplex. a single thread accepts
+// and reads every connection of its acceptor with multishot requests
+void *UringMultiplex(void *arg);
+// AddClient - adds a client's fd to the list of client fds.
+// returns -1 when the list is full
+int AddClient(Multiplexer *mux, int clientSocketFd);
+// StartClientHandler - spawns the ClientHandler thread of a connection
+int StartClientHandler(Multiplexer *mux, int clientSocketFd);
+// MultiplexReplyQueue - takes a copy of a reply the event loop sends to fd
+// without waiting for it to be written. returns -1 when fd isn't read by
+// the loop
+typedef int (*MultiplexReplyQueue)(int fd, const void *reply, size_t len);
+// MultiplexEventLoop - the calling thread reads many connections , their
+// requests are rejected instead of waiting while the queue is full or they
+// are over a rate limit , and the replies sent while reading them (the
+// handshake , READY_REPLY and rejections) are handed to queue
+void MultiplexEventLoop(MultiplexReplyQueue queue);
+// RejectRequest - answers a request the server won't serve with an
+// ERROR_MESSAGE of text , framed like its replies would have been when it
+// is tagged
+void RejectRequest(int clientSocketFd, uint32_t tag, const char *text);
+// HandleClientFrame - acts on one frame read from a client and takes
+// ownership of recv_buffer. returns -1 when the client asked to leave or
+// sent a corrupt body , 1 when the connection moved to shared memory and 0
+// otherwise
+int HandleClientFrame(Multiplexer *mux, int clientSocketFd, uint16_t magic,
+                      uint16_t protocol, uint32_t payload_size,
+                      char *recv_buffer);
+// HandleClientBytes - decodes the frames received in data and hands them to
+// HandleClientFrame , skipping garbage up to the next valid header. garbage
+// carries the bytes skipped since the last valid frame across calls.
+// *consumed is set to the bytes used up and *pending to the size of the
+// incomplete frame left when its header is valid. returns like
+// HandleClientFrame , stopping at its first non zero result , and -1 once
+// more than MAX_FRAME_GARBAGE bytes were skipped. it also stops once
+// MULTIPLEX_REPLY_BATCH bytes of replies were handed to the
+// MultiplexReplyQueue , and before a SHM_ATTACH_REQUEST behind any , the
+// rest is decoded again once they were sent
+int HandleClientBytes(Multiplexer *mux, int clientSocketFd,
+                      const unsigned char *data, size_t len, size_t *garbage,
+                      size_t *consumed, size_t *pending);
 #endif
@@ -0,0 +1,606 @@
+#define _GNU_SOURCE
+#include "../uring/uring.h"
+#include "multiplexer.h"
+#include "../handoff/handoff.h"
+
+// submission / completion queue entries of an event loop ring
+#define URING_LOOP_ENTRIES 256
+// provided receive buffers , must be a power of two
+#define URING_RECV_BUFFERS 256
+#define URING_RECV_BUFFER_SIZE (16 * 1024)
+// bytes a connection may buffer while the loop's replies to it are unsent ,
+// its recv is cancelled past them until the peer reads
+#define URING_PAUSE_BYTES (4 * URING_RECV_BUFFER_SIZE)
+
+// user_data of every request : kind in the top byte , the generation of the
+// connection in the next 24 bits and the descriptor in the low 32 bits.
+// sends carry their UringOutput below the kind instead
+enum {
+  URING_ACCEPT = 1,
+  URING_RECV = 2,
+  URING_CANCEL = 3,
+  // the server is being replaced (see Handoff)
+  URING_HANDOFF = 4,
+  URING_HANDOFF_RETRY = 5,
+  URING_SEND = 6,
+  // waits for socket space after a send found none
+  URING_SEND_POLL = 7
+};
+#define URING_OUTPUT_MASK ((1ULL << 56) - 1)
+
+// UringOutput - replies of the loop to a connection (see QueueReply) ,
+// written by one IORING_OP_SEND at a time. it outlives its connection
+// while a request reading it is in flight
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+  // bytes at the start of data the peer got already
+  size_t sent;
+  // buffer the send in flight reads , data unless it grew meanwhile
+  unsigned char *inFlight;
+  int fd;
+  // a send or the poll for socket space is in flight
+  int busy;
+  // the connection was forgotten , the completion frees it
+  int orphaned;
+} UringOutput;
+
+// UringConnection - bytes of a connection that do not form a whole frame yet
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+  uint32_t generation;
+  // bytes skipped since its last valid frame
+  size_t garbage;
+  // its recv was cancelled to hand it to the new server
+  int leaving;
+  // bytes of a frame rejected past the memory hard cap still to drop
+  size_t discard;
+  UringOutput *output;
+  // 1 once its recv was cancelled because the peer doesn't read the
+  // replies , 2 once that recv ended
+  int paused;
+} UringConnection;
+
+// connections of the event loop running on the thread , for QueueReply
+static __thread UringRing *loopRing;
+static __thread UringConnection **loopConnections;
+// a send couldn't be queued , they are tried again before the next submit
+static __thread int sendsMissing;
+
+static uint64_t UserData(int kind, uint32_t generation, int fd) {
+  return ((uint64_t)kind << 56) | ((uint64_t)(generation & 0xFFFFFF) << 32) |
+         (uint32_t)fd;
+}
+
+static uint64_t OutputData(int kind, UringOutput *output) {
+  return ((uint64_t)kind << 56) | (uint64_t)(uintptr_t)output;
+}
+
+// LoopSqe - an sqe for a request of the event loop , or NULL when the
+// kernel takes none of the queued ones even after submitting them (a
+// completion queue overflowing makes io_uring_enter fail with EBUSY)
+static struct io_uring_sqe *LoopSqe(UringRing *ring, const char *request) {
+  struct io_uring_sqe *sqe = UringGetSqe(ring);
+  if (sqe == NULL)
+    fprintf(stderr, "[DEBUG] io_uring submission queue is full , no %s\n",
+            request);
+  return sqe;
+}
+
+// ArmAccept - returns -1 when the accept can't be queued , it is tried
+// again before the next submit (see ArmAccepts)
+static int ArmAccept(UringRing *ring, int listenerFd) {
+  struct io_uring_sqe *sqe = LoopSqe(ring, "accept");
+  if (sqe == NULL)
+    return -1;
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listenerFd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = UserData(URING_ACCEPT, 0, listenerFd);
+  return 0;
+}
+
+// ArmAccepts - arms the listeners of the acceptor marked in unarmed.
+// returns how many are still unarmed
+static int ArmAccepts(UringRing *ring, const Acceptor *acceptor,
+                      char *unarmed) {
+  int missing = 0;
+  for (int i = 0; i < acceptor->numListeners; i++) {
+    if (unarmed[i] && ArmAccept(ring, acceptor->listenerFds[i]) == 0)
+      unarmed[i] = 0;
+    missing += unarmed[i];
+  }
+  return missing;
+}
+
+// ArmRecv - returns -1 when the recv can't be queued , the connection is
+// dropped then
+static int ArmRecv(UringRing *ring, int fd, UringConnection *connection) {
+  struct io_uring_sqe *sqe = LoopSqe(ring, "recv");
+  if (sqe == NULL)
+    return -1;
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = UserData(URING_RECV, connection->generation, fd);
+  return 0;
+}
+
+// ArmSend - writes the unsent replies of output. returns -1 when the send
+// can't be queued , it is tried again before the next submit
+static int ArmSend(UringRing *ring, UringOutput *output) {
+  struct io_uring_sqe *sqe = LoopSqe(ring, "send");
+  if (sqe == NULL) {
+    sendsMissing = 1;
+    return -1;
+  }
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = output->fd;
+  sqe->addr = (uint64_t)(uintptr_t)(output->data + output->sent);
+  sqe->len = output->len - output->sent;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = OutputData(URING_SEND, output);
+  output->inFlight = output->data;
+  output->busy = 1;
+  return 0;
+}
+
+// ArmSendPoll - waits for socket space before sending again
+static int ArmSendPoll(UringRing *ring, UringOutput *output) {
+  struct io_uring_sqe *sqe = LoopSqe(ring, "send poll");
+  if (sqe == NULL) {
+    sendsMissing = 1;
+    return -1;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = output->fd;
+  sqe->poll32_events = POLLOUT;
+  sqe->user_data = OutputData(URING_SEND_POLL, output);
+  output->busy = 1;
+  return 0;
+}
+
+// ArmMissingSends - queues the sends ArmSend couldn't
+static void ArmMissingSends(UringRing *ring, UringConnection **connections) {
+  sendsMissing = 0;
+  for (int fd = 0; fd < MAX_SESSIONS && !sendsMissing; fd++) {
+    UringOutput *output =
+        connections[fd] != NULL ? connections[fd]->output : NULL;
+    if (output != NULL && !output->busy && output->sent < output->len)
+      ArmSend(ring, output);
+  }
+}
+
+static void FreeOutput(UringOutput *output) {
+  if (output->inFlight != output->data)
+    free(output->inFlight);
+  free(output->data);
+  free(output);
+}
+
+// QueueReply - the MultiplexReplyQueue of the loop , the bytes are appended
+// to the replies of fd and sent once the ones before them were
+static int QueueReply(int fd, const void *reply, size_t len) {
+  if (fd < 0 || fd >= MAX_SESSIONS || loopConnections[fd] == NULL)
+    return -1;
+  UringOutput *output = loopConnections[fd]->output;
+  if (output->len + len > output->cap) {
+    size_t cap = output->cap ? output->cap * 2 : MAX_BUFFER;
+    while (cap < output->len + len)
+      cap *= 2;
+    // the send in flight keeps reading the old buffer until it completes
+    unsigned char *data = output->data == output->inFlight
+                              ? malloc(cap)
+                              : realloc(output->data, cap);
+    if (data == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    if (output->data == output->inFlight)
+      memcpy(data, output->data, output->len);
+    output->data = data;
+    MemoryCharge(fd, cap - output->cap);
+    output->cap = cap;
+  }
+  memcpy(output->data + output->len, reply, len);
+  output->len += len;
+  if (!output->busy)
+    ArmSend(loopRing, output);
+  return 0;
+}
+
+// Sent - handles the completion of a send of output , or of its poll for
+// socket space. returns 1 once every reply was sent , -1 when the
+// connection failed and 0 otherwise
+static int Sent(UringRing *ring, UringOutput *output, int kind, int res) {
+  output->busy = 0;
+  if (kind == URING_SEND) {
+    if (output->inFlight != output->data)
+      free(output->inFlight);
+    output->inFlight = NULL;
+  }
+  if (output->orphaned) {
+    FreeOutput(output);
+    return 0;
+  }
+  if (kind == URING_SEND && res == -EAGAIN) {
+    ArmSendPoll(ring, output);
+    return 0;
+  }
+  if (kind == URING_SEND && res <= 0)
+    return -1;
+  if (kind == URING_SEND)
+    output->sent += res;
+  if (output->sent < output->len) {
+    ArmSend(ring, output);
+    return 0;
+  }
+  output->sent = output->len = 0;
+  return 1;
+}
+
+// requests of the handoff still to be armed (see ArmHandoffs)
+enum {
+  HANDOFF_ARM_ACCEPT = 1,
+  HANDOFF_ARM_CONNECTION = 2,
+  HANDOFF_ARM_RETRY = 4
+};
+
+// ArmHandoff - waits for one of the handoff wake descriptors. returns -1
+// when the poll can't be queued
+static int ArmHandoff(UringRing *ring, int wakeFd) {
+  struct io_uring_sqe *sqe = LoopSqe(ring, "handoff poll");
+  if (sqe == NULL)
+    return -1;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = wakeFd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = UserData(URING_HANDOFF, 0, wakeFd);
+  return 0;
+}
+
+// ArmHandoffRetry - sweeps the connections again in HANDOFF_RETRY_MS.
+// returns -1 when the timeout can't be queued
+static int ArmHandoffRetry(UringRing *ring) {
+  static struct __kernel_timespec delay = {0, HANDOFF_RETRY_MS * 1000000LL};
+  struct io_uring_sqe *sqe = LoopSqe(ring, "handoff retry");
+  if (sqe == NULL)
+    return -1;
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->addr = (uint64_t)(uintptr_t)&delay;
+  sqe->len = 1;
+  sqe->user_data = UserData(URING_HANDOFF_RETRY, 0, 0);
+  return 0;
+}
+
+// ArmHandoffs - arms the handoff requests set in pending , like accepts
+// they are tried again before the next submit. returns the ones left
+static int ArmHandoffs(UringRing *ring, int pending) {
+  if ((pending & HANDOFF_ARM_ACCEPT) &&
+      ArmHandoff(ring, HandoffAcceptWakeFd()) == 0)
+    pending &= ~HANDOFF_ARM_ACCEPT;
+  if ((pending & HANDOFF_ARM_CONNECTION) &&
+      ArmHandoff(ring, HandoffConnectionWakeFd()) == 0)
+    pending &= ~HANDOFF_ARM_CONNECTION;
+  if ((pending & HANDOFF_ARM_RETRY) && ArmHandoffRetry(ring) == 0)
+    pending &= ~HANDOFF_ARM_RETRY;
+  return pending;
+}
+
+// CancelRequest - returns -1 when the cancel can't be queued
+static int CancelRequest(UringRing *ring, uint64_t userData, int fd) {
+  struct io_uring_sqe *sqe = LoopSqe(ring, "cancel");
+  if (sqe == NULL)
+    return -1;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = userData;
+  sqe->user_data = UserData(URING_CANCEL, 0, fd);
+  return 0;
+}
+
+// SweepConnections - cancels the recv of every connection so the idle ones
+// can be handed off once it completed. returns the number of connections
+static int SweepConnections(UringRing *ring, UringConnection **connections) {
+  int count = 0;
+  for (int fd = 0; fd < MAX_SESSIONS; fd++) {
+    UringConnection *connection = connections[fd];
+    if (connection == NULL)
+      continue;
+    count++;
+    if (connection->leaving || connection->paused ||
+        connection->output->len > 0 || !SessionIdle(fd))
+      continue;
+    // the next sweep tries again when the cancel can't be queued
+    if (CancelRequest(ring, UserData(URING_RECV, connection->generation, fd),
+                      fd) == 0)
+      connection->leaving = 1;
+  }
+  return count;
+}
+
+// ForgetConnection - cancels the multishot recv of fd and drops its state.
+// completions still in flight for it are recognised by their generation
+static void ForgetConnection(UringRing *ring, UringConnection **connections,
+                             int fd) {
+  UringConnection *connection = connections[fd];
+  // the recv holds the socket open , shutting it down ends the recv too
+  if (CancelRequest(ring, UserData(URING_RECV, connection->generation, fd),
+                    fd) == -1)
+    shutdown(fd, SHUT_RDWR);
+  connections[fd] = NULL;
+  MemoryRelease(fd, connection->cap + connection->output->cap);
+  if (connection->output->busy)
+    connection->output->orphaned = 1;
+  else
+    FreeOutput(connection->output);
+  free(connection->data);
+  free(connection);
+}
+
+// EndConnection - lets go of fd once serving it returned result , -1 when
+// it is gone and 1 when it moved to shared memory
+static void EndConnection(UringRing *ring, Multiplexer *mux,
+                          UringConnection **connections, int fd, int result) {
+  ForgetConnection(ring, connections, fd);
+  if (result == 1) {
+    // shared memory connections are read by their own ClientHandler
+    if (StartClientHandler(mux, fd) == -1)
+      Disconnect(mux, fd);
+    return;
+  }
+  fprintf(stderr, "Client on socket %d has disconnected.\n", fd);
+  Disconnect(mux, fd);
+}
+
+// ParseFrames - hands every complete frame buffered for the connection to
+// HandleClientFrame. returns its last non zero result
+static int ParseFrames(Multiplexer *mux, int fd, UringConnection *connection) {
+  size_t consumed, pending;
+  int result = HandleClientBytes(mux, fd, connection->data, connection->len,
+                                 &connection->garbage, &consumed, &pending);
+  if (result == -1)
+    return -1;
+  memmove(connection->data, connection->data + consumed,
+          connection->len - consumed);
+  connection->len -= consumed;
+  if (pending > URING_RECV_BUFFER_SIZE &&
+      !MemoryAdmit(pending - connection->len)) {
+    // the frame is dropped as it arrives instead of buffered
+    fprintf(stderr,
+            "[DEBUG] rejecting a %zu byte frame of socket %d , %zu bytes are "
+            "held\n",
+            pending - PROTOCOL_HEADER_LEN, fd, MemoryHeld(-1));
+    RejectRequest(fd, SessionTakePendingTag(fd), MEMORY_OVERLOADED_TEXT);
+    connection->discard = pending - connection->len;
+    connection->len = 0;
+  }
+  if (connection->len == 0 && connection->cap > URING_RECV_BUFFER_SIZE) {
+    // the buffer grown for a large frame is given back
+    MemoryRelease(fd, connection->cap);
+    free(connection->data);
+    connection->data = NULL;
+    connection->cap = 0;
+  }
+  return result;
+}
+
+// ServeFrames - parses the frames buffered for the connection while none of
+// the loop's replies to it are unsent , HandleClientBytes stops once it
+// queued a batch of them. a peer that doesn't read them gets its recv
+// cancelled once it buffered URING_PAUSE_BYTES , and resumed when they were
+// sent. returns like ParseFrames
+static int ServeFrames(UringRing *ring, Multiplexer *mux, int fd,
+                       UringConnection *connection) {
+  if (connection->output->len == 0 && connection->len > 0) {
+    int result = ParseFrames(mux, fd, connection);
+    if (result != 0)
+      return result;
+  }
+  if (connection->output->len > 0) {
+    if (connection->paused == 0 && connection->len > URING_PAUSE_BYTES &&
+        CancelRequest(ring, UserData(URING_RECV, connection->generation, fd),
+                      fd) == 0)
+      connection->paused = 1;
+    return 0;
+  }
+  // a recv whose cancel is still in flight is armed again when it ends
+  int stopped = connection->paused == 2;
+  connection->paused = 0;
+  if (stopped && ArmRecv(ring, fd, connection) == -1)
+    return -1;
+  return 0;
+}
+
+// AppendBytes - buffers received bytes until they form whole frames
+static void AppendBytes(int fd, UringConnection *connection,
+                        const unsigned char *src, size_t len) {
+  size_t skip = len < connection->discard ? len : connection->discard;
+  connection->discard -= skip;
+  src += skip;
+  len -= skip;
+  if (connection->len + len > connection->cap) {
+    size_t cap = connection->cap ? connection->cap * 2 : URING_RECV_BUFFER_SIZE;
+    while (cap < connection->len + len)
+      cap *= 2;
+    connection->data = realloc(connection->data, cap);
+    if (connection->data == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    MemoryCharge(fd, cap - connection->cap);
+    connection->cap = cap;
+  }
+  memcpy(connection->data + connection->len, src, len);
+  connection->len += len;
+}
+
+void *UringMultiplex(void *arg) {
+  Acceptor *acceptor = (Acceptor *)arg;
+  Multiplexer *mux = acceptor->mux;
+  UringRing ring;
+  UringBufferRing buffers;
+  if (UringInit(&ring, URING_LOOP_ENTRIES) == -1) {
+    perror("io_uring setup failed , falling back to accept threads: ");
+    return Multiplex(arg);
+  }
+  if (UringSetupBufferRing(&ring, &buffers, 0, URING_RECV_BUFFERS,
+                           URING_RECV_BUFFER_SIZE) == -1) {
+    perror("io_uring buffer ring failed , falling back to accept threads: ");
+    UringExit(&ring);
+    return Multiplex(arg);
+  }
+  UringConnection **connections = calloc(MAX_SESSIONS, sizeof(*connections));
+  if (connections == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  uint32_t generation = 0;
+  int accepting = 1;
+  // listeners whose multishot accept has to be armed again
+  char unarmed[MAX_LISTENERS];
+  memset(unarmed, 1, sizeof(unarmed));
+  int missing = acceptor->numListeners;
+  loopRing = &ring;
+  loopConnections = connections;
+  MultiplexEventLoop(QueueReply);
+  int handoffs = HandoffAcceptWakeFd() != -1
+                     ? HANDOFF_ARM_ACCEPT | HANDOFF_ARM_CONNECTION
+                     : 0;
+
+  while (1) {
+    if (accepting && missing > 0)
+      missing = ArmAccepts(&ring, acceptor, unarmed);
+    if (handoffs != 0)
+      handoffs = ArmHandoffs(&ring, handoffs);
+    if (sendsMissing)
+      ArmMissingSends(&ring, connections);
+    // one enter submits everything queued by the previous batch of
+    // completions and waits for the next one
+    if (UringSubmit(&ring, 1) == -1 && errno != EINTR) {
+      perror("io_uring enter failed: ");
+      continue;
+    }
+    struct io_uring_cqe *cqe;
+    while ((cqe = UringPeekCqe(&ring)) != NULL) {
+      int kind = cqe->user_data >> 56;
+      uint32_t cqeGeneration = (cqe->user_data >> 32) & 0xFFFFFF;
+      int fd = (int)(cqe->user_data & 0xFFFFFFFF);
+      int res = cqe->res;
+      unsigned flags = cqe->flags;
+      UringCqeSeen(&ring);
+
+      if (kind == URING_SEND || kind == URING_SEND_POLL) {
+        UringOutput *output =
+            (UringOutput *)(uintptr_t)(cqe->user_data & URING_OUTPUT_MASK);
+        int outputFd = output->fd;
+        int sent = Sent(&ring, output, kind, res);
+        // the frames left behind the replies are served now
+        if (sent == 1)
+          sent = ServeFrames(&ring, mux, outputFd, connections[outputFd]);
+        if (sent != 0)
+          EndConnection(&ring, mux, connections, outputFd, sent);
+        continue;
+      }
+      if (kind == URING_HANDOFF && fd == HandoffAcceptWakeFd()) {
+        // the listeners belong to the new server now
+        accepting = 0;
+        for (int i = 0; i < acceptor->numListeners; i++)
+          CancelRequest(&ring,
+                        UserData(URING_ACCEPT, 0, acceptor->listenerFds[i]),
+                        acceptor->listenerFds[i]);
+        continue;
+      }
+      if (kind == URING_HANDOFF || kind == URING_HANDOFF_RETRY) {
+        if (SweepConnections(&ring, connections) > 0)
+          handoffs |= HANDOFF_ARM_RETRY;
+        continue;
+      }
+      if (kind == URING_ACCEPT) {
+        if (res >= 0) {
+          fprintf(stderr, " accepted new client. Socket: %d\n", res);
+          if (res >= MAX_SESSIONS || AddClient(mux, res) == -1) {
+            close(res);
+          } else {
+            UringConnection *connection = calloc(1, sizeof(UringConnection));
+            if (connection != NULL)
+              connection->output = calloc(1, sizeof(UringOutput));
+            if (connection == NULL || connection->output == NULL) {
+              perror("Couldn't allocate anymore memory!");
+              exit(EXIT_FAILURE);
+            }
+            connection->output->fd = res;
+            connection->generation = ++generation;
+            connections[res] = connection;
+            if (ArmRecv(&ring, res, connection) == -1) {
+              ForgetConnection(&ring, connections, res);
+              Disconnect(mux, res);
+            }
+          }
+        }
+        if (!(flags & IORING_CQE_F_MORE)) {
+          for (int i = 0; i < acceptor->numListeners; i++)
+            if (acceptor->listenerFds[i] == fd && !unarmed[i]) {
+              unarmed[i] = 1;
+              missing++;
+            }
+        }
+        continue;
+      }
+      if (kind != URING_RECV)
+        continue;
+
+      UringConnection *connection = connections[fd];
+      int current = connection != NULL &&
+                    (connection->generation & 0xFFFFFF) == cqeGeneration;
+      if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (current && res > 0) {
+          TraceReceived(fd, connection->len);
+          AppendBytes(fd, connection,
+                      buffers.buffers + (size_t)bid * buffers.bufferSize, res);
+        }
+        UringRecycleBuffer(&buffers, bid);
+      }
+      if (!current)
+        continue;
+      int result = 0;
+      // -ENOBUFS : every buffer was in use , the request has to be re armed.
+      // -ECANCELED : it was cancelled to hand the connection off
+      if (res > 0)
+        result = ServeFrames(&ring, mux, fd, connection);
+      else if (res != -ENOBUFS && res != -ECANCELED)
+        result = -1;
+      if (result != 0) {
+        EndConnection(&ring, mux, connections, fd, result);
+      } else if (!(flags & IORING_CQE_F_MORE)) {
+        // a connection with nothing buffered nor in flight goes to the new
+        // server , the others are served on until the next sweep
+        if (connection->leaving && connection->len == 0 &&
+            connection->output->len == 0 && SessionIdle(fd) &&
+            HandoffConnection(fd) == 0) {
+          fprintf(stderr, "Client on socket %d was handed to the new server.\n",
+                  fd);
+          ForgetConnection(&ring, connections, fd);
+          Disconnect(mux, fd);
+          continue;
+        }
+        connection->leaving = 0;
+        // a paused connection is read again once its replies were sent
+        if (connection->paused) {
+          connection->paused = 2;
+          continue;
+        }
+        if (ArmRecv(&ring, fd, connection) == -1) {
+          ForgetConnection(&ring, connections, fd);
+          Disconnect(mux, fd);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,218 @@
+// sigtimedwait , prctl
+#define _GNU_SOURCE
+#include "prefork.h"
+#include "../uuid/uuid.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// slot of this worker process in the shared segment , NULL in the master
+// and outside of prefork mode
+static PreforkSlot *self;
+
+static const char *counterNames[PREFORK_COUNTERS] = {"accepted", "closed",
+                                                     "requests"};
+
+void PreforkCount(PreforkCounter counter) {
+  if (self != NULL)
+    __atomic_fetch_add(&self->counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t NowMs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Spawn - forks worker index. the connections of the process it replaces
+// died with it , so they count as closed. a slot that can't be forked is
+// left with pid 0 and tried again by Retry
+static void Spawn(PreforkSlot *slots, int index, PreforkServe serve,
+                  void *arg, const sigset_t *mask) {
+  PreforkSlot *slot = &slots[index];
+  slot->counters[PREFORK_CLOSED] = slot->counters[PREFORK_ACCEPTED];
+  slot->startedMs = NowMs();
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == -1) {
+    uint64_t backoff = PREFORK_RESTART_MS;
+    for (uint32_t i = 0; i < slot->forkFailures; i++)
+      if ((backoff *= 2) >= PREFORK_RETRY_MAX_MS) {
+        backoff = PREFORK_RETRY_MAX_MS;
+        break;
+      }
+    slot->pid = 0;
+    slot->forkFailures++;
+    slot->retryMs = NowMs() + backoff;
+    fprintf(stderr, "[DEBUG] worker process %d could not be forked (%s) , "
+                    "retrying in %llu ms\n",
+            index, strerror(errno), (unsigned long long)backoff);
+    return;
+  }
+  slot->forkFailures = 0;
+  if (pid == 0) {
+    sigprocmask(SIG_SETMASK, mask, NULL);
+    // workers don't outlive the master
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() == 1)
+      exit(0);
+    // ids must not repeat across processes forked from the same master
+    InitializeUUID();
+    self = slot;
+    serve(index, slot->restarts, arg);
+    exit(0);
+  }
+  slot->pid = pid;
+  fprintf(stderr, "[DEBUG] worker process %d started , pid %d\n", index,
+          (int)pid);
+}
+
+// Report - the totals of every worker , and every worker when all is set
+static void Report(const PreforkSlot *slots, int processes, int all) {
+  uint64_t totals[PREFORK_COUNTERS] = {0};
+  uint32_t restarts = 0;
+  for (int i = 0; i < processes; i++) {
+    uint64_t counters[PREFORK_COUNTERS];
+    for (int c = 0; c < PREFORK_COUNTERS; c++) {
+      counters[c] =
+          __atomic_load_n(&slots[i].counters[c], __ATOMIC_RELAXED);
+      totals[c] += counters[c];
+    }
+    restarts += slots[i].restarts;
+    if (all)
+      fprintf(stderr,
+              "[DEBUG] worker process %d pid %d : open %llu , accepted "
+              "%llu , requests %llu , restarts %u\n",
+              i, (int)slots[i].pid,
+              (unsigned long long)(counters[PREFORK_ACCEPTED] -
+                                   counters[PREFORK_CLOSED]),
+              (unsigned long long)counters[PREFORK_ACCEPTED],
+              (unsigned long long)counters[PREFORK_REQUESTS],
+              slots[i].restarts);
+  }
+  fprintf(stderr, "[DEBUG] %d worker processes : open %llu", processes,
+          (unsigned long long)(totals[PREFORK_ACCEPTED] -
+                               totals[PREFORK_CLOSED]));
+  for (int c = 0; c < PREFORK_COUNTERS; c++)
+    fprintf(stderr, " , %s %llu", counterNames[c],
+            (unsigned long long)totals[c]);
+  fprintf(stderr, " , restarts %u\n", restarts);
+}
+
+// Reap - restarts the workers that died
+static void Reap(PreforkSlot *slots, int processes, PreforkServe serve,
+                 void *arg, const sigset_t *mask) {
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    int index = 0;
+    while (index < processes && slots[index].pid != pid)
+      index++;
+    if (index == processes)
+      continue;
+    if (WIFSIGNALED(status))
+      fprintf(stderr, "[DEBUG] worker process %d pid %d killed by signal "
+                      "%d , restarting it\n",
+              index, (int)pid, WTERMSIG(status));
+    else
+      fprintf(stderr, "[DEBUG] worker process %d pid %d exited with %d , "
+                      "restarting it\n",
+              index, (int)pid, WEXITSTATUS(status));
+    slots[index].restarts++;
+    // a crash loop is started again from the timer instead
+    if (NowMs() - slots[index].startedMs < PREFORK_MIN_UPTIME_MS) {
+      slots[index].pid = 0;
+      slots[index].retryMs = NowMs() + PREFORK_RESTART_MS;
+      continue;
+    }
+    Spawn(slots, index, serve, arg, mask);
+  }
+}
+
+// Retry - forks the slots left without a process whose retry is due , and
+// returns when the next one is due , or UINT64_MAX when none waits
+static uint64_t Retry(PreforkSlot *slots, int processes, PreforkServe serve,
+                      void *arg, const sigset_t *mask) {
+  uint64_t next = UINT64_MAX;
+  for (int i = 0; i < processes; i++) {
+    if (slots[i].pid != 0)
+      continue;
+    if (slots[i].retryMs <= NowMs())
+      Spawn(slots, i, serve, arg, mask);
+    if (slots[i].pid == 0 && slots[i].retryMs < next)
+      next = slots[i].retryMs;
+  }
+  return next;
+}
+
+int PreforkRun(int processes, PreforkServe serve, void *arg) {
+  size_t size = processes * sizeof(PreforkSlot);
+  PreforkSlot *slots = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (slots == MAP_FAILED) {
+    perror("prefork shared memory failed: ");
+    return -1;
+  }
+  memset(slots, 0, size);
+  // the master only waits for signals , workers get the mask back
+  sigset_t waited, mask;
+  sigemptyset(&waited);
+  sigaddset(&waited, SIGCHLD);
+  sigaddset(&waited, SIGTERM);
+  sigaddset(&waited, SIGINT);
+  sigaddset(&waited, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &waited, &mask);
+  for (int i = 0; i < processes; i++)
+    Spawn(slots, i, serve, arg, &mask);
+
+  uint64_t reported = 0;
+  uint64_t reportMs = NowMs() + PREFORK_REPORT_MS;
+  while (1) {
+    // the report timer goes off early for the slots waiting to be forked
+    // again
+    uint64_t wakeMs = Retry(slots, processes, serve, arg, &mask);
+    if (wakeMs > reportMs)
+      wakeMs = reportMs;
+    uint64_t now = NowMs();
+    uint64_t waitMs = wakeMs > now ? wakeMs - now : 0;
+    struct timespec timeout = {waitMs / 1000, (waitMs % 1000) * 1000000L};
+    int sig = sigtimedwait(&waited, NULL, &timeout);
+    if (sig == SIGTERM || sig == SIGINT)
+      break;
+    if (sig == SIGCHLD) {
+      Reap(slots, processes, serve, arg, &mask);
+    } else if (sig == SIGUSR1) {
+      Report(slots, processes, 1);
+    } else if (sig == -1 && errno == EAGAIN && NowMs() >= reportMs) {
+      reportMs = NowMs() + PREFORK_REPORT_MS;
+      // report only when something happened since the last time
+      uint64_t activity = 0;
+      for (int i = 0; i < processes; i++)
+        for (int c = 0; c < PREFORK_COUNTERS; c++)
+          activity +=
+              __atomic_load_n(&slots[i].counters[c], __ATOMIC_RELAXED);
+      if (activity != reported)
+        Report(slots, processes, 0);
+      reported = activity;
+    }
+  }
+
+  fprintf(stderr, "[DEBUG] stopping %d worker processes\n", processes);
+  for (int i = 0; i < processes; i++)
+    if (slots[i].pid > 0)
+      kill(slots[i].pid, SIGTERM);
+  for (int i = 0; i < processes; i++)
+    if (slots[i].pid > 0)
+      waitpid(slots[i].pid, NULL, 0);
+  Report(slots, processes, 1);
+  sigprocmask(SIG_SETMASK, &mask, NULL);
+  munmap(slots, size);
+  return 0;
+}
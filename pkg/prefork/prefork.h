@@ -0,0 +1,60 @@
+#ifndef PREFORK
+#define PREFORK
+#include <stdint.h>
+#include <sys/types.h>
+// Prefork - multi process server. the master binds the listeners and forks
+// one process per worker , every one of them running the whole server on
+// the inherited listeners with its own queue , sessions and cache. a worker
+// that crashes only takes its own connections down , the master starts it
+// again. workers count what they do in a segment of shared memory the
+// master reports from.
+
+// the master reports the totals this often when they changed
+#define PREFORK_REPORT_MS 10000
+// a worker that dies sooner than this after it started is started again
+// only after PREFORK_RESTART_MS , so a crash loop doesn't spin the master
+#define PREFORK_MIN_UPTIME_MS 1000
+#define PREFORK_RESTART_MS 1000
+// a slot whose fork failed is tried again after PREFORK_RESTART_MS , twice
+// as long after every failure in a row up to this
+#define PREFORK_RETRY_MAX_MS 60000
+#define MAX_PREFORK_PROCESSES 256
+// longest ".<index>.<restarts>" a worker process appends to the files it
+// writes , NUL included
+#define PREFORK_SUFFIX_LEN 16
+
+// what a worker process counts
+typedef enum {
+  PREFORK_ACCEPTED = 0,
+  PREFORK_CLOSED,
+  PREFORK_REQUESTS,
+  PREFORK_COUNTERS
+} PreforkCounter;
+
+// PreforkSlot - the shared memory of one worker process , one cache line
+// each so workers don't write to each other's lines
+typedef struct {
+  uint64_t counters[PREFORK_COUNTERS];
+  pid_t pid;
+  uint32_t restarts;
+  // CLOCK_MONOTONIC milliseconds of the last start
+  uint64_t startedMs;
+  // while pid is 0 , when the master forks the slot again and how many
+  // forks of it failed in a row
+  uint64_t retryMs;
+  uint32_t forkFailures;
+} __attribute__((aligned(64))) PreforkSlot;
+
+// PreforkServe - runs the server in worker process index , which was
+// started restarts times before in its slot
+typedef void (*PreforkServe)(int index, uint32_t restarts, void *arg);
+
+// PreforkRun - forks processes workers running serve and restarts the ones
+// that die until the master gets SIGTERM or SIGINT , then stops them.
+// SIGUSR1 prints the counters of every worker. returns -1 when the shared
+// segment can't be created
+int PreforkRun(int processes, PreforkServe serve, void *arg);
+// PreforkCount - adds one to counter of the calling worker process , does
+// nothing outside of prefork mode
+void PreforkCount(PreforkCounter counter);
+#endif
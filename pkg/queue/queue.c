@@ -1,4 +1,7 @@
 #include "queue.h"
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 // NewQueue - Initializes a new Queue
 Queue *NewQueue(void) {
@@ -8,8 +11,8 @@ Queue *NewQueue(void) {
     exit(EXIT_FAILURE);
   }
 
+  memset(q, 0, sizeof(Queue));
   q->empty = 1;
-  q->full = q->head = q->tail = 0;
   q->mutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
   if (q->mutex == NULL) {
     perror("Couldn't allocate anymore memory!");
@@ -31,6 +34,11 @@ Queue *NewQueue(void) {
   }
   pthread_cond_init(q->notEmpty, NULL);
 
+  q->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (q->wakeFd == -1) {
+    perror("queue eventfd failed: ");
+    exit(EXIT_FAILURE);
+  }
   return q;
 }
 // QueueDestroy - destroys a queue
@@ -41,30 +49,122 @@ void DestroyQueue(Queue *q) {
   free(q->mutex);
   free(q->notFull);
   free(q->notEmpty);
+  close(q->wakeFd);
   free(q);
 }
 
-// Push to end of Queue
-void Push(Queue *q, int origin, const Message msg) {
+static void UpdateState(Queue *q) {
+  int total = q->numParked;
+  for (int i = 0; i < QUEUE_CLASSES; i++)
+    total += q->classes[i].count;
+  q->empty = total == q->numParked;
+  q->full = total >= MAX_BUFFER;
+  if (!q->empty && q->watchers > 0 && !q->woken) {
+    uint64_t one = 1;
+    q->woken = write(q->wakeFd, &one, sizeof(one)) == sizeof(one);
+  }
+}
 
-  q->messages[q->tail] = msg;
-  q->tail++;
-  if (q->tail == MAX_BUFFER)
-    q->tail = 0;
-  if (q->tail == q->head)
-    q->full = 1;
-  q->empty = 0;
+static void Append(Queue *q, const Message msg) {
+  QueueClass *class = &q->classes[MessagePriority(&msg)];
+  class->messages[class->tail] = msg;
+  class->tail++;
+  if (class->tail == MAX_BUFFER)
+    class->tail = 0;
+  class->count++;
 }
 
-// Pop front of Queue
-Message Pop(Queue *q) {
-  Message entity = q->messages[q->head];
-  q->head++;
-  if (q->head == MAX_BUFFER)
-    q->head = 0;
-  if (q->head == q->tail)
-    q->empty = 1;
-  q->full = 0;
+static void Prepend(Queue *q, const Message msg) {
+  QueueClass *class = &q->classes[MessagePriority(&msg)];
+  class->head = class->head == 0 ? MAX_BUFFER - 1 : class->head - 1;
+  class->messages[class->head] = msg;
+  class->count++;
+}
 
+// classes of the registry , interactive for the values no protocol uses
+#define CLASS_OF(name, value, body, priority, ...)                             \
+  [value] = PRIORITY_##priority,
+static const unsigned char protocolClasses[PROTOCOL_TABLE_SIZE] = {
+    PROTOCOLS(CLASS_OF)};
+
+Priority MessagePriority(const Message *msg) {
+  if (msg->protocol >= PROTOCOL_TABLE_SIZE)
+    return PRIORITY_INTERACTIVE;
+  return protocolClasses[msg->protocol];
+}
+
+// Push to end of the Queue of the message's class
+void Push(Queue *q, int origin, Message msg) {
+  // a transfer queued again keeps the time it was first queued at
+  if (msg.resume == NULL)
+    msg.trace.at[TRACE_ENQUEUE] = TraceNow();
+  Append(q, msg);
+  UpdateState(q);
+}
+
+// Pop front of the next class in turn , a class gets its weight in pops
+// before it has to let the other one go
+Message Pop(Queue *q) {
+  static const int weights[QUEUE_CLASSES] = {QUEUE_INTERACTIVE_WEIGHT,
+                                             QUEUE_BULK_WEIGHT};
+  QueueClass *class = &q->classes[q->current];
+  while (class->count == 0 || q->credits == 0) {
+    q->current = (q->current + 1) % QUEUE_CLASSES;
+    q->credits = weights[q->current];
+    class = &q->classes[q->current];
+  }
+  q->credits--;
+  Message entity = class->messages[class->head];
+  class->head++;
+  if (class->head == MAX_BUFFER)
+    class->head = 0;
+  class->count--;
+  UpdateState(q);
   return entity;
 }
+
+int ClaimConnection(Queue *q, const Message *msg) {
+  int fd = msg->message_sender;
+  // a transfer queued again still holds its connection
+  if (fd < 0 || fd >= MAX_SESSIONS || msg->resume != NULL)
+    return 1;
+  if (q->busy[fd]) {
+    q->parked[q->numParked++] = *msg;
+    UpdateState(q);
+    return 0;
+  }
+  q->busy[fd] = 1;
+  return 1;
+}
+
+int ReleaseConnection(Queue *q, int fd) {
+  int queued = 0;
+  int kept = 0;
+  if (fd < 0 || fd >= MAX_SESSIONS)
+    return 0;
+  q->busy[fd] = 0;
+  // parked messages arrived before the ones of fd still queued , they go
+  // back in front of their class , in the order they arrived
+  for (int i = q->numParked; i-- > 0;) {
+    if (q->parked[i].message_sender == fd) {
+      Prepend(q, q->parked[i]);
+      queued++;
+    }
+  }
+  for (int i = 0; i < q->numParked; i++) {
+    if (q->parked[i].message_sender != fd)
+      q->parked[kept++] = q->parked[i];
+  }
+  q->numParked = kept;
+  UpdateState(q);
+  return queued;
+}
+
+void QueueWatch(Queue *q) {
+  uint64_t count;
+  if (q->woken && read(q->wakeFd, &count, sizeof(count)) == sizeof(count))
+    q->woken = 0;
+  q->watchers++;
+}
+
+void QueueUnwatch(Queue *q) { q->watchers--; }
@@ -5,20 +5,69 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-// Queue - Queue implementation using a char array.
+
+// priority classes of the queue , see MessagePriority
+typedef enum {
+  // short requests a user waits on , like echo , list or change dir
+  PRIORITY_INTERACTIVE = 0,
+  // transfers of whole files
+  PRIORITY_BULK = 1,
+  QUEUE_CLASSES = 2
+} Priority;
+// messages popped from a class in a row while the other class waits
+#define QUEUE_INTERACTIVE_WEIGHT 8
+#define QUEUE_BULK_WEIGHT 1
+
+// QueueClass - messages of one priority class in a ring buffer
 typedef struct {
   Message messages[MAX_BUFFER];
-  int head, tail, full, empty;
+  int head, tail, count;
+} QueueClass;
+
+// Queue - one FIFO per priority class , popped by weighted round robin so
+// interactive requests are not stuck behind bulk transfers. messages of a
+// connection that is still being answered are parked until it is released
+// (see ClaimConnection) , so one connection's replies never interleave.
+typedef struct {
+  QueueClass classes[QUEUE_CLASSES];
+  // class popped from and how many more it may pop before the next one
+  int current, credits;
+  // messages waiting for their connection to be released
+  Message parked[MAX_BUFFER];
+  int numParked;
+  // set while a worker answers a message of the connection
+  unsigned char busy[MAX_SESSIONS];
+  // full counts parked messages , so they always fit back in their class
+  int full, empty;
   // mutex is used for functions to lock on before modifying
   // the array and condition variables for when it's not empty or full.
   pthread_mutex_t *mutex;
   pthread_cond_t *notFull, *notEmpty;
+  // eventfd readable once a message is queued while workers wait on their
+  // coroutines instead of notEmpty (see QueueWatch) , and those workers
+  int wakeFd;
+  int watchers, woken;
 } Queue;
 
 // Prototype decl
 Queue *NewQueue(void);
 void DestroyQueue(Queue *q);
-void Push(Queue *q, int origin, const Message msg);
+void Push(Queue *q, int origin, Message msg);
 Message Pop(Queue *q);
+// MessagePriority - class a message is queued in
+Priority MessagePriority(const Message *msg);
+// ClaimConnection - marks the connection of a popped message as being
+// answered and returns 1 , or parks the message and returns 0 when another
+// worker is still answering it
+int ClaimConnection(Queue *q, const Message *msg);
+// ReleaseConnection - ends the answer on fd and queues its parked
+// messages again. returns the number of messages queued
+int ReleaseConnection(Queue *q, int fd);
+// QueueWatch - called with the mutex held by a worker about to wait on
+// wakeFd while the queue is empty , drains it so it is readable only once
+// a message is queued from now on
+void QueueWatch(Queue *q);
+// QueueUnwatch - called with the mutex held once the worker is back
+void QueueUnwatch(Queue *q);
 
 #endif
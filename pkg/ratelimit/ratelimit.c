@@ -0,0 +1,283 @@
+// nanosleep , clock_gettime
+#define _GNU_SOURCE
+#include "ratelimit.h"
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// slots of the address table probed for an address
+#define RATE_PROBES 8
+
+// Bucket - tokens left , negative after a frame larger than the bucket ,
+// and when they were last counted
+typedef struct {
+  double tokens;
+  uint64_t last;
+} Bucket;
+
+// Buckets - the buckets of one RateLimit
+typedef struct {
+  Bucket requests;
+  Bucket bytes;
+} Buckets;
+
+// ConnectionLimits - buckets of a connection , indexed by its descriptor.
+// only the thread reading the connection touches them
+typedef struct {
+  Buckets connection;
+  Buckets protocols[RATE_MAX_PROTOCOLS];
+  // bytes sent by the workers since the reader last took them from the
+  // connection bucket
+  uint64_t sent;
+  // ipv4 addresses are mapped to ipv6 , unix sockets have none
+  unsigned char address[16];
+  int hasAddress;
+} ConnectionLimits;
+
+// AddressLimits - buckets shared by the connections of an address
+typedef struct {
+  unsigned char address[16];
+  int used;
+  uint64_t seen;
+  Buckets buckets;
+} AddressLimits;
+
+static RateLimits limits;
+static int enabled;
+// slot of the buckets of a protocol in ConnectionLimits , -1 when it has no
+// limit of its own
+static int protocolSlots[PROTOCOL_TABLE_SIZE];
+static ConnectionLimits *connections;
+static AddressLimits *addresses;
+static pthread_mutex_t addressMutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int eventLoop;
+
+// the protocols of the registry , the ones a limit may name
+#define PROTOCOL_KNOWN(name, value, ...) [value] = 1,
+static const char knownProtocols[PROTOCOL_TABLE_SIZE] = {
+    PROTOCOLS(PROTOCOL_KNOWN)};
+
+static int Limited(const RateLimit *limit) {
+  return limit->requests > 0 || limit->bytes > 0;
+}
+
+int ParseRateLimit(RateLimit *limit, const char *spec) {
+  char *end;
+  limit->requests = strtod(spec, &end);
+  limit->bytes = 0;
+  if (end == spec || limit->requests < 0)
+    return -1;
+  if (*end == ':') {
+    spec = end + 1;
+    limit->bytes = strtod(spec, &end);
+    if (end == spec || limit->bytes < 0)
+      return -1;
+  }
+  return *end == '\0' ? 0 : -1;
+}
+
+int ParseProtocolRateLimit(RateLimits *config, const char *spec) {
+  unsigned char protocol = spec[0];
+  if (protocol >= PROTOCOL_TABLE_SIZE || !knownProtocols[protocol] ||
+      spec[1] != '=' || ParseRateLimit(&config->protocols[protocol],
+                                       spec + 2) == -1)
+    return -1;
+  int limited = 0;
+  for (int i = 0; i < PROTOCOL_TABLE_SIZE; i++)
+    limited += Limited(&config->protocols[i]);
+  return limited > RATE_MAX_PROTOCOLS ? -1 : 0;
+}
+
+void RateLimitInit(const RateLimits *config) {
+  int slots = 0;
+  limits = *config;
+  enabled = Limited(&limits.connection) || Limited(&limits.address);
+  for (int i = 0; i < PROTOCOL_TABLE_SIZE; i++) {
+    protocolSlots[i] = -1;
+    if (Limited(&limits.protocols[i]) && slots < RATE_MAX_PROTOCOLS) {
+      protocolSlots[i] = slots++;
+      enabled = 1;
+    }
+  }
+  if (!enabled)
+    return;
+  connections = calloc(MAX_SESSIONS, sizeof(ConnectionLimits));
+  addresses = calloc(RATE_ADDRESSES, sizeof(AddressLimits));
+  if (connections == NULL || addresses == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void RateLimitAccept(int fd) {
+  if (!enabled || fd < 0 || fd >= MAX_SESSIONS)
+    return;
+  ConnectionLimits *connection = &connections[fd];
+  struct sockaddr_storage peer;
+  socklen_t len = sizeof(peer);
+  memset(connection, 0, sizeof(*connection));
+  if (!Limited(&limits.address) ||
+      getpeername(fd, (struct sockaddr *)&peer, &len) == -1)
+    return;
+  if (peer.ss_family == AF_INET) {
+    struct sockaddr_in *in = (struct sockaddr_in *)&peer;
+    connection->address[10] = 0xFF;
+    connection->address[11] = 0xFF;
+    memcpy(&connection->address[12], &in->sin_addr, 4);
+    connection->hasAddress = 1;
+  } else if (peer.ss_family == AF_INET6) {
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&peer;
+    memcpy(connection->address, &in6->sin6_addr, 16);
+    connection->hasAddress = 1;
+  }
+}
+
+void RateLimitEventLoop(void) { eventLoop = 1; }
+
+static uint64_t NowNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Refill - adds the tokens earned since they were last counted , a bucket
+// holds one second of its rate and starts full
+static void Refill(Bucket *bucket, double rate, uint64_t now) {
+  if (bucket->last == 0) {
+    bucket->tokens = rate;
+  } else {
+    bucket->tokens += (now - bucket->last) * rate / 1e9;
+    if (bucket->tokens > rate)
+      bucket->tokens = rate;
+  }
+  bucket->last = now;
+}
+
+// Wait - nanoseconds until amount tokens are there. an amount larger than
+// the bucket only needs it full , its tokens then go negative
+static uint64_t Wait(const Bucket *bucket, double rate, double amount) {
+  if (amount > rate)
+    amount = rate;
+  if (bucket->tokens >= amount)
+    return 0;
+  return (uint64_t)((amount - bucket->tokens) * 1e9 / rate) + 1;
+}
+
+// WaitBuckets - refills the buckets of limit and returns the nanoseconds
+// until a request of bytes bytes fits in both
+static uint64_t WaitBuckets(Buckets *buckets, const RateLimit *limit,
+                            double bytes, uint64_t now) {
+  uint64_t wait = 0, bytesWait = 0;
+  if (limit->requests > 0) {
+    Refill(&buckets->requests, limit->requests, now);
+    wait = Wait(&buckets->requests, limit->requests, 1);
+  }
+  if (limit->bytes > 0) {
+    Refill(&buckets->bytes, limit->bytes, now);
+    bytesWait = Wait(&buckets->bytes, limit->bytes, bytes);
+  }
+  return wait > bytesWait ? wait : bytesWait;
+}
+
+static void TakeBuckets(Buckets *buckets, const RateLimit *limit,
+                        double bytes) {
+  if (limit->requests > 0)
+    buckets->requests.tokens -= 1;
+  if (limit->bytes > 0)
+    buckets->bytes.tokens -= bytes;
+}
+
+// FindAddress - the buckets of address , taking the slot of the least
+// recently seen address when it has none. called with addressMutex held
+static Buckets *FindAddress(const unsigned char *address, uint64_t now) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < 16; i++)
+    hash = (hash ^ address[i]) * 16777619u;
+  AddressLimits *victim = NULL;
+  for (int i = 0; i < RATE_PROBES; i++) {
+    AddressLimits *slot = &addresses[(hash + i) % RATE_ADDRESSES];
+    if (slot->used && memcmp(slot->address, address, 16) == 0) {
+      slot->seen = now;
+      return &slot->buckets;
+    }
+    if (victim == NULL || !slot->used ||
+        (victim->used && slot->seen < victim->seen))
+      victim = slot;
+  }
+  memset(victim, 0, sizeof(*victim));
+  memcpy(victim->address, address, 16);
+  victim->used = 1;
+  victim->seen = now;
+  return &victim->buckets;
+}
+
+int RateLimitAdmit(int fd, uint16_t protocol, uint32_t bytes) {
+  if (!enabled || fd < 0 || fd >= MAX_SESSIONS)
+    return 0;
+  ConnectionLimits *connection = &connections[fd];
+  int slot = protocol < PROTOCOL_TABLE_SIZE ? protocolSlots[protocol] : -1;
+  int byAddress = connection->hasAddress && Limited(&limits.address);
+  // the replies sent since the last request , the bucket is refilled first
+  // so they aren't forgiven by the cap
+  uint64_t sent = __atomic_exchange_n(&connection->sent, 0, __ATOMIC_RELAXED);
+  if (sent > 0) {
+    Refill(&connection->connection.bytes, limits.connection.bytes, NowNs());
+    connection->connection.bytes.tokens -= sent;
+  }
+  while (1) {
+    uint64_t now = NowNs(), wait, other;
+    Buckets *address = NULL;
+    wait = WaitBuckets(&connection->connection, &limits.connection, bytes,
+                       now);
+    if (slot != -1) {
+      other = WaitBuckets(&connection->protocols[slot],
+                          &limits.protocols[protocol], bytes, now);
+      wait = other > wait ? other : wait;
+    }
+    if (byAddress) {
+      pthread_mutex_lock(&addressMutex);
+      address = FindAddress(connection->address, now);
+      other = WaitBuckets(address, &limits.address, bytes, now);
+      wait = other > wait ? other : wait;
+    }
+    // the request takes its tokens from every bucket or from none
+    if (wait == 0) {
+      TakeBuckets(&connection->connection, &limits.connection, bytes);
+      if (slot != -1)
+        TakeBuckets(&connection->protocols[slot],
+                    &limits.protocols[protocol], bytes);
+      if (address != NULL)
+        TakeBuckets(address, &limits.address, bytes);
+    }
+    if (byAddress)
+      pthread_mutex_unlock(&addressMutex);
+    if (wait == 0)
+      return 0;
+    if (!limits.delay || eventLoop)
+      return -1;
+    struct timespec delay = {wait / 1000000000ULL, wait % 1000000000ULL};
+    nanosleep(&delay, NULL);
+  }
+}
+
+void RateLimitCharge(int fd, uint64_t bytes) {
+  if (!enabled || fd < 0 || fd >= MAX_SESSIONS)
+    return;
+  ConnectionLimits *connection = &connections[fd];
+  // the reader owns the connection bucket , it takes these on its next
+  // request
+  if (limits.connection.bytes > 0)
+    __atomic_fetch_add(&connection->sent, bytes, __ATOMIC_RELAXED);
+  if (connection->hasAddress && limits.address.bytes > 0) {
+    uint64_t now = NowNs();
+    pthread_mutex_lock(&addressMutex);
+    Bucket *bucket = &FindAddress(connection->address, now)->bytes;
+    Refill(bucket, limits.address.bytes, now);
+    bucket->tokens -= bytes;
+    pthread_mutex_unlock(&addressMutex);
+  }
+}
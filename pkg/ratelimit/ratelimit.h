@@ -0,0 +1,64 @@
+#ifndef RATELIMIT
+#define RATELIMIT
+#include "../shared/consts.h"
+#include <stdint.h>
+// RateLimit - token buckets on the requests a connection sends , checked
+// where a request is read , before it is queued. requests/s and bytes/s
+// (header and body of the request frames) are limited per connection , per
+// source address (every connection from one ip) and per protocol of a
+// connection. the bytes sent back are charged to the bytes buckets of the
+// connection and of its address too , after they went out , so a download
+// leaves them in debt and the next requests wait for it. a bucket holds
+// one second of its rate , so a client that waited may burst up to it. a
+// request over one of its limits is rejected with an ERROR_MESSAGE , or
+// when delaying is configured waits for the tokens , which stops reading
+// its connection. event loops serving many connections (the uring
+// backend) can't wait and reject.
+
+// protocols that can have a limit of their own
+#define RATE_MAX_PROTOCOLS 8
+// source addresses followed at once , the least recently seen one is
+// forgotten when a new one doesn't fit
+#define RATE_ADDRESSES 4096
+// body of the ERROR_MESSAGE a rejected request gets
+#define RATE_LIMITED_TEXT "rate limited"
+
+// RateLimit - requests and bytes per second , 0 is unlimited
+typedef struct {
+  double requests;
+  double bytes;
+} RateLimit;
+
+// RateLimits - every configured limit
+typedef struct {
+  RateLimit connection;
+  RateLimit address;
+  // per connection , indexed by protocol
+  RateLimit protocols[PROTOCOL_TABLE_SIZE];
+  // wait for tokens instead of rejecting
+  int delay;
+} RateLimits;
+
+// ParseRateLimit - reads 'requests[:bytes]' like 100:1048576 into limit.
+// returns -1 when it is malformed
+int ParseRateLimit(RateLimit *limit, const char *spec);
+// ParseProtocolRateLimit - reads 'C=requests[:bytes]' , C being the
+// character of a protocol like L , into limits. returns -1 when it is
+// malformed or too many protocols are limited
+int ParseProtocolRateLimit(RateLimits *limits, const char *spec);
+// RateLimitInit - enforces limits from now on , nothing is checked when
+// none is set
+void RateLimitInit(const RateLimits *limits);
+// RateLimitAccept - starts the buckets of the connection accepted on fd
+void RateLimitAccept(int fd);
+// RateLimitEventLoop - the calling thread reads many connections , its
+// requests over a limit are rejected instead of delayed
+void RateLimitEventLoop(void);
+// RateLimitAdmit - takes the tokens of a request of protocol with a frame
+// of bytes bytes read from fd , waiting for them when delaying. returns 0
+// when it can be served and -1 when it must be rejected
+int RateLimitAdmit(int fd, uint16_t protocol, uint32_t bytes);
+// RateLimitCharge - takes bytes sent to fd from the bytes buckets of its
+// connection and its address , from any thread
+void RateLimitCharge(int fd, uint64_t bytes);
+#endif
@@ -0,0 +1,318 @@
+#include "server.h"
+#include <getopt.h>
+
+// options without a short form
+enum {
+  OPT_ACCEPTOR_CPUS = 256,
+  OPT_WORKER_CPUS,
+  OPT_CLIENT_CPUS,
+  OPT_STACK_SIZE,
+  OPT_FILE_CACHE,
+  OPT_CAPTURE,
+  OPT_TRACE,
+  OPT_HANDOFF,
+  OPT_TAKEOVER,
+  OPT_TAKEOVER_CONNECTIONS,
+  OPT_LIMIT_CONNECTION,
+  OPT_LIMIT_ADDRESS,
+  OPT_LIMIT_PROTOCOL,
+  OPT_LIMIT_DELAY,
+  OPT_DURABLE_UPLOADS,
+  OPT_MEMORY_SOFT,
+  OPT_MEMORY_HARD,
+  OPT_COROUTINES,
+  OPT_COROUTINE_STACK,
+};
+
+static const struct option options[] = {
+    {"unix", required_argument, 0, 'u'},
+    {"no-tcp", no_argument, 0, 'n'},
+    {"listeners", required_argument, 0, 'l'},
+    {"backlog", required_argument, 0, 'b'},
+    {"reuseport-cpu", no_argument, 0, 'c'},
+    {"io-backend", required_argument, 0, 'i'},
+    {"workers", required_argument, 0, 'w'},
+    {"processes", required_argument, 0, 'p'},
+    {"coroutines", required_argument, 0, OPT_COROUTINES},
+    {"coroutine-stack-kb", required_argument, 0, OPT_COROUTINE_STACK},
+    {"acceptor-cpus", required_argument, 0, OPT_ACCEPTOR_CPUS},
+    {"worker-cpus", required_argument, 0, OPT_WORKER_CPUS},
+    {"client-cpus", required_argument, 0, OPT_CLIENT_CPUS},
+    {"stack-size", required_argument, 0, OPT_STACK_SIZE},
+    {"file-cache-mb", required_argument, 0, OPT_FILE_CACHE},
+    {"capture", required_argument, 0, OPT_CAPTURE},
+    {"trace", required_argument, 0, OPT_TRACE},
+    {"handoff", required_argument, 0, OPT_HANDOFF},
+    {"takeover", required_argument, 0, OPT_TAKEOVER},
+    {"takeover-connections", no_argument, 0, OPT_TAKEOVER_CONNECTIONS},
+    {"limit-connection", required_argument, 0, OPT_LIMIT_CONNECTION},
+    {"limit-address", required_argument, 0, OPT_LIMIT_ADDRESS},
+    {"limit-protocol", required_argument, 0, OPT_LIMIT_PROTOCOL},
+    {"limit-delay", no_argument, 0, OPT_LIMIT_DELAY},
+    {"durable-uploads", no_argument, 0, OPT_DURABLE_UPLOADS},
+    {"memory-soft-mb", required_argument, 0, OPT_MEMORY_SOFT},
+    {"memory-hard-mb", required_argument, 0, OPT_MEMORY_HARD},
+    {"config", required_argument, 0, 'f'},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}};
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "%s [options] [port]\n"
+          "  -u, --unix PATH   also listen on a unix socket "
+          "(prefix with @ for the abstract namespace)\n"
+          "  -n, --no-tcp      only listen on the unix socket\n"
+          "  -l, --listeners N number of SO_REUSEPORT tcp listeners, each "
+          "with its own accept thread (default 1)\n"
+          "  -b, --backlog N   listen backlog of every socket (default "
+          "SOMAXCONN)\n"
+          "  -c, --reuseport-cpu\n"
+          "                    steer connections to the listener of the cpu "
+          "that received them\n"
+          "  -i, --io-backend threads|uring\n"
+          "                    connection I/O engine (default threads)\n"
+          "  -w, --workers N   request handler threads (default 1)\n"
+          "  -p, --processes N fork N worker processes sharing the "
+          "listeners , restarted when they crash\n"
+          "      --coroutines N\n"
+          "                    requests every worker keeps in progress on "
+          "coroutines , 0 answers one at a time (default %d)\n"
+          "      --coroutine-stack-kb KB\n"
+          "                    stack of every coroutine , at least %d "
+          "(default %d)\n"
+          "      --acceptor-cpus LIST\n"
+          "      --worker-cpus LIST\n"
+          "      --client-cpus LIST\n"
+          "                    pin accept / event loop , request handler and "
+          "per client threads round robin to cpus like 0-3,8\n"
+          "      --stack-size KB\n"
+          "                    stack of every server thread (default %d)\n"
+          "      --file-cache-mb MB\n"
+          "                    memory for caching downloaded files , 0 "
+          "disables it (default %d)\n"
+          "      --capture FILE\n"
+          "                    record every frame clients send to FILE , "
+          "for cmd/replay\n"
+          "      --trace FILE\n"
+          "                    stamp every request at each stage and write "
+          "the last ones to FILE , for cmd/trace\n"
+          "      --handoff PATH\n"
+          "                    wait on the unix socket PATH for a new server "
+          "taking over\n"
+          "      --takeover PATH\n"
+          "                    take the listeners over from the server "
+          "waiting on PATH\n"
+          "      --takeover-connections\n"
+          "                    take its idle connections over too\n"
+          "      --limit-connection REQUESTS[:BYTES]\n"
+          "      --limit-address REQUESTS[:BYTES]\n"
+          "                    requests and bytes per second of every "
+          "connection , of every source address\n"
+          "      --limit-protocol C=REQUESTS[:BYTES]\n"
+          "                    the same for the requests of protocol C of "
+          "every connection , repeatable\n"
+          "      --limit-delay delay requests over a limit instead of "
+          "rejecting them\n"
+          "      --durable-uploads\n"
+          "                    acknowledge uploads once they are synced to "
+          "disk , syncs are batched\n"
+          "      --memory-soft-mb MB\n"
+          "                    past it the connections holding the most "
+          "memory stop being read\n"
+          "      --memory-hard-mb MB\n"
+          "                    past it new requests are rejected (both "
+          "default to 0 , no cap)\n"
+          "  -f, --config FILE read 'option = value' lines , one per long "
+          "option above\n",
+          name, DEFAULT_COROUTINES, MIN_COROUTINE_STACK_SIZE / 1024,
+          DEFAULT_COROUTINE_STACK_SIZE / 1024,
+          DEFAULT_THREAD_STACK_SIZE / 1024, DEFAULT_FILE_CACHE_MB);
+}
+
+void DefaultServerConfig(ServerConfig *config) {
+  memset(config, 0, sizeof(*config));
+  config->port = 8080;
+  config->tcpEnabled = 1;
+  config->listeners = 1;
+  config->backlog = SOMAXCONN;
+  config->workerThreads.count = 1;
+  config->fileCacheBytes = (size_t)DEFAULT_FILE_CACHE_MB << 20;
+  config->acceptorThreads.stackSize = DEFAULT_THREAD_STACK_SIZE;
+  config->workerThreads.stackSize = DEFAULT_THREAD_STACK_SIZE;
+  config->clientThreads.stackSize = DEFAULT_THREAD_STACK_SIZE;
+  config->coroutines = DEFAULT_COROUTINES;
+  config->coroutineStackSize = DEFAULT_COROUTINE_STACK_SIZE;
+}
+
+// ApplyServerOption - applies one option given on the command line or in a
+// config file. returns -1 when its value is invalid
+static int ApplyServerOption(ServerConfig *config, int opt, const char *arg) {
+  switch (opt) {
+  case 'u':
+    strncpy(config->unixPath, arg, UNIX_PATH_LEN - 1);
+    break;
+  case 'n':
+    config->tcpEnabled = 0;
+    break;
+  case 'l':
+    config->listeners = strtol(arg, NULL, 0);
+    break;
+  case 'b':
+    config->backlog = strtol(arg, NULL, 0);
+    break;
+  case 'c':
+    config->reusePortCpuFilter = 1;
+    break;
+  case 'i':
+    if (strcmp(arg, "uring") == 0)
+      config->ioBackend = IO_BACKEND_URING;
+    else if (strcmp(arg, "threads") == 0)
+      config->ioBackend = IO_BACKEND_THREADS;
+    else
+      return -1;
+    break;
+  case 'w':
+    config->workerThreads.count = strtol(arg, NULL, 0);
+    if (config->workerThreads.count < 1)
+      return -1;
+    break;
+  case 'p':
+    config->processes = strtol(arg, NULL, 0);
+    if (config->processes < 0 || config->processes > MAX_PREFORK_PROCESSES)
+      return -1;
+    break;
+  case OPT_ACCEPTOR_CPUS:
+    return ParseCpuList(&config->acceptorThreads, arg);
+  case OPT_WORKER_CPUS:
+    return ParseCpuList(&config->workerThreads, arg);
+  case OPT_CLIENT_CPUS:
+    return ParseCpuList(&config->clientThreads, arg);
+  case OPT_STACK_SIZE: {
+    size_t stackSize = strtoul(arg, NULL, 0) * 1024;
+    config->acceptorThreads.stackSize = stackSize;
+    config->workerThreads.stackSize = stackSize;
+    config->clientThreads.stackSize = stackSize;
+    break;
+  }
+  case OPT_COROUTINES:
+    config->coroutines = strtol(arg, NULL, 0);
+    return config->coroutines < 0 ? -1 : 0;
+  case OPT_COROUTINE_STACK:
+    config->coroutineStackSize = strtoul(arg, NULL, 0) * 1024;
+    return config->coroutineStackSize < MIN_COROUTINE_STACK_SIZE ? -1 : 0;
+  case OPT_FILE_CACHE:
+    config->fileCacheBytes = strtoul(arg, NULL, 0) << 20;
+    break;
+  case OPT_CAPTURE:
+    strncpy(config->capturePath, arg, CAPTURE_PATH_LEN - 1);
+    break;
+  case OPT_TRACE:
+    strncpy(config->tracePath, arg, TRACE_PATH_LEN - 1);
+    break;
+  case OPT_HANDOFF:
+    strncpy(config->handoffPath, arg, UNIX_PATH_LEN - 1);
+    break;
+  case OPT_TAKEOVER:
+    strncpy(config->takeoverPath, arg, UNIX_PATH_LEN - 1);
+    break;
+  case OPT_TAKEOVER_CONNECTIONS:
+    config->takeoverConnections = 1;
+    break;
+  case OPT_LIMIT_CONNECTION:
+    return ParseRateLimit(&config->rateLimits.connection, arg);
+  case OPT_LIMIT_ADDRESS:
+    return ParseRateLimit(&config->rateLimits.address, arg);
+  case OPT_LIMIT_PROTOCOL:
+    return ParseProtocolRateLimit(&config->rateLimits, arg);
+  case OPT_LIMIT_DELAY:
+    config->rateLimits.delay = 1;
+    break;
+  case OPT_DURABLE_UPLOADS:
+    config->durableUploads = 1;
+    break;
+  case OPT_MEMORY_SOFT:
+    config->memorySoftBytes = strtoul(arg, NULL, 0) << 20;
+    break;
+  case OPT_MEMORY_HARD:
+    config->memoryHardBytes = strtoul(arg, NULL, 0) << 20;
+    break;
+  case 'f':
+    return LoadServerConfigFile(config, arg);
+  default:
+    return -1;
+  }
+  return 0;
+}
+
+int LoadServerConfigFile(ServerConfig *config, const char *path) {
+  char line[MAX_BUFFER];
+  int lineNumber = 0;
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    perror("Couldn't open config file");
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineNumber++;
+    char *key = Trim(line);
+    if (key[0] == '\0' || key[0] == '#')
+      continue;
+    char *value = strchr(key, '=');
+    if (value != NULL)
+      *value++ = '\0';
+    key = Trim(key);
+    const struct option *option = options;
+    while (option->name != NULL && strcmp(option->name, key) != 0)
+      option++;
+    if (option->name == NULL || option->val == 'f' || option->val == 'h' ||
+        (option->has_arg == required_argument && value == NULL) ||
+        ApplyServerOption(config, option->val,
+                          value != NULL ? Trim(value) : NULL) == -1) {
+      fprintf(stderr, "%s:%d: invalid option '%s'\n", path, lineNumber, key);
+      fclose(fp);
+      return -1;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+void ParseServerConfig(ServerConfig *config, int argc, char *argv[]) {
+  int opt;
+  DefaultServerConfig(config);
+  while ((opt = getopt_long(argc, argv, "u:nl:b:ci:w:p:f:h", options,
+                            NULL)) != -1) {
+    if (opt == 'h' || opt == '?' ||
+        ApplyServerOption(config, opt, optarg) == -1) {
+      usage(argv[0]);
+      exit(opt == 'h' ? 0 : 1);
+    }
+  }
+  if (optind < argc)
+    config->port = strtol(argv[optind], NULL, 0);
+  if (!config->tcpEnabled && config->unixPath[0] == '\0') {
+    fprintf(stderr, "--no-tcp requires a unix socket path\n");
+    exit(1);
+  }
+  if (config->listeners < 1 || config->listeners > MAX_LISTENERS - 1) {
+    fprintf(stderr, "--listeners must be between 1 and %d\n",
+            MAX_LISTENERS - 1);
+    exit(1);
+  }
+  if (config->processes > 0 &&
+      (config->handoffPath[0] != '\0' || config->takeoverPath[0] != '\0')) {
+    fprintf(stderr, "--processes can't be combined with --handoff or "
+                    "--takeover\n");
+    exit(1);
+  }
+  // every worker process appends its own suffix to them , a path cut short
+  // would make workers share a file
+  if (config->processes > 0 &&
+      (strlen(config->capturePath) + PREFORK_SUFFIX_LEN > CAPTURE_PATH_LEN ||
+       strlen(config->tracePath) + PREFORK_SUFFIX_LEN > TRACE_PATH_LEN)) {
+    fprintf(stderr, "--capture and --trace paths must be shorter than %d "
+                    "bytes with --processes\n",
+            CAPTURE_PATH_LEN - PREFORK_SUFFIX_LEN + 1);
+    exit(1);
+  }
+}
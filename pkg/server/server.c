@@ -1,4 +1,7 @@
+#define _GNU_SOURCE
 #include "server.h"
+#include <linux/filter.h>
+#include <signal.h>
 
 void Bind(struct sockaddr_in *serverAddr, int socketFd, long port) {
   memset(serverAddr, 0, sizeof(*serverAddr));
@@ -11,34 +14,146 @@ void Bind(struct sockaddr_in *serverAddr, int socketFd, long port) {
     exit(1);
   }
 }
-void InitializeRPCHandlers(int socketFd) {
+void BindUnix(struct sockaddr_un *serverAddr, int socketFd, const char *path) {
+  socklen_t len = FillUnixAddress(serverAddr, path);
+  if (path[0] != '@')
+    unlink(path);
+  if (bind(socketFd, (struct sockaddr *)serverAddr, len) == -1) {
+    perror("Unix socket bind failed: ");
+    exit(1);
+  }
+}
+void EnableReusePort(int socketFd) {
+  int enable = 1;
+  if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEPORT, &enable,
+                 sizeof(enable)) == -1) {
+    perror("SO_REUSEPORT failed: ");
+    exit(1);
+  }
+}
+void AttachReusePortCpuFilter(int socketFd, int groupSize) {
+  // A = cpu ; A = A % groupSize ; return A
+  struct sock_filter code[] = {
+      {BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU},
+      {BPF_ALU | BPF_MOD | BPF_K, 0, 0, groupSize},
+      {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  struct sock_fprog program = {sizeof(code) / sizeof(code[0]), code};
+  if (setsockopt(socketFd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program,
+                 sizeof(program)) == -1)
+    perror("SO_ATTACH_REUSEPORT_CBPF failed , using kernel hashing: ");
+}
+// signals the server stops on , blocked in every thread but StopOnSignal
+static sigset_t stopSignals;
+
+// StopOnSignal - waits for SIGINT or SIGTERM and writes what the capture
+// and the trace still buffer before the process exits , the workers it
+// would otherwise join never return
+static void *StopOnSignal(void *arg) {
+  int sig;
+  sigwait(&stopSignals, &sig);
+  fprintf(stderr, "[DEBUG] stopping on signal %d\n", sig);
+  CaptureStop();
+  TraceStop();
+  exit(EXIT_SUCCESS);
+}
+
+void InitializeRPCHandlers(const ServerConfig *config, const int *socketFds,
+                           int numSockets) {
   Multiplexer mux;
-  mux.conn = malloc(sizeof *mux.conn);
-  mux.conn->numClients = 0;
-  mux.conn->socketFd = socketFd;
+  // blocked before any thread starts , so they all inherit the mask
+  pthread_t stopThread;
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+  if (pthread_create(&stopThread, NULL, StopOnSignal, NULL) == 0)
+    pthread_detach(stopThread);
+  else
+    pthread_sigmask(SIG_UNBLOCK, &stopSignals, NULL);
+  mux.conn = calloc(1, sizeof *mux.conn);
+  if (mux.conn == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  mux.conn->socketFd = socketFds[0];
+  for (int i = 0; i < numSockets && i < MAX_LISTENERS; i++)
+    mux.conn->listenerFds[mux.conn->numListeners++] = socketFds[i];
   mux.Queue = NewQueue();
   mux.clientListMutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
-  pthread_t connectionThread;
-  pthread_t payloadThread;
+  int numAcceptors = mux.conn->numListeners;
+  Acceptor acceptors[MAX_LISTENERS];
+  pthread_t connectionThreads[MAX_LISTENERS];
+  int numWorkers = config->workerThreads.count;
+  pthread_t *workerThreads = (pthread_t *)malloc(numWorkers * sizeof(pthread_t));
+  if (workerThreads == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  mux.clientThreads = &config->clientThreads;
+  FileCacheInit(config->fileCacheBytes);
+  if (config->capturePath[0] != '\0' &&
+      CaptureStart(config->capturePath) == -1)
+    exit(EXIT_FAILURE);
+  if (config->tracePath[0] != '\0' && TraceStart(config->tracePath) == -1)
+    exit(EXIT_FAILURE);
+  RateLimitInit(&config->rateLimits);
+  CommitStart(config->durableUploads);
+  MemoryInit(config->memorySoftBytes, config->memoryHardBytes);
+  CoroutineInit(config->coroutineStackSize, config->coroutines);
+  // sendfile has no MSG_NOSIGNAL , a client gone mid reply is a failed
+  // write and not the end of the server
+  signal(SIGPIPE, SIG_IGN);
   pthread_mutex_init(mux.clientListMutex, NULL);
-  // Start thread to handle new client connections
-  if ((pthread_create(&connectionThread, NULL, (void *)&Multiplex,
-                      (void *)&mux)) == 0) {
-    fprintf(stderr, " [DEBUG] Multiplexed Connection to client\n");
+  void *(*acceptLoop)(void *) = Multiplex;
+  if (config->ioBackend == IO_BACKEND_URING) {
+    if (UringAvailable()) {
+      acceptLoop = UringMultiplex;
+      UringEnableFileIo();
+      fprintf(stderr, "[DEBUG] using the io_uring backend\n");
+    } else {
+      fprintf(stderr, "[DEBUG] io_uring is not available on this kernel , "
+                      "using accept threads\n");
+    }
   }
+  // the wake descriptors of the accept loops are created first
+  if (config->handoffPath[0] != '\0' &&
+      HandoffListen(config->handoffPath, &mux) == -1)
+    exit(EXIT_FAILURE);
+  // Start one thread per listening socket to handle new client connections
+  for (int i = 0; i < numAcceptors; i++) {
+    acceptors[i].mux = &mux;
+    acceptors[i].listenerFds[0] = mux.conn->listenerFds[i];
+    acceptors[i].numListeners = 1;
+    if (SpawnThread(&connectionThreads[i], &config->acceptorThreads, i,
+                    "accept", acceptLoop, (void *)&acceptors[i]) == 0) {
+      fprintf(stderr, " [DEBUG] Multiplexed Connection to client\n");
+    }
+  }
+
+  TakeoverConnections(&mux);
 
   FD_ZERO(&(mux.readFds));
-  FD_SET(socketFd, &(mux.readFds));
+  FD_SET(socketFds[0], &(mux.readFds));
 
-  // Start thread to handle requests received
-  if ((pthread_create(&payloadThread, NULL, (void *)&ServerRequestHandler,
-                      (void *)&mux)) == 0) {
-    fprintf(stderr, "[DEBUG] Request handler started\n");
+  // Start the threads handling requests received , they all pop the same
+  // queue
+  for (int i = 0; i < numWorkers; i++) {
+    if (SpawnThread(&workerThreads[i], &config->workerThreads, i, "worker",
+                    ServerRequestHandler, (void *)&mux) == 0) {
+      fprintf(stderr, "[DEBUG] Request handler started\n");
+    }
   }
-  pthread_join(connectionThread, NULL);
-  pthread_join(payloadThread, NULL);
+  for (int i = 0; i < numAcceptors; i++)
+    pthread_join(connectionThreads[i], NULL);
+  for (int i = 0; i < numWorkers; i++)
+    pthread_join(workerThreads[i], NULL);
+  free(workerThreads);
+  CaptureStop();
+  TraceStop();
+  CommitStop();
   DestroyQueue(mux.Queue);
   pthread_mutex_destroy(mux.clientListMutex);
   free(mux.clientListMutex);
   free(mux.conn);
-}
\ No newline at end of file
+}
@@ -3,11 +3,98 @@
 #include "../handlers/handlers.h"
 #include "../multiplexer/multiplexer.h"
 #include "../queue/queue.h"
+#include "../cache/cache.h"
+#include "../capture/capture.h"
+#include "../trace/trace.h"
+#include "../handoff/handoff.h"
+#include "../prefork/prefork.h"
 #include "../shared/consts.h"
-// AddHandler - Spawns the new client handler thread
+#include "../uring/uring.h"
+#include <sys/un.h>
+// memory of the download cache unless configured otherwise
+#define DEFAULT_FILE_CACHE_MB 64
+// io backends the connection layer can run on
+enum {
+  // one blocking ClientHandler thread per connection
+  IO_BACKEND_THREADS = 0,
+  // one io_uring event loop per acceptor , falls back to threads
+  IO_BACKEND_URING = 1
+};
+// ServerConfig - runtime options of the server binary
+typedef struct {
+  // TCP port to listen on
+  long port;
+  // set to 0 to only listen on the unix socket
+  int tcpEnabled;
+  // unix socket path , a leading '@' selects the abstract namespace
+  // and an empty string disables the unix listener
+  char unixPath[UNIX_PATH_LEN];
+  // number of SO_REUSEPORT tcp listeners , each one gets its accept thread
+  int listeners;
+  // listen() backlog of every listening socket
+  int backlog;
+  // steer connections to the listener of the cpu that received them
+  int reusePortCpuFilter;
+  // IO_BACKEND_THREADS or IO_BACKEND_URING
+  int ioBackend;
+  // accept / event loop threads (one per listener) , request handler
+  // threads and per client reader threads
+  ThreadRole acceptorThreads;
+  ThreadRole workerThreads;
+  ThreadRole clientThreads;
+  // requests every worker keeps in progress on coroutines , 0 answers them
+  // one at a time , and the stack of each coroutine (see Coroutine)
+  int coroutines;
+  size_t coroutineStackSize;
+  // memory of the shared cache of downloaded files , 0 disables it
+  size_t fileCacheBytes;
+  // file recording inbound frames , empty when not capturing
+  char capturePath[CAPTURE_PATH_LEN];
+  // file the stage times of the last requests are written to , empty when
+  // not tracing
+  char tracePath[TRACE_PATH_LEN];
+  // unix socket a new server can take the listeners over from , empty
+  // when hot restart is disabled
+  char handoffPath[UNIX_PATH_LEN];
+  // start with the listeners of the server waiting on this path , and its
+  // idle connections when takeoverConnections is set
+  char takeoverPath[UNIX_PATH_LEN];
+  int takeoverConnections;
+  // worker processes forked by a master , each one running the whole
+  // server on the same listeners. 0 runs the server in this process
+  int processes;
+  // token buckets of the requests of connections , addresses and protocols
+  RateLimits rateLimits;
+  // acknowledge uploads once they are synced to disk (see Commit)
+  int durableUploads;
+  // bytes held for connections past which the biggest ones stop being read
+  // and new requests are rejected (see Memory) , 0 for no cap
+  size_t memorySoftBytes;
+  size_t memoryHardBytes;
+} ServerConfig;
+// DefaultServerConfig - fills config with the defaults of every option
+void DefaultServerConfig(ServerConfig *config);
+// ParseServerConfig - builds config from the command line , exits with the
+// usage text when it is invalid
+void ParseServerConfig(ServerConfig *config, int argc, char *argv[]);
+// LoadServerConfigFile - applies 'option = value' lines of a config file ,
+// option being any long command line option. returns -1 on error
+int LoadServerConfigFile(ServerConfig *config, const char *path);
+// AddHandler - Spawns one accept thread per listening socket
 // and message consumer thread based on passed value
 // it returns a multiplexer objext in which the trheads are wrapped
-void InitializeRPCHandlers(int socketFd);
+void InitializeRPCHandlers(const ServerConfig *config, const int *socketFds,
+                           int numSockets);
 // Bind - Sets up and binds the socket
 void Bind(struct sockaddr_in *serverAddr, int socketFd, long port);
+// BindUnix - Sets up and binds a unix domain socket to the given path.
+// stale socket files left behind by a previous run are removed first
+void BindUnix(struct sockaddr_un *serverAddr, int socketFd, const char *path);
+// EnableReusePort - lets several sockets bind the same port so that the
+// kernel load balances incoming connections between them
+void EnableReusePort(int socketFd);
+// AttachReusePortCpuFilter - attaches a classic BPF program to the
+// reuseport group of socketFd that picks listener (cpu % groupSize) , so a
+// connection is accepted by the listener of the cpu that received it
+void AttachReusePortCpuFilter(int socketFd, int groupSize);
 #endif
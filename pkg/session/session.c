@@ -0,0 +1,104 @@
+#include "session.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t capabilities[MAX_SESSIONS];
+static uint32_t pendingTags[MAX_SESSIONS];
+static uint32_t generations[MAX_SESSIONS];
+static uint32_t inFlight[MAX_SESSIONS];
+static uint32_t totalInFlight;
+static Uuid ids[MAX_SESSIONS];
+static char *uploadNames[MAX_SESSIONS];
+
+void SessionSetCapabilities(int fd, uint32_t caps) {
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    __atomic_store_n(&capabilities[fd], caps, __ATOMIC_RELEASE);
+}
+
+uint32_t SessionCapabilities(int fd) {
+  if (fd < 0 || fd >= MAX_SESSIONS)
+    return 0;
+  return __atomic_load_n(&capabilities[fd], __ATOMIC_ACQUIRE);
+}
+
+void SessionSetPendingTag(int fd, uint32_t tag) {
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    __atomic_store_n(&pendingTags[fd], tag, __ATOMIC_RELEASE);
+}
+
+uint32_t SessionTakePendingTag(int fd) {
+  if (fd < 0 || fd >= MAX_SESSIONS)
+    return 0;
+  return __atomic_exchange_n(&pendingTags[fd], 0, __ATOMIC_ACQ_REL);
+}
+
+uint32_t SessionGeneration(int fd) {
+  if (fd < 0 || fd >= MAX_SESSIONS)
+    return 0;
+  return __atomic_load_n(&generations[fd], __ATOMIC_ACQUIRE);
+}
+
+void SessionBeginRequest(int fd) {
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    __atomic_add_fetch(&inFlight[fd], 1, __ATOMIC_ACQ_REL);
+  __atomic_add_fetch(&totalInFlight, 1, __ATOMIC_ACQ_REL);
+}
+
+void SessionEndRequest(int fd) {
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    __atomic_sub_fetch(&inFlight[fd], 1, __ATOMIC_ACQ_REL);
+  __atomic_sub_fetch(&totalInFlight, 1, __ATOMIC_ACQ_REL);
+}
+
+int SessionIdle(int fd) {
+  if (fd < 0 || fd >= MAX_SESSIONS)
+    return 0;
+  // an announced upload is in flight until its FILE_REPLY was read , the
+  // new server wouldn't know its name
+  return __atomic_load_n(&inFlight[fd], __ATOMIC_ACQUIRE) == 0 &&
+         __atomic_load_n(&pendingTags[fd], __ATOMIC_ACQUIRE) == 0 &&
+         __atomic_load_n(&uploadNames[fd], __ATOMIC_ACQUIRE) == NULL;
+}
+
+uint32_t SessionsInFlight(void) {
+  return __atomic_load_n(&totalInFlight, __ATOMIC_ACQUIRE);
+}
+
+void SessionAssignId(int fd) {
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    GenerateUUIDBytes(&ids[fd]);
+}
+
+void SessionId(int fd, Uuid *id) {
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    *id = ids[fd];
+  else
+    memset(id, 0, sizeof(*id));
+}
+
+void SessionSetUploadName(int fd, const char *name) {
+  if (fd < 0 || fd >= MAX_SESSIONS)
+    return;
+  char *copy = malloc(strlen(name) + 1);
+  if (copy == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  strcpy(copy, name);
+  free(__atomic_exchange_n(&uploadNames[fd], copy, __ATOMIC_ACQ_REL));
+}
+
+char *SessionTakeUploadName(int fd) {
+  if (fd < 0 || fd >= MAX_SESSIONS)
+    return NULL;
+  return __atomic_exchange_n(&uploadNames[fd], NULL, __ATOMIC_ACQ_REL);
+}
+
+void SessionReset(int fd) {
+  SessionSetCapabilities(fd, 0);
+  SessionSetPendingTag(fd, 0);
+  free(SessionTakeUploadName(fd));
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    __atomic_add_fetch(&generations[fd], 1, __ATOMIC_ACQ_REL);
+}
@@ -0,0 +1,47 @@
+#ifndef SESSION
+#define SESSION
+#include "../shared/consts.h"
+#include "../uuid/uuid.h"
+// Session - per connection state negotiated with the peer , indexed by the
+// connection's descriptor. a descriptor starts with no capabilities and
+// must be reset before it is closed so the next connection reusing the
+// number starts clean.
+
+// SessionSetCapabilities - records the capabilities agreed on for fd
+void SessionSetCapabilities(int fd, uint32_t capabilities);
+// SessionCapabilities - returns the capabilities agreed on for fd
+uint32_t SessionCapabilities(int fd);
+// SessionSetPendingTag - remembers the id a REQUEST_TAG frame announced for
+// the next request read from fd
+void SessionSetPendingTag(int fd, uint32_t tag);
+// SessionTakePendingTag - returns the id announced for the request just
+// read from fd , 0 if it is untagged , and forgets it
+uint32_t SessionTakePendingTag(int fd);
+// SessionGeneration - changes every time fd is reset , so work queued for
+// a connection can tell it was replaced by a new one with the same number
+uint32_t SessionGeneration(int fd);
+// SessionBeginRequest - counts a request of fd handed to the workers
+void SessionBeginRequest(int fd);
+// SessionEndRequest - counts a request of fd the workers are done with
+void SessionEndRequest(int fd);
+// SessionIdle - returns 1 when fd has no request in flight , no id
+// announced for its next one and no upload waiting for its FILE_REPLY , it
+// can be handed to another server
+int SessionIdle(int fd);
+// SessionsInFlight - requests of every connection in flight
+uint32_t SessionsInFlight(void);
+// SessionAssignId - gives the connection on fd a new id , when it is
+// accepted
+void SessionAssignId(int fd);
+// SessionId - copies the id of the connection on fd to id
+void SessionId(int fd, Uuid *id);
+// SessionSetUploadName - remembers the name an UPLOAD_REQUEST gave the
+// file the next FILE_REPLY of fd carries
+void SessionSetUploadName(int fd, const char *name);
+// SessionTakeUploadName - returns the name announced for the upload just
+// read from fd , to free , or NULL , and forgets it
+char *SessionTakeUploadName(int fd);
+// SessionReset - forgets everything negotiated on fd. requests still in
+// flight are counted until the workers are done with them
+void SessionReset(int fd);
+#endif
@@ -1,32 +1,55 @@
 #ifndef CONSTS
 #define CONSTS
+#include "protocols.h"
 #include <stdint.h>
 #define MAX_BUFFER 4096
 #define PROTOCOL_HEADER_LEN 8
+// size of a REQUEST_TAG / REQUEST_DONE frame
+#define REQUEST_TAG_FRAME_LEN (PROTOCOL_HEADER_LEN + 4)
 // used when initialize char array size for uuid
 #define UUID_LENGTH 37
+// maximum number of listening sockets a server can accept on
+#define MAX_LISTENERS 16
+// size of sun_path in struct sockaddr_un
+#define UNIX_PATH_LEN 108
+// upper bound on descriptor numbers tracked per connection
+#define MAX_SESSIONS 65536
+// bytes in each direction of a shared memory channel (power of two)
+#define SHM_RING_CAPACITY (1 << 20)
+// set in the protocol field of a frame whose body is compressed
+#define PROTOCOL_FLAG_COMPRESSED 0x8000
+// bodies shorter than this are never compressed
+#define COMPRESSION_THRESHOLD 512
+// largest body a compressed frame may expand to
+#define MAX_INFLATED_BODY (256u << 20)
+// largest body of a frame that doesn't carry file contents (see
+// FrameBodyLimit) , anything bigger is taken for garbage
+#define MAX_CONTROL_BODY (1u << 20)
+// a connection sending this many bytes without a valid frame is dropped
+#define MAX_FRAME_GARBAGE (64u << 10)
 
+// directory uploads are stored in
+#define UPLOAD_DIR "./fixture/server/"
+// name of the uploads not announced by an UPLOAD_REQUEST
+#define UPLOAD_DEFAULT_NAME "recieved"
+
+// deepest directory a batch download descends into
+#define BATCH_MAX_DEPTH 32
+// directory the client stores batch downloads in
+#define BATCH_DIR "./fixture/client/batch/"
+
+// capabilities exchanged by HELLO_REQUEST / HELLO_REPLY as a bitmask
+enum {
+  // bodies may carry PROTOCOL_FLAG_COMPRESSED
+  CAP_COMPRESSION = 0x0001
+};
+// capabilities this build supports
+#define SUPPORTED_CAPABILITIES CAP_COMPRESSION
+
+// MessageType - the protocol of a frame , generated from the registry in
+// protocols.h
 typedef enum {
-  // 'A' in hex
-  ECHO_REQUEST = 0x0042,
-  // 'a' in hex
-  ECHO_REPLY = 0x0062,
-  // 'D' in hex
-  DOWNLOAD_REQUEST = 0x0044,
-  // 'U' in hex
-  UPLOAD_REQUEST = 0x0055,
-  // 'R' in hex
-  READY_REPLY = 0x0052,
-  // 'F' in hex
-  FILE_REPLY = 0x0046,
-  // 'P' in hex
-  CHANGE_DIR_REQUEST = 0x0050,
-  // 'L' in hex
-  LIST_DIR_REQUEST = 0x004C,
-  // 'l' in hex
-  LIST_DIR_REPLY = 0x006C,
-  //   'E' in hex
-  ERROR_MESSAGE = 0x0045,
+  PROTOCOLS(PROTOCOL_ENUM)
   UNKNOWN_TYPE = 0xFFFF
 } MessageType;
 #endif
@@ -0,0 +1,85 @@
+#ifndef PROTOCOL_REGISTRY
+#define PROTOCOL_REGISTRY
+// PROTOCOLS - the registry of every message type , the one place a protocol
+// is added to. each row is
+//
+//   X(name , value , body , priority , serve , handler , send , stub , prompt)
+//
+//   name     - constant of MessageType
+//   value    - protocol field of its frames , an ascii character
+//   body     - largest body of its frames , MAX_<body>_BODY : CONTROL for
+//              requests and replies , INFLATED for the ones carrying files
+//   priority - queue class of the request , PRIORITY_<priority>
+//   serve    - how a worker calls handler (see Dispatch) : PLAIN for
+//              handler(socket , message) , DIR for handler(socket , dir ,
+//              message) , TRANSFER for a handler returning the rest of its
+//              reply as a Transfer , NONE when workers don't answer it
+//   send     - LINE generates stub(socket) , sending a line read from stdin
+//              after printing prompt , NONE when there is no stub or it is
+//              written by hand
+//
+// the tables built from it are indexed by value , so dispatching a request ,
+// finding its class or the limit of its body costs one load.
+#define PROTOCOLS(X)                                                           \
+  X(ECHO_REQUEST, 'B', CONTROL, INTERACTIVE, PLAIN, EchoProtocolServerHandler, \
+    LINE, EchoProtocolSendRequestToServer, "")                                \
+  X(ECHO_REPLY, 'b', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)       \
+  X(DOWNLOAD_REQUEST, 'D', CONTROL, BULK, TRANSFER,                            \
+    DownloadProtocolServerHandler, LINE, DownloadProtocolSendRequestToServer,  \
+    "Enter File Name for download")                                            \
+  /* announces an upload , the file follows as a FILE_REPLY */                 \
+  X(UPLOAD_REQUEST, 'U', CONTROL, INTERACTIVE, PLAIN,                          \
+    UploadRequestServerHandler, NONE, NULL, NULL)                              \
+  X(READY_REPLY, 'R', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)      \
+  /* an upload is stored , durably with --durable-uploads . the body is     \
+     where */                                                                  \
+  X(UPLOAD_REPLY, 'u', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)     \
+  X(FILE_REPLY, 'F', INFLATED, BULK, PLAIN, UploadProtocolServerHandler, NONE, \
+    NULL, NULL)                                                                \
+  X(CHANGE_DIR_REQUEST, 'P', CONTROL, INTERACTIVE, DIR,                        \
+    ChangeDirectoryProtocolServerHandler, LINE,                                \
+    ChangeDirectoryProtocolSendRequestToServer,                                \
+    "Enter Directory name For server TO change into")                          \
+  X(LIST_DIR_REQUEST, 'L', CONTROL, INTERACTIVE, DIR,                          \
+    ListDirectoryProtocolServerHandler, LINE,                                  \
+    ListDirectoryProtocolSendRequestToServer,                                  \
+    "Enter Directory name For server list")                                    \
+  X(LIST_DIR_REPLY, 'l', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)   \
+  X(ERROR_MESSAGE, 'E', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)    \
+  /* moves the connection to a shared memory channel (see Shm) */              \
+  X(SHM_ATTACH_REQUEST, 'S', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL,     \
+    NULL)                                                                      \
+  X(SHM_ATTACH_REPLY, 's', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL) \
+  /* capability handshake , the body is a CAP_ bitmask in decimal */           \
+  X(HELLO_REQUEST, 'H', CONTROL, INTERACTIVE, PLAIN,                           \
+    HelloProtocolServerHandler, NONE, NULL, NULL)                              \
+  X(HELLO_REPLY, 'h', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)      \
+  /* the body is a 4 byte request id. sent by a client right before a        \
+     request and by the server right before the frames answering it */        \
+  X(REQUEST_TAG, '#', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)      \
+  /* the body is a 4 byte request id. closes the frames answering a tagged   \
+     request */                                                                \
+  X(REQUEST_DONE, '$', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)     \
+  X(CHECKSUM_REQUEST, 'C', CONTROL, BULK, PLAIN,                               \
+    ChecksumProtocolServerHandler, NONE, NULL, NULL)                           \
+  X(CHECKSUM_REPLY, 'c', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)   \
+  /* the body of a sync request carries the signature of a whole file */     \
+  X(SYNC_DOWNLOAD_REQUEST, 'Y', INFLATED, BULK, PLAIN,                         \
+    SyncDownloadProtocolServerHandler, NONE, NULL, NULL)                       \
+  X(SYNC_UPLOAD_REQUEST, 'Z', INFLATED, BULK, PLAIN,                           \
+    SyncUploadSignatureServerHandler, NONE, NULL, NULL)                        \
+  X(DELTA_REPLY, 'y', INFLATED, BULK, PLAIN, SyncUploadProtocolServerHandler,  \
+    NONE, NULL, NULL)                                                          \
+  X(BATCH_DOWNLOAD_REQUEST, 'T', CONTROL, BULK, TRANSFER,                      \
+    BatchDownloadProtocolServerHandler, NONE, NULL, NULL)                      \
+  X(BATCH_FILE_REPLY, 't', INFLATED, INTERACTIVE, NONE, NULL, NONE, NULL,     \
+    NULL)                                                                      \
+  X(BATCH_END_REPLY, 'e', CONTROL, INTERACTIVE, NONE, NULL, NONE, NULL, NULL)
+
+// protocol values are ascii , the registry tables have one entry per value
+#define PROTOCOL_TABLE_SIZE 128
+
+#define PROTOCOL_ENUM(name, value, body, priority, serve, handler, send, stub, \
+                      prompt)                                                  \
+  name = value,
+#endif
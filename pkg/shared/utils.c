@@ -1,4 +1,7 @@
+// O_CLOEXEC
+#define _GNU_SOURCE
 #include "utils.h"
+#include <unistd.h>
 char *Trim(char *str) {
   size_t len = 0;
   char *frontp = str;
@@ -76,4 +79,50 @@ uint64_t xor_shift(uint64_t *s) {
   s1 ^= s1 << 23;
   s[1] = s1 ^ s0 ^ (s1 >> 18) ^ (s0 >> 5);
   return s[1] + s0;
-}
\ No newline at end of file
+}
+socklen_t FillUnixAddress(struct sockaddr_un *addr, const char *path) {
+  size_t len = strlen(path);
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (len >= sizeof(addr->sun_path))
+    len = sizeof(addr->sun_path) - 1;
+  memcpy(addr->sun_path, path, len);
+  // abstract sockets start with a NUL byte and are not NUL terminated
+  if (path[0] == '@') {
+    addr->sun_path[0] = '\0';
+    return offsetof(struct sockaddr_un, sun_path) + len;
+  }
+  return offsetof(struct sockaddr_un, sun_path) + len + 1;
+}
+int OpenReplacement(const char *path, char *tmpPath) {
+  // unique per process and call so concurrent writers never share one
+  static unsigned int counter;
+  snprintf(tmpPath, MAX_BUFFER, "%s.tmp.%d.%u", path, (int)getpid(),
+           __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+  return open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+int FinishReplacement(int fd, const char *tmpPath, const char *path,
+                      int failed) {
+  if (close(fd) == -1)
+    failed = 1;
+  if (!failed && rename(tmpPath, path) == 0)
+    return 0;
+  unlink(tmpPath);
+  return -1;
+}
+int ReplaceFileContents(const char *path, const void *data, size_t size) {
+  char tmpPath[MAX_BUFFER];
+  int fd = OpenReplacement(path, tmpPath);
+  if (fd == -1)
+    return -1;
+  const char *src = data;
+  size_t left = size;
+  while (left > 0) {
+    ssize_t n = write(fd, src, left);
+    if (n == -1)
+      return FinishReplacement(fd, tmpPath, path, 1);
+    src += n;
+    left -= n;
+  }
+  return FinishReplacement(fd, tmpPath, path, 0);
+}
@@ -3,11 +3,31 @@
 #include "consts.h"
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 char *Trim(char *str);
 char *magic_reallocating_fgets(char **bufp, size_t *sizep, FILE *fp);
 uint64_t xor_shift(uint64_t *s);
 void print_array_in_hex(unsigned char *array);
+// FillUnixAddress - fills a unix socket address for the given path and
+// returns its length. a leading '@' selects the abstract namespace
+socklen_t FillUnixAddress(struct sockaddr_un *addr, const char *path);
+// OpenReplacement - creates the temporary file next to path a new version
+// of it is written to , and stores its name in tmpPath (MAX_BUFFER bytes).
+// returns its descriptor or -1
+int OpenReplacement(const char *path, char *tmpPath);
+// FinishReplacement - closes the temporary file and renames it over path ,
+// or removes it when failed is set. returns -1 unless it replaced path
+int FinishReplacement(int fd, const char *tmpPath, const char *path,
+                      int failed);
+// ReplaceFileContents - writes data to a temporary file next to path and
+// renames it over path , so readers see either the old or the new file.
+// returns -1 on error
+int ReplaceFileContents(const char *path, const void *data, size_t size);
 #endif
@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include "shm.h"
+#include "../transport/transport.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+// eventfds of a channel in the order the handshake passes them
+enum { SHM_C2S_DATA, SHM_S2C_DATA, SHM_C2S_SPACE, SHM_S2C_SPACE, SHM_EVENT_FDS };
+
+// RingBytes - bytes taken by one ring (header + data) , page aligned
+static size_t RingBytes(uint32_t capacity) {
+  return (sizeof(ShmRing) + capacity + 4095) & ~(size_t)4095;
+}
+
+// PeerHungUp - the control socket reports a hang up once the peer process
+// closed its end or died
+static int PeerHungUp(ShmChannel *channel) {
+  struct pollfd control = {channel->controlFd, POLLRDHUP, 0};
+  if (poll(&control, 1, 0) == -1)
+    return 0;
+  return (control.revents & (POLLHUP | POLLRDHUP | POLLERR)) != 0;
+}
+
+// Corrupt - marks the channel dead after the peer published an index that
+// doesn't fit in the ring , and hangs up the socket it was negotiated on so
+// both sides drop the connection
+static void Corrupt(ShmChannel *channel) {
+  if (!__atomic_exchange_n(&channel->broken, 1, __ATOMIC_ACQ_REL)) {
+    fprintf(stderr, "[DEBUG] shared memory peer on socket %d corrupted its "
+                    "ring , closing it\n",
+            channel->controlFd);
+    shutdown(channel->controlFd, SHUT_RDWR);
+  }
+}
+
+// WakePeer - rings the eventfd only if the consumer is about to sleep
+static void WakePeer(ShmChannel *channel) {
+  uint64_t one = 1;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&channel->tx->waiting, __ATOMIC_RELAXED)) {
+    if (write(channel->txEventFd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+      perror("eventfd write failed: ");
+  }
+}
+
+// WakeWriter - rings the space eventfd only if the producer is about to
+// sleep , called after consuming from rx
+static void WakeWriter(ShmChannel *channel) {
+  uint64_t one = 1;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&channel->rx->writerWaiting, __ATOMIC_RELAXED)) {
+    if (write(channel->rxSpaceFd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+      perror("eventfd write failed: ");
+  }
+}
+
+// WaitForSpace - sleeps until the consumer moved the head of tx past head ,
+// suspending only the coroutine calling it when there is one. returns -1
+// once the peer hung up
+static int WaitForSpace(ShmChannel *channel, uint64_t head) {
+  ShmRing *ring = channel->tx;
+  uint64_t value;
+  // drop wakeups for space that has already been used
+  while (read(channel->txSpaceFd, &value, sizeof(value)) > 0) {
+  }
+  __atomic_store_n(&ring->writerWaiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == head &&
+      CoroutineWaitFd(channel->txSpaceFd, POLLIN) == -1) {
+    struct pollfd fds[2] = {{channel->txSpaceFd, POLLIN, 0},
+                            {channel->controlFd, POLLRDHUP, 0}};
+    if (poll(fds, 2, -1) == -1 && errno != EINTR)
+      return -1;
+  }
+  __atomic_store_n(&ring->writerWaiting, 0, __ATOMIC_RELAXED);
+  // a coroutine is resumed after COROUTINE_RECHECK_MS at the latest
+  return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == head &&
+                 PeerHungUp(channel)
+             ? -1
+             : 0;
+}
+
+// MapChannel - maps the segment in memFd. the client to server ring comes
+// first, followed by the server to client ring. eventFds are indexed like
+// SHM_C2S_DATA
+static ShmChannel *MapChannel(int memFd, uint32_t capacity, int isServer,
+                              const int *eventFds, int socket) {
+  size_t ringBytes = RingBytes(capacity);
+  void *segment = mmap(NULL, 2 * ringBytes, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, memFd, 0);
+  if (segment == MAP_FAILED) {
+    perror("shared memory mmap failed: ");
+    return NULL;
+  }
+  ShmChannel *channel = malloc(sizeof(ShmChannel));
+  if (channel == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  ShmRing *c2s = (ShmRing *)segment;
+  ShmRing *s2c = (ShmRing *)((char *)segment + ringBytes);
+  channel->segment = segment;
+  channel->segmentSize = 2 * ringBytes;
+  channel->tx = isServer ? s2c : c2s;
+  channel->rx = isServer ? c2s : s2c;
+  channel->txEventFd = eventFds[isServer ? SHM_S2C_DATA : SHM_C2S_DATA];
+  channel->rxEventFd = eventFds[isServer ? SHM_C2S_DATA : SHM_S2C_DATA];
+  channel->txSpaceFd = eventFds[isServer ? SHM_S2C_SPACE : SHM_C2S_SPACE];
+  channel->rxSpaceFd = eventFds[isServer ? SHM_C2S_SPACE : SHM_S2C_SPACE];
+  channel->controlFd = socket;
+  channel->capacity = capacity;
+  channel->txTail = 0;
+  channel->rxHead = 0;
+  channel->broken = 0;
+  channel->refs = 1;
+  pthread_mutex_init(&channel->sendMutex, NULL);
+  return channel;
+}
+
+static void SendAttachError(int socket, const char *reason) {
+  unsigned char reply[PROTOCOL_HEADER_LEN + 128];
+  int length = MarshallMessage(reply, 0xC0DE, ERROR_MESSAGE, reason);
+  if (send(socket, reply, length, MSG_NOSIGNAL) == -1)
+    perror("write failed: ");
+}
+
+void ShmServerAttach(int socket) {
+  struct sockaddr_storage addr;
+  socklen_t addrLen = sizeof(addr);
+  if (getsockname(socket, (struct sockaddr *)&addr, &addrLen) == -1 ||
+      addr.ss_family != AF_UNIX) {
+    SendAttachError(socket,
+                    "shared memory transport needs a unix socket connection");
+    return;
+  }
+  uint32_t capacity = SHM_RING_CAPACITY;
+  int memFd = memfd_create("tcp-c-framework-shm", MFD_CLOEXEC);
+  int eventFds[SHM_EVENT_FDS];
+  int created = memFd != -1;
+  for (int i = 0; i < SHM_EVENT_FDS; i++) {
+    eventFds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    created = created && eventFds[i] != -1;
+  }
+  ShmChannel *channel = NULL;
+  if (created && ftruncate(memFd, 2 * RingBytes(capacity)) == 0)
+    channel = MapChannel(memFd, capacity, 1, eventFds, socket);
+  if (channel == NULL) {
+    perror("shared memory segment setup failed: ");
+    SendAttachError(socket, "could not set up shared memory segment");
+    if (memFd != -1)
+      close(memFd);
+    for (int i = 0; i < SHM_EVENT_FDS; i++)
+      if (eventFds[i] != -1)
+        close(eventFds[i]);
+    return;
+  }
+  // the segment is zero filled by ftruncate , the capacities are only
+  // informative , each side uses the one of the handshake
+  channel->tx->capacity = capacity;
+  channel->rx->capacity = capacity;
+
+  // from now on replies to this socket are written to the ring
+  TransportRegisterChannel(socket, channel);
+
+  char body[32];
+  unsigned char reply[PROTOCOL_HEADER_LEN + sizeof(body)];
+  snprintf(body, sizeof(body), "%u", capacity);
+  int length = MarshallMessage(reply, 0xC0DE, SHM_ATTACH_REPLY, body);
+  int fds[1 + SHM_EVENT_FDS] = {memFd};
+  memcpy(fds + 1, eventFds, sizeof(eventFds));
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = {reply, length};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  if (sendmsg(socket, &msg, MSG_NOSIGNAL) == -1)
+    perror("shared memory handshake failed: ");
+  // the mapping keeps the segment alive
+  close(memFd);
+  fprintf(stderr,
+          "[DEBUG] Client on socket %d moved to shared memory transport\n",
+          socket);
+}
+
+int ShmClientAttach(int socket) {
+  unsigned char request[PROTOCOL_HEADER_LEN + 1];
+  int length = MarshallMessage(request, 0xC0DE, SHM_ATTACH_REQUEST, "");
+  if (send(socket, request, length, MSG_NOSIGNAL) == -1) {
+    perror("write failed: ");
+    return -1;
+  }
+
+  unsigned char header[PROTOCOL_HEADER_LEN];
+  int fds[1 + SHM_EVENT_FDS] = {-1, -1, -1, -1, -1};
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = {header, sizeof(header)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (recvmsg(socket, &msg, MSG_WAITALL) != sizeof(header) ||
+      ExtractMessageMagic(header) != 0xC0DE) {
+    fprintf(stderr, "shared memory handshake failed\n");
+    return -1;
+  }
+  uint32_t bodySize = ExtractMessageBodySize(header);
+  char *body = malloc(bodySize + 1);
+  if (body == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  if (bodySize > 0 && recv(socket, body, bodySize, MSG_WAITALL) != bodySize)
+    bodySize = 0;
+  body[bodySize] = '\0';
+  if (ExtractMessageProtocol(header) != SHM_ATTACH_REPLY) {
+    fprintf(stderr, "[ ERROR MESSAGE ] : [ %s ]\n", body);
+    free(body);
+    return -1;
+  }
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  }
+  uint32_t capacity = strtoul(body, NULL, 10);
+  free(body);
+  int received = 1;
+  for (int i = 0; i <= SHM_EVENT_FDS; i++)
+    received = received && fds[i] != -1;
+  if (!received || capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    fprintf(stderr, "shared memory handshake carried no segment\n");
+    for (int i = 0; i <= SHM_EVENT_FDS; i++)
+      if (fds[i] != -1)
+        close(fds[i]);
+    return -1;
+  }
+  ShmChannel *channel = MapChannel(fds[0], capacity, 0, fds + 1, socket);
+  close(fds[0]);
+  if (channel == NULL) {
+    for (int i = 1; i <= SHM_EVENT_FDS; i++)
+      close(fds[i]);
+    return -1;
+  }
+  TransportRegisterChannel(socket, channel);
+  return 0;
+}
+
+int ShmWrite(ShmChannel *channel, const void *buf, size_t len) {
+  const unsigned char *src = buf;
+  ShmRing *ring = channel->tx;
+  size_t capacity = channel->capacity;
+  size_t total = len;
+  pthread_mutex_lock(&channel->sendMutex);
+  uint64_t tail = channel->txTail;
+  while (len > 0) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (channel->broken || tail - head > capacity) {
+      Corrupt(channel);
+      pthread_mutex_unlock(&channel->sendMutex);
+      return -1;
+    }
+    size_t space = capacity - (size_t)(tail - head);
+    if (space == 0) {
+      // ring is full , sleep until the consumer drained some of it
+      if (WaitForSpace(channel, head) == -1) {
+        pthread_mutex_unlock(&channel->sendMutex);
+        return -1;
+      }
+      continue;
+    }
+    size_t n = len < space ? len : space;
+    size_t offset = tail & (capacity - 1);
+    size_t first = n < capacity - offset ? n : capacity - offset;
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, src + first, n - first);
+    tail += n;
+    src += n;
+    len -= n;
+    channel->txTail = tail;
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    WakePeer(channel);
+  }
+  pthread_mutex_unlock(&channel->sendMutex);
+  return total;
+}
+
+int ShmPrepareWait(ShmChannel *channel) {
+  ShmRing *ring = channel->rx;
+  uint64_t value;
+  // drop wakeups for data that has already been consumed
+  while (read(channel->rxEventFd, &value, sizeof(value)) > 0) {
+  }
+  __atomic_store_n(&ring->waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != channel->rxHead) {
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    return -1;
+  }
+  return channel->rxEventFd;
+}
+
+// ShmReadAtLeast - reads between min and len bytes from the rx ring
+static int ShmReadAtLeast(ShmChannel *channel, void *buf, size_t len,
+                          size_t min) {
+  unsigned char *dst = buf;
+  ShmRing *ring = channel->rx;
+  size_t capacity = channel->capacity;
+  size_t total = 0;
+  uint64_t head = channel->rxHead;
+  while (total < min) {
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (channel->broken || tail - head > capacity) {
+      // reads as a hang up , the reader drops the connection
+      Corrupt(channel);
+      return 0;
+    }
+    size_t available = tail - head;
+    if (available == 0) {
+      int eventFd = ShmPrepareWait(channel);
+      if (eventFd == -1)
+        continue;
+      struct pollfd fds[2] = {{eventFd, POLLIN, 0},
+                              {channel->controlFd, POLLRDHUP, 0}};
+      if (poll(fds, 2, -1) == -1 && errno != EINTR)
+        return 0;
+      __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+      if ((fds[1].revents & (POLLHUP | POLLRDHUP | POLLERR)) &&
+          __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head)
+        return 0;
+      continue;
+    }
+    if (ring->waiting)
+      __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    size_t n = len < available ? len : available;
+    size_t offset = head & (capacity - 1);
+    size_t first = n < capacity - offset ? n : capacity - offset;
+    memcpy(dst, ring->data + offset, first);
+    memcpy(dst + first, ring->data, n - first);
+    head += n;
+    dst += n;
+    len -= n;
+    total += n;
+    channel->rxHead = head;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    WakeWriter(channel);
+  }
+  return total;
+}
+
+int ShmRead(ShmChannel *channel, void *buf, size_t len) {
+  return ShmReadAtLeast(channel, buf, len, len);
+}
+
+int ShmReadSome(ShmChannel *channel, void *buf, size_t len) {
+  return ShmReadAtLeast(channel, buf, len, 1);
+}
+
+void ShmRelease(ShmChannel *channel) {
+  if (__atomic_sub_fetch(&channel->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+  munmap(channel->segment, channel->segmentSize);
+  close(channel->txEventFd);
+  close(channel->rxEventFd);
+  close(channel->txSpaceFd);
+  close(channel->rxSpaceFd);
+  pthread_mutex_destroy(&channel->sendMutex);
+  free(channel);
+}
@@ -0,0 +1,83 @@
+#ifndef SHM
+#define SHM
+#include "../message/message.h"
+#include "../shared/consts.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+// ShmRing - single producer / single consumer byte ring that lives in the
+// shared segment. head and tail only ever grow, positions are taken
+// modulo capacity (a power of two). every index sits on its own cache line
+// so the producer and consumer do not false share.
+typedef struct {
+  // next byte the consumer will read
+  uint64_t head;
+  char headPad[56];
+  // next byte the producer will write
+  uint64_t tail;
+  char tailPad[56];
+  // set by the consumer before it sleeps on the eventfd
+  uint32_t waiting;
+  uint32_t capacity;
+  char waitingPad[56];
+  // set by the producer before it sleeps on the space eventfd of the ring
+  uint32_t writerWaiting;
+  char writerWaitingPad[60];
+  unsigned char data[];
+} ShmRing;
+
+// ShmChannel - process local view of a shared memory connection.
+// tx is written by this process, rx is read by it. the peer can write
+// anything to the segment , so the capacity and this side's own indexes
+// are kept here and the peer's index is checked on every load.
+typedef struct {
+  void *segment;
+  size_t segmentSize;
+  ShmRing *tx;
+  ShmRing *rx;
+  // capacity negotiated in the handshake , tail of tx and head of rx
+  uint32_t capacity;
+  uint64_t txTail;
+  uint64_t rxHead;
+  // set once the peer published an impossible index , the channel is dead
+  int broken;
+  // written after publishing to tx so the peer wakes up
+  int txEventFd;
+  // signalled by the peer after it publishes to rx
+  int rxEventFd;
+  // signalled by the peer after it consumed from tx while we wait for space
+  int txSpaceFd;
+  // written after consuming from rx so a peer waiting for space goes on
+  int rxSpaceFd;
+  // socket the channel was negotiated on , used to detect a dead peer
+  int controlFd;
+  // serializes concurrent writers so tx stays single producer
+  pthread_mutex_t sendMutex;
+  int refs;
+} ShmChannel;
+
+// ShmServerAttach - answers a SHM_ATTACH_REQUEST received on socket.
+// creates the segment and eventfds, passes them to the client over the
+// unix socket and registers the channel so that all further traffic on
+// socket goes through the rings
+void ShmServerAttach(int socket);
+// ShmClientAttach - asks the server to move the connection on socket to
+// shared memory and registers the returned channel. returns 0 on success
+int ShmClientAttach(int socket);
+// ShmWrite - copies len bytes into the tx ring, blocking while it is full
+// (only suspending the coroutine calling it , if any). returns -1 once the
+// peer hung up
+int ShmWrite(ShmChannel *channel, const void *buf, size_t len);
+// ShmRead - reads exactly len bytes from the rx ring, blocking while it is
+// empty. returns 0 once the peer has hung up
+int ShmRead(ShmChannel *channel, void *buf, size_t len);
+// ShmReadSome - reads what the rx ring holds , up to len bytes , blocking
+// while it is empty. returns 0 once the peer has hung up
+int ShmReadSome(ShmChannel *channel, void *buf, size_t len);
+// ShmPrepareWait - arms the wakeup of the rx ring. returns the eventfd to
+// sleep on or -1 when data is already available
+int ShmPrepareWait(ShmChannel *channel);
+// ShmRelease - drops a reference and unmaps the channel on the last one
+void ShmRelease(ShmChannel *channel);
+#endif
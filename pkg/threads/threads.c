@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include "threads.h"
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// set_mempolicy mode that allocates on the node of the running cpu
+#define THREADS_MPOL_LOCAL 4
+
+// ThreadStart - what the spawned thread runs before fn
+typedef struct {
+  void *(*fn)(void *);
+  void *arg;
+  char name[16];
+  int pinned;
+} ThreadStart;
+
+static void *StartThread(void *arg) {
+  ThreadStart start = *(ThreadStart *)arg;
+  free(arg);
+  pthread_setname_np(pthread_self(), start.name);
+  // a pinned thread also prefers its local node , even if the process was
+  // started under an interleave policy (numactl --interleave)
+  if (start.pinned)
+    syscall(SYS_set_mempolicy, THREADS_MPOL_LOCAL, NULL, 0);
+  return start.fn(start.arg);
+}
+
+int ParseCpuList(ThreadRole *role, const char *list) {
+  const char *p = list;
+  role->numCpus = 0;
+  while (*p != '\0') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p || first < 0)
+      return -1;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1 || last < first)
+        return -1;
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      if (role->numCpus == MAX_THREAD_CPUS || cpu >= CPU_SETSIZE)
+        return -1;
+      role->cpus[role->numCpus++] = cpu;
+    }
+    if (*p == ',')
+      p++;
+    else if (*p != '\0')
+      return -1;
+  }
+  return 0;
+}
+
+int SpawnThread(pthread_t *thread, const ThreadRole *role, int index,
+                const char *name, void *(*fn)(void *), void *arg) {
+  pthread_attr_t attr;
+  ThreadStart *start = malloc(sizeof(ThreadStart));
+  if (start == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  start->fn = fn;
+  start->arg = arg;
+  start->pinned = role != NULL && role->numCpus > 0;
+  snprintf(start->name, sizeof(start->name), "%s-%d", name, index);
+
+  pthread_attr_init(&attr);
+  if (role != NULL && role->stackSize > 0) {
+    size_t stackSize = role->stackSize;
+    if (stackSize < PTHREAD_STACK_MIN)
+      stackSize = PTHREAD_STACK_MIN;
+    pthread_attr_setstacksize(&attr, stackSize);
+  }
+  if (start->pinned) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(role->cpus[index % role->numCpus], &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  int res = pthread_create(thread, &attr, StartThread, start);
+  if (res == EINVAL && start->pinned) {
+    // the cpu is offline or outside our cpuset , run unpinned instead
+    fprintf(stderr, "[DEBUG] could not pin %s to cpu %d\n", start->name,
+            role->cpus[index % role->numCpus]);
+    pthread_attr_destroy(&attr);
+    pthread_attr_init(&attr);
+    if (role->stackSize > 0)
+      pthread_attr_setstacksize(&attr, role->stackSize < PTHREAD_STACK_MIN
+                                           ? PTHREAD_STACK_MIN
+                                           : role->stackSize);
+    start->pinned = 0;
+    res = pthread_create(thread, &attr, StartThread, start);
+  }
+  pthread_attr_destroy(&attr);
+  if (res != 0)
+    free(start);
+  return res;
+}
@@ -0,0 +1,32 @@
+#ifndef THREADS
+#define THREADS
+#include "../shared/consts.h"
+#include <pthread.h>
+#include <stddef.h>
+// most cpus a thread role can be pinned to
+#define MAX_THREAD_CPUS 256
+// stack size of server threads unless configured otherwise
+#define DEFAULT_THREAD_STACK_SIZE (256 * 1024)
+
+// ThreadRole - attributes shared by every thread of one role
+// (acceptors , request workers or per client readers)
+typedef struct {
+  // threads of the role , 0 leaves the decision to the caller
+  int count;
+  // stack size in bytes , 0 keeps the system default
+  size_t stackSize;
+  // thread i is pinned to cpus[i % numCpus] , no pinning when empty
+  int cpus[MAX_THREAD_CPUS];
+  int numCpus;
+} ThreadRole;
+
+// ParseCpuList - parses a list like "0-3,8,10-11" into role->cpus.
+// returns -1 when the list is malformed
+int ParseCpuList(ThreadRole *role, const char *list);
+// SpawnThread - starts fn(arg) as thread number index of the given role.
+// the thread is pinned before it runs , so the memory it touches first is
+// allocated on its own NUMA node , and it is named "name-index" so it
+// shows up in top / perf. returns 0 on success like pthread_create
+int SpawnThread(pthread_t *thread, const ThreadRole *role, int index,
+                const char *name, void *(*fn)(void *), void *arg);
+#endif
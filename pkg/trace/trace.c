@@ -0,0 +1,375 @@
+// clock_gettime
+#define _GNU_SOURCE
+#include "trace.h"
+#include <arpa/inet.h>
+#include <time.h>
+#include <unistd.h>
+
+// TraceRing - the records of the requests a worker answered , locked by the
+// worker while it records one and by the writer while it copies them
+typedef struct TraceRing {
+  pthread_mutex_t mutex;
+  TraceRecord records[TRACE_RING_RECORDS];
+  // records ever written , the ring holds the last TRACE_RING_RECORDS
+  uint64_t written;
+  struct TraceRing *next;
+} TraceRing;
+
+static struct {
+  // guards the list of rings and stopping
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;
+  pthread_t writer;
+  TraceRing *rings;
+  char path[TRACE_PATH_LEN];
+  int stopping;
+  // set when a request was recorded since the last write
+  int changed;
+} trace = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+static int running;
+static __thread TraceRing *ownRing;
+// per connection : when it was accepted , when the bytes it has buffered
+// started to arrive and when it was last read. only the thread reading a
+// connection touches them
+static uint64_t acceptedAt[MAX_SESSIONS];
+static uint64_t firstAt[MAX_SESSIONS];
+static uint64_t lastAt[MAX_SESSIONS];
+
+static const char *stageNames[TRACE_STAGES] = {
+    "accept", "header", "body", "enqueue", "dequeue", "start", "end", "sent"};
+
+static uint64_t Now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void PutU64(unsigned char *dest, uint64_t value) {
+  *(uint32_t *)dest = htonl(value >> 32);
+  *(uint32_t *)(dest + 4) = htonl(value & 0xFFFFFFFF);
+}
+
+static uint64_t GetU64(const unsigned char *src) {
+  return (uint64_t)ntohl(*(const uint32_t *)src) << 32 |
+         ntohl(*(const uint32_t *)(src + 4));
+}
+
+// Snapshot - copies the records of every ring , oldest first in each one.
+// returns them , to free , and sets *count
+static TraceRecord *Snapshot(size_t *count) {
+  size_t total = 0, n = 0;
+  pthread_mutex_lock(&trace.mutex);
+  for (TraceRing *ring = trace.rings; ring != NULL; ring = ring->next)
+    total += TRACE_RING_RECORDS;
+  TraceRecord *records = malloc((total ? total : 1) * sizeof(TraceRecord));
+  if (records == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  for (TraceRing *ring = trace.rings; ring != NULL; ring = ring->next) {
+    pthread_mutex_lock(&ring->mutex);
+    uint64_t first = ring->written > TRACE_RING_RECORDS
+                         ? ring->written - TRACE_RING_RECORDS
+                         : 0;
+    for (uint64_t i = first; i < ring->written; i++)
+      records[n++] = ring->records[i % TRACE_RING_RECORDS];
+    pthread_mutex_unlock(&ring->mutex);
+  }
+  pthread_mutex_unlock(&trace.mutex);
+  *count = n;
+  return records;
+}
+
+// WriteTrace - replaces the trace file by the records of every ring , the
+// file is written aside and renamed so readers never see half of it
+static void WriteTrace(void) {
+  char tmpPath[TRACE_PATH_LEN + 8];
+  unsigned char header[TRACE_MAGIC_LEN + 4];
+  unsigned char encoded[TRACE_RECORD_LEN];
+  size_t count;
+  TraceRecord *records = Snapshot(&count);
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", trace.path);
+  FILE *fp = fopen(tmpPath, "wb");
+  if (fp == NULL) {
+    perror("Couldn't create trace file");
+    free(records);
+    return;
+  }
+  memcpy(header, TRACE_MAGIC, TRACE_MAGIC_LEN);
+  *(uint32_t *)(header + TRACE_MAGIC_LEN) = htonl(TRACE_STAGES);
+  int failed = fwrite(header, 1, sizeof(header), fp) != sizeof(header);
+  for (size_t i = 0; i < count && !failed; i++) {
+    memcpy(encoded, records[i].id.bytes, sizeof(records[i].id.bytes));
+    *(uint32_t *)(encoded + 16) = htonl(records[i].connection);
+    *(uint32_t *)(encoded + 20) = htonl(records[i].tag);
+    *(uint32_t *)(encoded + 24) = htonl(records[i].protocol);
+    for (int stage = 0; stage < TRACE_STAGES; stage++)
+      PutU64(encoded + 28 + 8 * stage, records[i].stamps.at[stage]);
+    failed = fwrite(encoded, 1, TRACE_RECORD_LEN, fp) != TRACE_RECORD_LEN;
+  }
+  if (fclose(fp) != 0 || failed || rename(tmpPath, trace.path) == -1) {
+    perror("trace write failed: ");
+    unlink(tmpPath);
+  }
+  free(records);
+}
+
+static void *TraceWriter(void *arg) {
+  pthread_mutex_lock(&trace.mutex);
+  while (!trace.stopping) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += TRACE_DUMP_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&trace.wake, &trace.mutex, &deadline);
+    pthread_mutex_unlock(&trace.mutex);
+    if (__atomic_exchange_n(&trace.changed, 0, __ATOMIC_RELAXED))
+      WriteTrace();
+    pthread_mutex_lock(&trace.mutex);
+  }
+  pthread_mutex_unlock(&trace.mutex);
+  WriteTrace();
+  return NULL;
+}
+
+int TraceStart(const char *path) {
+  strncpy(trace.path, path, TRACE_PATH_LEN - 1);
+  FILE *fp = fopen(trace.path, "wb");
+  if (fp == NULL) {
+    perror("Couldn't create trace file");
+    return -1;
+  }
+  fclose(fp);
+  if (pthread_create(&trace.writer, NULL, TraceWriter, NULL) != 0) {
+    perror("Couldn't start the trace writer");
+    return -1;
+  }
+  __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void TraceStop(void) {
+  if (!__atomic_exchange_n(&running, 0, __ATOMIC_ACQ_REL))
+    return;
+  pthread_mutex_lock(&trace.mutex);
+  trace.stopping = 1;
+  pthread_cond_signal(&trace.wake);
+  pthread_mutex_unlock(&trace.mutex);
+  pthread_join(trace.writer, NULL);
+
+  size_t count;
+  TraceRecord *records = Snapshot(&count);
+  TraceHistogram *histograms = calloc(TRACE_STAGES, sizeof(TraceHistogram));
+  if (histograms == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < count; i++)
+    TraceAddRecord(histograms, &records[i]);
+  fprintf(stderr, "[DEBUG] trace of the last %zu requests :\n", count);
+  TraceReport(stderr, histograms, 0);
+  free(histograms);
+  free(records);
+}
+
+uint64_t TraceNow(void) {
+  if (!__atomic_load_n(&running, __ATOMIC_RELAXED))
+    return 0;
+  return Now();
+}
+
+void TraceAccepted(int fd) {
+  if (fd >= 0 && fd < MAX_SESSIONS)
+    acceptedAt[fd] = TraceNow();
+}
+
+void TraceReceived(int fd, size_t buffered) {
+  if (fd < 0 || fd >= MAX_SESSIONS ||
+      !__atomic_load_n(&running, __ATOMIC_RELAXED))
+    return;
+  uint64_t now = Now();
+  if (buffered == 0)
+    firstAt[fd] = now;
+  lastAt[fd] = now;
+}
+
+void TraceFrame(int fd, TraceStamps *stamps) {
+  memset(stamps, 0, sizeof(TraceStamps));
+  if (fd < 0 || fd >= MAX_SESSIONS ||
+      !__atomic_load_n(&running, __ATOMIC_RELAXED))
+    return;
+  stamps->at[TRACE_ACCEPT] = acceptedAt[fd];
+  stamps->at[TRACE_HEADER] = firstAt[fd];
+  stamps->at[TRACE_BODY] = lastAt[fd];
+  // the frames behind it arrived by the last read at the latest
+  firstAt[fd] = lastAt[fd];
+}
+
+// OwnRing - ring of the calling thread , created on its first request
+static TraceRing *OwnRing(void) {
+  if (ownRing != NULL)
+    return ownRing;
+  ownRing = calloc(1, sizeof(TraceRing));
+  if (ownRing == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&ownRing->mutex, NULL);
+  pthread_mutex_lock(&trace.mutex);
+  ownRing->next = trace.rings;
+  trace.rings = ownRing;
+  pthread_mutex_unlock(&trace.mutex);
+  return ownRing;
+}
+
+void TraceRequest(int fd, const Uuid *id, uint32_t tag, uint16_t protocol,
+                  TraceStamps *stamps) {
+  if (!__atomic_load_n(&running, __ATOMIC_RELAXED))
+    return;
+  stamps->at[TRACE_SENT] = Now();
+  TraceRing *ring = OwnRing();
+  pthread_mutex_lock(&ring->mutex);
+  TraceRecord *record = &ring->records[ring->written % TRACE_RING_RECORDS];
+  record->id = *id;
+  record->connection = (SessionGeneration(fd) << 16) | (fd & 0xFFFF);
+  record->tag = tag;
+  record->protocol = protocol;
+  record->stamps = *stamps;
+  ring->written++;
+  pthread_mutex_unlock(&ring->mutex);
+  __atomic_store_n(&trace.changed, 1, __ATOMIC_RELAXED);
+}
+
+FILE *TraceOpen(const char *path) {
+  unsigned char header[TRACE_MAGIC_LEN + 4];
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return NULL;
+  if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+      memcmp(header, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0 ||
+      ntohl(*(uint32_t *)(header + TRACE_MAGIC_LEN)) != TRACE_STAGES) {
+    fclose(fp);
+    return NULL;
+  }
+  return fp;
+}
+
+int TraceRead(FILE *fp, TraceRecord *record) {
+  unsigned char encoded[TRACE_RECORD_LEN];
+  size_t n = fread(encoded, 1, TRACE_RECORD_LEN, fp);
+  if (n == 0)
+    return 0;
+  if (n != TRACE_RECORD_LEN)
+    return -1;
+  memcpy(record->id.bytes, encoded, sizeof(record->id.bytes));
+  record->connection = ntohl(*(uint32_t *)(encoded + 16));
+  record->tag = ntohl(*(uint32_t *)(encoded + 20));
+  record->protocol = ntohl(*(uint32_t *)(encoded + 24));
+  for (int stage = 0; stage < TRACE_STAGES; stage++)
+    record->stamps.at[stage] = GetU64(encoded + 28 + 8 * stage);
+  return 1;
+}
+
+const char *TraceStageName(int stage) {
+  if (stage < 0 || stage >= TRACE_STAGES)
+    return "?";
+  return stageNames[stage];
+}
+
+// Span - adds the time from stage from to stage to , when both were reached
+static void Span(TraceHistogram *histogram, const TraceRecord *record,
+                 int from, int to) {
+  uint64_t start = record->stamps.at[from], end = record->stamps.at[to];
+  if (start != 0 && end >= start)
+    TraceHistogramAdd(histogram, end - start);
+}
+
+void TraceAddRecord(TraceHistogram histograms[TRACE_STAGES],
+                    const TraceRecord *record) {
+  for (int stage = 1; stage < TRACE_STAGES; stage++)
+    Span(&histograms[stage], record, stage - 1, stage);
+  Span(&histograms[0], record, TRACE_HEADER, TRACE_SENT);
+}
+
+// BucketOf - the top TRACE_SUB_BITS bits below the highest one select the
+// bucket within the power of two
+static int BucketOf(uint64_t ns) {
+  if (ns < (1 << TRACE_SUB_BITS))
+    return ns;
+  int msb = 63 - __builtin_clzll(ns);
+  return ((msb - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS) +
+         ((ns >> (msb - TRACE_SUB_BITS)) & ((1 << TRACE_SUB_BITS) - 1));
+}
+
+// BucketLimit - largest duration of a bucket
+static uint64_t BucketLimit(int bucket) {
+  if (bucket < (1 << TRACE_SUB_BITS))
+    return bucket;
+  int shift = (bucket >> TRACE_SUB_BITS) - 1;
+  uint64_t sub = bucket & ((1 << TRACE_SUB_BITS) - 1);
+  return ((((uint64_t)1 << TRACE_SUB_BITS) + sub) << shift) +
+         (((uint64_t)1 << shift) - 1);
+}
+
+void TraceHistogramAdd(TraceHistogram *histogram, uint64_t ns) {
+  histogram->buckets[BucketOf(ns)]++;
+  histogram->count++;
+  histogram->total += ns;
+  if (ns > histogram->max)
+    histogram->max = ns;
+}
+
+uint64_t TraceHistogramPercentile(const TraceHistogram *histogram, double p) {
+  if (histogram->count == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(p / 100 * histogram->count + 0.5);
+  if (rank == 0)
+    rank = 1;
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < TRACE_BUCKETS; bucket++) {
+    seen += histogram->buckets[bucket];
+    if (seen >= rank) {
+      uint64_t limit = BucketLimit(bucket);
+      return limit < histogram->max ? limit : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+// ReportLine - one line of the report , durations in microseconds
+static void ReportLine(FILE *out, const char *name,
+                       const TraceHistogram *histogram) {
+  double mean = histogram->count ? (double)histogram->total / histogram->count
+                                 : 0;
+  fprintf(out, "%-18s %9llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+          (unsigned long long)histogram->count, mean / 1000,
+          TraceHistogramPercentile(histogram, 50) / 1000.0,
+          TraceHistogramPercentile(histogram, 90) / 1000.0,
+          TraceHistogramPercentile(histogram, 99) / 1000.0,
+          histogram->max / 1000.0);
+}
+
+void TraceReport(FILE *out, const TraceHistogram histograms[TRACE_STAGES],
+                 int buckets) {
+  char name[32];
+  fprintf(out, "%-18s %9s %10s %10s %10s %10s %10s\n", "stage (us)", "count",
+          "mean", "p50", "p90", "p99", "max");
+  // stage 0 , the whole request , comes last
+  for (int i = 1; i <= TRACE_STAGES; i++) {
+    int stage = i % TRACE_STAGES;
+    if (stage == 0)
+      snprintf(name, sizeof(name), "total");
+    else
+      snprintf(name, sizeof(name), "%s->%s", stageNames[stage - 1],
+               stageNames[stage]);
+    ReportLine(out, name, &histograms[stage]);
+    if (!buckets)
+      continue;
+    for (int bucket = 0; bucket < TRACE_BUCKETS; bucket++) {
+      if (histograms[stage].buckets[bucket] != 0)
+        fprintf(out, "  <= %12.3f %9llu\n", BucketLimit(bucket) / 1000.0,
+                (unsigned long long)histograms[stage].buckets[bucket]);
+    }
+  }
+}
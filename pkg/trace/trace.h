@@ -0,0 +1,124 @@
+#ifndef TRACE
+#define TRACE
+#include "../session/session.h"
+#include "../shared/consts.h"
+#include "../uuid/uuid.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Trace - stamps every request with the monotonic time it reached each
+// stage of the server , from the accept of its connection to the last byte
+// of its reply , to tell whether its latency comes from queueing , from the
+// handler or from the socket. a request is recorded once it is answered ,
+// in a ring buffer of the worker that answered it where the oldest records
+// are overwritten , and the rings are written to the trace file every
+// TRACE_DUMP_MS (see cmd/trace).
+//
+// a trace file starts with TRACE_MAGIC and the number of stages (4 bytes) ,
+// followed by one TRACE_RECORD_LEN bytes record per request : its id (16
+// bytes) , its connection like in a capture (4 bytes) , its tag (4 bytes) ,
+// its protocol (4 bytes) and the nanoseconds at which it reached every
+// stage (8 bytes each , 0 when it didn't). integers are in network order.
+
+// TraceStage - the stages a request goes through , in order
+typedef enum {
+  // its connection was accepted
+  TRACE_ACCEPT = 0,
+  // its first bytes were read
+  TRACE_HEADER = 1,
+  // it was read whole
+  TRACE_BODY = 2,
+  // it was pushed to the queue
+  TRACE_ENQUEUE = 3,
+  // a worker popped it
+  TRACE_DEQUEUE = 4,
+  // its handler was called
+  TRACE_HANDLER_START = 5,
+  // its handler returned , a time sliced reply goes on after it
+  TRACE_HANDLER_END = 6,
+  // the last byte of its reply was sent
+  TRACE_SENT = 7,
+  TRACE_STAGES = 8
+} TraceStage;
+
+#define TRACE_MAGIC "TCPTRC01"
+#define TRACE_MAGIC_LEN 8
+// longest trace file path
+#define TRACE_PATH_LEN 256
+// bytes of a record in a trace file
+#define TRACE_RECORD_LEN (28 + 8 * TRACE_STAGES)
+// requests kept by the ring of every worker
+#define TRACE_RING_RECORDS 16384
+// the rings are written to the trace file this often
+#define TRACE_DUMP_MS 1000
+// a histogram splits every power of two in 1 << TRACE_SUB_BITS buckets
+#define TRACE_SUB_BITS 2
+#define TRACE_BUCKETS (64 << TRACE_SUB_BITS)
+
+// TraceStamps - times a request reached every stage , 0 for the stages it
+// didn't reach or when tracing is off
+typedef struct {
+  uint64_t at[TRACE_STAGES];
+} TraceStamps;
+
+// TraceRecord - one request of a trace
+typedef struct {
+  Uuid id;
+  uint32_t connection;
+  uint32_t tag;
+  uint32_t protocol;
+  TraceStamps stamps;
+} TraceRecord;
+
+// TraceHistogram - durations in nanoseconds , the percentiles it reports
+// are within a quarter of their power of two
+typedef struct {
+  uint64_t buckets[TRACE_BUCKETS];
+  uint64_t count, total, max;
+} TraceHistogram;
+
+// TraceStart - starts stamping requests and writing them to path. returns
+// -1 if it can't be created
+int TraceStart(const char *path);
+// TraceStop - writes the trace file a last time and prints the report of
+// the requests it holds to stderr
+void TraceStop(void);
+// TraceNow - monotonic time in nanoseconds , 0 when tracing is off
+uint64_t TraceNow(void);
+// TraceAccepted - stamps the accept of the connection fd
+void TraceAccepted(int fd);
+// TraceReceived - stamps a read of fd , buffered being the bytes of fd
+// read before and not handled yet
+void TraceReceived(int fd, size_t buffered);
+// TraceFrame - fills the accept , header and body stamps of a request read
+// whole from fd and clears the others
+void TraceFrame(int fd, TraceStamps *stamps);
+// TraceRequest - stamps the last byte of the reply of a request and
+// records it in the ring of the calling thread
+void TraceRequest(int fd, const Uuid *id, uint32_t tag, uint16_t protocol,
+                  TraceStamps *stamps);
+
+// TraceOpen - opens a trace file for reading , NULL if it isn't one
+FILE *TraceOpen(const char *path);
+// TraceRead - reads the next record. returns 1 , 0 at the end of the file
+// or -1 if it is truncated
+int TraceRead(FILE *fp, TraceRecord *record);
+// TraceStageName - short name of a stage
+const char *TraceStageName(int stage);
+// TraceAddRecord - adds the time a request took to reach every stage from
+// the previous one to histograms[stage] , and from its header to its last
+// byte to histograms[0] (the accept having no previous stage)
+void TraceAddRecord(TraceHistogram histograms[TRACE_STAGES],
+                    const TraceRecord *record);
+// TraceHistogramAdd - counts a duration
+void TraceHistogramAdd(TraceHistogram *histogram, uint64_t ns);
+// TraceHistogramPercentile - duration below which p percent of the counted
+// ones are
+uint64_t TraceHistogramPercentile(const TraceHistogram *histogram, double p);
+// TraceReport - prints the percentiles of every stage , and their buckets
+// when buckets is set
+void TraceReport(FILE *out, const TraceHistogram histograms[TRACE_STAGES],
+                 int buckets);
+#endif
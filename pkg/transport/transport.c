@@ -0,0 +1,225 @@
+#include "transport.h"
+#include "../ratelimit/ratelimit.h"
+#include "../session/session.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+
+// bytes of a file copied per write when the connection is a shm channel
+#define TRANSPORT_FILE_CHUNK (64 * 1024)
+
+// shared memory channels indexed by the socket they were negotiated on
+static ShmChannel *channels[MAX_SESSIONS];
+static pthread_mutex_t channelsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// AcquireChannel - returns the channel of fd with a reference held or
+// NULL for plain sockets
+static ShmChannel *AcquireChannel(int fd) {
+  ShmChannel *channel;
+  if (fd < 0 || fd >= MAX_SESSIONS ||
+      __atomic_load_n(&channels[fd], __ATOMIC_ACQUIRE) == NULL)
+    return NULL;
+  pthread_mutex_lock(&channelsMutex);
+  channel = channels[fd];
+  if (channel != NULL)
+    __atomic_add_fetch(&channel->refs, 1, __ATOMIC_ACQ_REL);
+  pthread_mutex_unlock(&channelsMutex);
+  return channel;
+}
+
+// WaitReady - blocks until a non blocking socket is readable / writable ,
+// or only suspends the coroutine calling it until then. returns -1 when
+// the connection was closed meanwhile and fd now belongs to another one
+static int WaitReady(int fd, short events) {
+  uint32_t generation = SessionGeneration(fd);
+  if (CoroutineWaitFd(fd, events) == 0) {
+    if (SessionGeneration(fd) == generation)
+      return 0;
+    errno = ECONNRESET;
+    return -1;
+  }
+  struct pollfd pfd = {fd, events, 0};
+  while (poll(&pfd, 1, -1) == -1 && errno == EINTR) {
+  }
+  return 0;
+}
+
+int TransportSend(int fd, const void *buf, size_t len) {
+  ShmChannel *channel = AcquireChannel(fd);
+  if (channel != NULL) {
+    int sent = ShmWrite(channel, buf, len);
+    ShmRelease(channel);
+    if (sent != -1)
+      RateLimitCharge(fd, len);
+    return sent;
+  }
+  const char *src = buf;
+  size_t total = len;
+  while (len > 0) {
+    ssize_t n = send(fd, src, len, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      // accepted sockets are non blocking , wait for buffer space
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (WaitReady(fd, POLLOUT) == -1)
+          return -1;
+        continue;
+      }
+      return -1;
+    }
+    src += n;
+    len -= n;
+  }
+  // counts against the byte limits of the connection when the server has any
+  RateLimitCharge(fd, total);
+  return total;
+}
+
+int TransportRecv(int fd, void *buf, size_t len) {
+  ShmChannel *channel = AcquireChannel(fd);
+  if (channel != NULL) {
+    int received = ShmRead(channel, buf, len);
+    ShmRelease(channel);
+    return received;
+  }
+  char *dst = buf;
+  size_t total = len;
+  while (len > 0) {
+    ssize_t n = read(fd, dst, len);
+    if (n == 0)
+      return 0;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (WaitReady(fd, POLLIN) == -1)
+          return -1;
+        continue;
+      }
+      return -1;
+    }
+    dst += n;
+    len -= n;
+  }
+  return total;
+}
+
+int TransportRecvSome(int fd, void *buf, size_t len) {
+  ShmChannel *channel = AcquireChannel(fd);
+  if (channel != NULL) {
+    int received = ShmReadSome(channel, buf, len);
+    ShmRelease(channel);
+    return received;
+  }
+  while (1) {
+    ssize_t n = read(fd, buf, len);
+    if (n >= 0)
+      return n;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      if (WaitReady(fd, POLLIN) == -1)
+        return -1;
+    } else if (errno != EINTR)
+      return -1;
+  }
+}
+
+int TransportWaitFd(int fd) {
+  ShmChannel *channel = AcquireChannel(fd);
+  if (channel == NULL)
+    return fd;
+  int waitFd = ShmPrepareWait(channel);
+  ShmRelease(channel);
+  return waitFd;
+}
+
+int TransportIsShm(int fd) {
+  return fd >= 0 && fd < MAX_SESSIONS &&
+         __atomic_load_n(&channels[fd], __ATOMIC_ACQUIRE) != NULL;
+}
+
+void TransportRegisterChannel(int fd, ShmChannel *channel) {
+  ShmChannel *previous;
+  if (fd < 0 || fd >= MAX_SESSIONS) {
+    ShmRelease(channel);
+    return;
+  }
+  pthread_mutex_lock(&channelsMutex);
+  previous = channels[fd];
+  __atomic_store_n(&channels[fd], channel, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&channelsMutex);
+  if (previous != NULL)
+    ShmRelease(previous);
+}
+
+void TransportRelease(int fd) {
+  ShmChannel *channel;
+  if (fd < 0 || fd >= MAX_SESSIONS)
+    return;
+  pthread_mutex_lock(&channelsMutex);
+  channel = channels[fd];
+  __atomic_store_n(&channels[fd], NULL, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&channelsMutex);
+  if (channel != NULL)
+    ShmRelease(channel);
+}
+
+ssize_t TransportSendFile(int fd, int fileFd, off_t offset, size_t len) {
+  size_t total = len;
+  ShmChannel *channel = AcquireChannel(fd);
+  if (channel != NULL) {
+    // the ring lives in user space so the file has to be copied in
+    char *chunk = malloc(TRANSPORT_FILE_CHUNK);
+    if (chunk == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    while (len > 0) {
+      ssize_t n = UringPread(fileFd, chunk,
+                             len < TRANSPORT_FILE_CHUNK ? len
+                                                        : TRANSPORT_FILE_CHUNK,
+                             offset);
+      if (n <= 0 || ShmWrite(channel, chunk, n) == -1) {
+        total = -1;
+        break;
+      }
+      offset += n;
+      len -= n;
+    }
+    free(chunk);
+    ShmRelease(channel);
+    if (total != (size_t)-1)
+      RateLimitCharge(fd, total);
+    return total;
+  }
+  // the linked read and send wait for socket space in the kernel , a
+  // coroutine sends with sendfile to wait in CoroutineWaitFd instead
+  if (UringFileIoEnabled() && !CoroutineActive()) {
+    ssize_t sent = UringSendFile(fd, fileFd, offset, len);
+    if (sent != -1)
+      RateLimitCharge(fd, sent);
+    if (sent != -1 || errno != ENOSYS)
+      return sent;
+  }
+  while (len > 0) {
+    ssize_t n = sendfile(fd, fileFd, &offset, len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (WaitReady(fd, POLLOUT) == -1)
+          return -1;
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0)
+      return -1;
+    len -= n;
+  }
+  RateLimitCharge(fd, total);
+  return total;
+}
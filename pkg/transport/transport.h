@@ -0,0 +1,39 @@
+#ifndef TRANSPORT
+#define TRANSPORT
+#include "../coroutine/coroutine.h"
+#include "../shared/consts.h"
+#include "../shm/shm.h"
+#include "../uring/uring.h"
+#include <stddef.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// Transport - every read and write of a framed connection goes through
+// these methods so that the connection can be moved from its socket to a
+// shared memory channel without the handlers noticing.
+
+// TransportSend - writes all len bytes of buf to the connection.
+// returns the number of bytes written or -1 on error
+int TransportSend(int fd, const void *buf, size_t len);
+// TransportSendFile - sends len bytes of fileFd starting at offset to the
+// connection , without copying through user space whenever possible.
+// returns the number of bytes sent or -1 on error
+ssize_t TransportSendFile(int fd, int fileFd, off_t offset, size_t len);
+// TransportRecv - reads exactly len bytes from the connection.
+// returns len , 0 once the peer has disconnected or -1 on error
+int TransportRecv(int fd, void *buf, size_t len);
+// TransportRecvSome - receives what is available , at most len bytes ,
+// blocking until something is. returns 0 once the peer closed and -1 on
+// error
+int TransportRecvSome(int fd, void *buf, size_t len);
+// TransportWaitFd - returns the descriptor to wait on (select / poll) for
+// incoming data on the connection , or -1 if data can be read right away
+int TransportWaitFd(int fd);
+// TransportIsShm - returns 1 when fd moved to a shared memory channel
+int TransportIsShm(int fd);
+// TransportRegisterChannel - routes all further traffic of fd through the
+// given shared memory channel. the transport takes over its reference
+void TransportRegisterChannel(int fd, ShmChannel *channel);
+// TransportRelease - detaches any shared memory channel from fd.
+// must be called before fd is closed
+void TransportRelease(int fd);
+#endif
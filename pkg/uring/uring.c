@@ -0,0 +1,361 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+// bytes of a file moved per linked read / send pair
+#define URING_FILE_CHUNK (256 * 1024)
+// entries of the per thread ring used for file I/O
+#define URING_THREAD_ENTRIES 8
+
+static int fileIoEnabled;
+static __thread UringRing *threadRing;
+static __thread unsigned char *threadChunk;
+
+static int SysSetup(unsigned entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+static int SysEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                    unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL,
+                 0);
+}
+static int SysRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+int UringInit(UringRing *ring, unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(ring, 0, sizeof(*ring));
+  ring->ringFd = SysSetup(entries, &params);
+  if (ring->ringFd == -1)
+    return -1;
+  // every kernel with the features we need maps sq and cq rings at once
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(ring->ringFd);
+    errno = ENOSYS;
+    return -1;
+  }
+  size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cqSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->ringMapSize = sqSize > cqSize ? sqSize : cqSize;
+  ring->ringMap = mmap(NULL, ring->ringMapSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->ringFd,
+                       IORING_OFF_SQ_RING);
+  if (ring->ringMap == MAP_FAILED) {
+    close(ring->ringFd);
+    return -1;
+  }
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    munmap(ring->ringMap, ring->ringMapSize);
+    close(ring->ringFd);
+    return -1;
+  }
+  char *base = ring->ringMap;
+  ring->sqHead = (unsigned *)(base + params.sq_off.head);
+  ring->sqTail = (unsigned *)(base + params.sq_off.tail);
+  ring->sqMask = *(unsigned *)(base + params.sq_off.ring_mask);
+  ring->sqEntries = *(unsigned *)(base + params.sq_off.ring_entries);
+  ring->cqHead = (unsigned *)(base + params.cq_off.head);
+  ring->cqTail = (unsigned *)(base + params.cq_off.tail);
+  ring->cqMask = *(unsigned *)(base + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(base + params.cq_off.cqes);
+  // sqe slots are used in order so the indirection array is the identity
+  unsigned *array = (unsigned *)(base + params.sq_off.array);
+  for (unsigned i = 0; i < ring->sqEntries; i++)
+    array[i] = i;
+  ring->sqeTail = *ring->sqTail;
+  return 0;
+}
+
+void UringExit(UringRing *ring) {
+  munmap(ring->sqes, ring->sqesSize);
+  munmap(ring->ringMap, ring->ringMapSize);
+  close(ring->ringFd);
+}
+
+struct io_uring_sqe *UringGetSqe(UringRing *ring) {
+  unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+  if (ring->sqeTail - head >= ring->sqEntries) {
+    UringSubmit(ring, 0);
+    head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (ring->sqeTail - head >= ring->sqEntries)
+      return NULL;
+  }
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sqeTail & ring->sqMask];
+  ring->sqeTail++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int UringSubmit(UringRing *ring, unsigned waitNr) {
+  unsigned toSubmit = ring->sqeTail - *ring->sqTail;
+  __atomic_store_n(ring->sqTail, ring->sqeTail, __ATOMIC_RELEASE);
+  int ret;
+  do {
+    ret = SysEnter(ring->ringFd, toSubmit, waitNr,
+                   waitNr ? IORING_ENTER_GETEVENTS : 0);
+  } while (ret == -1 && errno == EINTR && waitNr == 0);
+  return ret;
+}
+
+struct io_uring_cqe *UringPeekCqe(UringRing *ring) {
+  unsigned head = *ring->cqHead;
+  if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &ring->cqes[head & ring->cqMask];
+}
+
+void UringCqeSeen(UringRing *ring) {
+  __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+int UringSetupBufferRing(UringRing *ring, UringBufferRing *buffers,
+                         uint16_t groupId, unsigned entries,
+                         unsigned bufferSize) {
+  size_t ringSize = entries * sizeof(struct io_uring_buf);
+  buffers->ring = mmap(NULL, ringSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffers->ring == MAP_FAILED)
+    return -1;
+  buffers->buffers = malloc((size_t)entries * bufferSize);
+  if (buffers->buffers == NULL) {
+    perror("Couldn't allocate anymore memory!");
+    exit(EXIT_FAILURE);
+  }
+  buffers->entries = entries;
+  buffers->bufferSize = bufferSize;
+  buffers->groupId = groupId;
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)buffers->ring;
+  reg.ring_entries = entries;
+  reg.bgid = groupId;
+  if (SysRegister(ring->ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+    munmap(buffers->ring, ringSize);
+    free(buffers->buffers);
+    return -1;
+  }
+  buffers->ring->tail = 0;
+  for (unsigned i = 0; i < entries; i++)
+    UringRecycleBuffer(buffers, i);
+  return 0;
+}
+
+void UringRecycleBuffer(UringBufferRing *buffers, uint16_t bid) {
+  uint16_t tail = buffers->ring->tail;
+  struct io_uring_buf *buf = &buffers->ring->bufs[tail & (buffers->entries - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(buffers->buffers +
+                                    (size_t)bid * buffers->bufferSize);
+  buf->len = buffers->bufferSize;
+  buf->bid = bid;
+  __atomic_store_n(&buffers->ring->tail, (uint16_t)(tail + 1),
+                   __ATOMIC_RELEASE);
+}
+
+int UringAvailable(void) {
+  struct utsname name;
+  int major = 0, minor = 0;
+  // multishot recv landed in 6.0
+  if (uname(&name) == -1 ||
+      sscanf(name.release, "%d.%d", &major, &minor) != 2 || major < 6)
+    return 0;
+  UringRing ring;
+  if (UringInit(&ring, 4) == -1)
+    return 0;
+  // buffer rings (5.19) are the last piece , check they register
+  UringBufferRing buffers;
+  int available = UringSetupBufferRing(&ring, &buffers, 0, 2, 64) == 0;
+  if (available) {
+    munmap(buffers.ring, buffers.entries * sizeof(struct io_uring_buf));
+    free(buffers.buffers);
+  }
+  UringExit(&ring);
+  return available;
+}
+
+void UringEnableFileIo(void) { fileIoEnabled = 1; }
+
+int UringFileIoEnabled(void) { return fileIoEnabled; }
+
+// ThreadRing - lazily creates the ring of the calling thread
+static UringRing *ThreadRing(void) {
+  if (!fileIoEnabled)
+    return NULL;
+  if (threadRing == NULL) {
+    UringRing *ring = malloc(sizeof(UringRing));
+    threadChunk = malloc(URING_FILE_CHUNK);
+    if (ring == NULL || threadChunk == NULL) {
+      perror("Couldn't allocate anymore memory!");
+      exit(EXIT_FAILURE);
+    }
+    if (UringInit(ring, URING_THREAD_ENTRIES) == -1) {
+      free(ring);
+      return NULL;
+    }
+    threadRing = ring;
+  }
+  return threadRing;
+}
+
+// RunSingle - submits the single prepared sqe and returns its result
+static int RunSingle(UringRing *ring) {
+  struct io_uring_cqe *cqe;
+  if (UringSubmit(ring, 1) == -1)
+    return -errno;
+  while ((cqe = UringPeekCqe(ring)) == NULL) {
+    if (UringSubmit(ring, 1) == -1 && errno != EINTR)
+      return -errno;
+  }
+  int res = cqe->res;
+  UringCqeSeen(ring);
+  return res;
+}
+
+ssize_t UringPread(int fd, void *buf, size_t len, off_t offset) {
+  UringRing *ring = ThreadRing();
+  if (ring == NULL)
+    return pread(fd, buf, len, offset);
+  struct io_uring_sqe *sqe = UringGetSqe(ring);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = offset;
+  int res = RunSingle(ring);
+  if (res < 0) {
+    errno = -res;
+    return -1;
+  }
+  return res;
+}
+
+ssize_t UringPwrite(int fd, const void *buf, size_t len, off_t offset) {
+  UringRing *ring = ThreadRing();
+  const char *src = buf;
+  size_t total = len;
+  while (len > 0) {
+    ssize_t n;
+    if (ring == NULL) {
+      n = pwrite(fd, src, len, offset);
+    } else {
+      struct io_uring_sqe *sqe = UringGetSqe(ring);
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = fd;
+      sqe->addr = (uint64_t)(uintptr_t)src;
+      sqe->len = len;
+      sqe->off = offset;
+      n = RunSingle(ring);
+      if (n < 0) {
+        errno = -n;
+        n = -1;
+      }
+    }
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    src += n;
+    offset += n;
+    len -= n;
+  }
+  return total;
+}
+
+// RingSendAll - sends the rest of a chunk after a short or refused send
+static int RingSendAll(UringRing *ring, int socket, const unsigned char *buf,
+                       size_t len) {
+  while (len > 0) {
+    struct io_uring_sqe *sqe = UringGetSqe(ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = socket;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    int res = RunSingle(ring);
+    if (res == -EAGAIN) {
+      struct pollfd pfd = {socket, POLLOUT, 0};
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    if (res == -EINTR)
+      continue;
+    if (res < 0) {
+      errno = -res;
+      return -1;
+    }
+    buf += res;
+    len -= res;
+  }
+  return 0;
+}
+
+ssize_t UringSendFile(int socket, int fileFd, off_t offset, size_t len) {
+  UringRing *ring = ThreadRing();
+  if (ring == NULL) {
+    errno = ENOSYS;
+    return -1;
+  }
+  size_t sent = 0;
+  while (sent < len) {
+    size_t chunk = len - sent < URING_FILE_CHUNK ? len - sent : URING_FILE_CHUNK;
+    struct io_uring_sqe *read = UringGetSqe(ring);
+    read->opcode = IORING_OP_READ;
+    read->fd = fileFd;
+    read->addr = (uint64_t)(uintptr_t)threadChunk;
+    read->len = chunk;
+    read->off = offset + sent;
+    read->flags = IOSQE_IO_LINK;
+    read->user_data = 1;
+    struct io_uring_sqe *send = UringGetSqe(ring);
+    send->opcode = IORING_OP_SEND;
+    send->fd = socket;
+    send->addr = (uint64_t)(uintptr_t)threadChunk;
+    send->len = chunk;
+    send->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    send->user_data = 2;
+    if (UringSubmit(ring, 2) == -1 && errno != EINTR)
+      return -1;
+    int readRes = 0, sendRes = 0, completed = 0;
+    while (completed < 2) {
+      struct io_uring_cqe *cqe = UringPeekCqe(ring);
+      if (cqe == NULL) {
+        if (UringSubmit(ring, 1) == -1 && errno != EINTR)
+          return -1;
+        continue;
+      }
+      if (cqe->user_data == 1)
+        readRes = cqe->res;
+      else
+        sendRes = cqe->res;
+      completed++;
+      UringCqeSeen(ring);
+    }
+    if (readRes <= 0) {
+      errno = readRes < 0 ? -readRes : EIO;
+      return -1;
+    }
+    // a short read cancels the linked send , a refused or short send
+    // leaves the rest of the chunk to be sent on its own
+    size_t done = sendRes > 0 ? (size_t)sendRes : 0;
+    if (done < (size_t)readRes &&
+        RingSendAll(ring, socket, threadChunk + done, readRes - done) == -1)
+      return -1;
+    sent += readRes;
+  }
+  return sent;
+}
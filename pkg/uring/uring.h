@@ -0,0 +1,75 @@
+#ifndef URING
+#define URING
+#include "../shared/consts.h"
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+// UringRing - minimal io_uring instance driven through the raw system
+// calls. a ring must only be used by the thread that owns it.
+typedef struct {
+  int ringFd;
+  // submission queue
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned sqMask;
+  unsigned sqEntries;
+  struct io_uring_sqe *sqes;
+  // sqes handed out by UringGetSqe but not submitted yet end at sqeTail
+  unsigned sqeTail;
+  // completion queue
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned cqMask;
+  struct io_uring_cqe *cqes;
+  void *ringMap;
+  size_t ringMapSize;
+  size_t sqesSize;
+} UringRing;
+
+// UringBufferRing - group of equally sized receive buffers registered with
+// a ring. the kernel picks one of them for every multishot recv completion
+typedef struct {
+  struct io_uring_buf_ring *ring;
+  unsigned char *buffers;
+  unsigned entries;
+  unsigned bufferSize;
+  uint16_t groupId;
+} UringBufferRing;
+
+// UringAvailable - returns 1 when the kernel supports everything the
+// io_uring backend uses (multishot accept / recv and buffer rings)
+int UringAvailable(void);
+// UringInit - creates a ring with the given number of entries
+int UringInit(UringRing *ring, unsigned entries);
+// UringExit - unmaps and closes the ring
+void UringExit(UringRing *ring);
+// UringGetSqe - returns a zeroed sqe , submitting pending ones if the
+// submission queue is full
+struct io_uring_sqe *UringGetSqe(UringRing *ring);
+// UringSubmit - submits all pending sqes and waits for waitNr completions
+int UringSubmit(UringRing *ring, unsigned waitNr);
+// UringPeekCqe - returns the next completion or NULL if there is none
+struct io_uring_cqe *UringPeekCqe(UringRing *ring);
+// UringCqeSeen - marks the completion returned by UringPeekCqe as consumed
+void UringCqeSeen(UringRing *ring);
+// UringSetupBufferRing - allocates and registers a provided buffer ring
+int UringSetupBufferRing(UringRing *ring, UringBufferRing *buffers,
+                         uint16_t groupId, unsigned entries,
+                         unsigned bufferSize);
+// UringRecycleBuffer - hands buffer bid back to the kernel
+void UringRecycleBuffer(UringBufferRing *buffers, uint16_t bid);
+
+// UringEnableFileIo - routes the file helpers below through a per thread
+// ring. without it they fall back to the plain system calls
+void UringEnableFileIo(void);
+// UringFileIoEnabled - returns 1 once UringEnableFileIo has been called
+int UringFileIoEnabled(void);
+// UringPread - reads up to len bytes of fd at offset
+ssize_t UringPread(int fd, void *buf, size_t len, off_t offset);
+// UringPwrite - writes all len bytes to fd at offset
+ssize_t UringPwrite(int fd, const void *buf, size_t len, off_t offset);
+// UringSendFile - sends len bytes of fileFd starting at offset to socket.
+// every chunk is a read linked to a send so it costs a single enter
+ssize_t UringSendFile(int socket, int fileFd, off_t offset, size_t len);
+#endif
@@ -1,8 +1,24 @@
 #include "uuid.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
-static uint64_t seed[2];
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UUID_SIMD
+#endif
+
+// key of the process , every thread seeds its generator from it and its
+// own number so no two threads share a state
+static uint64_t key[2];
+static uint64_t nextThread;
+static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+static __thread uint64_t seed[2];
+static __thread int seeded;
+
+static const char hexDigits[] = "0123456789abcdef";
 
 int InitializeUUID(void) {
   int res;
@@ -10,35 +26,107 @@ int InitializeUUID(void) {
   if (!fp) {
     return -1;
   }
-  res = fread(seed, 1, sizeof(seed), fp);
+  res = fread(key, 1, sizeof(key), fp);
   fclose(fp);
-  if ( res != sizeof(seed) ) {
+  if ( res != sizeof(key) ) {
     return -1;
   }
   return 0;
 }
 
-void GenerateUUID(char *dst) {
-  static const char *template = "xxxxxxxx-xxxx-4xxx-yxxx-xxxxxxxxxxxx";
-  static const char *chars = "0123456789abcdef";
-  union { unsigned char b[16]; uint64_t word[2]; } s;
-  const char *p;
-  int i, n;
-  // get random
-  s.word[0] = xor_shift(seed);
-  s.word[1] = xor_shift(seed);
-  // build string
-  p = template;
-  i = 0;
-  while (*p) {
-    n = s.b[i >> 1];
-    n = (i & 1) ? (n >> 4) : (n & 0xf);
-    switch (*p) {
-      case 'x'  : *dst = chars[n];              i++;  break;
-      case 'y'  : *dst = chars[(n & 0x3) + 8];  i++;  break;
-      default   : *dst = *p;
-    }
-    dst++, p++;
+static void InitializeKey(void) {
+  if (key[0] == 0 && key[1] == 0 && InitializeUUID() == -1) {
+    // without /dev/urandom ids are still unique , only guessable
+    key[0] = (uint64_t)time(NULL);
+    key[1] = (uint64_t)(uintptr_t)&key;
+  }
+}
+
+// SplitMix64 - spreads a counter over the whole state
+static uint64_t SplitMix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static void SeedThread(void) {
+  pthread_once(&keyOnce, InitializeKey);
+  uint64_t x = key[0] ^
+               (__atomic_fetch_add(&nextThread, 1, __ATOMIC_RELAXED) << 32);
+  seed[0] = SplitMix64(&x) ^ key[1];
+  seed[1] = SplitMix64(&x);
+  seeded = 1;
+}
+
+void GenerateUUIDs(Uuid *dst, size_t count) {
+  if (!seeded)
+    SeedThread();
+  for (size_t i = 0; i < count; i++) {
+    uint64_t word[2] = {xor_shift(seed), xor_shift(seed)};
+    memcpy(dst[i].bytes, word, sizeof(word));
+    // version 4 , variant 10xx
+    dst[i].bytes[6] = (dst[i].bytes[6] & 0x0F) | 0x40;
+    dst[i].bytes[8] = (dst[i].bytes[8] & 0x3F) | 0x80;
   }
-  *dst = '\0';
-}
\ No newline at end of file
+}
+
+void GenerateUUIDBytes(Uuid *dst) { GenerateUUIDs(dst, 1); }
+
+static void FormatHexPlain(const unsigned char *bytes, char *hex) {
+  for (int i = 0; i < 16; i++) {
+    hex[2 * i] = hexDigits[bytes[i] >> 4];
+    hex[2 * i + 1] = hexDigits[bytes[i] & 0x0F];
+  }
+}
+
+#ifdef UUID_SIMD
+// looks all 32 nibbles up in the digit table with one shuffle per half
+__attribute__((target("ssse3"))) static void
+FormatHexSsse3(const unsigned char *bytes, char *hex) {
+  const __m128i digits = _mm_loadu_si128((const __m128i *)hexDigits);
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  __m128i value = _mm_loadu_si128((const __m128i *)bytes);
+  __m128i low = _mm_and_si128(value, nibble);
+  __m128i high = _mm_and_si128(_mm_srli_epi16(value, 4), nibble);
+  low = _mm_shuffle_epi8(digits, low);
+  high = _mm_shuffle_epi8(digits, high);
+  _mm_storeu_si128((__m128i *)hex, _mm_unpacklo_epi8(high, low));
+  _mm_storeu_si128((__m128i *)(hex + 16), _mm_unpackhi_epi8(high, low));
+}
+#endif
+
+void FormatUUID(const Uuid *id, char *dst) {
+  char hex[32];
+#ifdef UUID_SIMD
+  // picked on first use , every thread picks the same one
+  static void (*format)(const unsigned char *, char *);
+  void (*hexify)(const unsigned char *, char *) =
+      __atomic_load_n(&format, __ATOMIC_RELAXED);
+  if (hexify == NULL) {
+    __builtin_cpu_init();
+    hexify = __builtin_cpu_supports("ssse3") ? FormatHexSsse3 : FormatHexPlain;
+    __atomic_store_n(&format, hexify, __ATOMIC_RELAXED);
+  }
+  hexify(id->bytes, hex);
+#else
+  FormatHexPlain(id->bytes, hex);
+#endif
+  // xxxxxxxx-xxxx-4xxx-yxxx-xxxxxxxxxxxx
+  memcpy(dst, hex, 8);
+  dst[8] = '-';
+  memcpy(dst + 9, hex + 8, 4);
+  dst[13] = '-';
+  memcpy(dst + 14, hex + 12, 4);
+  dst[18] = '-';
+  memcpy(dst + 19, hex + 16, 4);
+  dst[23] = '-';
+  memcpy(dst + 24, hex + 20, 12);
+  dst[UUID_STRING_LEN] = '\0';
+}
+
+void GenerateUUID(char *dst) {
+  Uuid id;
+  GenerateUUIDBytes(&id);
+  FormatUUID(&id, dst);
+}
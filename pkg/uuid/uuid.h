@@ -2,10 +2,25 @@
 #define UUID
 #include "../shared/consts.h"
 #include "../shared/utils.h"
-// InitializeUUID - This method needs to be called 
-// before calling Generate UUID . It would set a random
-// seed to generate future UUIDs from.
+#include <stddef.h>
+#include <stdint.h>
+// Uuid - a version 4 UUID in binary form
+typedef struct {
+  unsigned char bytes[16];
+} Uuid;
+// length of the string form , without the NUL
+#define UUID_STRING_LEN 36
+// InitializeUUID - reads the random key every thread derives its generator
+// from. called on first use when it wasn't before
 int  InitializeUUID(void);
+// GenerateUUIDBytes - generates a UUID with the calling thread's generator ,
+// without locking
+void GenerateUUIDBytes(Uuid *dst);
+// GenerateUUIDs - generates count UUIDs at once
+void GenerateUUIDs(Uuid *dst, size_t count);
+// FormatUUID - writes the string form of id and a NUL to dst
+// (UUID_STRING_LEN + 1 bytes)
+void FormatUUID(const Uuid *id, char *dst);
 // GenerateUUID - Generates a UUID V4 string 
 void GenerateUUID(char *dst);
 #endif